@@ -0,0 +1,547 @@
+/*
+ * corrsim - R3 corridor microsimulator (Intersection 1 -> Intersection 2)
+ *
+ * Cellular automaton (Nagel-Schreckenberg) on the R3 through lane between
+ * the two local controllers, to see platoon effects the queue model in
+ * traffic2 -s cannot: vehicles released by Intersection 1 arrive at
+ * Intersection 2 as a platoon, and whether it meets green depends on the
+ * offset between the two signal sequences.
+ *
+ * Signals come from the NORMAL tables of demo1 (Intersection 1) and demo3
+ * (Intersection 2), stepped state by state with their fixed durations,
+ * free running or in their coordinated mode (-c: common cycle, R3 RS-G
+ * takes the rest of the cycle and starts at the controller's offset).
+ * R3 through traffic may pass on RS-G only; every other aspect (RS-Y
+ * included) is a stop line.
+ *
+ * Many independent lanes (replications, own random streams) run side by
+ * side. Vehicle state is structure-of-arrays per lane and every per-step
+ * kernel is a branch-free loop over int32 arrays with no loop-carried
+ * dependency, so the compiler vectorizes it (SSE2 on the x86_64 target,
+ * AVX2 with -mavx2).
+ *
+ * Usage: corrsim [-n lanes] [-t seconds] [-q veh/h] [-d metres] [-o offset s]
+ *                [-v vmax cells/s] [-p slowdown] [-r seed]
+ *        -c cycle      coordinated, -o = Intersection 2 offset (Intersection 1 at 0)
+ *        -C lo..hi     offset optimizer over that cycle range, -j threads
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <time.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+
+/* ================= SIGNAL TABLES =================
+ * NORMAL sequences, S01 first. MUST match NORM[] and the T_* timings in
+ * demo1/src/demo1.c and demo3/src/demo3.c. Only the R3 head matters here.
+ */
+typedef struct {
+    const char *r3;          /* R3 head aspect */
+    unsigned    dur_s;
+} sig_state_t;
+
+static const sig_state_t SIG_I1[] = {   /* demo1: T_YELLOW 5, T_ALL_RED 5, T_PREP_Y 5 */
+    { "RED",   5 }, { "PRE-Y", 5 }, { "RS-G", 20 }, { "RS-Y", 5 }, { "L-G", 12 }, { "L-Y", 5 },
+    { "RED",   5 }, { "RED",   5 }, { "RED",  20 }, { "RED",  5 }, { "RED", 12 }, { "RED", 5 },
+};
+
+static const sig_state_t SIG_I2[] = {   /* demo3: T_YELLOW 4, T_ALL_RED 2, T_PREP_Y 2 */
+    { "RED",   2 }, { "PRE-Y", 2 }, { "RS-G", 20 }, { "RS-Y", 4 }, { "L-G", 12 }, { "L-Y", 4 },
+    { "RED",   2 }, { "RED",   2 }, { "RED",  20 }, { "RED",  4 }, { "RED", 12 }, { "RED", 4 },
+};
+
+#define N_SIG(t) (sizeof(t) / sizeof((t)[0]))
+
+/* R3 min green, MUST match T_RS_MIN (coordinated cycle lower bound) */
+#define COORD_MIN_GREEN  8
+
+typedef struct {
+    uint8_t *go;             /* per second of the cycle from S01: 1 = through may pass */
+    unsigned cycle_s;
+    unsigned green_s;
+    unsigned green_at;       /* RS-G start within the cycle */
+} sig_plan_t;
+
+/* coord_cycle 0 = table durations; otherwise RS-G takes the rest of it */
+static int sig_build(sig_plan_t *sp, const sig_state_t *t, size_t n, unsigned coord_cycle)
+{
+    unsigned rest = 0, green = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (strcmp(t[i].r3, "RS-G") == 0) green += t[i].dur_s;
+        else rest += t[i].dur_s;
+    }
+    if (coord_cycle) {
+        if (coord_cycle < rest + COORD_MIN_GREEN) return -1;
+        green = coord_cycle - rest;
+    }
+    sp->cycle_s = rest + green;
+    sp->green_s = green;
+
+    sp->go = calloc(sp->cycle_s, 1);
+    if (!sp->go) { perror("calloc"); exit(1); }
+
+    unsigned at = 0;
+    for (size_t i = 0; i < n; i++) {
+        int go = (strcmp(t[i].r3, "RS-G") == 0);
+        if (go) sp->green_at = at;
+        unsigned d = go ? green : t[i].dur_s;
+        for (unsigned k = 0; k < d; k++) sp->go[at++] = (uint8_t)go;
+    }
+    return 0;
+}
+
+/* start = simulation second (mod cycle) at which S01 begins */
+static int sig_go(const sig_plan_t *sp, unsigned start, unsigned t)
+{
+    return sp->go[(t % sp->cycle_s + sp->cycle_s - start % sp->cycle_s) % sp->cycle_s];
+}
+
+/* S01 start for a controller offset (offset = nominal RS-G start) */
+static unsigned sig_start_for_offset(const sig_plan_t *sp, unsigned offset)
+{
+    return (offset % sp->cycle_s + sp->cycle_s - sp->green_at) % sp->cycle_s;
+}
+
+/* ================= ROAD =================
+ * 7.5 m cells, 1 s steps. Cell 0 is the entry, vehicles must stay below a
+ * stop line cell while its signal holds them.
+ */
+#define CELL_M        7.5
+#define APPROACH_C    60                /* queue space upstream of Intersection 1 */
+#define DEPART_C      30                /* run-out past Intersection 2 */
+#define FREE_C        (1 << 28)         /* "no obstacle" */
+
+static unsigned g_lanes   = 256;
+static unsigned g_secs    = 3600;
+static double   g_inflow  = 300.0;      /* veh/h entering each lane */
+static double   g_dist_m  = 600.0;      /* stop line to stop line */
+static unsigned g_offset  = 0;          /* Intersection 2 cycle start after Intersection 1 */
+static int32_t  g_vmax    = 2;          /* 15 m/s */
+static double   g_slow_p  = 0.15;
+static uint32_t g_seed    = 1;
+
+static int32_t S1, S2, EXIT_C, CAP;     /* stop lines, exit cell, vehicles per lane */
+
+/* ================= VEHICLES (structure of arrays) =================
+ * Vehicles [first, n) in road order, front vehicle first: the leader of
+ * vehicle i is i-1, which keeps the gap kernel a plain shifted load.
+ */
+typedef struct {
+    int32_t  *pos, *vel, *gap, *t_in;
+    uint32_t *rng;
+    int32_t   first, n;
+    uint32_t  arr_rng;                  /* arrival stream */
+    unsigned  backlog;                  /* arrivals waiting for a free entry cell */
+
+    uint64_t  exited, tt_sum;           /* travel time of exited vehicles */
+    uint64_t  stops1, stops2;           /* moving -> stopped, before / after Intersection 1 */
+} lane_t;
+
+static void *alloc_arr(size_t n)
+{
+    void *p = NULL;
+    if (posix_memalign(&p, 64, n * sizeof(int32_t)) != 0) { perror("posix_memalign"); exit(1); }
+    memset(p, 0, n * sizeof(int32_t));
+    return p;
+}
+
+static uint32_t xorshift32(uint32_t *s)
+{
+    uint32_t x = *s;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return *s = x;
+}
+
+static void lane_init(lane_t *ln, unsigned id, uint32_t seed)
+{
+    memset(ln, 0, sizeof *ln);
+    ln->pos  = alloc_arr((size_t)CAP);
+    ln->vel  = alloc_arr((size_t)CAP);
+    ln->gap  = alloc_arr((size_t)CAP);
+    ln->t_in = alloc_arr((size_t)CAP);
+    ln->rng  = alloc_arr((size_t)CAP);
+    ln->arr_rng = (seed * 0x9E3779B9u) ^ (id * 0x85EBCA6Bu) ^ 0x1234567u;
+    if (!ln->arr_rng) ln->arr_rng = 1;
+}
+
+static void lane_free(lane_t *ln)
+{
+    free(ln->pos);
+    free(ln->vel);
+    free(ln->gap);
+    free(ln->t_in);
+    free(ln->rng);
+}
+
+static void lane_compact(lane_t *ln)
+{
+    int32_t k = ln->n - ln->first;
+    size_t b = (size_t)k * sizeof(int32_t);
+    memmove(ln->pos,  ln->pos  + ln->first, b);
+    memmove(ln->vel,  ln->vel  + ln->first, b);
+    memmove(ln->t_in, ln->t_in + ln->first, b);
+    memmove(ln->rng,  ln->rng  + ln->first, b);
+    ln->first = 0;
+    ln->n = k;
+}
+
+/* ================= KERNELS ================= */
+
+/* space to the leader; the front vehicle sees open road */
+static void k_gap(int32_t *restrict gap, const int32_t *restrict pos, int32_t n)
+{
+    gap[0] = FREE_C;
+    for (int32_t i = 1; i < n; i++) {
+        gap[i] = pos[i - 1] - pos[i] - 1;
+    }
+}
+
+/* accelerate, brake for leader and stop lines, random slowdown, move */
+static void k_move(int32_t *restrict pos, int32_t *restrict vel, const int32_t *restrict gap,
+                   uint32_t *restrict rng, int32_t n, int32_t go1, int32_t go2,
+                   uint64_t *stops1, uint64_t *stops2)
+{
+    const uint32_t p_slow = (uint32_t)(g_slow_p * 16777216.0);
+    const int32_t vmax = g_vmax, s1 = S1, s2 = S2;
+    uint32_t st1 = 0, st2 = 0;
+
+    for (int32_t i = 0; i < n; i++) {
+        int32_t x = pos[i], v0 = vel[i];
+
+        int32_t lim1 = go1 ? FREE_C : s1 - 1 - x;
+        int32_t lim2 = go2 ? FREE_C : s2 - 1 - x;
+        int32_t lim  = (x < s1) ? lim1 : ((x < s2) ? lim2 : FREE_C);
+
+        int32_t v = v0 + 1;
+        v = (v < vmax) ? v : vmax;
+        v = (v < gap[i]) ? v : gap[i];
+        v = (v < lim) ? v : lim;
+
+        uint32_t r = rng[i];
+        r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+        rng[i] = r;
+        v -= ((r >> 8) < p_slow) & (v > 0);
+
+        uint32_t stop = (uint32_t)((v0 > 0) & (v == 0));
+        st1 += stop & (uint32_t)(x < s1);
+        st2 += stop & (uint32_t)(x >= s1);
+
+        vel[i] = v;
+        pos[i] = x + v;
+    }
+    *stops1 += st1;
+    *stops2 += st2;
+}
+
+/* ================= STEP ================= */
+static void lane_step(lane_t *ln, int32_t t, int32_t go1, int32_t go2)
+{
+    int32_t f = ln->first, n = ln->n - f;
+
+    if (n > 0) {
+        k_gap(ln->gap + f, ln->pos + f, n);
+        k_move(ln->pos + f, ln->vel + f, ln->gap + f, ln->rng + f, n, go1, go2,
+               &ln->stops1, &ln->stops2);
+    }
+
+    /* leave at the far end (front of the arrays) */
+    while (ln->first < ln->n && ln->pos[ln->first] >= EXIT_C) {
+        ln->exited++;
+        ln->tt_sum += (uint64_t)(t + 1 - ln->t_in[ln->first]);
+        ln->first++;
+    }
+
+    /* Bernoulli arrivals, at most one entry per second */
+    if ((xorshift32(&ln->arr_rng) >> 8) < (uint32_t)(g_inflow / 3600.0 * 16777216.0)) ln->backlog++;
+    if (ln->backlog && (ln->first == ln->n || ln->pos[ln->n - 1] > 0)) {
+        if (ln->n == CAP) lane_compact(ln);
+        int32_t i = ln->n++;
+        ln->pos[i]  = 0;
+        ln->vel[i]  = 0;
+        ln->t_in[i] = t + 1 - (int32_t)(ln->backlog - 1);
+        ln->rng[i]  = ln->arr_rng ^ (uint32_t)i;
+        if (!ln->rng[i]) ln->rng[i] = 1;
+        ln->backlog--;
+    }
+}
+
+/* ================= CORRIDOR RUN ================= */
+static double now_s(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (double)ts.tv_sec + (double)ts.tv_nsec / 1e9;
+}
+
+typedef struct {
+    const sig_plan_t *i1, *i2;
+    unsigned start1, start2;            /* S01 start of each signal, simulation seconds */
+    unsigned lanes, secs;
+    uint32_t seed;
+} corr_run_t;
+
+typedef struct {
+    uint64_t veh_steps, exited, tt;
+    uint64_t stops1, stops2, backlog, inside;
+} corr_stats_t;
+
+static void corr_run(const corr_run_t *r, corr_stats_t *st)
+{
+    lane_t *lanes = calloc(r->lanes, sizeof(*lanes));
+    if (!lanes) { perror("calloc"); exit(1); }
+    for (unsigned l = 0; l < r->lanes; l++) lane_init(&lanes[l], l, r->seed);
+
+    memset(st, 0, sizeof *st);
+    for (int32_t t = 0; t < (int32_t)r->secs; t++) {
+        int32_t go1 = sig_go(r->i1, r->start1, (unsigned)t);
+        int32_t go2 = sig_go(r->i2, r->start2, (unsigned)t);
+        for (unsigned l = 0; l < r->lanes; l++) {
+            st->veh_steps += (uint64_t)(lanes[l].n - lanes[l].first);
+            lane_step(&lanes[l], t, go1, go2);
+        }
+    }
+
+    for (unsigned l = 0; l < r->lanes; l++) {
+        st->exited  += lanes[l].exited;
+        st->tt      += lanes[l].tt_sum;
+        st->stops1  += lanes[l].stops1;
+        st->stops2  += lanes[l].stops2;
+        st->backlog += lanes[l].backlog;
+        st->inside  += (uint64_t)(lanes[l].n - lanes[l].first);
+        lane_free(&lanes[l]);
+    }
+    free(lanes);
+}
+
+static double stat_tt(const corr_stats_t *st)
+{
+    return st->exited ? (double)st->tt / (double)st->exited : 0.0;
+}
+
+static double stat_stops2(const corr_stats_t *st)
+{
+    return st->exited ? (double)st->stops2 / (double)st->exited : 0.0;
+}
+
+/* ================= OFFSET OPTIMIZER =================
+ * For every common cycle in -C lo..hi that both controllers can run, and
+ * every Intersection 2 offset (Intersection 1 at 0): the R3 through
+ * bandwidth, i.e. the seconds of the cycle in which a vehicle crossing
+ * Intersection 1 on green reaches Intersection 2 on green (NaSch mean
+ * speed vmax - p), and a simulated corridor run. Ranked by bandwidth, then
+ * simulated travel time; bandwidth is compared as a share of the cycle.
+ * Workers pull candidates from one atomic counter.
+ */
+#define OPT_MAX_JOBS  64
+#define OPT_TOP       10
+
+typedef struct {
+    sig_plan_t   i1, i2;
+    unsigned     off2;
+    unsigned     band_s;
+    corr_stats_t st;
+} opt_cand_t;
+
+static opt_cand_t   *opt_cand = NULL;
+static unsigned long opt_n = 0;
+static _Atomic unsigned long opt_next = 0;
+
+static unsigned band_s(const sig_plan_t *i1, unsigned start1, const sig_plan_t *i2, unsigned start2)
+{
+    unsigned tau = (unsigned)((double)(S2 - S1) / ((double)g_vmax - g_slow_p) + 0.5);
+    unsigned b = 0;
+    for (unsigned t = 0; t < i1->cycle_s; t++) {
+        b += (unsigned)(sig_go(i1, start1, t) && sig_go(i2, start2, t + tau));
+    }
+    return b;
+}
+
+static void *opt_worker(void *arg)
+{
+    (void)arg;
+    while (1) {
+        unsigned long i = atomic_fetch_add_explicit(&opt_next, 1, memory_order_relaxed);
+        if (i >= opt_n) break;
+
+        opt_cand_t *c = &opt_cand[i];
+        corr_run_t r = { &c->i1, &c->i2, sig_start_for_offset(&c->i1, 0),
+                         sig_start_for_offset(&c->i2, c->off2), g_lanes, g_secs, g_seed };
+        c->band_s = band_s(r.i1, r.start1, r.i2, r.start2);
+        corr_run(&r, &c->st);
+    }
+    return NULL;
+}
+
+static int opt_cmp(const void *a, const void *b)
+{
+    const opt_cand_t *x = a, *y = b;
+    unsigned long bx = (unsigned long)x->band_s * y->i1.cycle_s;   /* share of the cycle */
+    unsigned long by = (unsigned long)y->band_s * x->i1.cycle_s;
+    if (bx != by) return (bx > by) ? -1 : 1;
+    double tx = stat_tt(&x->st), ty = stat_tt(&y->st);
+    if (tx != ty) return (tx < ty) ? -1 : 1;
+    return 0;
+}
+
+static int optimize(unsigned c_lo, unsigned c_hi, unsigned jobs)
+{
+    unsigned long cap = 0;
+    for (unsigned c = c_lo; c <= c_hi; c++) cap += c;
+    opt_cand = calloc(cap, sizeof *opt_cand);
+    if (!opt_cand) { perror("calloc"); return 1; }
+
+    for (unsigned c = c_lo; c <= c_hi; c++) {
+        sig_plan_t i1, i2;
+        if (sig_build(&i1, SIG_I1, N_SIG(SIG_I1), c) != 0) continue;
+        if (sig_build(&i2, SIG_I2, N_SIG(SIG_I2), c) != 0) { free(i1.go); continue; }
+        for (unsigned o = 0; o < c; o++) {
+            opt_cand[opt_n].i1 = i1;      /* go arrays shared by the cycle's candidates */
+            opt_cand[opt_n].i2 = i2;
+            opt_cand[opt_n].off2 = o;
+            opt_n++;
+        }
+    }
+    if (opt_n == 0) {
+        printf("corrsim: no cycle in %u..%u leaves both intersections an R3 min green of %us\n",
+               c_lo, c_hi, COORD_MIN_GREEN);
+        return 1;
+    }
+
+    if (jobs < 1) jobs = 1;
+    if (jobs > OPT_MAX_JOBS) jobs = OPT_MAX_JOBS;
+
+    printf("corrsim optimizer: cycles %u..%u, %lu candidates, %u threads, %u lanes x %us each\n",
+           c_lo, c_hi, opt_n, jobs, g_lanes, g_secs);
+    fflush(stdout);
+
+    double t0 = now_s();
+    pthread_t th[OPT_MAX_JOBS];
+    for (unsigned j = 0; j < jobs; j++) {
+        if (pthread_create(&th[j], NULL, opt_worker, NULL) != 0) { perror("pthread_create"); return 1; }
+    }
+    for (unsigned j = 0; j < jobs; j++) pthread_join(th[j], NULL);
+    double wall = now_s() - t0;
+
+    /* free-running reference with the same traffic */
+    sig_plan_t f1, f2;
+    sig_build(&f1, SIG_I1, N_SIG(SIG_I1), 0);
+    sig_build(&f2, SIG_I2, N_SIG(SIG_I2), 0);
+    corr_run_t fr = { &f1, &f2, 0, 0, g_lanes, g_secs, g_seed };
+    corr_stats_t fst;
+    corr_run(&fr, &fst);
+
+    qsort(opt_cand, opt_n, sizeof *opt_cand, opt_cmp);
+
+    printf("  %lu runs in %.2fs\n\n", opt_n, wall);
+    printf("  cycle  offset2  R3 green I1/I2  bandwidth  travel s  stops@I2\n");
+    for (unsigned long i = 0; i < opt_n && i < OPT_TOP; i++) {
+        const opt_cand_t *c = &opt_cand[i];
+        printf("  %5u  %7u  %7u/%-6u  %4us %3.0f%%  %8.1f  %8.2f\n",
+               c->i1.cycle_s, c->off2, c->i1.green_s, c->i2.green_s, c->band_s,
+               100.0 * c->band_s / c->i1.cycle_s, stat_tt(&c->st), stat_stops2(&c->st));
+    }
+    printf("  free running (%us / %us)             %8.1f  %8.2f\n",
+           f1.cycle_s, f2.cycle_s, stat_tt(&fst), stat_stops2(&fst));
+
+    const opt_cand_t *best = &opt_cand[0];
+    printf("\n  best: demo1 -c %u -o 0   demo3 -c %u -o %u\n",
+           best->i1.cycle_s, best->i2.cycle_s, best->off2);
+    fflush(stdout);
+    return 0;
+}
+
+static void usage(const char *me)
+{
+    fprintf(stderr, "usage: %s [-n lanes] [-t seconds] [-q veh/h] [-d metres] [-o offset s]\n"
+                    "       %*s [-v vmax cells/s] [-p slowdown] [-r seed]\n"
+                    "       %*s [-c cycle | -C lo..hi [-j threads]]\n",
+            me, (int)strlen(me), "", (int)strlen(me), "");
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    unsigned coord = 0, c_lo = 0, c_hi = 0, jobs = 1;
+    int lanes_set = 0;
+    while ((c = getopt(argc, argv, "n:t:q:d:o:v:p:r:c:C:j:")) != -1) {
+        switch (c) {
+        case 'n': g_lanes  = (unsigned)strtoul(optarg, NULL, 10); lanes_set = 1; break;
+        case 't': g_secs   = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'q': g_inflow = strtod(optarg, NULL); break;
+        case 'd': g_dist_m = strtod(optarg, NULL); break;
+        case 'o': g_offset = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'v': g_vmax   = (int32_t)strtol(optarg, NULL, 10); break;
+        case 'p': g_slow_p = strtod(optarg, NULL); break;
+        case 'r': g_seed   = (uint32_t)strtoul(optarg, NULL, 10); break;
+        case 'c': coord    = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'C':
+            if (sscanf(optarg, "%u..%u", &c_lo, &c_hi) != 2 || c_lo < 1 || c_hi < c_lo || c_hi > 600) {
+                usage(argv[0]);
+                return 2;
+            }
+            break;
+        case 'j': jobs     = (unsigned)strtoul(optarg, NULL, 10); break;
+        default:  usage(argv[0]); return 2;
+        }
+    }
+    if (g_lanes < 1 || g_secs < 1 || g_inflow < 0.0 || g_inflow > 3600.0 ||
+        g_dist_m < 50.0 || g_vmax < 1 || g_vmax > 10 || g_slow_p < 0.0 || g_slow_p >= 1.0) {
+        usage(argv[0]);
+        return 2;
+    }
+
+    S1 = APPROACH_C;
+    S2 = S1 + (int32_t)(g_dist_m / CELL_M + 0.5);
+    EXIT_C = S2 + DEPART_C;
+    CAP = 2 * (EXIT_C + g_vmax);        /* at most one vehicle per cell, x2 before compacting */
+
+    if (c_hi) {
+        if (!lanes_set) g_lanes = 16;   /* per candidate */
+        return optimize(c_lo, c_hi, jobs);
+    }
+
+    sig_plan_t i1, i2;
+    if (sig_build(&i1, SIG_I1, N_SIG(SIG_I1), coord) != 0 ||
+        sig_build(&i2, SIG_I2, N_SIG(SIG_I2), coord) != 0) {
+        printf("corrsim: cycle %us leaves no R3 min green of %us\n", coord, COORD_MIN_GREEN);
+        return 1;
+    }
+    corr_run_t run = { &i1, &i2, 0, g_offset, g_lanes, g_secs, g_seed };
+    if (coord) {
+        run.start1 = sig_start_for_offset(&i1, 0);
+        run.start2 = sig_start_for_offset(&i2, g_offset);
+    }
+
+    printf("corrsim: %u lanes x %us, %.0f veh/h per lane, %.0f m (%d cells) between stop lines\n",
+           g_lanes, g_secs, g_inflow, g_dist_m, S2 - S1);
+    printf("  Intersection 1: cycle %us, R3 green %us | Intersection 2: cycle %us, R3 green %us, offset %us%s\n",
+           i1.cycle_s, i1.green_s, i2.cycle_s, i2.green_s, g_offset, coord ? " (coordinated)" : "");
+    if (i1.cycle_s != i2.cycle_s) {
+        printf("  (cycles differ: the offset drifts by %ds per cycle, no stable progression)\n",
+               (int)i1.cycle_s - (int)i2.cycle_s);
+    } else {
+        printf("  R3 bandwidth %us of %us\n", band_s(&i1, run.start1, &i2, run.start2), i1.cycle_s);
+    }
+    fflush(stdout);
+
+    corr_stats_t st;
+    double t0 = now_s();
+    corr_run(&run, &st);
+    double wall = now_s() - t0;
+
+    double free_tt = (double)(EXIT_C) / (double)g_vmax;
+    printf("\n  throughput      %8.1f veh/h per lane\n", (double)st.exited / g_lanes * 3600.0 / g_secs);
+    printf("  travel time     %8.1f s (free flow %.1f s)\n", stat_tt(&st), free_tt);
+    printf("  stops/vehicle   %8.2f at Intersection 1, %.2f at Intersection 2\n",
+           st.exited ? (double)st.stops1 / (double)st.exited : 0.0, stat_stops2(&st));
+    printf("  left in system  %8.1f per lane on road, %.1f waiting to enter\n",
+           (double)st.inside / g_lanes, (double)st.backlog / g_lanes);
+    printf("\n  %llu vehicle-steps in %.3fs = %.1f M vehicle-steps/s\n",
+           (unsigned long long)st.veh_steps, wall, wall > 0.0 ? (double)st.veh_steps / wall / 1e6 : 0.0);
+    fflush(stdout);
+    return 0;
+}
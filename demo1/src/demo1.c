@@ -17,6 +17,12 @@
  *   't' = Train detected  (preempt if in NORMAL green)
  *   'c' = Train cleared   (exit TRAIN at next SAFE all-red)
  *   'p' = Ped button      (PED active only during SAFE ALL-RED + next PRE-Y)
+ *   train approach (type 0x23, track + ETA): clear early so TRAIN starts by the ETA
+ *   Sequenced events (epoch + seq) are applied once; a retry gets "DUP"
+ *   batch (type 0x24): up to EVT_BATCH_MAX timestamped events in one message,
+ *   applied in time order within one receive
+ *   event bus: the same events published on the node's evtbus for this
+ *   intersection (BUS_MY_ISECT) or all, read from /traffic_bus at each poll
  *
  * TRAIN SEQUENCE (NO SRL, PRINT S01..S08, S01 starts at PRE-Y):
  *   S01 (05s) R3=PRE-Y, R1=RED/RED
@@ -32,9 +38,17 @@
 
 #include <stdio.h>
 #include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <unistd.h>
+#include <fcntl.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/wait.h>
+#include <signal.h>
 
 #include <sys/dispatch.h>
 #include <sys/neutrino.h>
@@ -46,6 +60,18 @@
 #define EVT_TRAIN_DETECT  't'
 #define EVT_TRAIN_CLEAR   'c'
 #define EVT_PED_PRESS     'p'
+#define EVT_VEH_CALL      'v'   /* detector call, lane id in pad[0] */
+
+/* ================= DETECTORS =================
+ * Lane ids MUST match VM7 (keyv7 "v<lane>"); same numbering on VM6 and VM8.
+ */
+enum {
+    LANE_R3_RS = 0, LANE_R3_L,
+    LANE_R1_WE_RS,  LANE_R1_WE_L,
+    LANE_R1_EW_RS,  LANE_R1_EW_L,
+    N_LANES
+};
+#define LN(l) (1u << (l))
 
 /* ================= TIMINGS (seconds) ================= */
 /* NORMAL */
@@ -55,6 +81,14 @@
 #define T_ALL_RED     5
 #define T_PREP_Y      5   /* PRE-Y inserted so S02 = PRE-Y */
 
+/* NORMAL actuated greens: min, max, extension per call (gap) */
+#define T_RS_MIN      8
+#define T_RS_MAX     30
+#define T_RS_EXT      3
+#define T_L_MIN       5
+#define T_L_MAX      15
+#define T_L_EXT       2
+
 /* TRAIN */
 #define T_TR_2_G     12
 #define T_TR_3_G     15
@@ -68,17 +102,69 @@
 typedef struct {
     _Uint16t type;
     _Uint16t subtype;
-    char     ev;        /* 't','c','p' */
-    char     pad[3];
+    char     ev;        /* 't','c','p','v' */
+    char     pad[3];    /* 'v': pad[0] = lane id */
     int      client_id;
+    uint32_t epoch;     /* client instance; a new epoch restarts its seq */
+    uint32_t seq;       /* per client, from 1; 0 = unsequenced (applied always) */
 } evt_msg_t;
 
 typedef struct {
     _Uint16t type;
     _Uint16t subtype;
     char     text[64];
+    uint32_t last_seq;  /* highest seq applied for this client */
 } evt_reply_t;
 
+/* Train approach, broadcast by the crossing ahead of the gate closing.
+ * Same size and client_id/epoch/seq offsets as evt_msg_t, so one receive
+ * buffer and one dedup path serve both.
+ */
+#define MSG_TRAIN_APPROACH  0x23
+#define APPR_SUB_ETA        0     /* train due in eta_s seconds */
+#define APPR_SUB_CANCEL     1     /* train stopped / rerouted */
+
+typedef struct {
+    _Uint16t type;        /* MSG_TRAIN_APPROACH */
+    _Uint16t subtype;     /* APPR_SUB_* */
+    _Uint16t track_id;
+    _Uint16t eta_s;
+    int      client_id;
+    uint32_t epoch;
+    uint32_t seq;
+} train_appr_msg_t;
+
+/* Batch: many events in one round trip (scripted tests, detector feeds).
+ * client_id/epoch/seq at the evt_msg_t offsets; the batch is one seq.
+ * Items are applied in t_ms order (equal times keep their array order).
+ */
+#define MSG_EVT_BATCH   0x24
+#define EVT_BATCH_MAX   64
+
+typedef struct {
+    uint32_t t_ms;        /* client clock, ms (only the order matters here) */
+    char     ev;          /* 't','c','p','v' */
+    uint8_t  lane;        /* 'v': lane id */
+    _Uint16t pad;
+} evt_item_t;
+
+typedef struct {
+    _Uint16t   type;      /* MSG_EVT_BATCH */
+    _Uint16t   count;     /* items used */
+    char       pad[4];
+    int        client_id;
+    uint32_t   epoch;
+    uint32_t   seq;
+    evt_item_t items[EVT_BATCH_MAX];
+} evt_batch_msg_t;
+
+/* every message this server receives */
+typedef union {
+    evt_msg_t        evt;
+    train_appr_msg_t appr;
+    evt_batch_msg_t  batch;
+} evt_rx_t;
+
 /* QNET server handle */
 static name_attach_t *g_attach = NULL;
 
@@ -88,6 +174,11 @@ static int train_active  = 0;        /* train currently present */
 static int train_clear_pending = 0;  /* set by 'c'; exit at SAFE all-red */
 static int ped_request   = 0;        /* set by 'p'; starts PED window at SAFE all-red */
 
+/* detector calls per lane; actuated greens start with the first call seen */
+static unsigned lane_calls[N_LANES];
+static unsigned lane_occ_ms[N_LANES];   /* detector occupied time, ms */
+static int actuated = 0;
+
 static int in_train_state = 0;       /* 0=NORMAL, 1=TRAIN */
 static int train_preempt_to_allred = 0;
 
@@ -98,13 +189,437 @@ static int normal_ui_base = 0;       /* NORMAL shift so chosen start prints S01
 static int ped_window_active = 0;          /* if 1 => PED=WALK, else RED */
 static int ped_window_stop_after_prep = 0; /* if 1 => stop PED at end of next PRE-Y */
 
+/* =========================================================
+   TRACE RECORDER  ("-R <file>")
+   Binary timeline of this controller for trace2json (Chrome / Perfetto
+   export): fixed 32-byte records appended to <file>, flushed at every
+   poll. A session starts with META records (controller, clock, head
+   names); then PHASE = a head changes aspect, EVENT = an input was
+   applied, DECISION = what the FSM did. An input and the transitions
+   it causes share a flow id: START at the input, STEP at intermediate
+   decisions, END at the final one.
+   ========================================================= */
+#define TR_VERSION     1
+#define TR_HEADS       4
+#define TR_TRACK_CTRL  0xFF     /* META: name = controller */
+#define TR_TRACK_CLOCK 0xFE     /* META: name[0..7] = CLOCK_REALTIME us at t_us */
+
+enum { TR_K_META = 0, TR_K_PHASE, TR_K_EVENT, TR_K_DECISION };
+enum { TR_FLOW_NONE = 0, TR_FLOW_START, TR_FLOW_STEP, TR_FLOW_END };
+enum { TRF_TRAIN = 0, TRF_CLEAR, TRF_PED, TRF_APPR, TRF_N };
+
+/* MUST match trace2json */
+typedef struct {
+    uint64_t t_us;        /* CLOCK_MONOTONIC */
+    uint8_t  kind;        /* TR_K_* */
+    uint8_t  track;       /* PHASE: head; META: head or TR_TRACK_* */
+    uint8_t  mode;        /* 'N' normal, 'T' train */
+    uint8_t  flag;        /* TR_FLOW_* */
+    uint16_t state;       /* UI state number (S01 = 1) */
+    uint16_t arg;         /* lane, track id, tenths of s, ... */
+    uint32_t flow;        /* 0 = none */
+    char     name[12];    /* aspect / event / decision, NUL padded */
+} trace_rec_t;
+
+static const char *const TR_HEAD_NAMES[TR_HEADS] = { "R3(S-N)", "R1(W->E)", "R1(E->W)", "PED" };
+
+static FILE    *tr_file = NULL;
+static uint32_t tr_flow_last = 0;
+static uint32_t tr_pending[TRF_N];        /* open flow per input class */
+static char     tr_aspect[TR_HEADS][8];   /* last aspect written per head */
+static uint8_t  tr_mode = 'N';
+static uint16_t tr_state = 0;
+
+static uint64_t tr_clock_us(clockid_t c)
+{
+    struct timespec ts;
+    clock_gettime(c, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+static void tr_put(uint8_t kind, uint8_t track, uint16_t arg, uint8_t flag, uint32_t flow, const char *name)
+{
+    if (!tr_file) return;
+    trace_rec_t r;
+    memset(&r, 0, sizeof(r));
+    r.t_us = tr_clock_us(CLOCK_MONOTONIC);
+    r.kind = kind;
+    r.track = track;
+    r.mode = tr_mode;
+    r.flag = flag;
+    r.state = tr_state;
+    r.arg = arg;
+    r.flow = flow;
+    if (kind == TR_K_META && track == TR_TRACK_CLOCK) memcpy(r.name, name, sizeof(r.name));  /* binary */
+    else                                               strncpy(r.name, name, sizeof(r.name));
+    fwrite(&r, sizeof(r), 1, tr_file);
+}
+
+static void tr_open(const char *path)
+{
+    tr_file = fopen(path, "ab");              /* a restart appends a new session */
+    if (!tr_file) { perror(path); return; }
+    setvbuf(tr_file, NULL, _IOFBF, 1 << 16);
+
+    char clk[12] = { 0 };
+    uint64_t real = tr_clock_us(CLOCK_REALTIME);
+    memcpy(clk, &real, sizeof(real));
+    tr_put(TR_K_META, TR_TRACK_CTRL, TR_VERSION, 0, 0, "vm6_local1");
+    tr_put(TR_K_META, TR_TRACK_CLOCK, 0, 0, 0, clk);
+    for (int i = 0; i < TR_HEADS; i++) tr_put(TR_K_META, (uint8_t)i, 0, 0, 0, TR_HEAD_NAMES[i]);
+    memset(tr_aspect, 0, sizeof(tr_aspect));
+    printf("[vm6_local1] recording trace to %s\n", path);
+}
+
+static void tr_flush(void)
+{
+    if (tr_file) fflush(tr_file);
+}
+
+/* a state goes out: one PHASE record per head that changes aspect */
+static void tr_heads(uint8_t mode, int state, const char *h[])
+{
+    tr_mode = mode;
+    tr_state = (uint16_t)state;
+    for (int i = 0; i < TR_HEADS; i++) {
+        if (strncmp(tr_aspect[i], h[i], sizeof(tr_aspect[i])) == 0) continue;
+        snprintf(tr_aspect[i], sizeof(tr_aspect[i]), "%s", h[i]);
+        tr_put(TR_K_PHASE, (uint8_t)i, 0, 0, 0, h[i]);
+    }
+}
+
+/* an input; cls >= 0 opens a flow unless one of that class is still open */
+static void tr_event(int cls, uint16_t arg, const char *name)
+{
+    uint32_t flow = 0;
+    if (cls >= 0 && !tr_pending[cls]) flow = tr_pending[cls] = ++tr_flow_last;
+    tr_put(TR_K_EVENT, 0, arg, flow ? TR_FLOW_START : TR_FLOW_NONE, flow, name);
+}
+
+/* a decision; continues (or with final, ends) the open flow of cls */
+static void tr_decision(int cls, int final, uint16_t arg, const char *name)
+{
+    uint32_t flow = (cls >= 0) ? tr_pending[cls] : 0;
+    tr_put(TR_K_DECISION, 0, arg, flow ? (final ? TR_FLOW_END : TR_FLOW_STEP) : TR_FLOW_NONE, flow, name);
+    if (flow && final) tr_pending[cls] = 0;
+}
+
 /* ================= NOTIFY ================= */
-static void notify_train_begin(void)   { printf("\n*** TRAIN BEGIN ***\n\n"); fflush(stdout); }
-static void notify_train_over(void)    { printf("\n*** TRAIN OVER  ***\n\n"); fflush(stdout); }
+static void notify_train_begin(void)   { printf("\n*** TRAIN BEGIN ***\n\n"); fflush(stdout); tr_decision(TRF_TRAIN, 1, 0, "TRAIN BEGIN"); }
+static void notify_train_over(void)    { printf("\n*** TRAIN OVER  ***\n\n"); fflush(stdout); tr_decision(TRF_CLEAR, 1, 0, "TRAIN OVER"); }
 static void notify_train_preempt(void) { printf("\n>>> TRAIN PREEMPT: forcing YELLOW immediately <<<\n\n"); fflush(stdout); }
-static void notify_train_clear(void)   { printf("\n>>> TRAIN CLEAR: will exit at next SAFE ALL-RED <<<\n\n"); fflush(stdout); }
-static void notify_ped_begin(void)     { printf("\n*** PED BEGIN   ***\n\n"); fflush(stdout); }
-static void notify_ped_over(void)      { printf("\n*** PED OVER    ***\n\n"); fflush(stdout); }
+static void notify_train_clear(void)   { printf("\n>>> TRAIN CLEAR: will exit at next SAFE ALL-RED <<<\n\n"); fflush(stdout); tr_decision(TRF_CLEAR, 0, 0, "CLEAR ACK"); }
+static void notify_ped_begin(void)     { printf("\n*** PED BEGIN   ***\n\n"); fflush(stdout); tr_decision(TRF_PED, 1, 0, "PED BEGIN"); }
+static void notify_ped_over(void)      { printf("\n*** PED OVER    ***\n\n"); fflush(stdout); tr_decision(-1, 0, 0, "PED OVER"); }
+
+static void note_actuated(void)
+{
+    if (actuated) return;
+    actuated = 1;
+    printf("\n*** ACTUATED: detector calls seen, greens gap out / max out ***\n\n");
+    fflush(stdout);
+}
+
+/* =========================================================
+   TRAIN APPROACH
+   't' only arrives when the gate closes, so a green can still be running
+   then and TRAIN starts a full yellow + all-red later. With an approach
+   ETA the controller works back from it instead: a green ends APPR_CLEAR_MS
+   before the ETA (yellow and all-red keep their full length), a green that
+   could not run its minimum is not started (left phases are skipped), and
+   TRAIN is entered at the last SAFE all-red before the ETA.
+   One entry per track; the earliest ETA drives the clearing.
+   ========================================================= */
+#define APPR_MAX       4
+#define APPR_CLEAR_MS  ((T_YELLOW + T_ALL_RED) * 1000U)
+
+typedef struct {
+    int      active;
+    unsigned track;
+    uint64_t due_ms;      /* CLOCK_MONOTONIC */
+} approach_t;
+
+static approach_t appr[APPR_MAX];
+
+static uint64_t monotonic_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+static const approach_t *approach_next(void)
+{
+    const approach_t *e = NULL;
+    for (int i = 0; i < APPR_MAX; i++)
+        if (appr[i].active && (!e || appr[i].due_ms < e->due_ms)) e = &appr[i];
+    return e;
+}
+
+/* returns 0 if the approach was not stored (table full) */
+static int approach_update(unsigned track, unsigned eta_s, int cancel)
+{
+    approach_t *e = NULL;
+    for (int i = 0; i < APPR_MAX && !e; i++)
+        if (appr[i].active && appr[i].track == track) e = &appr[i];
+    if (cancel) {
+        if (e) e->active = 0;
+        printf("\n>>> TRAIN APPROACH: track %u cancelled <<<\n\n", track);
+        fflush(stdout);
+        return 1;
+    }
+    for (int i = 0; i < APPR_MAX && !e; i++)
+        if (!appr[i].active) e = &appr[i];
+    if (!e) return 0;
+
+    e->active = 1;
+    e->track = track;
+    e->due_ms = monotonic_ms() + (uint64_t)eta_s * 1000ULL;
+    printf("\n>>> TRAIN APPROACH: track %u due in %us <<<\n\n", track, eta_s);
+    fflush(stdout);
+    return 1;
+}
+
+/* can need_ms more of NORMAL run and still leave a full clearance before the ETA? */
+static int approach_allows_ms(unsigned need_ms)
+{
+    const approach_t *e = approach_next();
+    if (!e || in_train_state) return 1;
+    return monotonic_ms() + need_ms + APPR_CLEAR_MS <= e->due_ms;
+}
+
+/* turn the pending approach into a train request (same path as 't') */
+static void approach_fire(void)
+{
+    if (train_request) return;
+    const approach_t *e = approach_next();
+    uint64_t now = monotonic_ms();
+    uint64_t left = (e && e->due_ms > now) ? e->due_ms - now : 0;
+    printf("\n>>> TRAIN APPROACH: track %u due in %u.%us, clearing now <<<\n\n",
+           e ? e->track : 0U, (unsigned)(left / 1000U), (unsigned)(left % 1000U) / 100U);
+    fflush(stdout);
+    tr_decision(TRF_APPR, 1, e ? (uint16_t)e->track : 0, "APPR FIRE");
+    train_request = 1;
+    train_active  = 1;
+    train_clear_pending = 0;
+}
+
+/* TRAIN started: retire approaches it covers, report the lead on the ETA */
+static void approach_train_begin(void)
+{
+    uint64_t now = monotonic_ms();
+    for (int i = 0; i < APPR_MAX; i++) {
+        if (!appr[i].active) continue;
+        /* NORMAL can still fit PRE-Y + a minimum green before a later train */
+        if (appr[i].due_ms > now + APPR_CLEAR_MS + (T_PREP_Y + T_RS_MIN) * 1000U) continue;
+        appr[i].active = 0;
+        long long lead = (long long)appr[i].due_ms - (long long)now;
+        printf("  [APPR] track %u: TRAIN %s ETA by %lld.%llds\n", appr[i].track,
+               lead >= 0 ? "ahead of" : "LATE on",
+               (lead < 0 ? -lead : lead) / 1000, ((lead < 0 ? -lead : lead) % 1000) / 100);
+    }
+    fflush(stdout);
+}
+
+/* =========================================================
+   EVENT SEQUENCING
+   keyv7 numbers its events per server and retries with short timeouts
+   until a reply arrives, so an event can arrive more than once. Each
+   client keeps the highest applied seq and a SEQ_WINDOW bitmap below
+   it: a seq already seen (or older than the window) is a duplicate and
+   is answered without being applied. A jump past top + 1 is logged as
+   lost events. A newer epoch (client restarted) resets the client; an
+   older one is a retry from before the restart and is refused. A full
+   table evicts the least recently used client only once it has been
+   quiet past every retry, else the newcomer is refused: a live window
+   is never reset.
+   ========================================================= */
+#define SEQ_CLIENTS  8
+#define SEQ_WINDOW   64
+#define SEQ_IDLE_MS  10000    /* well past keyv7's retries (20 x 100 ms) */
+
+typedef struct {
+    int      used;
+    int      client_id;
+    uint32_t epoch;
+    uint32_t top;         /* highest applied seq */
+    uint64_t mask;        /* bit n: top - n applied */
+    uint64_t last_ms;     /* monotonic: last event from this client */
+} seq_client_t;
+
+static seq_client_t seq_tab[SEQ_CLIENTS];
+
+/* 1 = new, apply it; 0 = duplicate; -1 = refused (stale epoch or table
+   full). *last = highest applied seq */
+static int seq_accept(int client_id, uint32_t epoch, uint32_t seq, uint32_t *last)
+{
+    uint64_t now = monotonic_ms();
+    seq_client_t *c = NULL, *free_slot = NULL, *lru = NULL;
+    for (int i = 0; i < SEQ_CLIENTS && !c; i++) {
+        if (seq_tab[i].used && seq_tab[i].client_id == client_id) c = &seq_tab[i];
+        else if (!seq_tab[i].used) { if (!free_slot) free_slot = &seq_tab[i]; }
+        else if (!lru || seq_tab[i].last_ms < lru->last_ms) lru = &seq_tab[i];
+    }
+    *last = 0;
+    if (!c) {
+        if (!free_slot && now - lru->last_ms < SEQ_IDLE_MS) {
+            printf("  [SEQ] client %d refused: %d clients active\n", client_id, SEQ_CLIENTS);
+            fflush(stdout);
+            return -1;
+        }
+        c = free_slot ? free_slot : lru;
+        memset(c, 0, sizeof(*c));
+        c->used = 1;
+        c->client_id = client_id;
+        c->epoch = epoch;
+    } else if (epoch < c->epoch) {
+        printf("  [SEQ] client %d: #%u from old epoch %u refused\n", client_id,
+               (unsigned)seq, (unsigned)epoch);
+        fflush(stdout);
+        *last = c->top;
+        return -1;
+    } else if (epoch > c->epoch) {
+        printf("  [SEQ] client %d restarted (epoch %u)\n", client_id, (unsigned)epoch);
+        fflush(stdout);
+        c->epoch = epoch;
+        c->top = 0;
+        c->mask = 0;
+    }
+    c->last_ms = now;
+
+    if (seq > c->top) {
+        uint32_t d = seq - c->top;
+        if (c->top && d > 1) {
+            printf("  [SEQ] client %d: #%u..#%u missing (lost events)\n", client_id,
+                   (unsigned)(c->top + 1), (unsigned)(seq - 1));
+            fflush(stdout);
+        }
+        c->mask = (d >= SEQ_WINDOW) ? 0 : c->mask << d;
+        c->mask |= 1;
+        c->top = seq;
+        *last = seq;
+        return 1;
+    }
+
+    uint32_t back = c->top - seq;
+    *last = c->top;
+    if (back >= SEQ_WINDOW || ((c->mask >> back) & 1U)) return 0;
+    c->mask |= 1ULL << back;     /* late, but not seen before */
+    return 1;
+}
+
+/* =========================================================
+   WARM RESTART SNAPSHOT
+   FSM state, flags, the PED window, pending approaches and the end of
+   the current phase live in a one-page file mapping (SNAP_PATH). Stores
+   land in the page cache, so they outlive the process: after a crash or
+   an upgrade the controller resumes mid-phase instead of restarting the
+   cycle. Written at every phase start and on every poll (100ms), so an
+   event is saved before it is acknowledged. The region is a seqlock: seq
+   is odd while a write is in progress, readers (a hot standby, or a
+   restart after a torn write) retry or reject. Only the owner pid writes;
+   a standby that takes the region over fences the old primary.
+   All times in it are CLOCK_MONOTONIC, which no clock step moves; boot_ms
+   (realtime - monotonic) tells a snapshot from an earlier boot apart.
+   ========================================================= */
+#define SNAP_PATH        "/tmp/demo1.snap"
+#define SNAP_MAGIC       0x534E4150u   /* "SNAP" */
+#define SNAP_VERSION     5
+#define SNAP_MAX_GAP_MS  3000U         /* longer outage: heads went dark */
+
+typedef struct {
+    uint32_t   magic;
+    uint16_t   version;
+    uint16_t   size;
+    uint32_t   seq;             /* odd while writing */
+    int32_t    owner;           /* pid allowed to write */
+    uint8_t    in_train, train_request, train_active, train_clear_pending;
+    uint8_t    ped_request, ped_window_active, ped_window_stop_after_prep, train_preempt_to_allred;
+    uint8_t    actuated, pad[3];
+    int32_t    state;           /* normal_state_t, or train_state_t when in_train */
+    int32_t    ui_base;
+    uint64_t   deadline_ms;     /* CLOCK_MONOTONIC end of the current phase */
+    uint64_t   alive_ms;        /* CLOCK_MONOTONIC of the last write */
+    int64_t    boot_ms;         /* CLOCK_REALTIME - CLOCK_MONOTONIC at the last write */
+    approach_t appr[APPR_MAX];
+    seq_client_t seqs[SEQ_CLIENTS];
+} snap_t;
+
+static volatile snap_t *snap = NULL;
+static int      snap_in_train = 0;
+static int      snap_state = 0;
+static uint64_t snap_deadline = 0;
+static unsigned snap_resume_ms = 0;    /* remainder of the phase cut by the restart */
+static int32_t  snap_owner = 0;
+static uint64_t ha_kill_at = 0;        /* -k fault injection: die at this CLOCK_MONOTONIC time */
+
+static uint64_t realtime_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_REALTIME, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+static void snap_save(void)
+{
+    if (!snap) return;
+    if (snap->owner != snap_owner) {   /* a standby took over */
+        printf("\n[HA] fenced: pid %d owns the controller now, exiting\n", (int)snap->owner);
+        fflush(stdout);
+        exit(EXIT_FAILURE);
+    }
+
+    snap->seq++;
+    atomic_thread_fence(memory_order_release);
+    snap->in_train = (uint8_t)snap_in_train;
+    snap->train_request = (uint8_t)train_request;
+    snap->train_active = (uint8_t)train_active;
+    snap->train_clear_pending = (uint8_t)train_clear_pending;
+    snap->ped_request = (uint8_t)ped_request;
+    snap->ped_window_active = (uint8_t)ped_window_active;
+    snap->ped_window_stop_after_prep = (uint8_t)ped_window_stop_after_prep;
+    snap->train_preempt_to_allred = (uint8_t)train_preempt_to_allred;
+    snap->actuated = (uint8_t)actuated;
+    snap->state = snap_state;
+    snap->ui_base = normal_ui_base;
+    snap->deadline_ms = snap_deadline;
+    snap->alive_ms = monotonic_ms();
+    snap->boot_ms = (int64_t)(realtime_ms() - snap->alive_ms);
+    for (int i = 0; i < APPR_MAX; i++) snap->appr[i] = appr[i];
+    for (int i = 0; i < SEQ_CLIENTS; i++) snap->seqs[i] = seq_tab[i];
+    atomic_thread_fence(memory_order_release);
+    snap->seq++;
+}
+
+/* seqlock read; returns 0 if every try overlapped a write */
+static int snap_read(const volatile snap_t *p, snap_t *out)
+{
+    for (int tries = 0; tries < 100; tries++) {
+        uint32_t seq = p->seq;
+        atomic_thread_fence(memory_order_acquire);
+        memcpy(out, (const void *)p, sizeof(*out));
+        atomic_thread_fence(memory_order_acquire);
+        if (!(seq & 1U) && p->seq == seq) return 1;
+    }
+    return 0;
+}
+
+/* a phase starts now and runs ms */
+static void snap_enter(int in_train, int state, unsigned ms)
+{
+    snap_in_train = in_train;
+    snap_state = state;
+    snap_deadline = monotonic_ms() + ms;
+    snap_save();
+}
+
+/* first wait after a warm restart runs only what the phase had left */
+static unsigned snap_take_resume(void)
+{
+    unsigned ms = snap_resume_ms;
+    snap_resume_ms = 0;
+    return ms;
+}
 
 /* =========================================================
    PED output
@@ -139,12 +654,197 @@ static void ped_stop_if_prep_finished(void)
 /* =========================================================
    QNET INPUT: poll events without blocking
    ========================================================= */
+/* one event from evt_msg_t or a batch item; 0 = unknown event */
+static int apply_event(char ev, unsigned lane, char *txt, size_t n)
+{
+    if (ev == EVT_TRAIN_DETECT) {
+        tr_pending[TRF_CLEAR] = 0;   /* a pending clear is cancelled */
+        tr_event(TRF_TRAIN, 0, "t");
+        notify_train_preempt();      /* print every press */
+        train_request = 1;
+        train_active  = 1;
+        train_clear_pending = 0;
+        snprintf(txt, n, "OK: t");
+
+    } else if (ev == EVT_TRAIN_CLEAR) {
+        tr_event(TRF_CLEAR, 0, "c");
+        train_clear_pending = 1;
+        train_request = 0;
+        snprintf(txt, n, "OK: c");
+
+    } else if (ev == EVT_PED_PRESS) {
+        tr_event(TRF_PED, 0, "p");
+        ped_request = 1; /* arms only; starts at next SAFE ALL-RED */
+        snprintf(txt, n, "OK: p");
+
+    } else if (ev == EVT_VEH_CALL && lane < N_LANES) {
+        tr_event(-1, (uint16_t)lane, "v");
+        lane_calls[lane]++;
+        note_actuated();
+        snprintf(txt, n, "OK: v%u", lane);
+
+    } else {
+        return 0;
+    }
+    return 1;
+}
+
+/* apply the batch in t_ms order; returns the events applied */
+static int apply_batch(const evt_batch_msg_t *b, int rcv_len)
+{
+    int count = b->count;
+    int fit = (rcv_len - (int)offsetof(evt_batch_msg_t, items)) / (int)sizeof(evt_item_t);
+    if (count > EVT_BATCH_MAX) count = EVT_BATCH_MAX;
+    if (count > fit) count = fit;          /* short message: only what arrived */
+    if (count <= 0) return 0;
+
+    /* stable insertion sort of indexes; batches are small and mostly sorted */
+    uint8_t ord[EVT_BATCH_MAX];
+    for (int i = 0; i < count; i++) {
+        int k = i;
+        while (k > 0 && b->items[ord[k - 1]].t_ms > b->items[i].t_ms) {
+            ord[k] = ord[k - 1];
+            k--;
+        }
+        ord[k] = (uint8_t)i;
+    }
+
+    int applied = 0;
+    char txt[64];
+    for (int i = 0; i < count; i++) {
+        const evt_item_t *it = &b->items[ord[i]];
+        applied += apply_event(it->ev, it->lane, txt, sizeof(txt));
+    }
+    return applied;
+}
+
+/* =========================================================
+   EVENT BUS (subscriber)
+   Senders publish once to the node's evtbus; it appends each record
+   to the /traffic_bus ring. We read the ring with our own cursor at
+   every poll and keep the records for this intersection (or all) and
+   our roads. Same dedup (seq_accept) and apply path as QNET events.
+   A (re)started controller starts at the current head.
+   ========================================================= */
+#define BUS_SHM_NAME   "/traffic_bus"
+#define BUS_MAGIC      0x42555331u      /* "BUS1" */
+#define BUS_SLOTS      1024
+#define BUS_ISECT_ALL  0
+#define BUS_ROAD_ANY   0
+#define BUS_CLS_APPROACH 4
+
+#define BUS_MY_ISECT   1
+#define BUS_MY_ROADS   "31"         /* R3 + side road */
+#define BUS_RETRY_POLLS 50              /* re-map every 5s until evtbus runs */
+
+/* MUST match evtbus */
+typedef struct {
+    uint8_t  isect;
+    uint8_t  road;
+    uint8_t  cls;
+    uint8_t  hop;
+    char     ev;
+    uint8_t  lane;
+    _Uint16t subtype;
+    _Uint16t track_id;
+    _Uint16t eta_s;
+    int      client_id;
+    uint32_t epoch;
+    uint32_t seq;
+    uint32_t t_ms;
+    uint32_t pad;
+} bus_rec_t;
+
+typedef struct {
+    _Atomic uint64_t seq;
+    bus_rec_t        rec;
+} bus_slot_t;
+
+typedef struct {
+    uint32_t         magic;
+    uint32_t         slots;
+    _Atomic uint64_t head;
+    bus_slot_t       slot[BUS_SLOTS];
+} bus_shm_t;
+
+static bus_shm_t *g_bus = NULL;
+static uint64_t   bus_cur = 0;
+static unsigned   bus_retry = 0;
+
+static void bus_map(void)
+{
+    int fd = shm_open(BUS_SHM_NAME, O_RDONLY, 0);
+    if (fd == -1) return;                       /* no broker on this node (yet) */
+    void *p = mmap(NULL, sizeof(bus_shm_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) return;
+    bus_shm_t *b = (bus_shm_t *)p;
+    if (b->magic != BUS_MAGIC || b->slots != BUS_SLOTS) {
+        munmap(p, sizeof(bus_shm_t));
+        return;
+    }
+    g_bus = b;
+    bus_cur = atomic_load_explicit(&g_bus->head, memory_order_acquire);
+    printf("[%s] subscribed to %s (intersection %d, roads %s)\n", "vm6_local1", BUS_SHM_NAME,
+           BUS_MY_ISECT, BUS_MY_ROADS);
+    fflush(stdout);
+}
+
+static int bus_wanted(const bus_rec_t *r)
+{
+    if (r->isect != BUS_ISECT_ALL && r->isect != BUS_MY_ISECT) return 0;
+    return r->road == BUS_ROAD_ANY || strchr(BUS_MY_ROADS, r->road) != NULL;
+}
+
+static void bus_poll(void)
+{
+    if (!g_bus) {
+        if ((bus_retry++ % BUS_RETRY_POLLS) == 0) bus_map();
+        if (!g_bus) return;
+    }
+
+    uint64_t head = atomic_load_explicit(&g_bus->head, memory_order_acquire);
+    if (head < bus_cur) bus_cur = head;         /* broker reset the ring */
+
+    int applied = 0;
+    while (bus_cur < head) {
+        const bus_slot_t *sl = &g_bus->slot[bus_cur % BUS_SLOTS];
+        uint64_t a = atomic_load_explicit(&sl->seq, memory_order_acquire);
+        bus_rec_t r = sl->rec;
+        atomic_thread_fence(memory_order_acquire);
+        if (a != bus_cur + 1 || atomic_load_explicit(&sl->seq, memory_order_relaxed) != a) {
+            if (a != 0 && a < bus_cur + 1) break;   /* not written yet */
+            uint64_t skip = (head - bus_cur > BUS_SLOTS) ? head - BUS_SLOTS : bus_cur + 1;
+            printf("  [BUS] overrun: %llu events lost\n", (unsigned long long)(skip - bus_cur));
+            fflush(stdout);
+            bus_cur = skip;
+            continue;
+        }
+        bus_cur++;
+
+        /* dedup sees the publisher's whole stream, so other topics are no gap */
+        uint32_t last;
+        if (r.seq && seq_accept(r.client_id, r.epoch, r.seq, &last) <= 0) continue;
+        if (!bus_wanted(&r)) continue;
+
+        char txt[64];
+        if (r.cls == BUS_CLS_APPROACH) applied += approach_update(r.track_id, r.eta_s, r.subtype == APPR_SUB_CANCEL);
+        else                           applied += apply_event(r.ev, r.lane, txt, sizeof(txt));
+    }
+    if (applied) snap_save();
+}
+
 static void poll_events_from_qnet_nonblock(void)
 {
+    if (ha_kill_at && monotonic_ms() >= ha_kill_at) raise(SIGKILL);
+    snap_save();
+    tr_flush();
+    bus_poll();
     if (!g_attach) return;
 
-    evt_msg_t msg;
+    evt_rx_t msg;
     evt_reply_t rep;
+    struct _msg_info info;
 
     memset(&msg, 0, sizeof(msg));
     memset(&rep, 0, sizeof(rep));
@@ -154,45 +854,53 @@ static void poll_events_from_qnet_nonblock(void)
     _Uint64t timeout_ns = 0; /* immediate */
     TimerTimeout(CLOCK_MONOTONIC, _NTO_TIMEOUT_RECEIVE, NULL, &timeout_ns, NULL);
 
-    int rcvid = MsgReceive(g_attach->chid, &msg, sizeof(msg), NULL);
+    int rcvid = MsgReceive(g_attach->chid, &msg, sizeof(msg), &info);
     if (rcvid == -1) {
         if (errno == ETIMEDOUT) return;
         perror("MsgReceive");
         return;
     }
 
-    if (msg.type == _IO_CONNECT) {
+    if (msg.evt.type == _IO_CONNECT) {
         MsgReply(rcvid, EOK, NULL, 0);
         return;
     }
 
-    if (msg.type > _IO_BASE && msg.type <= _IO_MAX) {
+    if (msg.evt.type > _IO_BASE && msg.evt.type <= _IO_MAX) {
         MsgError(rcvid, ENOSYS);
         return;
     }
 
-    char ev = msg.ev;
-
-    if (ev == EVT_TRAIN_DETECT) {
-        notify_train_preempt();      /* print every press */
-        train_request = 1;
-        train_active  = 1;
-        train_clear_pending = 0;
-        snprintf(rep.text, sizeof(rep.text), "OK: t");
-
-    } else if (ev == EVT_TRAIN_CLEAR) {
-        train_clear_pending = 1;
-        train_request = 0;
-        snprintf(rep.text, sizeof(rep.text), "OK: c");
-
-    } else if (ev == EVT_PED_PRESS) {
-        ped_request = 1; /* arms only; starts at next SAFE ALL-RED */
-        snprintf(rep.text, sizeof(rep.text), "OK: p");
+    uint32_t last = 0;
+    int fresh = msg.evt.seq ? seq_accept(msg.evt.client_id, msg.evt.epoch, msg.evt.seq, &last) : 1;
+    if (fresh <= 0) {
+        snprintf(rep.text, sizeof(rep.text), "%s #%u", fresh ? "REFUSED" : "DUP",
+                 (unsigned)msg.evt.seq);
+        rep.last_seq = last;
+        MsgReply(rcvid, EOK, &rep, sizeof(rep));
+        return;
+    }
+    rep.last_seq = last;
+
+    if (msg.evt.type == MSG_TRAIN_APPROACH) {
+        const train_appr_msg_t a = msg.appr;
+        if (approach_update(a.track_id, a.eta_s, a.subtype == APPR_SUB_CANCEL))
+            snprintf(rep.text, sizeof(rep.text), "OK: a%u eta %us", (unsigned)a.track_id, (unsigned)a.eta_s);
+        else
+            snprintf(rep.text, sizeof(rep.text), "IGNORED: approach table full");
+        snap_save();
+        MsgReply(rcvid, EOK, &rep, sizeof(rep));
+        return;
+    }
 
-    } else {
+    if (msg.evt.type == MSG_EVT_BATCH) {
+        int n = apply_batch(&msg.batch, info.msglen);
+        snprintf(rep.text, sizeof(rep.text), "OK: batch %d/%u", n, (unsigned)msg.batch.count);
+    } else if (!apply_event(msg.evt.ev, (unsigned char)msg.evt.pad[0], rep.text, sizeof(rep.text))) {
         snprintf(rep.text, sizeof(rep.text), "IGNORED");
     }
 
+    snap_save();
     MsgReply(rcvid, EOK, &rep, sizeof(rep));
 }
 
@@ -251,24 +959,32 @@ typedef struct {
     int  is_green;
     normal_state_t to_yellow;
     normal_state_t next;
+
+    /* actuated greens (0 = fixed dur_s) */
+    unsigned min_s;
+    unsigned max_s;
+    unsigned ext_s;       /* gap: green ends once no call for ext_s */
+    unsigned lanes;       /* LN() mask of the lanes calling this green */
+    int  skip_uncalled;   /* skipped (with its yellow) if no call waits */
 } normal_def_t;
 
 static const normal_def_t NORM[] = {
-    /* S01 */ { N_ALL_RED_1, T_ALL_RED, "RED",   "RED",   "RED",   1, 0, 0, N_ALL_RED_1, N_PREP_R3 },
-    /* S02 */ { N_PREP_R3,   T_PREP_Y,  "PRE-Y", "RED",   "RED",   0, 1, 0, N_PREP_R3,   N_R3_RS_G },
-
-    { N_R3_RS_G,  T_RS_GREEN, "RS-G", "RED", "RED", 0, 0, 1, N_R3_RS_Y, N_R3_RS_Y },
-    { N_R3_RS_Y,  T_YELLOW,   "RS-Y", "RED", "RED", 0, 0, 0, N_R3_RS_Y, N_R3_L_G  },
-    { N_R3_L_G,   T_L_GREEN,  "L-G",  "RED", "RED", 0, 0, 1, N_R3_L_Y,  N_R3_L_Y  },
-    { N_R3_L_Y,   T_YELLOW,   "L-Y",  "RED", "RED", 0, 0, 0, N_R3_L_Y,  N_ALL_RED_2 },
-
-    { N_ALL_RED_2, T_ALL_RED, "RED", "RED", "RED", 1, 0, 0, N_ALL_RED_2, N_PREP_R1 },
-    { N_PREP_R1,   T_PREP_Y,  "RED", "PRE-Y","PRE-Y", 0, 1, 0, N_PREP_R1, N_R1_RS_G },
-
-    { N_R1_RS_G,  T_RS_GREEN, "RED", "RS-G", "RS-G", 0, 0, 1, N_R1_RS_Y, N_R1_RS_Y },
-    { N_R1_RS_Y,  T_YELLOW,   "RED", "RS-Y", "RS-Y", 0, 0, 0, N_R1_RS_Y, N_R1_L_G  },
-    { N_R1_L_G,   T_L_GREEN,  "RED", "L-G",  "L-G",  0, 0, 1, N_R1_L_Y,  N_R1_L_Y  },
-    { N_R1_L_Y,   T_YELLOW,   "RED", "L-Y",  "L-Y",  0, 0, 0, N_R1_L_Y,  N_ALL_RED_1 }
+    /*          id, dur, heads, safe, prep, green, to_yellow, next, | min, max, ext, lanes, skip */
+    /* S01 */ { N_ALL_RED_1, T_ALL_RED, "RED",   "RED",   "RED",   1, 0, 0, N_ALL_RED_1, N_PREP_R3, 0, 0, 0, 0, 0 },
+    /* S02 */ { N_PREP_R3,   T_PREP_Y,  "PRE-Y", "RED",   "RED",   0, 1, 0, N_PREP_R3,   N_R3_RS_G, 0, 0, 0, 0, 0 },
+
+    { N_R3_RS_G,  T_RS_GREEN, "RS-G", "RED", "RED", 0, 0, 1, N_R3_RS_Y, N_R3_RS_Y, T_RS_MIN, T_RS_MAX, T_RS_EXT, LN(LANE_R3_RS), 0 },
+    { N_R3_RS_Y,  T_YELLOW,   "RS-Y", "RED", "RED", 0, 0, 0, N_R3_RS_Y, N_R3_L_G, 0, 0, 0, 0, 0 },
+    { N_R3_L_G,   T_L_GREEN,  "L-G",  "RED", "RED", 0, 0, 1, N_R3_L_Y,  N_R3_L_Y, T_L_MIN,  T_L_MAX,  T_L_EXT,  LN(LANE_R3_L),  1 },
+    { N_R3_L_Y,   T_YELLOW,   "L-Y",  "RED", "RED", 0, 0, 0, N_R3_L_Y,  N_ALL_RED_2, 0, 0, 0, 0, 0 },
+
+    { N_ALL_RED_2, T_ALL_RED, "RED", "RED", "RED", 1, 0, 0, N_ALL_RED_2, N_PREP_R1, 0, 0, 0, 0, 0 },
+    { N_PREP_R1,   T_PREP_Y,  "RED", "PRE-Y","PRE-Y", 0, 1, 0, N_PREP_R1, N_R1_RS_G, 0, 0, 0, 0, 0 },
+
+    { N_R1_RS_G,  T_RS_GREEN, "RED", "RS-G", "RS-G", 0, 0, 1, N_R1_RS_Y, N_R1_RS_Y, T_RS_MIN, T_RS_MAX, T_RS_EXT, LN(LANE_R1_WE_RS) | LN(LANE_R1_EW_RS), 0 },
+    { N_R1_RS_Y,  T_YELLOW,   "RED", "RS-Y", "RS-Y", 0, 0, 0, N_R1_RS_Y, N_R1_L_G, 0, 0, 0, 0, 0 },
+    { N_R1_L_G,   T_L_GREEN,  "RED", "L-G",  "L-G",  0, 0, 1, N_R1_L_Y,  N_R1_L_Y, T_L_MIN,  T_L_MAX,  T_L_EXT,  LN(LANE_R1_WE_L)  | LN(LANE_R1_EW_L),  1 },
+    { N_R1_L_Y,   T_YELLOW,   "RED", "L-Y",  "L-Y",  0, 0, 0, N_R1_L_Y,  N_ALL_RED_1, 0, 0, 0, 0, 0 }
 };
 
 static const normal_def_t* find_norm(normal_state_t id)
@@ -308,6 +1024,127 @@ static int is_normal_green(normal_state_t s)
     return (st && st->is_green);
 }
 
+/* =========================================================
+   DETECTOR INGEST (shared memory)
+   Loop detectors run far faster than one QNET message per vehicle can
+   carry. Local detector drivers (and detload) add per-lane vehicle
+   counts and occupied milliseconds into /traffic_det with relaxed atomic
+   adds, one add per lane per batch. The FSM only reads the counters at
+   its decision points (start of a phase, each 100ms tick of an actuated
+   green), so producer rate never touches phase timing.
+   Layout MUST match detload.
+   ========================================================= */
+#define DET_SHM_NAME  "/traffic_det"
+#define DET_MAGIC     0x44455431u   /* "DET1" */
+#define DET_LANES     8             /* >= N_LANES */
+
+typedef struct {
+    uint32_t magic;
+    uint32_t lanes;
+    _Atomic uint64_t calls[DET_LANES];    /* vehicles detected */
+    _Atomic uint64_t occ_ms[DET_LANES];   /* loop occupied time */
+    _Atomic uint64_t batches;             /* producer flushes */
+} det_shm_t;
+
+static det_shm_t *g_det = NULL;
+static uint64_t det_calls_seen[N_LANES];
+static uint64_t det_occ_seen[N_LANES];
+
+static void det_attach(void)
+{
+    int fd = shm_open(DET_SHM_NAME, O_RDWR | O_CREAT, 0666);
+    if (fd == -1) {
+        perror("shm_open(" DET_SHM_NAME ")");   /* QNET 'v' calls still work */
+        return;
+    }
+    if (ftruncate(fd, sizeof(det_shm_t)) == -1) {
+        perror("ftruncate(" DET_SHM_NAME ")");
+        close(fd);
+        return;
+    }
+    void *p = mmap(NULL, sizeof(det_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) {
+        perror("mmap(" DET_SHM_NAME ")");
+        return;
+    }
+    g_det = (det_shm_t *)p;
+    if (g_det->magic != DET_MAGIC) {      /* fresh region is all zero */
+        g_det->lanes = N_LANES;
+        g_det->magic = DET_MAGIC;
+    }
+
+    /* counters are monotonic: a restarted controller starts from now */
+    for (int l = 0; l < N_LANES; l++) {
+        det_calls_seen[l] = atomic_load_explicit(&g_det->calls[l], memory_order_relaxed);
+        det_occ_seen[l]   = atomic_load_explicit(&g_det->occ_ms[l], memory_order_relaxed);
+    }
+    printf("[%s] detector ingest at %s (%d lanes)\n", "vm6_local1", DET_SHM_NAME, N_LANES);
+}
+
+/* decision point: fold what producers added since last time into lane_* */
+static void det_sync(void)
+{
+    if (!g_det) return;
+    for (int l = 0; l < N_LANES; l++) {
+        uint64_t c = atomic_load_explicit(&g_det->calls[l], memory_order_relaxed);
+        uint64_t o = atomic_load_explicit(&g_det->occ_ms[l], memory_order_relaxed);
+        if (c != det_calls_seen[l]) {
+            lane_calls[l] += (unsigned)(c - det_calls_seen[l]);
+            det_calls_seen[l] = c;
+            note_actuated();
+        }
+        lane_occ_ms[l] += (unsigned)(o - det_occ_seen[l]);
+        det_occ_seen[l] = o;
+    }
+}
+
+/* ---------- actuation: calls since a green last looked at its lanes ---------- */
+static unsigned lane_seen[N_LANES];
+static unsigned lane_occ_seen[N_LANES];
+
+static int phase_called(const normal_def_t *st)
+{
+    for (int l = 0; l < N_LANES; l++) {
+        if ((st->lanes & LN(l)) && lane_calls[l] != lane_seen[l]) return 1;
+    }
+    return 0;
+}
+
+/* new calls on the green's lanes; marks them served */
+static unsigned phase_take_calls(const normal_def_t *st)
+{
+    unsigned n = 0;
+    for (int l = 0; l < N_LANES; l++) {
+        if (!(st->lanes & LN(l))) continue;
+        n += lane_calls[l] - lane_seen[l];
+        lane_seen[l] = lane_calls[l];
+    }
+    return n;
+}
+
+/* occupied ms on the green's lanes since last taken; a vehicle sitting on
+ * the loop keeps the green even though it adds no new call */
+static unsigned phase_take_occ(const normal_def_t *st)
+{
+    unsigned ms = 0;
+    for (int l = 0; l < N_LANES; l++) {
+        if (!(st->lanes & LN(l))) continue;
+        ms += lane_occ_ms[l] - lane_occ_seen[l];
+        lane_occ_seen[l] = lane_occ_ms[l];
+    }
+    return ms;
+}
+
+static unsigned phase_lane_count(const normal_def_t *st)
+{
+    unsigned n = 0;
+    for (int l = 0; l < N_LANES; l++) {
+        if (st->lanes & LN(l)) n++;
+    }
+    return n;
+}
+
 /* =========================================================
    TRAIN mini-FSM (prints TRAIN S01..S08)
    MUST start at PRE-Y (no initial all-red state)
@@ -356,26 +1193,163 @@ static int train_is_prep(train_state_t s)
     return (s == TR_S01_PREP_R3 || s == TR_S05_PREP_R1);
 }
 
-static void print_train_line(train_state_t s)
+/* =========================================================
+   SIGNAL HEADS + INTERLOCK
+   Each head lights a set of movements (L/S/R per approach, plus PED).
+   G/Y give right of way; RED and PRE-Y light nothing (so the PED window
+   may overlap a PRE-Y). CONFLICT_OF[mask] = union of the conflict rows of
+   the movements in mask; a frame is legal iff (mask & CONFLICT_OF[mask])==0.
+   Vehicle masks are precomputed per state; PED is OR-ed in at output.
+   ========================================================= */
+
+enum { H_R3 = 0, H_R1_WE, H_R1_EW, H_PED, N_HEADS };
+
+enum {
+    MV_R3_L = 0, MV_R3_S, MV_R3_R,
+    MV_R1_WE_L,  MV_R1_WE_S, MV_R1_WE_R,
+    MV_R1_EW_L,  MV_R1_EW_S, MV_R1_EW_R,
+    MV_PED,
+    MV_COUNT
+};
+
+typedef uint16_t mvmask_t;
+
+#define MV(b)      ((mvmask_t)(1u << (b)))
+#define MV_R3_ALL  ((mvmask_t)(0x07u << MV_R3_L))
+#define MV_R1_ALL  ((mvmask_t)(0x3Fu << MV_R1_WE_L))
+#define MV_VEH_ALL ((mvmask_t)(MV_R3_ALL | MV_R1_ALL))
+
+static const int HEAD_MV_BASE[N_HEADS] = { MV_R3_L, MV_R1_WE_L, MV_R1_EW_L, MV_PED };
+
+/* crossing roads conflict, PED conflicts with every vehicle movement;
+ * the two R1 approaches run together (permissive turns) */
+static const mvmask_t CONFLICT_ROW[MV_COUNT] = {
+    MV_R1_ALL | MV(MV_PED), MV_R1_ALL | MV(MV_PED), MV_R1_ALL | MV(MV_PED),
+    MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED),
+    MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED),
+    MV_VEH_ALL
+};
+
+#define N_NORM  (sizeof(NORM)/sizeof(NORM[0]))
+#define N_TRAIN ((unsigned)TR_S08_ALL_RED_B + 1U)
+
+static mvmask_t CONFLICT_OF[1u << MV_COUNT];
+static mvmask_t NORM_MASK[N_NORM];
+static mvmask_t TRAIN_MASK[N_TRAIN];
+static unsigned long interlock_trips = 0;
+
+static mvmask_t aspect_moves(const char *aspect, int head)
 {
-    const char *r3 = "RED";
-    const char *r1we = "RED";
-    const char *r1ew = "RED";
+    if (head == H_PED) return (strcmp(aspect, "WALK") == 0) ? MV(MV_PED) : 0;
+    if (strcmp(aspect, "RED") == 0 || strcmp(aspect, "PRE-Y") == 0) return 0;
+
+    mvmask_t m = 0;
+    for (const char *p = aspect; *p && *p != '-'; p++) {
+        if (*p == 'L') m |= MV(HEAD_MV_BASE[head] + 0);
+        if (*p == 'S') m |= MV(HEAD_MV_BASE[head] + 1);
+        if (*p == 'R') m |= MV(HEAD_MV_BASE[head] + 2);
+    }
+    return m;
+}
+
+static int interlock_ok(mvmask_t frame)
+{
+    return (frame & CONFLICT_OF[frame]) == 0;
+}
+
+/* vehicle heads of a TRAIN state (PED filled in by the caller) */
+static void train_heads(train_state_t s, const char *h[N_HEADS])
+{
+    h[H_R3] = "RED";
+    h[H_R1_WE] = "RED";
+    h[H_R1_EW] = "RED";
+    h[H_PED] = "RED";
 
     switch (s) {
-        case TR_S01_PREP_R3:    r3 = "PRE-Y"; break;
-        case TR_S02_R3_LR_G:    r3 = "LR-G";  break;
-        case TR_S03_R3_LR_Y:    r3 = "LR-Y";  break;
+        case TR_S01_PREP_R3:    h[H_R3] = "PRE-Y"; break;
+        case TR_S02_R3_LR_G:    h[H_R3] = "LR-G";  break;
+        case TR_S03_R3_LR_Y:    h[H_R3] = "LR-Y";  break;
 
-        case TR_S05_PREP_R1:    r1we = "PRE-Y"; r1ew = "PRE-Y"; break;
-        case TR_S06_R1_SPLIT_G: r1we = "SR-G";  r1ew = "SL-G";  break;
-        case TR_S07_R1_SPLIT_Y: r1we = "SR-Y";  r1ew = "SL-Y";  break;
+        case TR_S05_PREP_R1:    h[H_R1_WE] = "PRE-Y"; h[H_R1_EW] = "PRE-Y"; break;
+        case TR_S06_R1_SPLIT_G: h[H_R1_WE] = "SR-G";  h[H_R1_EW] = "SL-G";  break;
+        case TR_S07_R1_SPLIT_Y: h[H_R1_WE] = "SR-Y";  h[H_R1_EW] = "SL-Y";  break;
         default: break; /* ALL-RED => all RED */
     }
+}
+
+static mvmask_t heads_mask(const char *h[N_HEADS])
+{
+    mvmask_t m = 0;
+    for (int k = 0; k < N_HEADS; k++) m |= aspect_moves(h[k], k);
+    return m;
+}
+
+/* refuses to start if any table state lights conflicting movements,
+ * with or without the PED window on top */
+static void build_interlock(void)
+{
+    for (unsigned m = 0; m < (1u << MV_COUNT); m++) {
+        mvmask_t c = 0;
+        for (int b = 0; b < MV_COUNT; b++) {
+            if (m & (1u << b)) c |= CONFLICT_ROW[b];
+        }
+        CONFLICT_OF[m] = c;
+    }
+
+    int bad = 0;
+    for (unsigned i = 0; i < N_NORM; i++) {
+        const char *h[N_HEADS] = { NORM[i].r3, NORM[i].r1_we, NORM[i].r1_ew, "RED" };
+        NORM_MASK[i] = heads_mask(h);
+        if (!interlock_ok(NORM_MASK[i]) ||
+            ((NORM[i].is_safe_allred || NORM[i].is_prep_y) && !interlock_ok(NORM_MASK[i] | MV(MV_PED)))) {
+            printf("INTERLOCK: NORMAL state %u lights conflicting movements (mask 0x%04x)\n",
+                   i, (unsigned)NORM_MASK[i]);
+            bad = 1;
+        }
+    }
+    for (unsigned i = 0; i < N_TRAIN; i++) {
+        const char *h[N_HEADS];
+        train_heads((train_state_t)i, h);
+        TRAIN_MASK[i] = heads_mask(h);
+        if (!interlock_ok(TRAIN_MASK[i]) ||
+            ((train_is_safe_allred((train_state_t)i) || train_is_prep((train_state_t)i)) &&
+             !interlock_ok(TRAIN_MASK[i] | MV(MV_PED)))) {
+            printf("INTERLOCK: TRAIN state %u lights conflicting movements (mask 0x%04x)\n",
+                   i, (unsigned)TRAIN_MASK[i]);
+            bad = 1;
+        }
+    }
+    if (bad) {
+        fflush(stdout);
+        exit(EXIT_FAILURE);
+    }
+}
+
+/* fail safe: a conflicting frame never goes out, show ALL RED instead */
+static int interlock_check(mvmask_t vehicle_mask, const char *h[N_HEADS])
+{
+    mvmask_t frame = vehicle_mask | (ped_window_active ? MV(MV_PED) : 0);
+    if (interlock_ok(frame)) return 1;
+
+    interlock_trips++;
+    printf("\n!!! INTERLOCK: conflicting frame 0x%04x -> ALL RED (trips=%lu) !!!\n\n",
+           (unsigned)frame, interlock_trips);
+    tr_decision(-1, 0, (uint16_t)frame, "INTERLOCK");
+    for (int i = 0; i < N_HEADS; i++) h[i] = "RED";
+    return 0;
+}
+
+static void print_train_line(train_state_t s)
+{
+    const char *h[N_HEADS];
+    train_heads(s, h);
+    h[H_PED] = ped_output();
+    interlock_check(TRAIN_MASK[s], h);
+    tr_heads('T', (int)train_ui_label(s), h);
 
     printf("[TRAIN  S%02u] (%02us) | R3(S-N)=%-6s | R1(W->E)=%-6s | R1(E->W)=%-6s | PED=%-5s\n",
            train_ui_label(s), train_duration(s),
-           r3, r1we, r1ew, ped_output());
+           h[H_R3], h[H_R1_WE], h[H_R1_EW], h[H_PED]);
     fflush(stdout);
 }
 
@@ -384,8 +1358,11 @@ static void train_step(void)
     /* PED can start ONLY at SAFE ALL-RED */
     ped_try_start_at_safe_allred(train_is_safe_allred(tr));
 
+    unsigned ms = snap_take_resume();
+    if (!ms) ms = train_duration(tr) * 1000U;
     print_train_line(tr);
-    wait_with_poll_ms(train_duration(tr) * 1000U);
+    snap_enter(1, (int)tr, ms);
+    wait_with_poll_ms(ms);
 
     /* Stop PED at end of PRE-Y */
     if (train_is_prep(tr)) {
@@ -420,11 +1397,61 @@ static void train_step(void)
 /* =========================================================
    NORMAL print + step (Local2 logic)
    ========================================================= */
-static void print_normal_line(normal_state_t s, const normal_def_t *st)
+/* =========================================================
+   COORDINATION  ("-c <cycle s> -o <offset s>")
+   Common cycle with Intersection 2 (demo3) for an R3 green wave. Time reference is
+   CLOCK_REALTIME, kept in step across the VMs (NTP). The nominal R3 RS-G
+   starts at offset (mod cycle). Every other state keeps its fixed time and
+   R3 RS-G takes the rest of the cycle, holding until the yield point
+   offset + coord_green_s. It waits for the next yield point at least
+   T_RS_MIN away, so a skipped left, a PED window or a TRAIN only stretch
+   one R3 green and the following cycle is back in step.
+   Actuated extension is off while coordinated; an uncalled left is still
+   skipped and its time goes to R3.
+   ========================================================= */
+static unsigned coord_cycle_s  = 0;     /* 0 = free running */
+static unsigned coord_offset_s = 0;
+static unsigned coord_green_s  = 0;     /* nominal R3 RS-G */
+
+static int coord_setup(unsigned cycle_s, unsigned offset_s)
+{
+    unsigned rest = 0;
+    for (unsigned i = 0; i < sizeof(NORM)/sizeof(NORM[0]); i++) {
+        if (NORM[i].id != N_R3_RS_G) rest += NORM[i].dur_s;
+    }
+    if (cycle_s < rest + T_RS_MIN) {
+        printf("COORD: cycle %us too short (other states %us + R3 min green %us)\n",
+               cycle_s, rest, (unsigned)T_RS_MIN);
+        return -1;
+    }
+    coord_cycle_s  = cycle_s;
+    coord_offset_s = offset_s % cycle_s;
+    coord_green_s  = cycle_s - rest;
+    printf("[vm6_local1] coordinated: cycle %us, offset %us, R3 RS-G %us\n",
+           coord_cycle_s, coord_offset_s, coord_green_s);
+    return 0;
+}
+
+/* R3 RS-G length: until the next yield point at least T_RS_MIN away */
+static unsigned coord_green_ms(void)
 {
+    uint64_t cyc   = (uint64_t)coord_cycle_s * 1000ULL;
+    uint64_t yield = ((uint64_t)coord_offset_s + coord_green_s) * 1000ULL % cyc;
+    uint64_t since = (realtime_ms() + cyc - yield) % cyc;
+    uint64_t until = cyc - since;
+    if (until < (uint64_t)T_RS_MIN * 1000ULL) until += cyc;
+    return (unsigned)until;
+}
+
+static void print_normal_line(normal_state_t s, const normal_def_t *st, unsigned dur_s)
+{
+    const char *h[N_HEADS] = { st->r3, st->r1_we, st->r1_ew, ped_output() };
+    interlock_check(NORM_MASK[s], h);
+    tr_heads('N', normal_ui_index_shifted(s), h);
+
     printf("[NORMAL S%02d] (%02us) | R3(S-N)=%-6s | R1(W->E)=%-6s | R1(E->W)=%-6s | PED=%-5s\n",
-           normal_ui_index_shifted(s), st->dur_s,
-           st->r3, st->r1_we, st->r1_ew, ped_output());
+           normal_ui_index_shifted(s), dur_s,
+           h[H_R3], h[H_R1_WE], h[H_R1_EW], h[H_PED]);
     fflush(stdout);
 }
 
@@ -433,38 +1460,97 @@ static void normal_step(normal_state_t *cur)
     const normal_def_t *st = find_norm(*cur);
     if (!st) { *cur = N_ALL_RED_1; return; }
 
+    /* a green never starts with a train pending, nor when it could not run
+     * its minimum before the approach clearance: back to a SAFE all-red
+     * (PRE-Y and a completed yellow both precede it) */
+    if (st->is_green && !snap_resume_ms && (train_request || !approach_allows_ms(st->min_s * 1000U))) {
+        approach_fire();
+        printf("  [APPR] NORMAL S%02d not started (train)\n", normal_ui_index_shifted(*cur));
+        fflush(stdout);
+        tr_decision(TRF_TRAIN, 0, (uint16_t)normal_ui_index_shifted(*cur), "NO GREEN");
+        train_preempt_to_allred = 1;
+        *cur = (*cur == N_R3_RS_G || *cur == N_R3_L_G) ? N_ALL_RED_1 : N_ALL_RED_2;
+        return;
+    }
+
     ped_try_start_at_safe_allred(st->is_safe_allred);
+    det_sync();
+
+    /* actuated green: runs min_s, then extends per call until a gap of
+     * ext_s or max_s (once detectors report; fixed dur_s before that) */
+    int coord = (coord_cycle_s && *cur == N_R3_RS_G);
+    int act = (actuated && st->max_s && !coord_cycle_s);
+    unsigned resume_ms = snap_take_resume();
+    unsigned total_ms = coord ? coord_green_ms() : resume_ms ? resume_ms : (act ? st->max_s : st->dur_s) * 1000U;
+    unsigned dur_s = (total_ms + 500U) / 1000U;
+    uint64_t deadline = coord ? realtime_ms() + total_ms : 0;
+    unsigned calls = 0, occ_ms = 0, gap_ms = 0, elapsed_ms = 0;
+    if (act) {                       /* waiting calls are served by this green */
+        phase_take_calls(st);
+        phase_take_occ(st);
+    }
 
-    print_normal_line(*cur, st);
+    print_normal_line(*cur, st, dur_s);
+    snap_enter(0, (int)*cur, total_ms);
 
-    /* wait in 100ms ticks so QNET polling stays responsive */
-    unsigned total_ms = st->dur_s * 1000U;
+    /* wait in 100ms ticks so QNET polling stays responsive; a coordinated
+     * green runs to its deadline on the shared clock */
     const long step_ns = 100L * 1000L * 1000L;
-    unsigned steps = total_ms / 100U;
-    unsigned rem   = total_ms % 100U;
+    unsigned steps = coord ? total_ms / 100U + 2U : total_ms / 100U;
+    unsigned rem   = coord ? 0U : total_ms % 100U;
     struct timespec ts = { .tv_sec = 0, .tv_nsec = step_ns };
 
     for (unsigned i = 0; i < steps; i++) {
+        if (coord) {
+            uint64_t now = realtime_ms();
+            if (now >= deadline) break;
+            ts.tv_nsec = (deadline - now < 100U) ? (long)(deadline - now) * 1000L * 1000L : step_ns;
+        }
         nanosleep(&ts, NULL);
         poll_events_from_qnet_nonblock();
 
+        if (is_normal_green(*cur) && !approach_allows_ms(0)) approach_fire();
         if (train_request && is_normal_green(*cur)) {
+            tr_decision(TRF_TRAIN, 0, 0, "PREEMPT Y");
             train_preempt_to_allred = 1;
             *cur = st->to_yellow;
             return;
         }
+
+        if (act) {
+            det_sync();
+            unsigned n = phase_take_calls(st);
+            unsigned o = phase_take_occ(st);
+            calls += n;
+            occ_ms += o;
+            elapsed_ms += 100U;
+            gap_ms = (n || o) ? 0 : gap_ms + 100U;
+            if (elapsed_ms >= st->min_s * 1000U && gap_ms >= st->ext_s * 1000U) break;
+        }
     }
     if (rem) {
         struct timespec ts2 = { .tv_sec = 0, .tv_nsec = (long)rem * 1000L * 1000L };
         nanosleep(&ts2, NULL);
         poll_events_from_qnet_nonblock();
 
+        if (is_normal_green(*cur) && !approach_allows_ms(0)) approach_fire();
         if (train_request && is_normal_green(*cur)) {
+            tr_decision(TRF_TRAIN, 0, 0, "PREEMPT Y");
             train_preempt_to_allred = 1;
             *cur = st->to_yellow;
             return;
         }
     }
+    if (act) {
+        unsigned span = elapsed_ms * phase_lane_count(st);
+        unsigned occ_pct = span ? (unsigned)((occ_ms * 100ULL) / span) : 0;
+        printf("  [ACT] %s after %u.%us (%u calls, occ %u%%)\n",
+               (elapsed_ms < total_ms) ? "gap-out" : "max-out",
+               elapsed_ms / 1000U, (elapsed_ms % 1000U) / 100U, calls,
+               occ_pct > 100 ? 100 : occ_pct);
+        fflush(stdout);
+        tr_decision(-1, 0, (uint16_t)(elapsed_ms / 100U), (elapsed_ms < total_ms) ? "GAP-OUT" : "MAX-OUT");
+    }
 
     if (st->is_prep_y) {
         ped_stop_if_prep_finished();
@@ -480,6 +1566,11 @@ static void normal_step(normal_state_t *cur)
     if (st->is_safe_allred) {
         train_preempt_to_allred = 0;
 
+        /* last SAFE all-red before the ETA if PRE-Y + the next minimum green won't fit */
+        const normal_def_t *pp = find_norm(st->next);
+        const normal_def_t *gg = pp ? find_norm(pp->next) : NULL;
+        if (pp && gg && !approach_allows_ms((pp->dur_s + gg->min_s) * 1000U)) approach_fire();
+
         if (train_request) {
             train_request = 0;
             train_active  = 1;
@@ -488,10 +1579,22 @@ static void normal_step(normal_state_t *cur)
             in_train_state = 1;
             tr = TR_S01_PREP_R3; /* TRAIN S01 = PRE-Y (NOT ALL-RED) */
             notify_train_begin();
+            approach_train_begin();
             return;
         }
     }
 
+    /* skip an uncalled left turn (and its yellow) */
+    det_sync();
+    const normal_def_t *nx = find_norm(st->next);
+    if (actuated && nx && nx->skip_uncalled && !phase_called(nx)) {
+        printf("  [ACT] NORMAL S%02d skipped (no call)\n", normal_ui_index_shifted(nx->id));
+        fflush(stdout);
+        tr_decision(-1, 0, (uint16_t)normal_ui_index_shifted(nx->id), "SKIP");
+        *cur = find_norm(nx->to_yellow)->next;
+        return;
+    }
+
     *cur = st->next;
 }
 
@@ -519,10 +1622,106 @@ static void train_run_until_exit(normal_state_t *normal_state_after)
     }
 }
 
+/* =========================================================
+   WARM RESTART: safe-entry rule
+   The snapshot is used only if it is whole (magic, version, size, seq
+   even), every field is in range and it was written at most
+   SNAP_MAX_GAP_MS ago on the monotonic clock of the same boot, i.e. the
+   heads still show the saved phase. Then the phase resumes with the time
+   it had left on that clock (at least one tick, never more than its full
+   length), so no green restarts from zero and no yellow or all-red is
+   cut short, whatever the wall clock did meanwhile. A valid but stale snapshot keeps the
+   pending train / ped requests and approaches and starts at SAFE
+   ALL-RED; anything else is a cold start.
+   ========================================================= */
+static int snap_restore(normal_state_t *ns)
+{
+    int fd = open(SNAP_PATH, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) { perror("open(" SNAP_PATH ")"); return 0; }
+    if (ftruncate(fd, sizeof(snap_t)) == -1) { perror("ftruncate(snap)"); close(fd); return 0; }
+    void *p = mmap(NULL, sizeof(snap_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { perror("mmap(snap)"); return 0; }
+
+    snap_t c;
+    snap_read((const volatile snap_t *)p, &c);
+    snap = (volatile snap_t *)p;
+    snap_resume_ms = 0;
+
+    int ok = c.magic == SNAP_MAGIC && c.version == SNAP_VERSION && c.size == sizeof(snap_t) &&
+             !(c.seq & 1U) && c.in_train <= 1 && c.train_request <= 1 && c.train_active <= 1 &&
+             c.train_clear_pending <= 1 && c.ped_request <= 1 && c.ped_window_active <= 1 &&
+             c.ped_window_stop_after_prep <= 1 && c.train_preempt_to_allred <= 1 && c.actuated <= 1;
+    const normal_def_t *st = NULL;
+    if (ok && c.in_train) ok = (c.state >= TR_S01_PREP_R3 && c.state <= TR_S08_ALL_RED_B);
+    if (ok && !c.in_train) ok = ((st = find_norm((normal_state_t)c.state)) != NULL);
+
+    uint32_t seq = c.seq;
+    memset((void *)snap, 0, sizeof(snap_t));
+    snap->magic = SNAP_MAGIC;
+    snap->version = SNAP_VERSION;
+    snap->size = sizeof(snap_t);
+    snap->seq = seq & ~1U;
+    snap->owner = snap_owner = (int32_t)getpid();
+    if (!ok) return 0;
+
+    /* approaches: monotonic deadlines, drop any from before a reboot */
+    uint64_t mono = monotonic_ms();
+    for (int i = 0; i < APPR_MAX; i++) {
+        appr[i] = c.appr[i];
+        if (appr[i].active && appr[i].due_ms > mono + 0xFFFFULL * 1000ULL) appr[i].active = 0;
+    }
+    ped_request = c.ped_request;
+    actuated = c.actuated;
+    memcpy(seq_tab, c.seqs, sizeof(seq_tab));      /* retries across a restart stay deduplicated */
+
+    /* another boot (or a clock step beyond the gap) shows as a moved boot_ms */
+    int64_t boot = (int64_t)(realtime_ms() - mono);
+    int64_t drift = boot > c.boot_ms ? boot - c.boot_ms : c.boot_ms - boot;
+    if (mono < c.alive_ms || mono - c.alive_ms > SNAP_MAX_GAP_MS || drift > (int64_t)SNAP_MAX_GAP_MS) {
+        train_active  = c.train_active && !c.train_clear_pending;
+        train_request = train_active;
+        printf("[SNAP] stale snapshot, start at SAFE ALL-RED%s%s\n",
+               train_request ? " (train pending)" : "", ped_request ? " (ped pending)" : "");
+        fflush(stdout);
+        return 0;
+    }
+
+    train_request = c.train_request;
+    train_active = c.train_active;
+    train_clear_pending = c.train_clear_pending;
+    ped_window_active = c.ped_window_active;
+    ped_window_stop_after_prep = c.ped_window_stop_after_prep;
+    train_preempt_to_allred = c.train_preempt_to_allred;
+    normal_ui_base = c.ui_base;
+    in_train_state = c.in_train;
+
+    unsigned full_ms;
+    if (c.in_train) {
+        tr = (train_state_t)c.state;
+        full_ms = train_duration(tr) * 1000U;
+    } else {
+        *ns = (normal_state_t)c.state;
+        full_ms = (st->max_s > st->dur_s ? st->max_s : st->dur_s) * 1000U;
+    }
+    uint64_t left = c.deadline_ms > mono ? c.deadline_ms - mono : 0;
+    if (left > full_ms) left = full_ms;
+    if (left < 100U) left = 100U;
+    snap_resume_ms = (unsigned)left;
+
+    printf("[SNAP] warm restart: %s S%02d, %u.%us left\n",
+           c.in_train ? "TRAIN " : "NORMAL",
+           c.in_train ? (int)tr + 1 : normal_ui_index_shifted(*ns),
+           snap_resume_ms / 1000U, (snap_resume_ms % 1000U) / 100U);
+    fflush(stdout);
+    return 1;
+}
+
 /* ================= QNET SETUP ================= */
 static void qnet_setup_server(void)
 {
-    g_attach = name_attach(NULL, ATTACH_POINT, 0);
+    /* a standby may race a primary that is still going down */
+    for (int i = 0; i < 100 && !(g_attach = name_attach(NULL, ATTACH_POINT, 0)); i++) usleep(10000);
     if (!g_attach) {
         perror("name_attach");
         exit(EXIT_FAILURE);
@@ -533,19 +1732,159 @@ static void qnet_setup_server(void)
     fflush(stdout);
 }
 
+/* =========================================================
+   HOT STANDBY  ("-b")
+   A second instance on the same node mirrors the primary through the
+   snapshot region (seqlock reads) and watches its heartbeat, alive_ms,
+   which the primary refreshes on every 100ms poll. Both run on the same
+   node, so the heartbeat and every HA deadline are CLOCK_MONOTONIC: an
+   NTP or operator clock step neither fakes a miss nor hides one. When
+   the primary's pid is gone or the heartbeat is more than HA_MISS_MS
+   old, the standby claims the region and adopts the state through the
+   warm-restart rule: mid-phase if the snapshot is whole, else SAFE
+   ALL-RED. Then it attaches the QNET name. Claiming the region also fences a primary that was only
+   stalled, because its next write makes it exit.
+   "-k ms" kills the primary ms after start-up (fault injection); "-t n"
+   runs n crash / take-over rounds and reports the failover time, last
+   heartbeat -> state adopted and name attached.
+   ========================================================= */
+#define HA_MISS_MS  150U
+#define HA_POLL_MS  10U
+
+static const volatile snap_t *ha_map(void)
+{
+    int fd = open(SNAP_PATH, O_RDONLY);
+    if (fd == -1) return NULL;
+    void *p = mmap(NULL, sizeof(snap_t), PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    return (p == MAP_FAILED) ? NULL : (const volatile snap_t *)p;
+}
+
+/* block until the primary (expect, or any if 0) is gone; returns its last heartbeat */
+static uint64_t ha_standby_wait(pid_t expect)
+{
+    const volatile snap_t *p = NULL;
+    const struct timespec ts = { .tv_sec = 0, .tv_nsec = HA_POLL_MS * 1000L * 1000L };
+    uint64_t since = monotonic_ms();
+
+    if (!expect) {
+        printf("[HA] standby: watching %s (take over after %ums without heartbeat)\n", SNAP_PATH, HA_MISS_MS);
+        fflush(stdout);
+    }
+    for (;;) {
+        if (!p) p = ha_map();
+
+        snap_t c;
+        uint64_t now = monotonic_ms();
+        int mine = p && snap_read(p, &c) && c.magic == SNAP_MAGIC && c.owner > 0 &&
+                   c.owner != (int32_t)getpid() && (!expect || c.owner == (int32_t)expect);
+        if (mine) {
+            if (expect) waitpid(expect, NULL, WNOHANG);     /* our own child: reap it */
+            int gone = (kill((pid_t)c.owner, 0) == -1 && errno == ESRCH);
+            if (gone || (now > c.alive_ms && now - c.alive_ms > HA_MISS_MS)) {
+                munmap((void *)p, sizeof(snap_t));
+                if (!expect) {
+                    printf("[HA] primary pid %d %s, taking over\n", (int)c.owner, gone ? "gone" : "missed its heartbeat");
+                    fflush(stdout);
+                }
+                return c.alive_ms;
+            }
+        } else if (!expect && now - since > HA_MISS_MS) {
+            if (p) munmap((void *)p, sizeof(snap_t));
+            printf("[HA] no primary running, taking over\n");
+            fflush(stdout);
+            return now;
+        }
+        nanosleep(&ts, NULL);
+    }
+}
+
+/* "-t n": returns only in the forked primaries */
+static void ha_selftest(unsigned rounds)
+{
+    unsigned lo = ~0U, hi = 0, sum = 0;
+    srand((unsigned)getpid());
+
+    for (unsigned r = 0; r < rounds; r++) {
+        unsigned kill_ms = 1500U + (unsigned)(rand() % 3000);
+        pid_t pid = fork();
+        if (pid == -1) { perror("fork"); exit(EXIT_FAILURE); }
+        if (pid == 0) {
+            ha_kill_at = monotonic_ms() + kill_ms;
+            return;
+        }
+
+        uint64_t beat = ha_standby_wait(pid);
+        normal_state_t ns = N_ALL_RED_1;
+        snap_restore(&ns);
+        qnet_setup_server();
+        unsigned ms = (unsigned)(monotonic_ms() - beat);
+
+        printf("[HA] round %u: primary killed after %ums, failover %ums\n", r + 1, kill_ms, ms);
+        fflush(stdout);
+        if (ms < lo) lo = ms;
+        if (ms > hi) hi = ms;
+        sum += ms;
+
+        /* hand the state on to the next primary */
+        snap_in_train = in_train_state;
+        snap_state = in_train_state ? (int)tr : (int)ns;
+        snap_deadline = monotonic_ms() + snap_resume_ms;
+        snap_save();
+        name_detach(g_attach, 0);
+        g_attach = NULL;
+        munmap((void *)snap, sizeof(snap_t));
+        snap = NULL;
+    }
+    printf("\n[HA] %u failovers: min %ums avg %ums max %ums (heartbeat miss %ums)\n",
+           rounds, lo, rounds ? sum / rounds : 0, hi, HA_MISS_MS);
+    fflush(stdout);
+    exit(EXIT_SUCCESS);
+}
+
 /* ================= MAIN ================= */
-int main(void)
+int main(int argc, char **argv)
 {
+    int c;
+    unsigned cycle_s = 0, offset_s = 0, kill_ms = 0, test_rounds = 0;
+    int standby = 0;
+    const char *trace_path = NULL;
+    while ((c = getopt(argc, argv, "c:o:bk:t:R:")) != -1) {
+        switch (c) {
+        case 'c': cycle_s  = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'o': offset_s = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'b': standby  = 1; break;
+        case 'k': kill_ms  = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 't': test_rounds = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'R': trace_path = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-c cycle_s -o offset_s] [-b] [-k ms] [-t rounds] [-R trace]\n", argv[0]);
+            return 2;
+        }
+    }
+
     printf("Local Control 1 (VM6, QNET INPUT) - Local2 structure\n");
     printf("Attach point: %s\n", ATTACH_POINT);
-    printf("Events from VM7: t=train, c=clear, p=ped\n\n");
+    printf("Events from VM7: t=train, c=clear, p=ped, v<lane>=vehicle call\n\n");
     fflush(stdout);
 
-    qnet_setup_server();
+    build_interlock();
+    if (cycle_s && coord_setup(cycle_s, offset_s) != 0) return 1;
+    if (test_rounds) ha_selftest(test_rounds);
+    uint64_t beat = standby ? ha_standby_wait(0) : 0;
 
     /* NORMAL S01 must be ALL-RED */
     normal_state_t ns = N_ALL_RED_1;
     normal_ui_set_start(N_ALL_RED_1);
+    snap_restore(&ns);
+    qnet_setup_server();
+    if (standby) {
+        printf("[HA] took over %ums after the primary's last heartbeat\n\n", (unsigned)(monotonic_ms() - beat));
+        fflush(stdout);
+    }
+    if (kill_ms) ha_kill_at = monotonic_ms() + kill_ms;
+    if (trace_path) tr_open(trace_path);
+    det_attach();
 
     while (1) {
         if (!in_train_state) normal_step(&ns);
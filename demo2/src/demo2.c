@@ -14,6 +14,9 @@
  * - Flushes extra chars until newline
  * - Cleaner retry logic + clearer errors
  * - Ignores unknown keys silently (or with message)
+ * - Priority classes (t > c > p) so a ped burst never delays a train
+ * - Ped presses coalesce while one is still queued and never take the
+ *   MQ_RESERVED_SLOTS kept for train events (overflow stats on 'q')
  */
 
 #include <stdio.h>
@@ -22,6 +25,7 @@
 #include <fcntl.h>
 #include <errno.h>
 #include <string.h>
+#include <time.h>
 
 #define QUEUE_NAME "/traffic_mq"
 #define MSG_SIZE   2
@@ -30,13 +34,47 @@
 #define EVT_TRAIN_CLEAR   'c'
 #define EVT_PED_PRESS     'p'
 
+/* MUST match traffic_fsm.c / traffic2.c */
+#define PRIO_TRAIN        3
+#define PRIO_CLEAR        2
+#define PRIO_PED          1
+#define MQ_RESERVED_SLOTS  4
+
+/* server drains the whole queue every 100ms poll */
+#define PED_COALESCE_MS  100
+
+/* train/clear retry while the reserved slots are momentarily full */
+#define SEND_RETRY_MS     10
+#define SEND_RETRIES     100
+
+/* overflow statistics */
+static unsigned long sent_count[PRIO_TRAIN + 1];
+static unsigned long ped_coalesced = 0;
+static unsigned long ped_dropped   = 0;
+static unsigned long send_retries  = 0;
+static long last_ped_ms = -PED_COALESCE_MS;
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
+static unsigned evt_prio(char ev)
+{
+    if (ev == EVT_TRAIN_DETECT) return PRIO_TRAIN;
+    if (ev == EVT_TRAIN_CLEAR)  return PRIO_CLEAR;
+    return PRIO_PED;
+}
+
 static mqd_t open_queue_writer_blocking(void)
 {
     mqd_t mq;
 
     /* Wait until traffic FSM creates the queue */
     for (;;) {
-        mq = mq_open(QUEUE_NAME, O_WRONLY);
+        mq = mq_open(QUEUE_NAME, O_WRONLY | O_NONBLOCK);
         if (mq != (mqd_t)-1) return mq;
 
         /* Expected until server starts */
@@ -52,19 +90,63 @@ static void flush_line(void)
     while ((ch = getchar()) != '\n' && ch != EOF) { /* discard */ }
 }
 
+/* returns 1 if a ped press should not take a queue slot */
+static int ped_admission_refused(mqd_t mq)
+{
+    struct mq_attr attr;
+    if (mq_getattr(mq, &attr) == -1) return 0;
+
+    /* previous press still queued -> coalesce */
+    if (attr.mq_curmsgs > 0 && now_ms() - last_ped_ms < PED_COALESCE_MS) {
+        ped_coalesced++;
+        return 1;
+    }
+
+    /* keep reserved slots for train events */
+    if (attr.mq_curmsgs >= attr.mq_maxmsg - MQ_RESERVED_SLOTS) {
+        ped_dropped++;
+        fprintf(stderr, "[keyboard] queue nearly full, ped dropped (total %lu)\n", ped_dropped);
+        return 1;
+    }
+    return 0;
+}
+
 static int send_event(mqd_t mq, char ev)
 {
     char msg[MSG_SIZE];
+    unsigned prio = evt_prio(ev);
     msg[0] = ev;
     msg[1] = '\0';
 
-    if (mq_send(mq, msg, MSG_SIZE, 0) == -1) {
+    if (ev == EVT_PED_PRESS) {
+        if (ped_admission_refused(mq)) return 1;
+        last_ped_ms = now_ms();
+    }
+
+    for (int attempt = 0; ; attempt++) {
+        if (mq_send(mq, msg, MSG_SIZE, prio) == 0) break;
+
+        /* ped never waits; train/clear retry until the server drains */
+        if (errno == EAGAIN && ev != EVT_PED_PRESS && attempt < SEND_RETRIES) {
+            send_retries++;
+            usleep(SEND_RETRY_MS * 1000);
+            continue;
+        }
         fprintf(stderr, "[keyboard] mq_send failed: %s\n", strerror(errno));
         return -1;
     }
+    sent_count[prio]++;
     return 0;
 }
 
+static void print_send_stats(void)
+{
+    printf("[keyboard] sent t=%lu c=%lu p=%lu | ped coalesced=%lu dropped=%lu | retries=%lu\n",
+           sent_count[PRIO_TRAIN], sent_count[PRIO_CLEAR], sent_count[PRIO_PED],
+           ped_coalesced, ped_dropped, send_retries);
+    fflush(stdout);
+}
+
 int main(void)
 {
     mqd_t mq = open_queue_writer_blocking();
@@ -98,13 +180,18 @@ int main(void)
             continue;
         }
 
-        if (send_event(mq, ev) == 0) {
+        int rc = send_event(mq, ev);
+        if (rc == 0) {
             printf("[keyboard] sent '%c'\n", ev);
             fflush(stdout);
+        } else if (rc == 1) {
+            printf("[keyboard] '%c' not queued (coalesced)\n", ev);
+            fflush(stdout);
         }
     }
 
     mq_close(mq);
+    print_send_stats();
     printf("[keyboard] exit\n");
     fflush(stdout);
     return 0;
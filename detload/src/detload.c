@@ -0,0 +1,387 @@
+/*
+ * detload - detector load generator for the shared-memory ingest path
+ *
+ * Runs next to demo1 (VM6) or demo3 (VM8) and plays loop detectors: each
+ * producer thread draws vehicles on random lanes with a random dwell time
+ * and keeps them in thread-local per-lane counters. A batch is flushed
+ * into /traffic_det with one relaxed atomic add per touched lane, either
+ * when it holds -b events or at the end of each 1ms pacing slice.
+ *
+ * Once a second the main thread prints the rate it sees in the region,
+ * and it times a full read of every lane the way the controller does at
+ * a decision point (every 100ms) - that read is all the FSM ever pays, so
+ * the controller's phase timing does not depend on the event rate.
+ *
+ * With -q <path> the same calls go to the controller over QNET instead
+ * (e.g. -q /net/vm6/dev/name/local/traffic_evt): -b events per MsgSend,
+ * as one evt_batch_msg_t, or plain evt_msg_t per event with -b 1. The
+ * rate printed is then what the server acknowledged.
+ *
+ * Usage: detload [-r events/s] [-t seconds] [-j threads] [-b batch] [-q path]
+ *        -r 0 runs flat out (default 200000), -t 0 runs until Ctrl-C
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/dispatch.h>
+#include <sys/neutrino.h>
+
+/* ================= DETECTOR REGION (MUST match demo1, demo3) ================= */
+#define DET_SHM_NAME  "/traffic_det"
+#define DET_MAGIC     0x44455431u   /* "DET1" */
+#define DET_LANES     8
+
+typedef struct {
+    uint32_t magic;
+    uint32_t lanes;
+    _Atomic uint64_t calls[DET_LANES];    /* vehicles detected */
+    _Atomic uint64_t occ_ms[DET_LANES];   /* loop occupied time */
+    _Atomic uint64_t batches;             /* producer flushes */
+} det_shm_t;
+
+/* ================= QNET EVENTS (MUST match demo1, demo3) ================= */
+#define EVT_VEH_CALL    'v'
+#define MSG_EVT_BATCH   0x24
+#define EVT_BATCH_MAX   64
+
+typedef struct {
+    _Uint16t type;
+    _Uint16t subtype;
+    char     ev;
+    char     pad[3];
+    int      client_id;
+    uint32_t epoch;
+    uint32_t seq;       /* 0: not sequenced, load is sent once */
+} evt_msg_t;
+
+typedef struct {
+    _Uint16t type;
+    _Uint16t subtype;
+    char     text[64];
+    uint32_t last_seq;
+} evt_reply_t;
+
+typedef struct {
+    uint32_t t_ms;
+    char     ev;
+    uint8_t  lane;
+    _Uint16t pad;
+} evt_item_t;
+
+typedef struct {
+    _Uint16t   type;
+    _Uint16t   count;
+    char       pad[4];
+    int        client_id;
+    uint32_t   epoch;
+    uint32_t   seq;
+    evt_item_t items[EVT_BATCH_MAX];
+} evt_batch_msg_t;
+
+#define QNET_CLIENT_ID  900
+
+/* controllers use 6 lanes (R3 RS/L, side road W->E RS/L, E->W RS/L) */
+#define LOAD_LANES    6
+
+#define OCC_MIN_MS    120     /* dwell of one vehicle on the loop */
+#define OCC_SPAN_MS   380
+#define SLICE_NS      1000000L
+
+static det_shm_t *g_det = NULL;
+static volatile sig_atomic_t g_stop = 0;
+
+static unsigned long g_rate  = 200000;   /* events/s over all threads, 0 = max */
+static unsigned      g_secs  = 10;
+static unsigned      g_jobs  = 4;
+static unsigned      g_batch = 256;
+static const char   *g_qnet  = NULL;     /* -q: server path, NULL = region */
+static int           g_coid  = -1;
+static _Atomic uint64_t g_acked = 0;     /* -q: events the server applied */
+static _Atomic uint64_t g_sends = 0;     /* -q: MsgSend round trips */
+
+static void on_sigint(int sig) { (void)sig; g_stop = 1; }
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+static int det_open(void)
+{
+    int fd = shm_open(DET_SHM_NAME, O_RDWR | O_CREAT, 0666);
+    if (fd == -1) { perror("shm_open(" DET_SHM_NAME ")"); return -1; }
+    if (ftruncate(fd, sizeof(det_shm_t)) == -1) {
+        perror("ftruncate(" DET_SHM_NAME ")");
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, sizeof(det_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { perror("mmap(" DET_SHM_NAME ")"); return -1; }
+
+    g_det = (det_shm_t *)p;
+    if (g_det->magic != DET_MAGIC) {      /* started before the controller */
+        g_det->lanes = LOAD_LANES;
+        g_det->magic = DET_MAGIC;
+    }
+    return 0;
+}
+
+/* ================= PRODUCERS ================= */
+typedef struct {
+    unsigned id;
+    unsigned long rate;        /* this thread's share, 0 = max */
+    uint32_t rng;
+    uint64_t calls[LOAD_LANES];
+    uint64_t occ[LOAD_LANES];
+    evt_batch_msg_t msg;       /* -q: events of the pending batch */
+    unsigned pending;
+    uint64_t sent, flushes;
+} producer_t;
+
+static uint32_t xorshift32(uint32_t *s)
+{
+    uint32_t x = *s;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return *s = x;
+}
+
+/* -q: one round trip for the pending events */
+static void qnet_flush(producer_t *p)
+{
+    evt_reply_t rep;
+    int rc;
+    memset(&rep, 0, sizeof(rep));
+    if (p->pending == 1) {
+        evt_msg_t m;
+        memset(&m, 0, sizeof(m));
+        m.type = 0x22;
+        m.ev = EVT_VEH_CALL;
+        m.pad[0] = (char)p->msg.items[0].lane;
+        m.client_id = QNET_CLIENT_ID + (int)p->id;
+        rc = MsgSend(g_coid, &m, sizeof(m), &rep, sizeof(rep));
+    } else {
+        p->msg.type = MSG_EVT_BATCH;
+        p->msg.count = (_Uint16t)p->pending;
+        p->msg.client_id = QNET_CLIENT_ID + (int)p->id;
+        rc = MsgSend(g_coid, &p->msg,
+                     (int)(offsetof(evt_batch_msg_t, items) + p->pending * sizeof(evt_item_t)),
+                     &rep, sizeof(rep));
+    }
+    if (rc == -1) {
+        perror("MsgSend");
+        g_stop = 1;
+        return;
+    }
+    /* "OK: v3" = 1, "OK: batch n/m" = n */
+    unsigned n = 0;
+    if (sscanf(rep.text, "OK: batch %u", &n) != 1) n = (strncmp(rep.text, "OK", 2) == 0);
+    atomic_fetch_add_explicit(&g_acked, n, memory_order_relaxed);
+    atomic_fetch_add_explicit(&g_sends, 1, memory_order_relaxed);
+}
+
+static void flush_batch(producer_t *p)
+{
+    if (!p->pending) return;
+    if (g_qnet) {
+        qnet_flush(p);
+        p->sent += p->pending;
+        p->pending = 0;
+        p->flushes++;
+        return;
+    }
+    for (int l = 0; l < LOAD_LANES; l++) {
+        if (!p->calls[l]) continue;
+        atomic_fetch_add_explicit(&g_det->calls[l], p->calls[l], memory_order_relaxed);
+        atomic_fetch_add_explicit(&g_det->occ_ms[l], p->occ[l], memory_order_relaxed);
+        p->calls[l] = 0;
+        p->occ[l] = 0;
+    }
+    atomic_fetch_add_explicit(&g_det->batches, 1, memory_order_relaxed);
+    p->sent += p->pending;
+    p->pending = 0;
+    p->flushes++;
+}
+
+static void gen_events(producer_t *p, uint64_t n)
+{
+    while (n--) {
+        uint32_t r = xorshift32(&p->rng);
+        unsigned l = r % LOAD_LANES;
+        if (g_qnet) {
+            evt_item_t *it = &p->msg.items[p->pending];
+            it->t_ms = (uint32_t)(now_ns() / 1000000ULL);
+            it->ev = EVT_VEH_CALL;
+            it->lane = (uint8_t)l;
+            if (++p->pending >= g_batch) flush_batch(p);
+            continue;
+        }
+        p->calls[l]++;
+        p->occ[l] += OCC_MIN_MS + (r >> 8) % OCC_SPAN_MS;
+        if (++p->pending >= g_batch) flush_batch(p);
+    }
+}
+
+static void *producer_thread(void *arg)
+{
+    producer_t *p = (producer_t *)arg;
+    uint64_t t0 = now_ns(), owed_done = 0;
+    struct timespec next;
+    clock_gettime(CLOCK_MONOTONIC, &next);
+
+    while (!g_stop) {
+        if (!p->rate) {
+            gen_events(p, g_batch);
+            continue;
+        }
+
+        /* pace in 1ms slices: catch up to rate * elapsed, flush, sleep */
+        uint64_t due = (uint64_t)((double)p->rate * (double)(now_ns() - t0) / 1e9);
+        if (due > owed_done) {
+            gen_events(p, due - owed_done);
+            owed_done = due;
+        }
+        flush_batch(p);
+
+        next.tv_nsec += SLICE_NS;
+        if (next.tv_nsec >= 1000000000L) { next.tv_nsec -= 1000000000L; next.tv_sec++; }
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &next, NULL);
+    }
+    flush_batch(p);
+    return NULL;
+}
+
+/* ================= MONITOR ================= */
+static uint64_t det_total_calls(void)
+{
+    if (g_qnet) return atomic_load(&g_acked);
+    uint64_t sum = 0;
+    for (int l = 0; l < LOAD_LANES; l++) {
+        sum += atomic_load_explicit(&g_det->calls[l], memory_order_relaxed);
+    }
+    return sum;
+}
+
+/* same work as the controller's det_sync(): one load per counter */
+static uint64_t timed_decision_read(void)
+{
+    if (g_qnet) return 0;
+    uint64_t t = now_ns(), sink = 0;
+    for (int l = 0; l < LOAD_LANES; l++) {
+        sink += atomic_load_explicit(&g_det->calls[l], memory_order_relaxed);
+        sink += atomic_load_explicit(&g_det->occ_ms[l], memory_order_relaxed);
+    }
+    (void)sink;
+    return now_ns() - t;
+}
+
+static void usage(const char *me)
+{
+    fprintf(stderr, "usage: %s [-r events/s (0=max)] [-t seconds (0=forever)] [-j threads] [-b batch]\n"
+                    "       [-q server path: send over QNET, batch <= %d]\n", me, EVT_BATCH_MAX);
+}
+
+int main(int argc, char **argv)
+{
+    int c;
+    while ((c = getopt(argc, argv, "r:t:j:b:q:")) != -1) {
+        switch (c) {
+        case 'r': g_rate  = strtoul(optarg, NULL, 10); break;
+        case 't': g_secs  = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'j': g_jobs  = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'b': g_batch = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'q': g_qnet  = optarg; break;
+        default:  usage(argv[0]); return 2;
+        }
+    }
+    if (g_jobs < 1 || g_jobs > 64 || g_batch < 1) { usage(argv[0]); return 2; }
+    if (g_qnet && g_batch > EVT_BATCH_MAX) g_batch = EVT_BATCH_MAX;
+
+    if (g_qnet) {
+        g_coid = name_open(g_qnet, 0);
+        if (g_coid == -1) { fprintf(stderr, "name_open(%s): %s\n", g_qnet, strerror(errno)); return 1; }
+    } else if (det_open() != 0) return 1;
+    signal(SIGINT, on_sigint);
+
+    producer_t *prod = calloc(g_jobs, sizeof(*prod));
+    pthread_t *tid = calloc(g_jobs, sizeof(*tid));
+    if (!prod || !tid) { perror("calloc"); return 1; }
+
+    char target[32];
+    if (g_rate) snprintf(target, sizeof(target), "%lu events/s", g_rate);
+    else        snprintf(target, sizeof(target), "max");
+    printf("[detload] %s: %u threads, batch %u, target %s\n", g_qnet ? g_qnet : DET_SHM_NAME,
+           g_jobs, g_batch, target);
+    fflush(stdout);
+
+    uint64_t start = now_ns(), last_t = start;
+    uint64_t base = det_total_calls(), last_calls = base;
+    uint64_t last_batches = g_qnet ? atomic_load(&g_sends) : atomic_load(&g_det->batches);
+    uint64_t read_max = 0;
+    unsigned sec = 0;
+
+    for (unsigned i = 0; i < g_jobs; i++) {
+        prod[i].id = i;
+        prod[i].rate = g_rate / g_jobs + (i < g_rate % g_jobs ? 1 : 0);
+        prod[i].rng = 0x9E3779B9u * (i + 1);
+        if (pthread_create(&tid[i], NULL, producer_thread, &prod[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    while (!g_stop && (!g_secs || sec < g_secs)) {
+        for (int k = 0; k < 10 && !g_stop; k++) {       /* 100ms = FSM tick */
+            struct timespec ts = { 0, 100L * 1000L * 1000L };
+            nanosleep(&ts, NULL);
+            uint64_t r = timed_decision_read();
+            if (r > read_max) read_max = r;
+        }
+        sec++;
+
+        uint64_t t = now_ns();
+        uint64_t calls = det_total_calls();
+        uint64_t batches = g_qnet ? atomic_load(&g_sends) : atomic_load(&g_det->batches);
+        double dt = (double)(t - last_t) / 1e9;
+        printf("[detload] t=%3us  %9.0f events/s  %7.0f batches/s  decision read max %llu ns\n",
+               sec, (double)(calls - last_calls) / dt, (double)(batches - last_batches) / dt,
+               (unsigned long long)read_max);
+        fflush(stdout);
+        last_t = t;
+        last_calls = calls;
+        last_batches = batches;
+    }
+
+    g_stop = 1;
+    uint64_t sent = 0, flushes = 0;
+    for (unsigned i = 0; i < g_jobs; i++) {
+        pthread_join(tid[i], NULL);
+        sent += prod[i].sent;
+        flushes += prod[i].flushes;
+    }
+
+    double secs = (double)(now_ns() - start) / 1e9;
+    uint64_t seen = det_total_calls() - base;
+    printf("[detload] done: %llu events in %.2fs = %.0f events/s, %llu batches (avg %.1f events), %s saw %llu%s\n",
+           (unsigned long long)sent, secs, (double)sent / secs, (unsigned long long)flushes,
+           flushes ? (double)sent / (double)flushes : 0.0, g_qnet ? "server" : "region", (unsigned long long)seen,
+           (seen >= sent) ? "" : "  !!! LOST EVENTS");
+
+    if (g_qnet) name_close(g_coid);
+    free(prod);
+    free(tid);
+    return 0;
+}
@@ -0,0 +1,304 @@
+/*
+ * evtbus - local publish/subscribe event broker (one per node)
+ *
+ * Senders publish to ONE place, the broker on their node:
+ *     /dev/name/local/traffic_bus   (bus_pub_t, up to BUS_PUB_MAX records)
+ * and never need to know who consumes an event. Every record carries its
+ * topic: intersection (0 = all), road ('3','1','2', 0 = any) and event
+ * class (train, ped, vehicle, approach).
+ *
+ * FAN-OUT
+ * - The broker appends each record once to a ring in shared memory,
+ *   /traffic_bus (BUS_SLOTS records, single writer = this process).
+ * - Subscribers (demo1, demo3, ...) map the ring read-only, keep their own
+ *   cursor and keep only the topics they want. Publishing costs one slot
+ *   write whatever the number of subscribers; a subscriber that falls more
+ *   than BUS_SLOTS behind sees the overrun and skips ahead.
+ *
+ * OTHER NODES
+ * - "-p <path>" adds a peer broker, e.g. -p /net/vm6/dev/name/local/traffic_bus.
+ *   A forwarder thread per peer is just another ring subscriber: it sends
+ *   the records published on THIS node (hop 0) to the peer as hop 1, so
+ *   nothing is forwarded twice. Adding an intersection = start its
+ *   controller (subscribing by its id) and, if it is on a new node, list
+ *   that node's broker here. No sender changes.
+ *
+ * Records keep the publisher's client_id/epoch/seq, so a forwarder retry
+ * or a publisher retry is deduplicated by the subscriber (seq_accept()).
+ *
+ * Usage: evtbus [-p peer_path]... [-r]      (-r: reset the ring)
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/dispatch.h>
+#include <sys/neutrino.h>
+
+/* ================= BUS (MUST match demo1, demo3, keyv7) ================= */
+#define BUS_ATTACH     "traffic_bus"
+#define BUS_SHM_NAME   "/traffic_bus"
+#define BUS_MAGIC      0x42555331u      /* "BUS1" */
+#define BUS_SLOTS      1024             /* power of two */
+#define BUS_PUB_MAX    64
+
+#define MSG_BUS_PUB    0x30
+
+#define BUS_ISECT_ALL  0
+#define BUS_ROAD_ANY   0
+
+#define BUS_CLS_TRAIN    1    /* 't' / 'c' */
+#define BUS_CLS_PED      2    /* 'p' */
+#define BUS_CLS_VEH      3    /* 'v' + lane */
+#define BUS_CLS_APPROACH 4    /* track + ETA (train_appr_msg_t fields) */
+
+typedef struct {
+    uint8_t  isect;       /* BUS_ISECT_ALL or intersection id */
+    uint8_t  road;        /* BUS_ROAD_ANY or '3','1','2' */
+    uint8_t  cls;         /* BUS_CLS_* */
+    uint8_t  hop;         /* 0 = published on this node */
+    char     ev;          /* 't','c','p','v' */
+    uint8_t  lane;        /* 'v' */
+    _Uint16t subtype;     /* approach: APPR_SUB_* */
+    _Uint16t track_id;    /* approach */
+    _Uint16t eta_s;       /* approach */
+    int      client_id;   /* publisher, for the subscriber's dedup */
+    uint32_t epoch;
+    uint32_t seq;
+    uint32_t t_ms;        /* publisher clock */
+    uint32_t pad;
+} bus_rec_t;
+
+typedef struct {
+    _Atomic uint64_t seq;   /* n + 1 once record n is complete, 0 while written */
+    bus_rec_t        rec;
+} bus_slot_t;
+
+typedef struct {
+    uint32_t         magic;
+    uint32_t         slots;
+    _Atomic uint64_t head;  /* records ever published */
+    bus_slot_t       slot[BUS_SLOTS];
+} bus_shm_t;
+
+typedef struct {
+    _Uint16t  type;       /* MSG_BUS_PUB */
+    _Uint16t  count;
+    char      pad[4];
+    bus_rec_t recs[BUS_PUB_MAX];
+} bus_pub_t;
+
+typedef struct {
+    _Uint16t type;
+    _Uint16t subtype;
+    char     text[64];
+    uint32_t last_seq;    /* seq of the last record taken */
+} evt_reply_t;
+
+/* ================= PEERS ================= */
+#define MAX_PEERS      8
+#define PEER_TIMEOUT_MS 200
+
+typedef struct {
+    const char *path;
+    int         coid;
+    pthread_t   th;
+    uint64_t    sent, lost;
+} peer_t;
+
+static bus_shm_t *g_bus = NULL;
+static peer_t     g_peers[MAX_PEERS];
+static int        g_npeers = 0;
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL);
+}
+
+static int bus_create(int reset)
+{
+    int fd = shm_open(BUS_SHM_NAME, O_RDWR | O_CREAT, 0666);
+    if (fd == -1) { perror("shm_open(" BUS_SHM_NAME ")"); return -1; }
+    if (ftruncate(fd, sizeof(bus_shm_t)) == -1) {
+        perror("ftruncate(" BUS_SHM_NAME ")");
+        close(fd);
+        return -1;
+    }
+    void *p = mmap(NULL, sizeof(bus_shm_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { perror("mmap(" BUS_SHM_NAME ")"); return -1; }
+
+    g_bus = (bus_shm_t *)p;
+    if (reset || g_bus->magic != BUS_MAGIC || g_bus->slots != BUS_SLOTS) {
+        memset(g_bus, 0, sizeof(*g_bus));
+        g_bus->slots = BUS_SLOTS;
+        atomic_thread_fence(memory_order_release);
+        g_bus->magic = BUS_MAGIC;
+    }
+    /* a restarted broker continues at head: subscriber cursors stay valid */
+    return 0;
+}
+
+/* single writer: mark the slot busy, fill it, publish it, move head */
+static void bus_append(const bus_rec_t *r)
+{
+    uint64_t n = atomic_load_explicit(&g_bus->head, memory_order_relaxed);
+    bus_slot_t *s = &g_bus->slot[n % BUS_SLOTS];
+
+    atomic_store_explicit(&s->seq, 0, memory_order_relaxed);
+    atomic_thread_fence(memory_order_release);
+    s->rec = *r;
+    atomic_store_explicit(&s->seq, n + 1, memory_order_release);
+    atomic_store_explicit(&g_bus->head, n + 1, memory_order_release);
+}
+
+/* record n into *r: 1 = ok, 0 = not written yet, -1 = overwritten (lapped) */
+static int bus_read(uint64_t n, bus_rec_t *r)
+{
+    const bus_slot_t *s = &g_bus->slot[n % BUS_SLOTS];
+    uint64_t a = atomic_load_explicit(&s->seq, memory_order_acquire);
+    if (a != n + 1) return (a > n + 1 || atomic_load(&g_bus->head) > n + BUS_SLOTS) ? -1 : 0;
+    *r = s->rec;
+    atomic_thread_fence(memory_order_acquire);
+    return atomic_load_explicit(&s->seq, memory_order_relaxed) == a ? 1 : -1;
+}
+
+/* ================= FORWARDERS ================= */
+static void *peer_thread(void *arg)
+{
+    peer_t *p = arg;
+    bus_pub_t pub;
+    evt_reply_t rep;
+    uint64_t cur = atomic_load_explicit(&g_bus->head, memory_order_acquire);
+    uint64_t to_ns = (uint64_t)PEER_TIMEOUT_MS * 1000000ULL;
+    struct timespec idle = { 0, 5L * 1000L * 1000L };
+
+    for (;;) {
+        /* collect this node's records */
+        int n = 0;
+        uint64_t head = atomic_load_explicit(&g_bus->head, memory_order_acquire);
+        while (cur < head && n < BUS_PUB_MAX) {
+            int rc = bus_read(cur, &pub.recs[n]);
+            if (rc < 0) {
+                uint64_t skip = head - cur > BUS_SLOTS ? head - BUS_SLOTS : cur + 1;
+                p->lost += skip - cur;
+                printf("[bus] peer %s: %llu records overrun\n", p->path, (unsigned long long)(skip - cur));
+                fflush(stdout);
+                cur = skip;
+                continue;
+            }
+            if (rc == 0) break;
+            cur++;
+            if (pub.recs[n].hop != 0) continue;
+            pub.recs[n].hop = 1;
+            n++;
+        }
+        if (!n) { nanosleep(&idle, NULL); continue; }
+
+        pub.type = MSG_BUS_PUB;
+        pub.count = (_Uint16t)n;
+        int len = (int)(offsetof(bus_pub_t, recs) + (size_t)n * sizeof(bus_rec_t));
+
+        /* the same batch until the peer takes it (subscribers dedup) */
+        for (;;) {
+            if (p->coid == -1) p->coid = name_open(p->path, 0);
+            if (p->coid != -1) {
+                TimerTimeout(CLOCK_MONOTONIC, _NTO_TIMEOUT_SEND | _NTO_TIMEOUT_REPLY, NULL, &to_ns, NULL);
+                if (MsgSend(p->coid, &pub, len, &rep, sizeof(rep)) != -1) {
+                    p->sent += (uint64_t)n;
+                    break;
+                }
+                if (errno != ETIMEDOUT) { name_close(p->coid); p->coid = -1; }
+            }
+            if (atomic_load(&g_bus->head) - cur > BUS_SLOTS / 2) {
+                p->lost += (uint64_t)n;       /* peer gone too long: drop, keep up */
+                break;
+            }
+            usleep(PEER_TIMEOUT_MS * 1000);
+        }
+    }
+    return NULL;
+}
+
+/* ================= MAIN ================= */
+int main(int argc, char **argv)
+{
+    int o, reset = 0;
+    while ((o = getopt(argc, argv, "p:r")) != -1) {
+        if (o == 'p' && g_npeers < MAX_PEERS) {
+            g_peers[g_npeers].path = optarg;
+            g_peers[g_npeers].coid = -1;
+            g_npeers++;
+        } else if (o == 'r') {
+            reset = 1;
+        } else {
+            fprintf(stderr, "usage: %s [-p peer_path]... [-r]   (max %d peers)\n", argv[0], MAX_PEERS);
+            return EXIT_FAILURE;
+        }
+    }
+
+    if (bus_create(reset) != 0) return EXIT_FAILURE;
+
+    name_attach_t *att = name_attach(NULL, BUS_ATTACH, 0);
+    if (!att) { perror("name_attach(" BUS_ATTACH ")"); return EXIT_FAILURE; }
+
+    printf("[bus] %s: %d slots, head %llu; publish at /dev/name/local/%s\n", BUS_SHM_NAME, BUS_SLOTS,
+           (unsigned long long)atomic_load(&g_bus->head), BUS_ATTACH);
+    for (int i = 0; i < g_npeers; i++) {
+        printf("[bus] forwarding to %s\n", g_peers[i].path);
+        if (pthread_create(&g_peers[i].th, NULL, peer_thread, &g_peers[i]) != 0) perror("pthread_create");
+    }
+    fflush(stdout);
+
+    bus_pub_t msg;
+    evt_reply_t rep;
+    struct _msg_info info;
+    uint64_t pubs = 0;
+
+    for (;;) {
+        int rcvid = MsgReceive(att->chid, &msg, sizeof(msg), &info);
+        if (rcvid == -1) { perror("MsgReceive"); continue; }
+        if (rcvid == 0) continue;                                   /* pulse */
+        if (msg.type == _IO_CONNECT) { MsgReply(rcvid, EOK, NULL, 0); continue; }
+        if (msg.type > _IO_BASE && msg.type <= _IO_MAX) { MsgError(rcvid, ENOSYS); continue; }
+        if (msg.type != MSG_BUS_PUB) { MsgError(rcvid, EINVAL); continue; }
+
+        int count = msg.count;
+        int fit = (info.msglen - (int)offsetof(bus_pub_t, recs)) / (int)sizeof(bus_rec_t);
+        if (count > BUS_PUB_MAX) count = BUS_PUB_MAX;
+        if (count > fit) count = fit;
+
+        memset(&rep, 0, sizeof(rep));
+        rep.type = 0x01;
+        uint32_t t = now_ms();
+        for (int i = 0; i < count; i++) {
+            if (!msg.recs[i].t_ms) msg.recs[i].t_ms = t;
+            bus_append(&msg.recs[i]);
+            rep.last_seq = msg.recs[i].seq;
+        }
+        snprintf(rep.text, sizeof(rep.text), "OK: bus %d/%u", count < 0 ? 0 : count, (unsigned)msg.count);
+        MsgReply(rcvid, EOK, &rep, sizeof(rep));
+
+        if ((++pubs % 1000) == 0) {
+            printf("[bus] %llu publications, head %llu", (unsigned long long)pubs,
+                   (unsigned long long)atomic_load(&g_bus->head));
+            for (int i = 0; i < g_npeers; i++)
+                printf(" | %s sent %llu lost %llu", g_peers[i].path,
+                       (unsigned long long)g_peers[i].sent, (unsigned long long)g_peers[i].lost);
+            printf("\n");
+            fflush(stdout);
+        }
+    }
+    return EXIT_SUCCESS;
+}
@@ -0,0 +1,566 @@
+/*
+ * evtgen - multi-client event load generator for the traffic controllers
+ *
+ * Many concurrent clients (one thread each) send 't' / 'c' / 'p' (and
+ * 'v<lane>' detector calls over QNET) to one controller input:
+ *
+ *   -T mq     POSIX mqueue of traffic_fsm / traffic2   (default /traffic_mq)
+ *   -T qnet   QNET attach point of demo1 / demo3      (default traffic_evt)
+ *   -T pulse  L1 pulse channel, 't' / 'c' only         (default i1evt)
+ *
+ * Each client either plays a Poisson stream (-e rates per client, events/s)
+ * or replays a script (-s file, lines "<ms> <key>", key t c p or v<lane>).
+ *
+ * Two latencies are recorded per event kind:
+ *   ack       send -> mq_send / MsgSend / MsgSendPulse returns
+ *   reaction  send -> the controller prints its reaction, read from its
+ *             log (-w file, e.g. demo1 | tee /tmp/demo1.log): the first
+ *             marker after an event answers every event of that kind
+ *             still waiting (a burst of 'p' is one PED BEGIN)
+ *
+ * Usage: evtgen [-T mq|qnet|pulse] [-a name] [-j clients] [-d seconds]
+ *               [-e t=R,c=R,p=R,v=R] [-s script] [-w trace] [-S seed]
+ *        defaults: mq, 4 clients, 10 s, p=1 t=0.02 c=0.02 events/s per client
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <math.h>
+#include <signal.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <mqueue.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/dispatch.h>
+#include <sys/neutrino.h>
+
+/* ================= MQ TARGET (MUST match traffic_fsm.c) ================= */
+#define QUEUE_NAME        "/traffic_mq"
+#define MSG_SIZE          2
+#define PRIO_TRAIN        3
+#define PRIO_CLEAR        2
+#define PRIO_PED          1
+#define MQ_RESERVED_SLOTS 4     /* ped presses never take these */
+
+/* ================= QNET TARGET (MUST match demo1, demo3) ================= */
+#define AP_NAME           "traffic_evt"
+#define N_LANES           6
+
+typedef struct {
+    _Uint16t type;
+    _Uint16t subtype;
+    char     ev;
+    char     pad[3];    /* 'v': pad[0] = lane id */
+    int      client_id;
+    uint32_t epoch;
+    uint32_t seq;
+} evt_msg_t;
+
+typedef struct {
+    _Uint16t type;
+    _Uint16t subtype;
+    char     text[64];
+    uint32_t last_seq;
+} evt_reply_t;
+
+#define CLIENT_ID_BASE    1000
+
+/* ================= PULSE TARGET (MUST match L1) ================= */
+#define PULSE_NAME        "i1evt"
+
+/* ================= EVENT KINDS ================= */
+#define N_KINDS 4
+static const char KIND_CH[N_KINDS] = { 't', 'c', 'p', 'v' };
+
+/* what the controllers print when they act on an event (see notify_*()) */
+static const char *const REACT[N_KINDS][2] = {
+    { ">>> TRAIN PREEMPT", "*** TRAIN BEGIN" },
+    { ">>> TRAIN CLEAR",   "*** TRAIN OVER"  },
+    { "*** PED BEGIN",     NULL              },
+    { NULL,                NULL              },     /* calls only count */
+};
+
+static int kind_of(char ev)
+{
+    for (int k = 0; k < N_KINDS; k++) if (KIND_CH[k] == ev) return k;
+    return -1;
+}
+
+typedef enum { TGT_MQ, TGT_QNET, TGT_PULSE } target_t;
+
+/* ================= LATENCY HISTOGRAM =================
+ * Log-linear buckets over microseconds: exact below 64us, then 32 per
+ * power of two (~3% wide), up to hours. Cheap to add to and to merge.
+ */
+#define LAT_BUCKETS 1216
+
+typedef struct {
+    uint64_t n, sum_us, max_us;
+    uint32_t b[LAT_BUCKETS];
+} lat_t;
+
+static unsigned lat_bucket(uint64_t us)
+{
+    if (us < 64) return (unsigned)us;
+    unsigned e = 63u - (unsigned)__builtin_clzll(us) - 5u;
+    unsigned i = 64u + (e - 1u) * 32u + (unsigned)((us >> e) - 32u);
+    return i < LAT_BUCKETS ? i : LAT_BUCKETS - 1;
+}
+
+static uint64_t lat_floor(unsigned i)
+{
+    if (i < 64) return i;
+    unsigned e = (i - 64u) / 32u + 1u;
+    return (uint64_t)((i - 64u) % 32u + 32u) << e;
+}
+
+static void lat_add(lat_t *l, uint64_t us)
+{
+    l->n++;
+    l->sum_us += us;
+    if (us > l->max_us) l->max_us = us;
+    l->b[lat_bucket(us)]++;
+}
+
+static void lat_merge(lat_t *to, const lat_t *from)
+{
+    to->n += from->n;
+    to->sum_us += from->sum_us;
+    if (from->max_us > to->max_us) to->max_us = from->max_us;
+    for (int i = 0; i < LAT_BUCKETS; i++) to->b[i] += from->b[i];
+}
+
+static double lat_pct_ms(const lat_t *l, double q)
+{
+    uint64_t want = (uint64_t)ceil(q * (double)l->n), seen = 0;
+    for (unsigned i = 0; i < LAT_BUCKETS; i++) {
+        seen += l->b[i];
+        if (seen >= want && seen) return (double)lat_floor(i) / 1000.0;
+    }
+    return (double)l->max_us / 1000.0;
+}
+
+static void lat_print(const char *title, const lat_t *l)
+{
+    printf("[evtgen] %s latency (ms)   n       avg     p50     p90     p99     max\n", title);
+    for (int k = 0; k < N_KINDS; k++) {
+        if (!l[k].n) continue;
+        printf("           '%c'          %8llu %8.2f %7.2f %7.2f %7.2f %7.2f\n", KIND_CH[k],
+               (unsigned long long)l[k].n, (double)l[k].sum_us / (double)l[k].n / 1000.0,
+               lat_pct_ms(&l[k], 0.50), lat_pct_ms(&l[k], 0.90), lat_pct_ms(&l[k], 0.99),
+               (double)l[k].max_us / 1000.0);
+    }
+}
+
+/* ================= CONFIG ================= */
+static target_t     g_target = TGT_MQ;
+static const char  *g_name   = NULL;
+static unsigned     g_jobs   = 4;
+static unsigned     g_secs   = 10;
+static double       g_rate[N_KINDS] = { 0.02, 0.02, 1.0, 0.0 };
+static const char  *g_script = NULL;
+static const char  *g_trace  = NULL;
+static uint32_t     g_seed   = 1;
+static uint32_t     g_epoch;
+
+static volatile sig_atomic_t g_stop = 0;
+static _Atomic uint64_t g_sent = 0, g_failed = 0;
+static _Atomic unsigned g_running = 0;
+
+static void on_sigint(int sig) { (void)sig; g_stop = 1; }
+
+static uint64_t now_ns(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000000ULL + (uint64_t)ts.tv_nsec;
+}
+
+/* in <= 100ms steps, so a stop is seen even between sparse events */
+static void sleep_until_ns(uint64_t t)
+{
+    while (!g_stop) {
+        uint64_t now = now_ns();
+        if (now >= t) return;
+        uint64_t step = (t - now > 100000000ULL) ? now + 100000000ULL : t;
+        struct timespec ts = { (time_t)(step / 1000000000ULL), (long)(step % 1000000000ULL) };
+        clock_nanosleep(CLOCK_MONOTONIC, TIMER_ABSTIME, &ts, NULL);
+    }
+}
+
+/* ================= SCRIPT ================= */
+typedef struct {
+    uint32_t at_ms;
+    char     ev;
+    uint8_t  lane;
+} script_ev_t;
+
+static script_ev_t *g_steps = NULL;
+static unsigned     g_nsteps = 0;
+
+static int step_cmp(const void *a, const void *b)
+{
+    const script_ev_t *x = a, *y = b;
+    return (x->at_ms > y->at_ms) - (x->at_ms < y->at_ms);
+}
+
+/* "<ms> <key>" per line, '#' comments; kept in time order */
+static int script_load(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+
+    char line[128];
+    unsigned cap = 0, lineno = 0;
+    while (fgets(line, sizeof(line), f)) {
+        lineno++;
+        char *h = strchr(line, '#');
+        if (h) *h = '\0';
+        unsigned ms;
+        char key[8];
+        int n = sscanf(line, "%u %7s", &ms, key);
+        if (n <= 0) continue;
+        int k = (n == 2) ? kind_of(key[0]) : -1;
+        int lane = (k == 3) ? key[1] - '0' : 0;
+        if (k < 0 || lane < 0 || lane >= N_LANES) {
+            fprintf(stderr, "%s:%u: expected \"<ms> t|c|p|v<lane>\"\n", path, lineno);
+            fclose(f);
+            return -1;
+        }
+        if (g_nsteps == cap) {
+            cap = cap ? cap * 2 : 64;
+            script_ev_t *p = realloc(g_steps, cap * sizeof(*p));
+            if (!p) { perror("realloc"); fclose(f); return -1; }
+            g_steps = p;
+        }
+        g_steps[g_nsteps].at_ms = ms;
+        g_steps[g_nsteps].ev = KIND_CH[k];
+        g_steps[g_nsteps].lane = (uint8_t)lane;
+        g_nsteps++;
+    }
+    fclose(f);
+    qsort(g_steps, g_nsteps, sizeof(*g_steps), step_cmp);
+    return g_nsteps ? 0 : -1;
+}
+
+/* ================= REACTIONS (trace follower) ================= */
+#define WAIT_RING 1024
+
+static pthread_mutex_t g_react_mu = PTHREAD_MUTEX_INITIALIZER;
+static uint64_t g_wait_ns[N_KINDS][WAIT_RING];  /* unanswered send times */
+static unsigned g_wait_head[N_KINDS], g_wait_n[N_KINDS];
+static uint64_t g_wait_over[N_KINDS];           /* ring full: not timed */
+static lat_t    g_react[N_KINDS];
+
+static void react_expect(int k, uint64_t t)
+{
+    if (!g_trace || !REACT[k][0]) return;
+    pthread_mutex_lock(&g_react_mu);
+    if (g_wait_n[k] < WAIT_RING) {
+        g_wait_ns[k][(g_wait_head[k] + g_wait_n[k]) % WAIT_RING] = t;
+        g_wait_n[k]++;
+    } else {
+        g_wait_over[k]++;
+    }
+    pthread_mutex_unlock(&g_react_mu);
+}
+
+/* one marker answers every event of that kind sent before it */
+static void react_seen(int k, uint64_t t)
+{
+    pthread_mutex_lock(&g_react_mu);
+    while (g_wait_n[k]) {
+        uint64_t s = g_wait_ns[k][g_wait_head[k]];
+        if (s > t) break;
+        lat_add(&g_react[k], (t - s) / 1000ULL);
+        g_wait_head[k] = (g_wait_head[k] + 1) % WAIT_RING;
+        g_wait_n[k]--;
+    }
+    pthread_mutex_unlock(&g_react_mu);
+}
+
+static void *trace_thread(void *arg)
+{
+    (void)arg;
+    FILE *f = fopen(g_trace, "r");
+    if (!f) { perror(g_trace); return NULL; }
+    fseek(f, 0, SEEK_END);              /* only what happens from now on */
+
+    char line[256];
+    while (!g_stop) {
+        if (!fgets(line, sizeof(line), f)) {
+            clearerr(f);
+            struct timespec ts = { 0, 2L * 1000L * 1000L };
+            nanosleep(&ts, NULL);
+            continue;
+        }
+        uint64_t t = now_ns();
+        for (int k = 0; k < N_KINDS; k++)
+            for (int m = 0; m < 2 && REACT[k][m]; m++)
+                if (strstr(line, REACT[k][m])) react_seen(k, t);
+    }
+    fclose(f);
+    return NULL;
+}
+
+/* ================= CLIENTS ================= */
+typedef struct {
+    unsigned  id;
+    pthread_t th;
+    uint32_t  rng;
+    int       coid;
+    mqd_t     mq;
+    uint32_t  seq;
+    lat_t     ack[N_KINDS];
+    uint64_t  sent[N_KINDS];
+    uint64_t  failed, refused;
+} client_t;
+
+static uint32_t xorshift32(uint32_t *s)
+{
+    uint32_t x = *s;
+    x ^= x << 13; x ^= x >> 17; x ^= x << 5;
+    return *s = x;
+}
+
+/* (0, 1] */
+static double uniform01(uint32_t *s)
+{
+    return ((double)(xorshift32(s) >> 8) + 1.0) / 16777216.0;
+}
+
+static unsigned mq_prio(char ev)
+{
+    return ev == 't' ? PRIO_TRAIN : ev == 'c' ? PRIO_CLEAR : PRIO_PED;
+}
+
+static int client_open(client_t *c)
+{
+    c->coid = -1;
+    c->mq = (mqd_t)-1;
+    if (g_target == TGT_MQ) {
+        c->mq = mq_open(g_name, O_WRONLY | O_NONBLOCK);
+        if (c->mq == (mqd_t)-1) { perror("mq_open"); return -1; }
+    } else {
+        c->coid = name_open(g_name, 0);
+        if (c->coid == -1) { fprintf(stderr, "name_open(%s): %s\n", g_name, strerror(errno)); return -1; }
+    }
+    return 0;
+}
+
+static void client_close(client_t *c)
+{
+    if (c->mq != (mqd_t)-1) mq_close(c->mq);
+    if (c->coid != -1) name_close(c->coid);
+}
+
+/* one event; 1 = sent, 0 = refused (mq ped rule), -1 = failed */
+static int client_send(client_t *c, char ev, unsigned lane)
+{
+    if (g_target == TGT_MQ) {
+        if (ev == 'p') {
+            struct mq_attr a;
+            if (mq_getattr(c->mq, &a) == 0 && a.mq_curmsgs >= a.mq_maxmsg - MQ_RESERVED_SLOTS) return 0;
+        }
+        char msg[MSG_SIZE] = { ev, '\0' };
+        if (mq_send(c->mq, msg, MSG_SIZE, mq_prio(ev)) == -1) return errno == EAGAIN ? 0 : -1;
+        return 1;
+    }
+    if (g_target == TGT_PULSE)
+        return MsgSendPulse(c->coid, -1, ev, 0) == -1 ? -1 : 1;
+
+    evt_msg_t m;
+    evt_reply_t rep;
+    memset(&m, 0, sizeof(m));
+    m.type = 0x22;
+    m.ev = ev;
+    m.pad[0] = (char)lane;
+    m.client_id = CLIENT_ID_BASE + (int)c->id;
+    m.epoch = g_epoch;
+    m.seq = ++c->seq;
+    return MsgSend(c->coid, &m, sizeof(m), &rep, sizeof(rep)) == -1 ? -1 : 1;
+}
+
+static void client_event(client_t *c, char ev, unsigned lane)
+{
+    int k = kind_of(ev);
+    uint64_t t0 = now_ns();
+    int rc = client_send(c, ev, lane);
+    uint64_t t1 = now_ns();
+
+    if (rc > 0) {
+        c->sent[k]++;
+        lat_add(&c->ack[k], (t1 - t0) / 1000ULL);
+        react_expect(k, t0);
+        atomic_fetch_add_explicit(&g_sent, 1, memory_order_relaxed);
+    } else if (rc == 0) {
+        c->refused++;
+    } else {
+        c->failed++;
+        atomic_fetch_add_explicit(&g_failed, 1, memory_order_relaxed);
+    }
+}
+
+static void *client_thread(void *arg)
+{
+    client_t *c = arg;
+    uint64_t start = now_ns();
+
+    if (g_steps) {
+        for (unsigned i = 0; i < g_nsteps && !g_stop; i++) {
+            sleep_until_ns(start + (uint64_t)g_steps[i].at_ms * 1000000ULL);
+            if (!g_stop) client_event(c, g_steps[i].ev, g_steps[i].lane);
+        }
+    } else {
+        double total = 0;
+        for (int k = 0; k < N_KINDS; k++) total += g_rate[k];
+        uint64_t t = start;
+        while (!g_stop && total > 0) {
+            t += (uint64_t)(-log(uniform01(&c->rng)) / total * 1e9);   /* Poisson gaps */
+            sleep_until_ns(t);
+            if (g_stop) break;
+
+            double pick = uniform01(&c->rng) * total;
+            int k = 0;
+            while (k < N_KINDS - 1 && pick > g_rate[k]) pick -= g_rate[k++];
+            client_event(c, KIND_CH[k], xorshift32(&c->rng) % N_LANES);
+        }
+    }
+    atomic_fetch_sub(&g_running, 1);
+    return NULL;
+}
+
+/* ================= MAIN ================= */
+static int parse_rates(const char *s)
+{
+    char buf[128];
+    snprintf(buf, sizeof(buf), "%s", s);
+    for (char *tok = strtok(buf, ","); tok; tok = strtok(NULL, ",")) {
+        int k = kind_of(tok[0]);
+        if (k < 0 || tok[1] != '=') return -1;
+        g_rate[k] = atof(tok + 2);
+        if (g_rate[k] < 0) return -1;
+    }
+    return 0;
+}
+
+static void usage(const char *me)
+{
+    fprintf(stderr, "usage: %s [-T mq|qnet|pulse] [-a name] [-j clients] [-d seconds (0=forever)]\n"
+                    "       [-e t=R,c=R,p=R,v=R (events/s per client)] [-s script] [-w trace] [-S seed]\n", me);
+}
+
+int main(int argc, char **argv)
+{
+    int o;
+    while ((o = getopt(argc, argv, "T:a:j:d:e:s:w:S:")) != -1) {
+        switch (o) {
+        case 'T':
+            if      (strcmp(optarg, "mq") == 0)    g_target = TGT_MQ;
+            else if (strcmp(optarg, "qnet") == 0)  g_target = TGT_QNET;
+            else if (strcmp(optarg, "pulse") == 0) g_target = TGT_PULSE;
+            else { usage(argv[0]); return 2; }
+            break;
+        case 'a': g_name   = optarg; break;
+        case 'j': g_jobs   = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'd': g_secs   = (unsigned)strtoul(optarg, NULL, 10); break;
+        case 'e': if (parse_rates(optarg) != 0) { usage(argv[0]); return 2; } break;
+        case 's': g_script = optarg; break;
+        case 'w': g_trace  = optarg; break;
+        case 'S': g_seed   = (uint32_t)strtoul(optarg, NULL, 10); break;
+        default:  usage(argv[0]); return 2;
+        }
+    }
+    if (g_jobs < 1 || g_jobs > 256) { usage(argv[0]); return 2; }
+    if (!g_name) g_name = g_target == TGT_MQ ? QUEUE_NAME : g_target == TGT_QNET ? AP_NAME : PULSE_NAME;
+    if (g_script && script_load(g_script) != 0) return 1;
+
+    /* what each target understands */
+    if (g_target != TGT_QNET && g_rate[3] > 0) {
+        printf("[evtgen] 'v' needs -T qnet, rate ignored\n");
+        g_rate[3] = 0;
+    }
+    if (g_target == TGT_PULSE && g_rate[2] > 0) {
+        printf("[evtgen] L1 takes 't'/'c' pulses only, 'p' rate ignored\n");
+        g_rate[2] = 0;
+    }
+    g_epoch = (uint32_t)time(NULL);
+    signal(SIGINT, on_sigint);
+
+    client_t *cl = calloc(g_jobs, sizeof(*cl));
+    if (!cl) { perror("calloc"); return 1; }
+    for (unsigned i = 0; i < g_jobs; i++) {
+        cl[i].id = i;
+        cl[i].rng = 0x9E3779B9u * (g_seed + i);
+        if (client_open(&cl[i]) != 0) return 1;
+    }
+
+    pthread_t tr;
+    int tracing = g_trace && pthread_create(&tr, NULL, trace_thread, NULL) == 0;
+
+    if (g_steps) printf("[evtgen] %s: %u clients replay %s (%u events each)\n", g_name, g_jobs, g_script, g_nsteps);
+    else printf("[evtgen] %s: %u clients, Poisson t=%.3g c=%.3g p=%.3g v=%.3g events/s each\n",
+                g_name, g_jobs, g_rate[0], g_rate[1], g_rate[2], g_rate[3]);
+    fflush(stdout);
+
+    uint64_t start = now_ns(), last_sent = 0;
+    g_running = g_jobs;
+    for (unsigned i = 0; i < g_jobs; i++) {
+        if (pthread_create(&cl[i].th, NULL, client_thread, &cl[i]) != 0) {
+            perror("pthread_create");
+            return 1;
+        }
+    }
+
+    /* script: until every client is done (then 2s for late reactions) */
+    unsigned sec = 0, idle = 0;
+    while (!g_stop && (!g_secs || sec < g_secs) && idle < 2) {
+        sleep_until_ns(start + (uint64_t)(sec + 1) * 1000000000ULL);
+        sec++;
+        if (atomic_load(&g_running) == 0) idle++;
+        uint64_t s = atomic_load(&g_sent);
+        printf("[evtgen] t=%3us  %6llu events/s  total %llu  failed %llu\n", sec,
+               (unsigned long long)(s - last_sent), (unsigned long long)s,
+               (unsigned long long)atomic_load(&g_failed));
+        fflush(stdout);
+        last_sent = s;
+    }
+
+    g_stop = 1;
+    lat_t *ack = calloc(N_KINDS, sizeof(lat_t));
+    uint64_t sent = 0, failed = 0, refused = 0;
+    for (unsigned i = 0; i < g_jobs; i++) {
+        pthread_join(cl[i].th, NULL);
+        client_close(&cl[i]);
+        for (int k = 0; k < N_KINDS; k++) {
+            if (ack) lat_merge(&ack[k], &cl[i].ack[k]);
+            sent += cl[i].sent[k];
+        }
+        failed += cl[i].failed;
+        refused += cl[i].refused;
+    }
+    if (tracing) pthread_join(tr, NULL);
+
+    double secs = (double)(now_ns() - start) / 1e9;
+    printf("\n[evtgen] done: %llu events in %.2fs = %.1f events/s, %llu refused (queue reserve), %llu failed\n",
+           (unsigned long long)sent, secs, (double)sent / secs,
+           (unsigned long long)refused, (unsigned long long)failed);
+    if (ack) lat_print("ack", ack);
+    if (tracing) {
+        lat_print("reaction", g_react);
+        for (int k = 0; k < N_KINDS; k++)
+            if (REACT[k][0] && (g_wait_n[k] || g_wait_over[k]))
+                printf("           '%c' %u never answered, %llu not timed (too many waiting)\n",
+                       KIND_CH[k], g_wait_n[k], (unsigned long long)g_wait_over[k]);
+    }
+
+    free(ack);
+    free(cl);
+    free(g_steps);
+    return 0;
+}
@@ -0,0 +1,1149 @@
+/*
+ * fsmcheck - exhaustive safety checker for the traffic FSM (traffic_fsm.c / traffic2.c)
+ *
+ * Enumerates every reachable (state, remaining time, flags, plan)
+ * combination of the NORMAL + TRAIN + PED FSM, with any subset of {t, c, p}
+ * arriving at every 100ms poll (processed in mq priority order t > c > p).
+ *
+ * Timings come from the controllers' own plan files, read with the same
+ * keys and ranges (TP_KEYS), or from their built-in plans:
+ *   Intersection 1  one plan per -p file (traffic_fsm.c hot reload)
+ *   Intersection 2  a plan set per -p file: base plan plus [name] plans
+ *                   (traffic2.c); the 'at' / 'holiday' schedule is skipped
+ * Any loaded plan may become active at any safe all-red, which covers
+ * every schedule and every reload. Intersection 1 also restarts from its
+ * snapshot at any tick (warm, stale or cold start, see snap_restore()).
+ *
+ * Checks:
+ *   1) no conflicting movements lit together (R3 vs R1/R2, vehicles vs PED)
+ *   2) a green head always leaves through its yellow (WALK through FLASH)
+ *   3) a head only turns green after every conflicting head was RED
+ *   4) yellows, PED FLASH and all-reds are never cut short
+ *   5) longest time from 'p' / 't' until served (WALK / TRAIN start)
+ *
+ * The model MUST match the transition rules of traffic_fsm.c:
+ *   SingleStep_SM(), CYCLE_NEXT, wait_seconds_interruptible(),
+ *   try_start_ped_if_safe(), PREEMPT table, poll_events_from_mq(),
+ *   plan_apply_pending() / plan_tick(), snap_restore().
+ *
+ * Visited set is a bitset over the packed state; BFS levels and the
+ * wait-time fixed point are split across all online CPUs.
+ *
+ * Usage: fsmcheck [-2] [-j threads] [-p plan-file ...]
+ *   -2  Intersection 2 (traffic2.c)
+ *   -p  plan file in the controller's format (repeat for more)
+ * Exit status 0 = all checks passed, 2 = bad plan file.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <time.h>
+
+#define TICKS_PER_S  10   /* 100ms poll */
+
+/* ================= STATE ENUM (MUST match traffic_fsm.c) ================= */
+typedef enum {
+    N_R3_RS_G = 0,
+    N_R3_RS_Y,
+    N_R3_L_G,
+    N_R3_L_Y,
+    N_ALL_RED_1,
+    N_R1_RS_G,
+    N_R1_RS_Y,
+    N_R1_L_G,
+    N_R1_L_Y,
+    N_ALL_RED_2,
+
+    T_R3_NS_SRL_G_1 = 10,
+    T_R3_NS_SRL_Y_1,
+    T_ALL_RED_A,
+    T_R3_SN_LR_G_2,
+    T_R3_SN_LR_Y_2,
+    T_ALL_RED_B,
+    T_R1_RESTRICT_G_3,
+    T_R1_RESTRICT_Y_3,
+    T_DECISION_ALL_RED_4,
+
+    P_WALK = 20,
+    P_FLASH,
+    P_CLEAR_ALL_RED
+} state_t;
+
+#define N_STATES ((int)P_CLEAR_ALL_RED + 1)
+
+static const char *STATE_NAME[N_STATES] = {
+    "N_R3_RS_G", "N_R3_RS_Y", "N_R3_L_G", "N_R3_L_Y", "N_ALL_RED_1",
+    "N_R1_RS_G", "N_R1_RS_Y", "N_R1_L_G", "N_R1_L_Y", "N_ALL_RED_2",
+    "T_R3_NS_SRL_G_1", "T_R3_NS_SRL_Y_1", "T_ALL_RED_A", "T_R3_SN_LR_G_2",
+    "T_R3_SN_LR_Y_2", "T_ALL_RED_B", "T_R1_RESTRICT_G_3", "T_R1_RESTRICT_Y_3",
+    "T_DECISION_ALL_RED_4", "-", "P_WALK", "P_FLASH", "P_CLEAR_ALL_RED"
+};
+
+/* ================= CYCLE (MUST match CYCLE_NEXT in traffic_fsm.c / traffic2.c) ================= */
+static const state_t CYCLE_NEXT[N_STATES] = {
+    [N_R3_RS_G] = N_R3_RS_Y,   [N_R3_RS_Y] = N_R3_L_G,   [N_R3_L_G] = N_R3_L_Y,
+    [N_R3_L_Y]  = N_ALL_RED_1, [N_ALL_RED_1] = N_R1_RS_G,
+    [N_R1_RS_G] = N_R1_RS_Y,   [N_R1_RS_Y] = N_R1_L_G,   [N_R1_L_G] = N_R1_L_Y,
+    [N_R1_L_Y]  = N_ALL_RED_2, [N_ALL_RED_2] = N_R3_RS_G,
+
+    [T_R3_NS_SRL_G_1] = T_R3_NS_SRL_Y_1, [T_R3_NS_SRL_Y_1] = T_ALL_RED_A,
+    [T_ALL_RED_A]     = T_R3_SN_LR_G_2,  [T_R3_SN_LR_G_2]  = T_R3_SN_LR_Y_2,
+    [T_R3_SN_LR_Y_2]  = T_ALL_RED_B,     [T_ALL_RED_B]     = T_R1_RESTRICT_G_3,
+    [T_R1_RESTRICT_G_3] = T_R1_RESTRICT_Y_3, [T_R1_RESTRICT_Y_3] = T_DECISION_ALL_RED_4,
+    [T_DECISION_ALL_RED_4] = T_R3_SN_LR_G_2,
+
+    [P_WALK] = P_FLASH, [P_FLASH] = P_CLEAR_ALL_RED, [P_CLEAR_ALL_RED] = P_CLEAR_ALL_RED,
+};
+
+static int intersection = 0; /* 0 = traffic_fsm.c, 1 = traffic2.c */
+
+static int is_valid_state(int s)
+{
+    return (s <= T_DECISION_ALL_RED_4 && s != 19) || (s >= P_WALK && s <= P_CLEAR_ALL_RED);
+}
+
+static int is_train_state(state_t s)  { return (s >= T_R3_NS_SRL_G_1 && s <= T_DECISION_ALL_RED_4); }
+static int is_normal_state(state_t s) { return (s <= N_ALL_RED_2); }
+static int is_left_green(state_t s)   { return (s == N_R3_L_G || s == N_R1_L_G); }
+
+static int is_normal_green(state_t s)
+{
+    return (s == N_R3_RS_G || s == N_R3_L_G || s == N_R1_RS_G || s == N_R1_L_G);
+}
+
+/* ================= SIGNAL HEADS =================
+ * Mirrors print_state_outputs(): 4 vehicle heads + PED.
+ */
+enum { H_R3_SN = 0, H_R3_NS, H_R1_WE, H_R1_EW, H_PED, N_HEADS };
+enum { A_RED = 0, A_GREEN, A_YELLOW };   /* PED: RED / WALK / FLASH */
+
+static void heads_of(state_t s, unsigned char h[N_HEADS])
+{
+    memset(h, A_RED, N_HEADS);
+    switch (s) {
+        case N_R3_RS_G: case N_R3_L_G: h[H_R3_SN] = h[H_R3_NS] = A_GREEN;  break;
+        case N_R3_RS_Y: case N_R3_L_Y: h[H_R3_SN] = h[H_R3_NS] = A_YELLOW; break;
+        case N_R1_RS_G: case N_R1_L_G: h[H_R1_WE] = h[H_R1_EW] = A_GREEN;  break;
+        case N_R1_RS_Y: case N_R1_L_Y: h[H_R1_WE] = h[H_R1_EW] = A_YELLOW; break;
+
+        case T_R3_NS_SRL_G_1: h[H_R3_NS] = A_GREEN;  break;
+        case T_R3_NS_SRL_Y_1: h[H_R3_NS] = A_YELLOW; break;
+        case T_R3_SN_LR_G_2:  h[H_R3_SN] = A_GREEN;  break;
+        case T_R3_SN_LR_Y_2:  h[H_R3_SN] = A_YELLOW; break;
+        case T_R1_RESTRICT_G_3: h[H_R1_WE] = h[H_R1_EW] = A_GREEN;  break;
+        case T_R1_RESTRICT_Y_3: h[H_R1_WE] = h[H_R1_EW] = A_YELLOW; break;
+
+        case P_WALK:  h[H_PED] = A_GREEN;  break;
+        case P_FLASH: h[H_PED] = A_YELLOW; break;
+        default: break;
+    }
+}
+
+/* crossing roads conflict; PED conflicts with every vehicle head.
+ * Opposing approaches of the same road run together (permissive turns).
+ */
+static int heads_conflict(int a, int b)
+{
+    if (a == b) return 0;
+    if (a == H_PED || b == H_PED) return 1;
+    int road_a = (a <= H_R3_NS) ? 3 : 1;
+    int road_b = (b <= H_R3_NS) ? 3 : 1;
+    return road_a != road_b;
+}
+
+/* is_safe_allred(): every head RED, a plan may be swapped in */
+static int is_safe_allred(state_t s)
+{
+    unsigned char h[N_HEADS];
+    heads_of(s, h);
+    for (int i = 0; i < N_HEADS; i++) {
+        if (h[i] != A_RED) return 0;
+    }
+    return 1;
+}
+
+/* ================= TIMING PLANS =================
+ * Keys, built-in values and ranges MUST match TP_KEYS in traffic_fsm.c
+ * (Intersection 1) and traffic2.c (Intersection 2). A key sets one or two
+ * of the model's timing slots; the side road is R1 or R2.
+ */
+typedef enum {
+    TS_R3_RS_G = 0, TS_R3_L_G, TS_SIDE_RS_G, TS_SIDE_L_G,
+    TS_YELLOW, TS_ALL_RED,
+    TS_TR_1_G, TS_TR_2_G, TS_TR_3_G, TS_TR_Y, TS_TR_R,
+    TS_PED_WALK, TS_PED_FLASH, TS_PED_CLR,
+    N_TS
+} tslot_t;
+
+typedef struct { const char *name; unsigned def, min, max; int slot[2]; } tp_key_t;
+
+static const tp_key_t TP_KEYS_1[] = {
+    { "rs_green",   20,  5, 120, { TS_R3_RS_G,  TS_SIDE_RS_G } },
+    { "l_green",    12,  3,  60, { TS_R3_L_G,   TS_SIDE_L_G } },
+    { "yellow",      4,  4,   6, { TS_YELLOW,   -1 } },
+    { "all_red",     2,  2,   6, { TS_ALL_RED,  -1 } },
+    { "tr_1_g",      8,  3,  60, { TS_TR_1_G,   -1 } },
+    { "tr_2_g",      8,  3,  60, { TS_TR_2_G,   -1 } },
+    { "tr_3_g",     15,  3,  60, { TS_TR_3_G,   -1 } },
+    { "tr_y",        4,  4,   6, { TS_TR_Y,     -1 } },
+    { "tr_r",        2,  2,   6, { TS_TR_R,     -1 } },
+    { "ped_walk",    8,  4,  60, { TS_PED_WALK, -1 } },
+    { "ped_flash",   4,  4,  30, { TS_PED_FLASH, -1 } },
+    { "ped_clr",     2,  2,   6, { TS_PED_CLR,  -1 } },
+    { NULL, 0, 0, 0, { -1, -1 } }
+};
+
+static const tp_key_t TP_KEYS_2[] = {
+    { "r3_rs_green", 20,  5, 120, { TS_R3_RS_G,   -1 } },
+    { "r3_l_green",  12,  3,  60, { TS_R3_L_G,    -1 } },
+    { "r2_rs_green", 15,  5, 120, { TS_SIDE_RS_G, -1 } },
+    { "r2_l_green",   8,  3,  60, { TS_SIDE_L_G,  -1 } },
+    { "yellow",       4,  4,   6, { TS_YELLOW,    -1 } },
+    { "all_red",      2,  2,   6, { TS_ALL_RED,   -1 } },
+    { "tr_1_g",       8,  3,  60, { TS_TR_1_G,    -1 } },
+    { "tr_2_g",       8,  3,  60, { TS_TR_2_G,    -1 } },
+    { "tr_3_g",      15,  3,  60, { TS_TR_3_G,    -1 } },
+    { "tr_y",         4,  4,   6, { TS_TR_Y,      -1 } },
+    { "tr_r",         2,  2,   6, { TS_TR_R,      -1 } },
+    { "ped_walk",     8,  4,  60, { TS_PED_WALK,  -1 } },
+    { "ped_flash",    4,  4,  30, { TS_PED_FLASH, -1 } },
+    { "ped_clr",      2,  2,   6, { TS_PED_CLR,   -1 } },
+    { NULL, 0, 0, 0, { -1, -1 } }
+};
+
+/* MUST match BUILTIN_PLANS in traffic2.c */
+static const char *BUILTIN_PLANS_2[] = {
+    "[am_peak]",
+    "r3_rs_green = 30",
+    "[pm_peak]",
+    "r3_rs_green = 30",
+    "r2_rs_green = 20",
+    "[night]",
+    "r3_rs_green = 12",
+    "r3_l_green  = 6",
+    "r2_rs_green = 8",
+    "r2_l_green  = 5",
+    "at all     06:00 base",
+    "at mon-fri 07:00 am_peak",
+    "at mon-fri 09:30 base",
+    "at mon-fri 16:00 pm_peak",
+    "at mon-fri 19:00 base",
+    "at all     22:00 night",
+    NULL
+};
+
+#define MAX_PLANS          8    /* MUST match traffic2.c */
+#define PLAN_MAX_PREEMPT_S 15   /* MUST match traffic_fsm.c / traffic2.c */
+
+typedef struct {
+    char     name[16];
+    unsigned t[N_TS];
+    unsigned dur[N_STATES];
+    state_t  preempt_next_hop[N_STATES];
+    unsigned preempt_worst[N_STATES];
+} plan_t;
+
+static plan_t   plans[MAX_PLANS];
+static unsigned n_plans = 0;
+
+static const tp_key_t *tp_keys(void)
+{
+    return intersection ? TP_KEYS_2 : TP_KEYS_1;
+}
+
+static unsigned plan_state_duration(const plan_t *p, state_t s)
+{
+    switch (s) {
+        case N_R3_RS_G:  return p->t[TS_R3_RS_G];
+        case N_R3_RS_Y:  return p->t[TS_YELLOW];
+        case N_R3_L_G:   return p->t[TS_R3_L_G];
+        case N_R3_L_Y:   return p->t[TS_YELLOW];
+        case N_ALL_RED_1:return p->t[TS_ALL_RED];
+
+        case N_R1_RS_G:  return p->t[TS_SIDE_RS_G];
+        case N_R1_RS_Y:  return p->t[TS_YELLOW];
+        case N_R1_L_G:   return p->t[TS_SIDE_L_G];
+        case N_R1_L_Y:   return p->t[TS_YELLOW];
+        case N_ALL_RED_2:return p->t[TS_ALL_RED];
+
+        case T_R3_NS_SRL_G_1:      return p->t[TS_TR_1_G];
+        case T_R3_NS_SRL_Y_1:      return p->t[TS_TR_Y];
+        case T_ALL_RED_A:          return p->t[TS_TR_R];
+        case T_R3_SN_LR_G_2:       return p->t[TS_TR_2_G];
+        case T_R3_SN_LR_Y_2:       return p->t[TS_TR_Y];
+        case T_ALL_RED_B:          return p->t[TS_TR_R];
+        case T_R1_RESTRICT_G_3:    return p->t[TS_TR_3_G];
+        case T_R1_RESTRICT_Y_3:    return p->t[TS_TR_Y];
+        case T_DECISION_ALL_RED_4: return p->t[TS_TR_R];
+
+        case P_WALK:          return p->t[TS_PED_WALK];
+        case P_FLASH:         return p->t[TS_PED_FLASH];
+        case P_CLEAR_ALL_RED: return p->t[TS_PED_CLR];
+
+        default: return 0;
+    }
+}
+
+/* ================= PREEMPT TABLE (MUST match traffic_fsm.c) ================= */
+static int is_preempt_target(state_t s)
+{
+    return (s == N_ALL_RED_1 || s == N_ALL_RED_2 || s == P_CLEAR_ALL_RED);
+}
+
+static unsigned preempt_min_s(const plan_t *p, state_t s)
+{
+    if (is_normal_green(s) || s == P_WALK) return 0;
+    return p->dur[s];
+}
+
+static int preempt_edges(state_t s, state_t to[2])
+{
+    if (is_preempt_target(s)) return 0;
+    if (!is_normal_state(s) && s != P_WALK && s != P_FLASH) return 0;
+
+    int n = 0;
+    to[n++] = CYCLE_NEXT[s];
+    if (is_left_green(CYCLE_NEXT[s])) to[n++] = CYCLE_NEXT[CYCLE_NEXT[CYCLE_NEXT[s]]];
+    return n;
+}
+
+static void build_preempt_table(plan_t *p)
+{
+    for (int i = 0; i < N_STATES; i++) {
+        p->preempt_next_hop[i] = (state_t)i;
+        p->preempt_worst[i] = is_preempt_target((state_t)i) ? p->dur[i] : 0;
+    }
+
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < N_STATES; i++) {
+            state_t a = (state_t)i, to[2];
+            int n = preempt_edges(a, to);
+            for (int e = 0; e < n; e++) {
+                state_t b = to[e];
+                if (p->preempt_worst[b] == 0) continue;
+
+                unsigned via = preempt_min_s(p, a) + p->preempt_worst[b];
+                if (p->preempt_worst[a] == 0 || via < p->preempt_worst[a]) {
+                    p->preempt_next_hop[a] = b;
+                    p->preempt_worst[a] = via;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+/* ================= PLAN FILES =================
+ * Same line syntax and validation as the controllers. Intersection 2
+ * also takes [name] plans (a copy of the file's base plan) and skips
+ * its schedule lines.
+ */
+typedef struct { unsigned base, cur; } plan_src_t;
+
+static int plan_src_line(plan_src_t *ps, char *line, int ln, char *err, size_t errlen)
+{
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+
+    char a[32], nm[16], extra;
+    unsigned v;
+
+    if (sscanf(line, " %31s", a) != 1) return 0;    /* blank / comment */
+
+    if (intersection == 1) {
+        if (sscanf(line, " [%15[a-z0-9_]] %c", nm, &extra) == 1) {
+            if (strcmp(nm, "base") == 0) {
+                snprintf(err, errlen, "line %d: plan name 'base' is reserved", ln);
+                return -1;
+            }
+            for (unsigned i = ps->base; i < n_plans; i++) {
+                if (strcmp(plans[i].name, nm) == 0) {
+                    snprintf(err, errlen, "line %d: plan '%s' defined twice", ln, nm);
+                    return -1;
+                }
+            }
+            if (n_plans == MAX_PLANS) {
+                snprintf(err, errlen, "line %d: more than %d plans", ln, MAX_PLANS);
+                return -1;
+            }
+            ps->cur = n_plans++;
+            memcpy(plans[ps->cur].t, plans[ps->base].t, sizeof plans[0].t);
+            snprintf(plans[ps->cur].name, sizeof plans[0].name, "%s", nm);
+            return 0;
+        }
+        if (strcmp(a, "at") == 0 || strcmp(a, "holiday") == 0) return 0;  /* schedule */
+    }
+
+    int n = sscanf(line, " %31[a-z0-9_] = %u %c", a, &v, &extra);
+    if (n != 2) {
+        snprintf(err, errlen, "line %d: expected 'key = seconds'", ln);
+        return -1;
+    }
+
+    const tp_key_t *k = tp_keys();
+    while (k->name && strcmp(k->name, a) != 0) k++;
+    if (!k->name) {
+        snprintf(err, errlen, "line %d: unknown key '%s'", ln, a);
+        return -1;
+    }
+    if (v < k->min || v > k->max) {
+        snprintf(err, errlen, "line %d: %s=%u out of range [%u..%u]", ln, a, v, k->min, k->max);
+        return -1;
+    }
+    for (int i = 0; i < 2; i++) {
+        if (k->slot[i] >= 0) plans[ps->cur].t[k->slot[i]] = v;
+    }
+    return 0;
+}
+
+/* one plan file (or the built-in plans when path is NULL) */
+static int plan_load(const char *path, char *err, size_t errlen)
+{
+    if (n_plans == MAX_PLANS) {
+        snprintf(err, errlen, "more than %d plans", MAX_PLANS);
+        return -1;
+    }
+    plan_src_t ps = { n_plans, n_plans };
+    plan_t *p = &plans[n_plans++];
+    memset(p, 0, sizeof *p);
+    for (const tp_key_t *k = tp_keys(); k->name; k++) {
+        for (int i = 0; i < 2; i++) {
+            if (k->slot[i] >= 0) p->t[k->slot[i]] = k->def;
+        }
+    }
+
+    const char *slash = path ? strrchr(path, '/') : NULL;
+    snprintf(p->name, sizeof p->name, "%s", (!path || intersection) ? "base" : slash ? slash + 1 : path);
+
+    char line[128];
+    if (!path) {
+        for (int i = 0; intersection && BUILTIN_PLANS_2[i]; i++) {
+            snprintf(line, sizeof line, "%s", BUILTIN_PLANS_2[i]);
+            if (plan_src_line(&ps, line, i + 1, err, errlen) != 0) return -1;
+        }
+        return 0;
+    }
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        snprintf(err, errlen, "cannot open");
+        return -1;
+    }
+    int ln = 0;
+    while (fgets(line, sizeof line, f)) {
+        if (plan_src_line(&ps, line, ++ln, err, errlen) != 0) {
+            fclose(f);
+            return -1;
+        }
+    }
+    fclose(f);
+    return 0;
+}
+
+/* plan_build(): durations, preempt table and the controller's preempt bound */
+static int plan_build(plan_t *p, char *err, size_t errlen)
+{
+    for (int i = 0; i < N_STATES; i++) p->dur[i] = plan_state_duration(p, (state_t)i);
+
+    build_preempt_table(p);
+    for (int i = 0; i < N_STATES; i++) {
+        if (p->preempt_worst[i] > PLAN_MAX_PREEMPT_S) {
+            snprintf(err, errlen, "plan %s: %s train preempt takes %us (max %us)",
+                     p->name, STATE_NAME[i], p->preempt_worst[i], PLAN_MAX_PREEMPT_S);
+            return -1;
+        }
+    }
+    return 0;
+}
+
+/* ================= PACKED MODEL STATE =================
+ * Mixed radix, sized at startup from the loaded plans:
+ *   state (N_STATES) x remaining ticks (0..longest state of any plan)
+ *   x flags (64) x ped_return_state (3) x plan (n_plans)
+ * Every TP_KEYS max fits: 8 plans with 120s greens is 42M packed states.
+ */
+#define F_TRAIN_REQ     0x01
+#define F_TRAIN_ACTIVE  0x02
+#define F_CLEAR_PEND    0x04
+#define F_PED_REQ       0x08
+#define F_IN_TRAIN      0x10
+#define F_IN_PED        0x20
+#define N_FLAGS         64
+#define N_RET           3
+
+static uint32_t rem_radix = 0;   /* longest state in ticks + 1 */
+static uint32_t n_packed = 0;
+
+#define EV_T 0x1
+#define EV_C 0x2
+#define EV_P 0x4
+#define N_EVSETS 8
+
+/* controller restarts (Intersection 1 only): snap_restore() outcomes */
+enum { EV_WARM = N_EVSETS, EV_STALE, EV_COLD, N_EV_ALL };
+
+static unsigned n_ev = N_EVSETS;
+
+static const state_t RET_STATES[N_RET] = { N_R3_RS_G, N_R1_RS_G, T_R3_SN_LR_G_2 };
+
+typedef struct {
+    state_t  st;
+    unsigned rem;     /* ticks left before the state's wait ends */
+    unsigned flags;
+    unsigned ret;     /* index into RET_STATES */
+    unsigned plan;    /* index into plans[] */
+
+    /* one transition, not packed */
+    unsigned swap;    /* plan taken at the next safe all-red */
+    int      swapped; /* swap was used */
+} model_t;
+
+static uint32_t pack(const model_t *m)
+{
+    uint32_t v = m->plan;
+    v = v * N_RET + m->ret;
+    v = v * N_FLAGS + m->flags;
+    v = v * rem_radix + m->rem;
+    return v * (uint32_t)N_STATES + (uint32_t)m->st;
+}
+
+static void unpack(uint32_t v, model_t *m)
+{
+    m->st    = (state_t)(v % N_STATES); v /= N_STATES;
+    m->rem   = v % rem_radix;           v /= rem_radix;
+    m->flags = v % N_FLAGS;             v /= N_FLAGS;
+    m->ret   = v % N_RET;               v /= N_RET;
+    m->plan  = v;
+    m->swap  = m->plan;
+    m->swapped = 0;
+}
+
+/* ================= TRANSITION (one 100ms tick) ================= */
+static void enter(model_t *m, state_t s)
+{
+    if (is_safe_allred(s)) {    /* plan_apply_pending() / plan_tick() */
+        m->plan = m->swap;
+        m->swapped = 1;
+    }
+    m->st  = s;
+    m->rem = plans[m->plan].dur[s] * TICKS_PER_S;
+}
+
+static void apply_events(model_t *m, unsigned ev)
+{
+    /* mq priority order: t, c, p */
+    if (ev & EV_T) {
+        m->flags |= F_TRAIN_REQ | F_TRAIN_ACTIVE;
+        m->flags &= ~F_CLEAR_PEND;
+    }
+    if (ev & EV_C) {
+        m->flags |= F_CLEAR_PEND;
+        m->flags &= ~F_TRAIN_REQ;
+    }
+    if (ev & EV_P) {
+        m->flags |= F_PED_REQ;
+    }
+}
+
+static void enter_train(model_t *m)
+{
+    m->flags &= ~(F_TRAIN_REQ | F_CLEAR_PEND);
+    m->flags |= F_TRAIN_ACTIVE | F_IN_TRAIN;
+    enter(m, T_R3_NS_SRL_G_1);
+}
+
+static int try_start_ped(model_t *m);
+
+/* do_exit_train_to_normal(): a waiting ped is served from the all-red first */
+static void exit_train(model_t *m)
+{
+    m->flags &= ~(F_TRAIN_ACTIVE | F_CLEAR_PEND | F_TRAIN_REQ | F_IN_TRAIN);
+    if (try_start_ped(m)) return;
+    enter(m, N_R3_RS_G);
+}
+
+static int try_start_ped(model_t *m)
+{
+    state_t s = m->st;
+    if (!(m->flags & F_PED_REQ)) return 0;
+    if (!(s == N_ALL_RED_1 || s == N_ALL_RED_2 ||
+          s == T_ALL_RED_A || s == T_ALL_RED_B || s == T_DECISION_ALL_RED_4)) return 0;
+
+    if ((m->flags & F_TRAIN_ACTIVE) && !(m->flags & F_CLEAR_PEND)) {
+        if (!(s == T_ALL_RED_A || s == T_ALL_RED_B || s == T_DECISION_ALL_RED_4)) return 0;
+        m->ret = 2;
+    } else {
+        m->ret = (s == N_ALL_RED_1) ? 1 : 0;
+    }
+
+    m->flags &= ~F_PED_REQ;
+    m->flags |= F_IN_PED;
+    enter(m, P_WALK);
+    return 1;
+}
+
+static int train_pending(const model_t *m)
+{
+    return (m->flags & F_TRAIN_REQ) && !(m->flags & F_IN_TRAIN);
+}
+
+/* post-wait logic of SingleStep_SM() */
+static void finish_state(model_t *m)
+{
+    state_t s = m->st;
+    int exit_now = (m->flags & F_CLEAR_PEND) &&
+                   (s == T_ALL_RED_A || s == T_ALL_RED_B || s == T_DECISION_ALL_RED_4);
+
+    switch (s) {
+        case N_R3_RS_Y:
+        case N_R1_RS_Y:
+            if (train_pending(m)) enter(m, plans[m->plan].preempt_next_hop[s]);   /* skip left phases */
+            else enter(m, CYCLE_NEXT[s]);
+            break;
+
+        case N_ALL_RED_1:
+        case N_ALL_RED_2:
+            if (m->flags & F_TRAIN_REQ) { enter_train(m); break; }
+            if (try_start_ped(m)) break;
+            enter(m, CYCLE_NEXT[s]);
+            break;
+
+        case T_ALL_RED_A:
+        case T_ALL_RED_B:
+            if (exit_now) { exit_train(m); break; }
+            if (try_start_ped(m)) break;
+            enter(m, CYCLE_NEXT[s]);
+            break;
+        case T_DECISION_ALL_RED_4:
+            if (exit_now) { exit_train(m); break; }
+            if (try_start_ped(m)) break;
+            if ((m->flags & F_TRAIN_ACTIVE) && !(m->flags & F_CLEAR_PEND)) enter(m, CYCLE_NEXT[s]);
+            else exit_train(m);
+            break;
+
+        case P_CLEAR_ALL_RED:
+            m->flags &= ~F_IN_PED;
+            if (train_pending(m)) { enter_train(m); break; }
+            enter(m, RET_STATES[m->ret]);
+            break;
+
+        default:
+            enter(m, is_valid_state(s) ? CYCLE_NEXT[s] : N_R3_RS_G);
+            break;
+    }
+}
+
+/* snap_restore() (traffic_fsm.c): the plan file is read again, so any plan
+ * may come back. Warm: the heads still show the state, which resumes with
+ * the time it had left (ticks skipped in the outage are plain ticks here).
+ * Stale: ALL-RED 1 keeping a pending train / ped. Cold: as main(). */
+static void restart(model_t *m, unsigned ev)
+{
+    m->plan = m->swap;
+    m->swapped = 1;
+
+    if (ev == EV_WARM) {
+        unsigned full = plans[m->plan].dur[m->st] * TICKS_PER_S;
+        if (m->rem > full) m->rem = full;
+        return;
+    }
+
+    unsigned keep = 0;
+    if (ev == EV_STALE) {
+        keep = m->flags & F_PED_REQ;
+        if ((m->flags & F_TRAIN_ACTIVE) && !(m->flags & F_CLEAR_PEND)) keep |= F_TRAIN_REQ | F_TRAIN_ACTIVE;
+    }
+    m->flags = keep;
+    m->ret = 0;
+    enter(m, ev == EV_STALE ? N_ALL_RED_1 : N_R3_RS_G);
+}
+
+/* *used = the plan choice made a difference */
+static uint32_t step(uint32_t packed, unsigned ev, unsigned swap, int *used)
+{
+    model_t m;
+    unpack(packed, &m);
+    m.swap = swap;
+
+    if (ev >= N_EVSETS) {
+        restart(&m, ev);
+        *used = m.swapped;
+        return pack(&m);
+    }
+
+    m.rem--;
+    apply_events(&m, ev);
+
+    if (train_pending(&m) && preempt_min_s(&plans[m.plan], m.st) == 0 &&
+        plans[m.plan].preempt_next_hop[m.st] != m.st) {
+        /* wait_seconds_interruptible(): cut green / WALK */
+        enter(&m, plans[m.plan].preempt_next_hop[m.st]);
+    } else if (m.rem == 0) {
+        finish_state(&m);
+    } else {
+        *used = 0;
+        return pack(&m);
+    }
+
+    /* SingleStep_SM() epilogue */
+    if (is_train_state(m.st)) m.flags |= F_IN_TRAIN;
+    if (is_normal_state(m.st)) m.flags &= ~F_IN_TRAIN;
+    *used = m.swapped;
+    return pack(&m);
+}
+
+/* ================= SAFETY CHECKS ================= */
+typedef struct {
+    uint32_t from;
+    uint32_t to;
+    unsigned ev;
+    const char *what;
+} violation_t;
+
+static const char *check_transition(uint32_t from, uint32_t to, unsigned ev)
+{
+    model_t a, b;
+    unpack(from, &a);
+    unpack(to, &b);
+
+    unsigned char ha[N_HEADS], hb[N_HEADS];
+    heads_of(a.st, ha);
+    heads_of(b.st, hb);
+
+    for (int i = 0; i < N_HEADS; i++) {
+        for (int j = i + 1; j < N_HEADS; j++) {
+            if (heads_conflict(i, j) && hb[i] != A_RED && hb[j] != A_RED)
+                return "conflicting heads lit together";
+        }
+    }
+
+    if (a.st == b.st) return NULL;
+
+    /* a stale or cold restart follows an outage longer than SNAP_MAX_GAP_MS:
+     * the heads were dark, which clears every movement */
+    if (ev >= N_EVSETS) return NULL;
+
+    for (int i = 0; i < N_HEADS; i++) {
+        if (ha[i] == A_GREEN && hb[i] == A_RED)
+            return "green left without yellow/flash";
+
+        if (hb[i] == A_GREEN && ha[i] != A_GREEN) {
+            for (int j = 0; j < N_HEADS; j++) {
+                if (heads_conflict(i, j) && ha[j] != A_RED)
+                    return "green started without all-red clearance";
+            }
+        }
+    }
+
+    /* only greens and WALK may be cut (preempt), and only by a train */
+    model_t tmp = a;
+    apply_events(&tmp, ev);
+    if (a.rem > 1 && !(preempt_min_s(&plans[a.plan], a.st) == 0 && train_pending(&tmp)))
+        return "state cut short";
+
+    return NULL;
+}
+
+/* ================= VISITED BITSET + BFS ================= */
+static uint64_t *visited;
+static uint32_t *parent;          /* packed predecessor (counterexample traces) */
+static unsigned char *parent_ev;
+
+static int test_and_set(uint32_t v)
+{
+    uint64_t bit = 1ull << (v & 63);
+    uint64_t old = __atomic_fetch_or(&visited[v >> 6], bit, __ATOMIC_RELAXED);
+    return (old & bit) != 0;
+}
+
+typedef struct {
+    const uint32_t *in;
+    size_t lo, hi;
+    uint32_t *out;
+    size_t n_out;
+    size_t cap_out;
+    unsigned long transitions;
+    violation_t first;
+    int has_violation;
+} bfs_job_t;
+
+static void *bfs_worker(void *arg)
+{
+    bfs_job_t *job = (bfs_job_t *)arg;
+
+    for (size_t i = job->lo; i < job->hi; i++) {
+        uint32_t s = job->in[i];
+        for (unsigned ev = 0; ev < n_ev; ev++) {
+            for (unsigned swap = 0; swap < n_plans; swap++) {
+                int used;
+                uint32_t t = step(s, ev, swap, &used);
+                job->transitions++;
+
+                const char *bad = check_transition(s, t, ev);
+                if (bad && !job->has_violation) {
+                    job->has_violation = 1;
+                    job->first.from = s;
+                    job->first.to = t;
+                    job->first.ev = ev;
+                    job->first.what = bad;
+                }
+
+                if (!test_and_set(t)) {
+                    parent[t] = s;
+                    parent_ev[t] = (unsigned char)ev;
+
+                    if (job->n_out == job->cap_out) {
+                        job->cap_out = job->cap_out ? job->cap_out * 2 : 1024;
+                        job->out = realloc(job->out, job->cap_out * sizeof(uint32_t));
+                        if (!job->out) { perror("realloc"); exit(2); }
+                    }
+                    job->out[job->n_out++] = t;
+                }
+                if (!used) break;   /* no safe all-red entered: same for every plan */
+            }
+        }
+    }
+    return NULL;
+}
+
+/* ================= WAIT-TIME FIXED POINT =================
+ * W(s) = 0 if the request is not pending in s, else 1 + max W(succ),
+ * over events and plan swaps (restarts are outages, not waits).
+ * Jacobi iterations in parallel over the reachable states only; no
+ * convergence by MAX_WAIT_TICKS means the request can starve.
+ */
+#define MAX_WAIT_TICKS 6000   /* 10 minutes */
+
+typedef int (*pending_fn)(const model_t *m);
+
+static int ped_pending(const model_t *m) { return (m->flags & F_PED_REQ) != 0; }
+
+typedef struct {
+    const uint32_t *states;
+    const uint32_t *index;   /* packed -> position in states */
+    size_t lo, hi;
+    pending_fn pending;
+    const uint16_t *w_in;
+    uint16_t *w_out;
+    int changed;
+} wait_job_t;
+
+static void *wait_worker(void *arg)
+{
+    wait_job_t *job = (wait_job_t *)arg;
+    job->changed = 0;
+
+    for (size_t i = job->lo; i < job->hi; i++) {
+        uint32_t s = job->states[i];
+        model_t m;
+        unpack(s, &m);
+        if (!job->pending(&m)) { job->w_out[i] = 0; continue; }
+
+        unsigned best = 0;
+        for (unsigned ev = 0; ev < N_EVSETS; ev++) {
+            for (unsigned swap = 0; swap < n_plans; swap++) {
+                int used;
+                uint32_t t = step(s, ev, swap, &used);
+                unsigned w = job->w_in[job->index[t]];
+                if (w > best) best = w;
+                if (!used) break;
+            }
+        }
+        unsigned w = best + 1;
+        if (w > MAX_WAIT_TICKS) w = MAX_WAIT_TICKS;
+        job->w_out[i] = (uint16_t)w;
+        if (w != job->w_in[i]) job->changed = 1;
+    }
+    return NULL;
+}
+
+static unsigned longest_wait(const uint32_t *states, const uint32_t *index, size_t n,
+                             pending_fn pending, int nthreads, uint32_t *worst_state, int *converged)
+{
+    uint16_t *wa = calloc(n, sizeof(uint16_t));
+    uint16_t *wb = calloc(n, sizeof(uint16_t));
+    if (!wa || !wb) { perror("calloc"); exit(2); }
+
+    pthread_t th[nthreads];
+    wait_job_t jobs[nthreads];
+
+    *converged = 0;
+    for (int iter = 0; iter <= MAX_WAIT_TICKS; iter++) {
+        int changed = 0;
+        for (int t = 0; t < nthreads; t++) {
+            jobs[t].states = states;
+            jobs[t].index = index;
+            jobs[t].lo = n * (size_t)t / (size_t)nthreads;
+            jobs[t].hi = n * (size_t)(t + 1) / (size_t)nthreads;
+            jobs[t].pending = pending;
+            jobs[t].w_in = wa;
+            jobs[t].w_out = wb;
+            pthread_create(&th[t], NULL, wait_worker, &jobs[t]);
+        }
+        for (int t = 0; t < nthreads; t++) {
+            pthread_join(th[t], NULL);
+            changed |= jobs[t].changed;
+        }
+
+        uint16_t *tmp = wa; wa = wb; wb = tmp;
+        if (!changed) { *converged = 1; break; }
+    }
+
+    unsigned worst = 0;
+    *worst_state = 0;
+    for (size_t i = 0; i < n; i++) {
+        if (wa[i] > worst) { worst = wa[i]; *worst_state = states[i]; }
+    }
+    /* saturated at the cap = a cycle that never serves the request */
+    if (worst >= MAX_WAIT_TICKS) *converged = 0;
+
+    free(wa);
+    free(wb);
+    return worst;
+}
+
+/* ================= REPORTING ================= */
+static void print_model(uint32_t v)
+{
+    model_t m;
+    unpack(v, &m);
+    printf("%-20s rem=%5.1fs flags=%s%s%s%s%s%s ret=%s",
+           STATE_NAME[m.st], m.rem / (double)TICKS_PER_S,
+           (m.flags & F_TRAIN_REQ)    ? "REQ "    : "",
+           (m.flags & F_TRAIN_ACTIVE) ? "ACTIVE " : "",
+           (m.flags & F_CLEAR_PEND)   ? "CLEAR "  : "",
+           (m.flags & F_PED_REQ)      ? "PED "    : "",
+           (m.flags & F_IN_TRAIN)     ? "INTRAIN ": "",
+           (m.flags & F_IN_PED)       ? "INPED "  : "",
+           STATE_NAME[RET_STATES[m.ret]]);
+    if (n_plans > 1) printf(" plan=%s", plans[m.plan].name);
+    printf("\n");
+}
+
+static void print_events(unsigned ev)
+{
+    static const char *RESTART[] = { "WRM", "STL", "CLD" };
+    if (ev >= N_EVSETS) { printf("%s", RESTART[ev - N_EVSETS]); return; }
+    printf("%c%c%c", (ev & EV_T) ? 't' : '-', (ev & EV_C) ? 'c' : '-', (ev & EV_P) ? 'p' : '-');
+}
+
+static void print_plans(void)
+{
+    for (unsigned i = 0; i < n_plans; i++) {
+        const unsigned *t = plans[i].t;
+        printf("  %-10s R3 %u/%u %s %u/%u  Y %u AR %u  train %u/%u/%u Y %u R %u  ped %u/%u/%u\n",
+               plans[i].name, t[TS_R3_RS_G], t[TS_R3_L_G], intersection ? "R2" : "R1",
+               t[TS_SIDE_RS_G], t[TS_SIDE_L_G], t[TS_YELLOW], t[TS_ALL_RED],
+               t[TS_TR_1_G], t[TS_TR_2_G], t[TS_TR_3_G], t[TS_TR_Y], t[TS_TR_R],
+               t[TS_PED_WALK], t[TS_PED_FLASH], t[TS_PED_CLR]);
+    }
+}
+
+static void print_trace(uint32_t init, uint32_t last)
+{
+    /* walk parents back to init, then print forward */
+    size_t n = 0, cap = 64;
+    uint32_t *path = malloc(cap * sizeof(uint32_t));
+    for (uint32_t v = last; ; v = parent[v]) {
+        if (n == cap) { cap *= 2; path = realloc(path, cap * sizeof(uint32_t)); }
+        path[n++] = v;
+        if (v == init) break;
+    }
+
+    printf("  counterexample (%zu ticks):\n", n - 1);
+    model_t prev;
+    unpack(path[n - 1], &prev);
+    printf("    t=%6.1fs      ", 0.0);
+    print_model(path[n - 1]);
+    for (size_t i = n - 1; i-- > 0; ) {
+        model_t m;
+        unpack(path[i], &m);
+        if (m.st == prev.st && parent_ev[path[i]] == 0) { prev = m; continue; }
+        printf("    t=%6.1fs ", (double)(n - 1 - i) / TICKS_PER_S);
+        print_events(parent_ev[path[i]]);
+        printf("  ");
+        print_model(path[i]);
+        prev = m;
+    }
+    free(path);
+}
+
+static double elapsed_s(const struct timespec *a)
+{
+    struct timespec b;
+    clock_gettime(CLOCK_MONOTONIC, &b);
+    return (double)(b.tv_sec - a->tv_sec) + (double)(b.tv_nsec - a->tv_nsec) / 1e9;
+}
+
+/* ================= MAIN ================= */
+int main(int argc, char *argv[])
+{
+    int nthreads = (int)sysconf(_SC_NPROCESSORS_ONLN);
+    const char *plan_paths[MAX_PLANS];
+    int n_paths = 0;
+    int opt;
+
+    while ((opt = getopt(argc, argv, "2j:p:")) != -1) {
+        switch (opt) {
+            case '2': intersection = 1; break;
+            case 'j': nthreads = atoi(optarg); break;
+            case 'p':
+                if (n_paths < MAX_PLANS) { plan_paths[n_paths++] = optarg; break; }
+                fprintf(stderr, "at most %d plan files\n", MAX_PLANS);
+                return 2;
+            default:
+                fprintf(stderr, "usage: %s [-2] [-j threads] [-p plan-file ...]\n", argv[0]);
+                return 2;
+        }
+    }
+    if (nthreads < 1) nthreads = 1;
+
+    printf("fsmcheck: %s, %d thread(s)\n",
+           intersection ? "Intersection 2 (traffic2.c)" : "Intersection 1 (traffic_fsm.c)", nthreads);
+
+    char err[128];
+    for (int i = 0; i < (n_paths ? n_paths : 1); i++) {
+        const char *path = n_paths ? plan_paths[i] : NULL;
+        if (plan_load(path, err, sizeof err) != 0) {
+            printf("PLAN: %s: %s\n", path ? path : "built-in", err);
+            return 2;
+        }
+    }
+    unsigned longest = 0;
+    for (unsigned i = 0; i < n_plans; i++) {
+        if (plan_build(&plans[i], err, sizeof err) != 0) {
+            printf("PLAN: %s (the controller rejects it)\n", err);
+            return 2;
+        }
+        for (int s = 0; s < N_STATES; s++) {
+            if (plans[i].dur[s] > longest) longest = plans[i].dur[s];
+        }
+    }
+
+    /* snapshots exist on Intersection 1 only */
+    if (intersection == 0) n_ev = N_EV_ALL;
+
+    rem_radix = longest * TICKS_PER_S + 1;
+    n_packed = (uint32_t)N_STATES * rem_radix * N_FLAGS * N_RET * n_plans;
+
+    printf("plans (%s, any plan at any safe all-red):\n", n_paths ? "plan files" : "built-in");
+    print_plans();
+    printf("restarts         : %s\n", n_ev > N_EVSETS ? "warm / stale / cold at any tick" : "not modelled (no snapshot)");
+    fflush(stdout);
+
+    struct timespec t0;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    visited   = calloc((n_packed + 63) / 64, sizeof(uint64_t));
+    parent    = malloc((size_t)n_packed * sizeof(uint32_t));
+    parent_ev = malloc(n_packed);
+    if (!visited || !parent || !parent_ev) { perror("alloc"); return 2; }
+
+    /* main(): state s = N_R3_RS_G, all flags clear, the first plan */
+    model_t m0;
+    memset(&m0, 0, sizeof m0);
+    enter(&m0, N_R3_RS_G);
+    uint32_t init = pack(&m0);
+    test_and_set(init);
+    parent[init] = init;
+
+    size_t n_all = 0, cap_all = 1024;
+    uint32_t *all = malloc(cap_all * sizeof(uint32_t));
+    all[n_all++] = init;
+
+    size_t level_lo = 0;
+    unsigned long transitions = 0;
+    int violations = 0;
+
+    pthread_t th[nthreads];
+    bfs_job_t jobs[nthreads];
+    memset(jobs, 0, sizeof(jobs));
+
+    while (level_lo < n_all) {
+        size_t level_hi = n_all;
+        size_t width = level_hi - level_lo;
+
+        for (int t = 0; t < nthreads; t++) {
+            jobs[t].in = all;
+            jobs[t].lo = level_lo + width * (size_t)t / (size_t)nthreads;
+            jobs[t].hi = level_lo + width * (size_t)(t + 1) / (size_t)nthreads;
+            jobs[t].n_out = 0;
+            pthread_create(&th[t], NULL, bfs_worker, &jobs[t]);
+        }
+        for (int t = 0; t < nthreads; t++) pthread_join(th[t], NULL);
+
+        for (int t = 0; t < nthreads; t++) {
+            if (n_all + jobs[t].n_out > cap_all) {
+                while (n_all + jobs[t].n_out > cap_all) cap_all *= 2;
+                all = realloc(all, cap_all * sizeof(uint32_t));
+                if (!all) { perror("realloc"); return 2; }
+            }
+            memcpy(&all[n_all], jobs[t].out, jobs[t].n_out * sizeof(uint32_t));
+            n_all += jobs[t].n_out;
+        }
+        level_lo = level_hi;
+    }
+
+    for (int t = 0; t < nthreads; t++) {
+        transitions += jobs[t].transitions;
+        if (jobs[t].has_violation) {
+            violations++;
+            if (violations == 1) {
+                printf("\nVIOLATION: %s\n", jobs[t].first.what);
+                printf("  from ");
+                print_model(jobs[t].first.from);
+                printf("  on   ");
+                print_events(jobs[t].first.ev);
+                printf("\n  to   ");
+                print_model(jobs[t].first.to);
+                print_trace(init, jobs[t].first.from);
+            }
+        }
+        free(jobs[t].out);
+    }
+
+    /* state sanity: every reachable packed state decodes to a valid FSM state */
+    for (size_t i = 0; i < n_all; i++) {
+        model_t m;
+        unpack(all[i], &m);
+        if (!is_valid_state(m.st)) {
+            printf("\nVIOLATION: invalid FSM state %d reached\n", (int)m.st);
+            violations++;
+            break;
+        }
+    }
+
+    printf("\nreachable states : %zu (of %u packed)\n", n_all, n_packed);
+    printf("transitions      : %lu\n", transitions);
+    printf("conflict-free    : %s\n", violations ? "NO" : "yes");
+
+    /* traces are printed: parent becomes the packed -> reachable index map */
+    uint32_t *index = parent;
+    for (size_t i = 0; i < n_all; i++) index[all[i]] = (uint32_t)i;
+
+    int ped_ok, train_ok;
+    uint32_t ped_worst_s, train_worst_s;
+    unsigned ped_w   = longest_wait(all, index, n_all, ped_pending, nthreads, &ped_worst_s, &ped_ok);
+    unsigned train_w = longest_wait(all, index, n_all, train_pending, nthreads, &train_worst_s, &train_ok);
+
+    printf("longest ped wait : %s%.1fs (p -> WALK)\n", ped_ok ? "" : "UNBOUNDED >", ped_w / (double)TICKS_PER_S);
+    if (ped_w) { printf("  worst from: "); print_model(ped_worst_s); }
+    printf("longest train wait: %s%.1fs (t -> TRAIN start)\n", train_ok ? "" : "UNBOUNDED >", train_w / (double)TICKS_PER_S);
+    if (train_w) { printf("  worst from: "); print_model(train_worst_s); }
+
+    printf("elapsed          : %.3fs\n", elapsed_s(&t0));
+    fflush(stdout);
+
+    free(all);
+    free(visited);
+    free(parent);
+    free(parent_ev);
+
+    return (violations || !ped_ok || !train_ok) ? 1 : 0;
+}
@@ -0,0 +1,239 @@
+/*
+ * i1plan - timing plan compiler for the Intersection 1 process group (L1/R1L1/R3L1)
+ *
+ * Reads a text plan ("key = seconds" per line, '#' comments), validates it
+ * and publishes it as the next generation of the binary plan store
+ * /tmp/i1_plan.bin. L1 picks the new generation up and switches R3L1 and
+ * R1L1 to it together at the next cycle boundary; every process reads the
+ * timings straight from its read-only mapping of the store.
+ *
+ * Generation g is written into slot g % I1_PLAN_SLOTS. The slots of the
+ * generations L1 runs and has staged (run_gen, staged_gen) are never
+ * rewritten: a compile that would land on one is refused until the group
+ * has moved on at the next cycle boundary.
+ *
+ * Usage: i1plan <plan-file>   compile + publish
+ *        i1plan -l            list the store
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <stdint.h>
+#include <stddef.h>
+#include <errno.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+/* ================= PLAN STORE (MUST match L1, R1L1, R3L1) ================= */
+#define I1_PLAN_PATH    "/tmp/i1_plan.bin"
+#define I1_PLAN_MAGIC   0x4E4C5031u   /* "1PLN" */
+#define I1_PLAN_VERSION 2
+#define I1_PLAN_SLOTS   4             /* must divide 256 */
+
+typedef struct {
+    uint32_t gen;
+    uint16_t rs_green, l_green, yellow, all_red;
+    uint16_t tr_r3_s0, tr_r3_s1, tr_r3_s2;
+    uint16_t tr_r1_s6, tr_r1_s7, tr_r1_s8;
+    uint16_t tr_ex;
+    uint16_t pad;
+} i1_plan_slot_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t nslots;
+    uint32_t gen;                     /* newest published generation */
+    uint32_t run_gen;                 /* L1: generation the group runs */
+    uint32_t staged_gen;              /* L1: generation it switches to next */
+    i1_plan_slot_t slot[I1_PLAN_SLOTS];
+} i1_plan_file_t;
+
+/* ================= PLAN KEYS ================= */
+/* the report queue carries durations in one byte, hence max <= 255.
+ * Clearances (yellows, all-reds) never go below the built-in ones.
+ * Ranges MUST match PLAN_RANGE in R1L1 and R3L1. */
+static const struct { const char *name; size_t off; unsigned def, min, max; } KEYS[] = {
+    { "rs_green", offsetof(i1_plan_slot_t, rs_green), 20, 5, 120 },
+    { "l_green",  offsetof(i1_plan_slot_t, l_green),  12, 3,  60 },
+    { "yellow",   offsetof(i1_plan_slot_t, yellow),    4, 4,   6 },
+    { "all_red",  offsetof(i1_plan_slot_t, all_red),   2, 2,   6 },
+    { "tr_r3_s0", offsetof(i1_plan_slot_t, tr_r3_s0),  8, 3,  60 },
+    { "tr_r3_s1", offsetof(i1_plan_slot_t, tr_r3_s1),  4, 4,   6 },
+    { "tr_r3_s2", offsetof(i1_plan_slot_t, tr_r3_s2),  2, 2,   6 },
+    { "tr_r1_s6", offsetof(i1_plan_slot_t, tr_r1_s6), 15, 3,  60 },
+    { "tr_r1_s7", offsetof(i1_plan_slot_t, tr_r1_s7),  4, 4,   6 },
+    { "tr_r1_s8", offsetof(i1_plan_slot_t, tr_r1_s8),  2, 2,   6 },
+    { "tr_ex",    offsetof(i1_plan_slot_t, tr_ex),     5, 1,  30 },
+};
+#define N_KEYS (sizeof(KEYS)/sizeof(KEYS[0]))
+
+static uint16_t *key_field(i1_plan_slot_t *sl, unsigned k)
+{
+    return (uint16_t *)((char *)sl + KEYS[k].off);
+}
+
+static int parse_plan(const char *path, i1_plan_slot_t *sl)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+
+    memset(sl, 0, sizeof(*sl));
+    for (unsigned k = 0; k < N_KEYS; k++) *key_field(sl, k) = (uint16_t)KEYS[k].def;
+
+    char line[128];
+    int ln = 0, bad = 0;
+    while (fgets(line, sizeof(line), f)) {
+        ln++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char key[32], extra;
+        unsigned v;
+        int n = sscanf(line, " %31[a-z0-9_] = %u %c", key, &v, &extra);
+        if (n <= 0) continue;
+        if (n != 2) {
+            fprintf(stderr, "%s:%d: expected 'key = seconds'\n", path, ln);
+            bad = 1;
+            continue;
+        }
+
+        unsigned k = 0;
+        while (k < N_KEYS && strcmp(KEYS[k].name, key) != 0) k++;
+        if (k == N_KEYS) {
+            fprintf(stderr, "%s:%d: unknown key '%s'\n", path, ln, key);
+            bad = 1;
+            continue;
+        }
+        if (v < KEYS[k].min || v > KEYS[k].max) {
+            fprintf(stderr, "%s:%d: %s=%u out of range [%u..%u]\n",
+                    path, ln, key, v, KEYS[k].min, KEYS[k].max);
+            bad = 1;
+            continue;
+        }
+        *key_field(sl, k) = (uint16_t)v;
+    }
+    fclose(f);
+    return bad ? -1 : 0;
+}
+
+/* ================= STORE ================= */
+static i1_plan_file_t *open_store(int create)
+{
+    int fd = open(I1_PLAN_PATH, create ? (O_RDWR | O_CREAT) : O_RDONLY, 0644);
+    if (fd == -1) { perror(I1_PLAN_PATH); return NULL; }
+
+    struct stat st;
+    if (fstat(fd, &st) == -1) { perror("fstat"); close(fd); return NULL; }
+
+    int fresh = (st.st_size == 0);
+    if (fresh && !create) {
+        fprintf(stderr, "%s: empty store\n", I1_PLAN_PATH);
+        close(fd);
+        return NULL;
+    }
+    if (fresh && ftruncate(fd, sizeof(i1_plan_file_t)) == -1) {
+        perror("ftruncate");
+        close(fd);
+        return NULL;
+    }
+    if (!fresh && st.st_size != (off_t)sizeof(i1_plan_file_t)) {
+        fprintf(stderr, "%s: size %ld, expected %zu\n", I1_PLAN_PATH, (long)st.st_size, sizeof(i1_plan_file_t));
+        close(fd);
+        return NULL;
+    }
+
+    void *p = mmap(NULL, sizeof(i1_plan_file_t), create ? (PROT_READ | PROT_WRITE) : PROT_READ, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { perror("mmap"); return NULL; }
+
+    i1_plan_file_t *f = (i1_plan_file_t *)p;
+    if (fresh) {
+        f->version = I1_PLAN_VERSION;
+        f->nslots = I1_PLAN_SLOTS;
+        f->gen = 0;
+        f->run_gen = f->staged_gen = 0;
+        __sync_synchronize();
+        f->magic = I1_PLAN_MAGIC;
+    }
+    if (f->magic != I1_PLAN_MAGIC || f->version != I1_PLAN_VERSION || f->nslots != I1_PLAN_SLOTS) {
+        fprintf(stderr, "%s: not a version %d plan store\n", I1_PLAN_PATH, I1_PLAN_VERSION);
+        munmap(p, sizeof(i1_plan_file_t));
+        return NULL;
+    }
+    return f;
+}
+
+/* slot gen is cleared first and written last: readers never see a half slot as valid.
+ * Returns 0 if the slot holds a generation the group runs or is switching to. */
+static uint32_t publish(i1_plan_file_t *f, const i1_plan_slot_t *src)
+{
+    uint32_t gen = f->gen + 1;
+    if (gen == 0) gen = 1;
+    i1_plan_slot_t *sl = &f->slot[gen % I1_PLAN_SLOTS];
+
+    __sync_synchronize();
+    uint32_t held = sl->gen;
+    if (held && (held == f->run_gen || held == f->staged_gen)) {
+        fprintf(stderr, "%s: slot %u holds gen %u, which L1 %s; publish again after the next cycle boundary\n",
+                I1_PLAN_PATH, (unsigned)(gen % I1_PLAN_SLOTS), (unsigned)held,
+                held == f->run_gen ? "runs" : "is switching to");
+        return 0;
+    }
+
+    sl->gen = 0;
+    __sync_synchronize();
+    memcpy((char *)sl + sizeof(sl->gen), (const char *)src + sizeof(src->gen),
+           sizeof(*sl) - sizeof(sl->gen));
+    __sync_synchronize();
+    sl->gen = gen;
+    __sync_synchronize();
+    f->gen = gen;
+
+    msync(f, sizeof(*f), MS_SYNC);
+    return gen;
+}
+
+static void print_slot(const i1_plan_slot_t *sl, int newest)
+{
+    printf("  gen %-5u%s", (unsigned)sl->gen, newest ? "*" : " ");
+    for (unsigned k = 0; k < N_KEYS; k++) {
+        printf(" %s=%u", KEYS[k].name, *key_field((i1_plan_slot_t *)sl, k));
+    }
+    printf("\n");
+}
+
+int main(int argc, char **argv)
+{
+    if (argc == 2 && strcmp(argv[1], "-l") == 0) {
+        i1_plan_file_t *f = open_store(0);
+        if (!f) return 1;
+        printf("%s: newest gen %u, L1 runs gen %u, staged gen %u\n", I1_PLAN_PATH,
+               (unsigned)f->gen, (unsigned)f->run_gen, (unsigned)f->staged_gen);
+        for (int i = 0; i < I1_PLAN_SLOTS; i++) {
+            if (f->slot[i].gen) print_slot(&f->slot[i], f->slot[i].gen == f->gen);
+        }
+        return 0;
+    }
+    if (argc != 2 || argv[1][0] == '-') {
+        fprintf(stderr, "usage: %s <plan-file> | -l\n", argv[0]);
+        return 2;
+    }
+
+    i1_plan_slot_t sl;
+    if (parse_plan(argv[1], &sl) != 0) return 1;
+
+    i1_plan_file_t *f = open_store(1);
+    if (!f) return 1;
+
+    uint32_t gen = publish(f, &sl);
+    if (!gen) return 1;
+    sl.gen = gen;
+    printf("%s: published gen %u (slot %u); L1 switches the group at the next cycle boundary\n",
+           I1_PLAN_PATH, (unsigned)gen, (unsigned)(gen % I1_PLAN_SLOTS));
+    print_slot(&sl, 1);
+    return 0;
+}
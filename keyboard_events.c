@@ -6,6 +6,12 @@
  *   t = Train detected   (sets train_request=1 and train_active=1)
  *   c = Train cleared    (sets train_active=0)
  *   p = Ped button press (sets ped_request=1)
+ *
+ * Events are sent with a priority class (t > c > p). Ped presses are only
+ * sent while more than MQ_RESERVED_SLOTS slots are free, and a press is
+ * coalesced while a previous one is still waiting in the queue. Train and
+ * clear events retry a full queue (SEND_RETRIES x SEND_RETRY_MS) instead
+ * of being lost.
  */
 
 #include <stdio.h>
@@ -13,6 +19,8 @@
 #include <mqueue.h>
 #include <fcntl.h>
 #include <errno.h>
+#include <string.h>
+#include <time.h>
 
 #define QUEUE_NAME "/traffic_mq"
 #define MSG_SIZE   2
@@ -21,14 +29,40 @@
 #define EVT_TRAIN_CLEAR   'c'
 #define EVT_PED_PRESS     'p'
 
+/* MUST match traffic_fsm.c */
+#define PRIO_TRAIN        3
+#define PRIO_CLEAR        2
+#define PRIO_PED          1
+#define MQ_RESERVED_SLOTS  4
+
+/* server drains the whole queue every 100ms poll */
+#define PED_COALESCE_MS  100
+
+/* train/clear are never dropped: retry a full queue for up to 1s (as demo2) */
+#define SEND_RETRY_MS     10
+#define SEND_RETRIES     100
+
+static unsigned long ped_coalesced = 0;
+static unsigned long ped_dropped   = 0;
+static unsigned long send_retries  = 0;
+
+static long now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec * 1000L + ts.tv_nsec / 1000000L;
+}
+
 int main(void)
 {
     mqd_t mq;
     char msg[MSG_SIZE];
     char c;
+    unsigned prio;
+    long last_ped_ms = -PED_COALESCE_MS;
 
-    /* Wait until traffic FSM creates the queue */
-    while ((mq = mq_open(QUEUE_NAME, O_WRONLY)) == (mqd_t)-1) {
+    /* Wait until traffic FSM creates the queue (non-blocking: never stall on a full queue) */
+    while ((mq = mq_open(QUEUE_NAME, O_WRONLY | O_NONBLOCK)) == (mqd_t)-1) {
         perror("keyboard waiting for queue");
         sleep(1);
     }
@@ -42,19 +76,47 @@ int main(void)
     while (1) {
         scanf(" %c", &c);
 
-        if (c == 't' || c == 'T') c = EVT_TRAIN_DETECT;
-        else if (c == 'c' || c == 'C') c = EVT_TRAIN_CLEAR;
-        else if (c == 'p' || c == 'P') c = EVT_PED_PRESS;
+        if (c == 't' || c == 'T') { c = EVT_TRAIN_DETECT; prio = PRIO_TRAIN; }
+        else if (c == 'c' || c == 'C') { c = EVT_TRAIN_CLEAR; prio = PRIO_CLEAR; }
+        else if (c == 'p' || c == 'P') { c = EVT_PED_PRESS; prio = PRIO_PED; }
         else {
             printf("Ignored. Use t/c/p.\n");
             continue;
         }
 
+        if (c == EVT_PED_PRESS) {
+            struct mq_attr attr;
+            if (mq_getattr(mq, &attr) == 0) {
+                /* previous press still queued -> one slot is enough */
+                if (attr.mq_curmsgs > 0 && now_ms() - last_ped_ms < PED_COALESCE_MS) {
+                    ped_coalesced++;
+                    printf("Ped press coalesced (total %lu)\n", ped_coalesced);
+                    continue;
+                }
+                /* keep reserved slots for train events */
+                if (attr.mq_curmsgs >= attr.mq_maxmsg - MQ_RESERVED_SLOTS) {
+                    ped_dropped++;
+                    printf("Queue nearly full, ped press dropped (total %lu)\n", ped_dropped);
+                    continue;
+                }
+            }
+            last_ped_ms = now_ms();
+        }
+
         msg[0] = c;
         msg[1] = '\0';
 
-        if (mq_send(mq, msg, MSG_SIZE, 0) == -1) {
-            perror("mq_send");
+        for (int attempt = 0; ; attempt++) {
+            if (mq_send(mq, msg, MSG_SIZE, prio) == 0) break;
+
+            /* ped never waits; train/clear retry until the server drains */
+            if (errno == EAGAIN && c != EVT_PED_PRESS && attempt < SEND_RETRIES) {
+                send_retries++;
+                usleep(SEND_RETRY_MS * 1000);
+                continue;
+            }
+            fprintf(stderr, "mq_send '%c' failed: %s (retries so far %lu)\n", c, strerror(errno), send_retries);
+            break;
         }
     }
 
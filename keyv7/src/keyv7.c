@@ -4,6 +4,26 @@
  * PURPOSE
  * - Read keys locally on VM7
  * - Send events ('t','c','p') to BOTH servers (VM6 and VM8) via QNET
+ * - "v<lane>" sends a vehicle detector call (lane 0..5, see LANES below)
+ * - "a<track> <eta_s>" broadcasts a train approach (track id + seconds until
+ *   the gate closes) so every intersection starts clearing before 't';
+ *   "x<track>" cancels it
+ * - "b<keys>" sends a whole key sequence (e.g. "b v0v1pv3t") as ONE batch
+ *   message, applied in order by the server in a single receive
+ * - Each event goes to all servers at once (one sender thread per node), so
+ *   a slow or dead node does not delay the others
+ * - Events carry a per-node sequence number; a send that times out is
+ *   retried with the SAME seq, and the server applies each seq only once
+ *   (a retry of an applied event is answered "DUP")
+ *
+ * - If an event bus (evtbus) runs on this node, events are PUBLISHED to it
+ *   once instead, and every subscribed intersection picks them up; VM6/VM8
+ *   are only used without a bus (or with -d). "@<n>" addresses following
+ *   events to intersection n only ("@0" = all, the default).
+ *
+ * USAGE
+ *   keyv7 [-T timeout_ms] [-r tries] [-d]    (defaults 100 ms, 20 tries;
+ *                                             -d: direct to VM6/VM8)
  *
  * REQUIREMENTS
  * - VM6 server: name_attach(NULL, "traffic_evt", 0)
@@ -19,7 +39,13 @@
 #include <stdio.h>
 #include <errno.h>
 #include <string.h>
+#include <pthread.h>
+#include <time.h>
+#include <unistd.h>
+#include <stdint.h>
+#include <stddef.h>
 #include <sys/dispatch.h>   // name_open(), MsgSend(), name_close()
+#include <sys/neutrino.h>   // TimerTimeout()
 
 /* ---- MUST match each server's name_attach point ---- */
 #define AP_NAME "traffic_evt"
@@ -32,22 +58,179 @@
 #define EVT_TRAIN_DETECT  't'
 #define EVT_TRAIN_CLEAR   'c'
 #define EVT_PED_PRESS     'p'
+#define EVT_VEH_CALL      'v'
+
+/* LANES (MUST match the servers' DETECTORS):
+ *   0 = R3 RS, 1 = R3 L,
+ *   2 = side road W->E RS, 3 = W->E L, 4 = E->W RS, 5 = E->W L
+ */
+#define N_LANES 6
+
+/* last epoch used on this node */
+#define EPOCH_PATH "/tmp/keyv7.epoch"
+
+/* retry policy: short per-try timeout, many tries (dedup makes it safe) */
+#define SEND_TIMEOUT_MS_DEFAULT  100
+#define SEND_TRIES_DEFAULT       20
 
 /* EXACT message structs expected by server */
 typedef struct {
     _Uint16t type;
     _Uint16t subtype;
     char     ev;
-    char     pad[3];
+    char     pad[3];    /* 'v': pad[0] = lane id */
     int      client_id;
+    uint32_t epoch;     /* grows on every client start; a newer epoch restarts seq */
+    uint32_t seq;       /* per node, from 1 */
 } evt_msg_t;
 
 typedef struct {
     _Uint16t type;
     _Uint16t subtype;
     char     text[64];
+    uint32_t last_seq;  /* highest seq the server has applied from us */
 } evt_reply_t;
 
+/* train approach, MUST match the servers' train_appr_msg_t */
+#define MSG_TRAIN_APPROACH  0x23
+#define APPR_SUB_ETA        0
+#define APPR_SUB_CANCEL     1
+
+typedef struct {
+    _Uint16t type;
+    _Uint16t subtype;
+    _Uint16t track_id;
+    _Uint16t eta_s;
+    int      client_id;
+    uint32_t epoch;
+    uint32_t seq;
+} train_appr_msg_t;
+
+/* batch, MUST match the servers' evt_batch_msg_t */
+#define MSG_EVT_BATCH   0x24
+#define EVT_BATCH_MAX   64
+
+typedef struct {
+    uint32_t t_ms;
+    char     ev;
+    uint8_t  lane;
+    _Uint16t pad;
+} evt_item_t;
+
+typedef struct {
+    _Uint16t   type;
+    _Uint16t   count;
+    char       pad[4];
+    int        client_id;
+    uint32_t   epoch;
+    uint32_t   seq;
+    evt_item_t items[EVT_BATCH_MAX];
+} evt_batch_msg_t;
+
+/* event bus, MUST match evtbus */
+#define BUS_PATH       "/dev/name/local/traffic_bus"
+#define MSG_BUS_PUB    0x30
+#define BUS_PUB_MAX    64
+#define BUS_ROAD_ANY   0
+#define BUS_CLS_TRAIN    1
+#define BUS_CLS_PED      2
+#define BUS_CLS_VEH      3
+#define BUS_CLS_APPROACH 4
+
+typedef struct {
+    uint8_t  isect;
+    uint8_t  road;
+    uint8_t  cls;
+    uint8_t  hop;
+    char     ev;
+    uint8_t  lane;
+    _Uint16t subtype;
+    _Uint16t track_id;
+    _Uint16t eta_s;
+    int      client_id;
+    uint32_t epoch;
+    uint32_t seq;
+    uint32_t t_ms;
+    uint32_t pad;
+} bus_rec_t;
+
+typedef struct {
+    _Uint16t  type;
+    _Uint16t  count;
+    char      pad[4];
+    bus_rec_t recs[BUS_PUB_MAX];
+} bus_pub_t;
+
+/* servers; client_id is this client's id there (see client_ids()) */
+typedef struct {
+    const char *tag;
+    const char *path;
+    int         client_id;
+    int         coid;
+    uint32_t    seq;        /* last seq sent to this node */
+} node_t;
+
+static node_t NODES[] = {
+    { "VM6", VM6_PATH, 1, -1, 0 },     /* client_id: role until client_ids() */
+    { "VM8", VM8_PATH, 2, -1, 0 },
+};
+#define N_NODES ((int)(sizeof(NODES) / sizeof(NODES[0])))
+
+static node_t BUS = { "BUS", BUS_PATH, 0, -1, 0 };
+
+/* one broadcast: the same message to every connected node */
+typedef union {
+    evt_msg_t        evt;
+    train_appr_msg_t appr;
+    evt_batch_msg_t  batch;
+    bus_pub_t        bus;
+} out_msg_t;
+
+typedef struct {
+    node_t   *node;
+    out_msg_t msg;
+    int       len;         /* bytes of msg to send */
+    char      what[24];
+} send_job_t;
+
+static uint32_t epoch;
+static int      send_timeout_ms = SEND_TIMEOUT_MS_DEFAULT;
+static int      send_tries      = SEND_TRIES_DEFAULT;
+
+/* Servers reset a client's seq only for a NEWER epoch, so every start must
+ * raise it: the start time, but at least one past the last epoch used on
+ * this node (a restart within the same second, or after a clock step back).
+ */
+static uint32_t next_epoch(void)
+{
+    uint32_t e = (uint32_t)time(NULL), prev = 0;
+    FILE *f = fopen(EPOCH_PATH, "r+");
+    if (!f) f = fopen(EPOCH_PATH, "w+");
+    if (!f) return e;
+    if (fscanf(f, "%u", &prev) == 1 && prev >= e) e = prev + 1;
+    rewind(f);
+    fprintf(f, "%u\n", (unsigned)e);
+    fclose(f);
+    return e;
+}
+
+/* Servers dedup per client_id, so two keyv7s (on one node or on two) must
+ * never share one. The id hashes this node's name and our pid, keeps the
+ * role (bus, VM6, VM8) in the low bits, and sits at 1 << 30 and up, clear of
+ * detload (900 + n) and evtgen (1000 + n).
+ */
+static void client_ids(void)
+{
+    char host[64] = "";
+    uint32_t h = 2166136261u;                   /* FNV-1a */
+    gethostname(host, sizeof(host) - 1);
+    for (const char *c = host; *c; c++) h = (h ^ (uint8_t)*c) * 16777619u;
+    h = (h ^ (uint32_t)getpid()) * 16777619u;
+    int base = (int)(0x40000000u | (h & 0x3FFFFFFCu));
+    BUS.client_id += base;
+    for (int i = 0; i < N_NODES; i++) NODES[i].client_id += base;
+}
+
 /* flush extra chars until newline so user can type "t + enter" safely */
 static void flush_line(void)
 {
@@ -66,75 +249,321 @@ static int try_open(const char *path)
     return coid;
 }
 
-static void try_send(int coid, const char *tag, char ev, int client_id)
+static void *send_thread(void *arg)
 {
-    evt_msg_t msg;
+    send_job_t *job = arg;
     evt_reply_t rep;
-    memset(&msg, 0, sizeof(msg));
     memset(&rep, 0, sizeof(rep));
 
-    msg.type = 0x22;
-    msg.subtype = 0;
-    msg.ev = ev;
-    msg.client_id = client_id;
+    /* client_id/epoch/seq sit at the same offsets in every direct message;
+     * a bus publication numbers each record. seq is taken once; every
+     * retry below resends the same seq.
+     */
+    node_t *n = job->node;
+    uint32_t seq;
+    if (job->msg.evt.type == MSG_BUS_PUB) {
+        for (int i = 0; i < job->msg.bus.count; i++) {
+            job->msg.bus.recs[i].client_id = n->client_id;
+            job->msg.bus.recs[i].epoch = epoch;
+            job->msg.bus.recs[i].seq = ++n->seq;
+        }
+        seq = n->seq;
+    } else {
+        job->msg.evt.client_id = n->client_id;
+        job->msg.evt.epoch = epoch;
+        job->msg.evt.seq = seq = ++n->seq;
+    }
 
-    if (MsgSend(coid, &msg, sizeof(msg), &rep, sizeof(rep)) == -1) {
-        printf("[kb_vm7] %s MsgSend failed: %s\n", tag, strerror(errno));
-        return;
+    uint64_t to_ns = (uint64_t)send_timeout_ms * 1000000ULL;
+    for (int try = 1; try <= send_tries; try++) {
+        if (n->coid == -1) {
+            /* server restarted or failed over: the name comes back, reattach */
+            n->coid = name_open(n->path, 0);
+            if (n->coid == -1) { usleep((useconds_t)send_timeout_ms * 1000); continue; }
+        }
+        TimerTimeout(CLOCK_MONOTONIC, _NTO_TIMEOUT_SEND | _NTO_TIMEOUT_REPLY, NULL, &to_ns, NULL);
+        if (MsgSend(n->coid, &job->msg, job->len, &rep, sizeof(rep)) != -1) {
+            printf("[kb_vm7] %s sent %s #%u (try %d) -> reply: %s [applied up to #%u]\n",
+                   n->tag, job->what, (unsigned)seq, try, rep.text,
+                   (unsigned)rep.last_seq);
+            return NULL;
+        }
+        if (errno != ETIMEDOUT) {
+            name_close(n->coid);
+            n->coid = -1;
+        }
+    }
+    printf("[kb_vm7] %s %s #%u LOST after %d tries: %s\n", n->tag, job->what,
+           (unsigned)seq, send_tries, strerror(errno));
+    return NULL;
+}
+
+static uint32_t now_ms(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint32_t)((uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL);
+}
+
+/* "v0v1pv3t" -> batch items; returns item count, -1 on a bad key */
+static int parse_batch(const char *keys, evt_batch_msg_t *b)
+{
+    int n = 0;
+    uint32_t t = now_ms();
+    for (const char *k = keys; *k && *k != '\n'; k++) {
+        char ev = 0;
+        int lane = 0;
+        if (*k == ' ' || *k == '\t' || *k == '\r') continue;
+        if      (*k == 't' || *k == 'T') ev = EVT_TRAIN_DETECT;
+        else if (*k == 'c' || *k == 'C') ev = EVT_TRAIN_CLEAR;
+        else if (*k == 'p' || *k == 'P') ev = EVT_PED_PRESS;
+        else if (*k == 'v' || *k == 'V') {
+            ev = EVT_VEH_CALL;
+            lane = k[1] - '0';
+            if (lane < 0 || lane >= N_LANES) return -1;
+            k++;
+        } else return -1;
+        if (n == EVT_BATCH_MAX) return -1;
+        b->items[n].t_ms = t;
+        b->items[n].ev = ev;
+        b->items[n].lane = (uint8_t)lane;
+        n++;
     }
+    return n;
+}
+
+static uint8_t bus_class(char ev)
+{
+    return ev == EVT_PED_PRESS ? BUS_CLS_PED : ev == EVT_VEH_CALL ? BUS_CLS_VEH : BUS_CLS_TRAIN;
+}
 
-    printf("[kb_vm7] %s sent '%c' -> reply: %s\n", tag, ev, rep.text);
+static void bus_rec_event(bus_rec_t *r, uint8_t isect, char ev, uint8_t lane, uint32_t t)
+{
+    r->isect = isect;
+    r->road = (ev == EVT_VEH_CALL && lane < 2) ? '3' : BUS_ROAD_ANY;   /* lanes 0,1 = R3 */
+    r->cls = bus_class(ev);
+    r->ev = ev;
+    r->lane = lane;
+    r->t_ms = t;
 }
 
-int main(void)
+/* the same events as one bus publication for intersection isect (0 = all) */
+static int to_bus(const out_msg_t *in, out_msg_t *out, uint8_t isect)
 {
+    bus_pub_t *b = &out->bus;
+    memset(b, 0, sizeof(*b));
+    b->type = MSG_BUS_PUB;
+    uint32_t t = now_ms();
+
+    if (in->evt.type == MSG_EVT_BATCH) {
+        for (int i = 0; i < in->batch.count; i++)
+            bus_rec_event(&b->recs[i], isect, in->batch.items[i].ev, in->batch.items[i].lane,
+                          in->batch.items[i].t_ms);
+        b->count = in->batch.count;
+    } else if (in->evt.type == MSG_TRAIN_APPROACH) {
+        bus_rec_t *r = &b->recs[0];
+        r->isect = isect;
+        r->cls = BUS_CLS_APPROACH;
+        r->subtype = in->appr.subtype;
+        r->track_id = in->appr.track_id;
+        r->eta_s = in->appr.eta_s;
+        r->t_ms = t;
+        b->count = 1;
+    } else {
+        bus_rec_event(&b->recs[0], isect, in->evt.ev, (uint8_t)in->evt.pad[0], t);
+        b->count = 1;
+    }
+    return (int)(offsetof(bus_pub_t, recs) + (size_t)b->count * sizeof(bus_rec_t));
+}
+
+static void broadcast(const out_msg_t *msg, int len, const char *what)
+{
+    send_job_t jobs[N_NODES];
+    pthread_t  th[N_NODES];
+    int        started[N_NODES];
+
+    for (int i = 0; i < N_NODES; i++) {
+        started[i] = 0;
+        if (NODES[i].coid == -1) continue;
+        jobs[i].node = &NODES[i];
+        jobs[i].msg = *msg;
+        jobs[i].len = len;
+        snprintf(jobs[i].what, sizeof(jobs[i].what), "%s", what);
+        if (pthread_create(&th[i], NULL, send_thread, &jobs[i]) == 0) started[i] = 1;
+        else send_thread(&jobs[i]);     /* no thread: send inline */
+    }
+    for (int i = 0; i < N_NODES; i++)
+        if (started[i]) pthread_join(th[i], NULL);
+}
+
+int main(int argc, char **argv)
+{
+    int opt, direct = 0;
+    while ((opt = getopt(argc, argv, "T:r:d")) != -1) {
+        if (opt == 'T') send_timeout_ms = atoi(optarg);
+        else if (opt == 'r') send_tries = atoi(optarg);
+        else if (opt == 'd') direct = 1;
+        else {
+            fprintf(stderr, "usage: %s [-T timeout_ms] [-r tries] [-d]\n", argv[0]);
+            return EXIT_FAILURE;
+        }
+    }
+    if (send_timeout_ms < 1) send_timeout_ms = 1;
+    if (send_tries < 1) send_tries = 1;
+    epoch = next_epoch();
+    client_ids();
+
     printf("[kb_vm7] Keyboard Client (broadcast)\n");
-    printf("[kb_vm7] VM6 path: %s\n", VM6_PATH);
-    printf("[kb_vm7] VM8 path: %s\n\n", VM8_PATH);
+    printf("[kb_vm7] client %d, epoch %u, %d ms x %d tries per event\n\n",
+           BUS.client_id, (unsigned)epoch, send_timeout_ms, send_tries);
 
-    /* connect to both (if available) */
-    int coid6 = try_open(VM6_PATH);
-    int coid8 = try_open(VM8_PATH);
+    /* a local bus: publish there, subscribers decide who acts */
+    int connected = 0;
+    if (!direct) BUS.coid = name_open(BUS.path, 0);
+    int use_bus = (BUS.coid != -1);
+    if (use_bus) {
+        printf("[kb_vm7] publishing to the event bus at %s\n", BUS.path);
+        connected = 1;
+    } else {
+        for (int i = 0; i < N_NODES; i++)
+            printf("[kb_vm7] %s path: %s\n", NODES[i].tag, NODES[i].path);
+        for (int i = 0; i < N_NODES; i++) {
+            NODES[i].coid = try_open(NODES[i].path);
+            if (NODES[i].coid != -1) connected++;
+        }
+    }
 
-    if (coid6 == -1 && coid8 == -1) {
+    if (!connected) {
         printf("[kb_vm7] No servers connected. Start VM6/VM8 servers first.\n");
         return EXIT_FAILURE;
     }
 
-    printf("\nCommands: t=train, c=clear, p=ped, q=quit\n\n");
+    printf("\nCommands: t=train, c=clear, p=ped, v<lane>=vehicle call (0..%d),\n"
+           "          a<track> <eta_s>=train approach, x<track>=cancel approach,\n"
+           "          b<keys>=send keys as one batch (e.g. b v0v1p),\n"
+           "          @<n>=address intersection n (bus only, @0=all), q=quit\n\n", N_LANES - 1);
     fflush(stdout);
 
+    uint8_t isect = 0;
+
     for (;;) {
         int ch = getchar();
         if (ch == EOF) break;
 
         if (ch == '\n' || ch == '\r' || ch == ' ' || ch == '\t') continue;
-        flush_line();
 
-        char ev = 0;
-        if      (ch == 't' || ch == 'T') ev = EVT_TRAIN_DETECT;
-        else if (ch == 'c' || ch == 'C') ev = EVT_TRAIN_CLEAR;
-        else if (ch == 'p' || ch == 'P') ev = EVT_PED_PRESS;
-        else if (ch == 'q' || ch == 'Q') break;
-        else {
-            printf("[kb_vm7] ignored '%c' (use t/c/p/q)\n", ch);
+        out_msg_t msg;
+        int len = (int)sizeof(evt_msg_t);
+        char what[24];
+        memset(&msg, 0, sizeof(msg));
+
+        if (ch == '@') {
+            unsigned n = 0;
+            char line[16];
+            if (!fgets(line, sizeof(line), stdin)) break;
+            if (!strchr(line, '\n')) flush_line();
+            if (sscanf(line, "%u", &n) != 1 || n > 255) {
+                printf("[kb_vm7] use @<intersection> (0 = all)\n");
+            } else {
+                isect = (uint8_t)n;
+                if (n) printf("[kb_vm7] events now go to intersection %u\n", n);
+                else   printf("[kb_vm7] events now go to all intersections\n");
+            }
+            fflush(stdout);
+            continue;
+        }
+
+        if (ch == 'b' || ch == 'B') {
+            char line[EVT_BATCH_MAX * 2 + 16];
+            if (!fgets(line, sizeof(line), stdin)) break;
+            if (!strchr(line, '\n')) flush_line();
+            int n = parse_batch(line, &msg.batch);
+            if (n <= 0) {
+                printf("[kb_vm7] use b<keys>: up to %d of t c p v<lane>\n", EVT_BATCH_MAX);
+                fflush(stdout);
+                continue;
+            }
+            msg.batch.type = MSG_EVT_BATCH;
+            msg.batch.count = (_Uint16t)n;
+            len = (int)(offsetof(evt_batch_msg_t, items) + (size_t)n * sizeof(evt_item_t));
+            snprintf(what, sizeof(what), "batch of %d", n);
+        } else if (ch == 'a' || ch == 'A' || ch == 'x' || ch == 'X') {
+            /* "a<track> <eta_s>" / "x<track>": rest of the line */
+            char line[32];
+            unsigned track = 0, eta = 0;
+            int cancel = (ch == 'x' || ch == 'X');
+            if (!fgets(line, sizeof(line), stdin)) break;
+            if (!strchr(line, '\n')) flush_line();
+            int n = sscanf(line, "%u %u", &track, &eta);
+            if (n < (cancel ? 1 : 2) || track > 0xFFFFu || eta > 0xFFFFu) {
+                printf("[kb_vm7] use a<track> <eta_s> or x<track>\n");
+                fflush(stdout);
+                continue;
+            }
+            msg.appr.type = MSG_TRAIN_APPROACH;
+            msg.appr.subtype = cancel ? APPR_SUB_CANCEL : APPR_SUB_ETA;
+            msg.appr.track_id = (_Uint16t)track;
+            msg.appr.eta_s = (_Uint16t)(cancel ? 0 : eta);
+            if (cancel) snprintf(what, sizeof(what), "'x%u'", track);
+            else        snprintf(what, sizeof(what), "'a%u %u'", track, eta);
+        } else {
+            /* "v<lane>": lane digit follows the key */
+            int lane = 0;
+            if (ch == 'v' || ch == 'V') {
+                int d = getchar();
+                lane = (d >= '0' && d < '0' + N_LANES) ? d - '0' : -1;
+                if (d != '\n' && d != EOF) flush_line();
+                if (lane < 0) {
+                    printf("[kb_vm7] use v0..v%d\n", N_LANES - 1);
+                    fflush(stdout);
+                    continue;
+                }
+            } else {
+                flush_line();
+            }
+
+            char ev = 0;
+            if      (ch == 't' || ch == 'T') ev = EVT_TRAIN_DETECT;
+            else if (ch == 'c' || ch == 'C') ev = EVT_TRAIN_CLEAR;
+            else if (ch == 'p' || ch == 'P') ev = EVT_PED_PRESS;
+            else if (ch == 'v' || ch == 'V') ev = EVT_VEH_CALL;
+            else if (ch == 'q' || ch == 'Q') break;
+            else {
+                printf("[kb_vm7] ignored '%c' (use t/c/p/v<lane>/a<track> <eta>/x<track>/b<keys>/q)\n", ch);
+                fflush(stdout);
+                continue;
+            }
+            msg.evt.type = 0x22;
+            msg.evt.subtype = 0;
+            msg.evt.ev = ev;
+            msg.evt.pad[0] = (char)lane;
+            snprintf(what, sizeof(what), "'%c'", ev);
+        }
+
+        if (use_bus) {
+            /* one publication; send_thread retries and reattaches */
+            send_job_t job;
+            job.node = &BUS;
+            job.len = to_bus(&msg, &job.msg, isect);
+            snprintf(job.what, sizeof(job.what), "%s", what);
+            send_thread(&job);
             fflush(stdout);
             continue;
         }
 
         /* If a server wasn’t connected at startup, try reconnect on each keypress */
-        if (coid6 == -1) coid6 = try_open(VM6_PATH);
-        if (coid8 == -1) coid8 = try_open(VM8_PATH);
+        for (int i = 0; i < N_NODES; i++)
+            if (NODES[i].coid == -1) NODES[i].coid = try_open(NODES[i].path);
 
-        /* send to whichever is connected */
-        if (coid6 != -1) try_send(coid6, "VM6", ev, 700);
-        if (coid8 != -1) try_send(coid8, "VM8", ev, 800);
+        /* send to whichever is connected, all at once */
+        broadcast(&msg, len, what);
 
         fflush(stdout);
     }
 
-    if (coid6 != -1) name_close(coid6);
-    if (coid8 != -1) name_close(coid8);
+    for (int i = 0; i < N_NODES; i++)
+        if (NODES[i].coid != -1) name_close(NODES[i].coid);
+    if (BUS.coid != -1) name_close(BUS.coid);
 
     printf("[kb_vm7] exit\n");
     fflush(stdout);
@@ -0,0 +1,264 @@
+/*
+ * trace2json - Chrome / Perfetto timeline from the controllers' traces
+ *
+ * Converts the binary traces demo1 / demo3 write with -R <file> into
+ * Chrome trace JSON (open in ui.perfetto.dev or chrome://tracing):
+ *
+ *   one process per input file (controller), one thread per signal head
+ *     with a span per aspect (GREEN / YELLOW / RED / WALK ...)
+ *   an "events" thread: every input applied (t c p v, approaches)
+ *   a "decisions" thread: preemptions, train/ped begin and over,
+ *     gap-out / max-out / skip, interlock trips
+ *   flow arrows from an input to the decisions it caused
+ *
+ * Several files are merged on CLOCK_REALTIME (each session records the
+ * realtime / monotonic pair at open), so demo1 and demo3 on different VMs
+ * line up (the L1 / R1L1 / R3L1 road nodes record no trace). Records are
+ * streamed one at a time per input; memory does not grow with the trace.
+ *
+ * Usage: trace2json [-o out.json] trace [trace ...]
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <unistd.h>
+
+#define MAX_IN      16
+#define TR_VERSION  1
+#define TR_HEADS    4
+#define TR_TRACK_CTRL  0xFF
+#define TR_TRACK_CLOCK 0xFE
+#define TID_EVENTS     10
+#define TID_DECISIONS  11
+
+enum { TR_K_META = 0, TR_K_PHASE, TR_K_EVENT, TR_K_DECISION };
+enum { TR_FLOW_NONE = 0, TR_FLOW_START, TR_FLOW_STEP, TR_FLOW_END };
+
+/* MUST match demo1 / demo3 (TRACE RECORDER) */
+typedef struct {
+    uint64_t t_us;
+    uint8_t  kind;
+    uint8_t  track;
+    uint8_t  mode;
+    uint8_t  flag;
+    uint16_t state;
+    uint16_t arg;
+    uint32_t flow;
+    char     name[12];
+} trace_rec_t;
+
+typedef struct {
+    const char *path;
+    FILE       *f;
+    int         pid;
+    long        nrec;
+    unsigned    session;
+    int64_t     off_us;                   /* realtime - monotonic of the session */
+    trace_rec_t cur;                      /* next non-META record */
+    int         have;
+    uint64_t    last_ts;
+    int         open[TR_HEADS];           /* a phase span is open on the head */
+} input_t;
+
+static FILE *out;
+static int   n_out = 0;
+
+/* ================= JSON ================= */
+static void json_str(const char *s, size_t max)
+{
+    fputc('"', out);
+    for (size_t i = 0; i < max && s[i]; i++) {
+        unsigned char c = (unsigned char)s[i];
+        if (c == '"' || c == '\\') fprintf(out, "\\%c", c);
+        else if (c < 0x20)         fprintf(out, "\\u%04x", c);
+        else                       fputc(c, out);
+    }
+    fputc('"', out);
+}
+
+/* opens one trace event object; the caller adds fields and closes it */
+static void ev_begin(const char *ph, int pid, int tid, uint64_t ts)
+{
+    fprintf(out, "%s\n{\"ph\":\"%s\",\"pid\":%d,\"tid\":%d,\"ts\":%llu",
+            n_out++ ? "," : "", ph, pid, tid, (unsigned long long)ts);
+}
+
+static void meta(int pid, int tid, const char *what, const char *name, size_t max)
+{
+    ev_begin("M", pid, tid, 0);
+    fprintf(out, ",\"name\":\"%s\",\"args\":{\"name\":", what);
+    json_str(name, max);
+    fputs("}}", out);
+    if (tid) {
+        ev_begin("M", pid, tid, 0);
+        fprintf(out, ",\"name\":\"thread_sort_index\",\"args\":{\"sort_index\":%d}}", tid);
+    }
+}
+
+static void state_args(const trace_rec_t *r)
+{
+    fprintf(out, ",\"args\":{\"state\":\"%s S%02u\",\"arg\":%u}",
+            r->mode == 'T' ? "TRAIN" : "NORMAL", (unsigned)r->state, (unsigned)r->arg);
+}
+
+/* ================= INPUT ================= */
+static void close_spans(input_t *in)
+{
+    for (int h = 0; h < TR_HEADS; h++) {
+        if (!in->open[h]) continue;
+        ev_begin("E", in->pid, h + 1, in->last_ts);
+        fputs("}", out);
+        in->open[h] = 0;
+    }
+}
+
+static void on_meta(input_t *in, const trace_rec_t *r)
+{
+    if (r->track == TR_TRACK_CTRL) {
+        if (r->arg != TR_VERSION)
+            fprintf(stderr, "%s: trace version %u (expected %u)\n", in->path, (unsigned)r->arg, TR_VERSION);
+        close_spans(in);                  /* a restart begins a new session */
+        in->session++;
+        in->off_us = 0;
+        meta(in->pid, 0, "process_name", r->name, sizeof(r->name));
+        if (in->session == 1) {
+            meta(in->pid, TID_EVENTS, "thread_name", "events", 6);
+            meta(in->pid, TID_DECISIONS, "thread_name", "decisions", 9);
+        }
+    } else if (r->track == TR_TRACK_CLOCK) {
+        uint64_t real;
+        memcpy(&real, r->name, sizeof(real));
+        in->off_us = (int64_t)(real - r->t_us);
+    } else if (r->track < TR_HEADS) {
+        meta(in->pid, r->track + 1, "thread_name", r->name, sizeof(r->name));
+    }
+}
+
+/* next data record into in->cur; META records are handled on the way */
+static void advance(input_t *in)
+{
+    trace_rec_t r;
+    in->have = 0;
+    while (fread(&r, sizeof(r), 1, in->f) == 1) {
+        in->nrec++;
+        if (r.kind > TR_K_DECISION || (in->session == 0 && !(r.kind == TR_K_META && r.track == TR_TRACK_CTRL))) {
+            fprintf(stderr, "%s: not a controller trace (record %ld)\n", in->path, in->nrec);
+            return;
+        }
+        if (r.kind == TR_K_META) { on_meta(in, &r); continue; }
+        in->cur = r;
+        in->have = 1;
+        return;
+    }
+}
+
+/* ================= EXPORT ================= */
+static void flow(const input_t *in, int tid, uint64_t ts, const trace_rec_t *r)
+{
+    static const char *const PH[] = { "", "s", "t", "f" };
+    if (r->flag == TR_FLOW_NONE || r->flag > TR_FLOW_END) return;
+    ev_begin(PH[r->flag], in->pid, tid, ts);
+    fprintf(out, ",\"name\":\"cause\",\"cat\":\"flow\",\"id\":%llu%s}",
+            ((unsigned long long)in->pid << 40) | ((unsigned long long)in->session << 32) | r->flow,
+            r->flag == TR_FLOW_END ? ",\"bp\":\"e\"" : "");
+}
+
+static void emit(input_t *in)
+{
+    const trace_rec_t *r = &in->cur;
+    uint64_t ts = (uint64_t)((int64_t)r->t_us + in->off_us);
+    if (ts < in->last_ts) ts = in->last_ts;   /* keep spans well nested */
+    in->last_ts = ts;
+
+    if (r->kind == TR_K_PHASE) {
+        if (r->track >= TR_HEADS) return;
+        if (in->open[r->track]) {
+            ev_begin("E", in->pid, r->track + 1, ts);
+            fputs("}", out);
+        }
+        ev_begin("B", in->pid, r->track + 1, ts);
+        fputs(",\"name\":", out);
+        json_str(r->name, sizeof(r->name));
+        state_args(r);
+        fputs("}", out);
+        in->open[r->track] = 1;
+        return;
+    }
+
+    int tid = (r->kind == TR_K_EVENT) ? TID_EVENTS : TID_DECISIONS;
+    if (r->flag == TR_FLOW_NONE) {            /* nothing to bind: an instant */
+        ev_begin("i", in->pid, tid, ts);
+        fputs(",\"s\":\"t\",\"name\":", out);
+    } else {                                  /* flows bind to a slice */
+        ev_begin("X", in->pid, tid, ts);
+        fputs(",\"dur\":1,\"name\":", out);
+    }
+    json_str(r->name, sizeof(r->name));
+    state_args(r);
+    fputs("}", out);
+    flow(in, tid, ts, r);
+}
+
+/* ================= MAIN ================= */
+int main(int argc, char **argv)
+{
+    int c;
+    const char *out_path = NULL;
+    while ((c = getopt(argc, argv, "o:")) != -1) {
+        switch (c) {
+        case 'o': out_path = optarg; break;
+        default:
+            fprintf(stderr, "usage: %s [-o out.json] trace [trace ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    int n = argc - optind;
+    if (n < 1 || n > MAX_IN) {
+        fprintf(stderr, "usage: %s [-o out.json] trace [trace ...]  (1..%d traces)\n", argv[0], MAX_IN);
+        return 2;
+    }
+
+    out = out_path ? fopen(out_path, "w") : stdout;
+    if (!out) { perror(out_path); return 1; }
+    setvbuf(out, NULL, _IOFBF, 1 << 16);
+
+    static input_t in[MAX_IN];
+    for (int i = 0; i < n; i++) {
+        in[i].path = argv[optind + i];
+        in[i].pid = i + 1;
+        in[i].f = fopen(in[i].path, "rb");
+        if (!in[i].f) { perror(in[i].path); return 1; }
+        setvbuf(in[i].f, NULL, _IOFBF, 1 << 16);
+    }
+
+    fputs("{\"displayTimeUnit\":\"ms\",\"traceEvents\":[", out);
+    for (int i = 0; i < n; i++) advance(&in[i]);
+
+    /* k-way merge on realtime; n is small, a scan beats a heap */
+    long total = 0;
+    for (;;) {
+        input_t *best = NULL;
+        uint64_t best_ts = 0;
+        for (int i = 0; i < n; i++) {
+            if (!in[i].have) continue;
+            uint64_t ts = (uint64_t)((int64_t)in[i].cur.t_us + in[i].off_us);
+            if (!best || ts < best_ts) { best = &in[i]; best_ts = ts; }
+        }
+        if (!best) break;
+        emit(best);
+        total++;
+        advance(best);
+    }
+
+    for (int i = 0; i < n; i++) {
+        close_spans(&in[i]);
+        fclose(in[i].f);
+        fprintf(stderr, "%s: %ld records, %u session(s)\n", in[i].path, in[i].nrec, in[i].session);
+    }
+    fputs("\n]}\n", out);
+    if (out != stdout) fclose(out);
+    fprintf(stderr, "%ld records -> %d trace events\n", total, n_out);
+    return 0;
+}
@@ -0,0 +1,650 @@
+/*
+ * traceq - time-range queries over the controllers' long-term traces
+ *
+ * Answers "how many trains / peds, how long did the preemptions, the
+ * states, the aspects of each head take" over any time range of the
+ * binary traces demo1 / demo3 write with -R <file> (see trace2json).
+ *
+ * Each trace gets a sidecar index <trace>.idx, built on first use and
+ * extended when the trace has grown (traces are append only):
+ *
+ *   sparse time index  one entry per block of BLK_RECS records: first /
+ *                      last realtime, record offset, and the spans still
+ *                      open at the block start (carry), so any block can
+ *                      be scanned on its own
+ *   block summaries    per block: event / decision counts by name and
+ *                      count / sum / min / max of every duration that
+ *                      ends in the block
+ *
+ * A query adds up the summaries of the blocks fully inside the range and
+ * scans only the (at most two per file) edge blocks, so months of trace
+ * answer in milliseconds. -S ignores the summaries and scans every block
+ * of the range from the mmap'd trace, in parallel (-j threads) - the
+ * check, and the speed of a plain scan.
+ *
+ * A duration counts in the range it ends in:
+ *   TRAIN           first TRAIN state to the next NORMAL one (preemption)
+ *   <event> -> end  an input to the decision that completed it
+ *                   ("t" -> TRAIN BEGIN, "p" -> PED BEGIN, ...)
+ *   state           NORMAL / TRAIN Sxx as seen on the heads
+ *   head aspect     each aspect of each signal head
+ *
+ * Usage: traceq [-f from] [-t to] [-S] [-j threads] [-I] trace [trace ...]
+ *        from / to: YYYY-MM[-DD[ HH:MM[:SS]]] local time, or @epoch_s;
+ *        -I rebuilds the indexes from scratch
+ */
+
+#define _XOPEN_SOURCE 700   /* strptime */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <fcntl.h>
+#include <unistd.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+
+#define TR_HEADS       4
+#define TR_TRACK_CTRL  0xFF
+#define TR_TRACK_CLOCK 0xFE
+
+enum { TR_K_META = 0, TR_K_PHASE, TR_K_EVENT, TR_K_DECISION };
+enum { TR_FLOW_NONE = 0, TR_FLOW_START, TR_FLOW_STEP, TR_FLOW_END };
+
+/* MUST match demo1 / demo3 (TRACE RECORDER) and trace2json */
+typedef struct {
+    uint64_t t_us;
+    uint8_t  kind;
+    uint8_t  track;
+    uint8_t  mode;
+    uint8_t  flag;
+    uint16_t state;
+    uint16_t arg;
+    uint32_t flow;
+    char     name[12];
+} trace_rec_t;
+
+/* ================= INDEX FORMAT ================= */
+#define IDX_MAGIC    0x31495154u        /* "TQI1" */
+#define IDX_VERSION  1
+#define BLK_RECS     8192               /* 256 KB of trace per block */
+#define MAX_NAMES    64                 /* dictionary of record names */
+#define NAME_OTHER   (MAX_NAMES - 1)
+#define OPEN_FLOWS   4                  /* recorder keeps one per input class */
+#define N_STATES     64                 /* (mode == 'T') << 5 | state */
+
+/* span slots in a summary */
+#define SP_ASPECT(h, n)  ((h) * MAX_NAMES + (n))
+#define SP_STATE(k)      (TR_HEADS * MAX_NAMES + (k))
+#define SP_TRAIN         (SP_STATE(N_STATES))
+#define SP_FLOW(n)       (SP_TRAIN + 1 + (n))
+#define N_SPAN           (SP_FLOW(MAX_NAMES))
+
+typedef struct {
+    uint64_t start_us;                  /* 0 = nothing open */
+    uint32_t flow;
+    uint16_t name;                      /* name id, or state key */
+    uint16_t pad;
+} open_t;
+
+typedef struct {
+    int64_t  off_us;                    /* realtime - monotonic of the session */
+    uint64_t last_us;                   /* timestamps are kept monotonic */
+    open_t   head[TR_HEADS];
+    open_t   state;
+    open_t   train;
+    open_t   flow[OPEN_FLOWS];
+} carry_t;
+
+typedef struct {
+    uint64_t first_us, last_us;
+    uint64_t rec;                       /* first record of the block */
+    uint32_t n_rec, pad;
+    carry_t  carry;                     /* open spans at the block start */
+} blk_t;
+
+typedef struct { uint64_t n, sum_us, min_us, max_us; } stat_t;
+
+typedef struct {
+    uint64_t ev[MAX_NAMES];
+    uint64_t dec[MAX_NAMES];
+    stat_t   span[N_SPAN];
+} sum_t;
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t pad;
+    uint32_t blk_recs;
+    uint32_t n_blocks;
+    uint32_t n_names;
+    uint32_t pad2;
+    uint64_t covered;                   /* trace bytes indexed */
+    uint64_t first_t_us;                /* t_us of record 0: detects a replaced file */
+    char     names[MAX_NAMES][12];
+    char     heads[TR_HEADS][12];
+} idx_hdr_t;
+
+/* one trace with its index, in memory */
+typedef struct {
+    const char  *path;
+    const trace_rec_t *rec;             /* mmap of the trace */
+    size_t       n_rec;
+    idx_hdr_t    hdr;
+    blk_t       *blk;
+    sum_t       *sum;
+    uint8_t      hash[256];             /* name -> id + 1, open addressing */
+} trace_t;
+
+/* ================= NAMES ================= */
+static unsigned name_hash(const char *n)
+{
+    uint32_t h = 2166136261u;
+    for (int i = 0; i < 12; i++) h = (h ^ (uint8_t)n[i]) * 16777619u;
+    return h & 255u;
+}
+
+static void name_rehash(trace_t *t)
+{
+    memset(t->hash, 0, sizeof(t->hash));
+    for (uint32_t i = 0; i < t->hdr.n_names; i++) {
+        unsigned h = name_hash(t->hdr.names[i]);
+        while (t->hash[h]) h = (h + 1) & 255u;
+        t->hash[h] = (uint8_t)(i + 1);
+    }
+}
+
+/* id of a record name; add = grow the dictionary (index build only) */
+static uint16_t name_id(trace_t *t, const char *n, int add)
+{
+    unsigned h = name_hash(n);
+    for (; t->hash[h]; h = (h + 1) & 255u)
+        if (memcmp(t->hdr.names[t->hash[h] - 1], n, 12) == 0) return (uint16_t)(t->hash[h] - 1);
+    if (!add || t->hdr.n_names >= NAME_OTHER) return NAME_OTHER;
+    uint32_t id = t->hdr.n_names++;
+    memcpy(t->hdr.names[id], n, 12);
+    t->hash[h] = (uint8_t)(id + 1);
+    return (uint16_t)id;
+}
+
+/* ================= SCAN ================= */
+static void stat_add(stat_t *s, uint64_t d)
+{
+    if (!s->n || d < s->min_us) s->min_us = d;
+    if (d > s->max_us) s->max_us = d;
+    s->n++;
+    s->sum_us += d;
+}
+
+static void stat_merge(stat_t *a, const stat_t *b)
+{
+    if (!b->n) return;
+    if (!a->n || b->min_us < a->min_us) a->min_us = b->min_us;
+    if (b->max_us > a->max_us) a->max_us = b->max_us;
+    a->n += b->n;
+    a->sum_us += b->sum_us;
+}
+
+static void sum_merge(sum_t *a, const sum_t *b)
+{
+    for (int i = 0; i < MAX_NAMES; i++) { a->ev[i] += b->ev[i]; a->dec[i] += b->dec[i]; }
+    for (int i = 0; i < N_SPAN; i++) stat_merge(&a->span[i], &b->span[i]);
+}
+
+/*
+ * Apply records [r, r + n) to carry c. What falls in [from, to) goes to s.
+ * The index build runs this with add = 1 over the whole range; queries
+ * re-run it from a block's stored carry, so both see the same spans.
+ */
+static void scan(trace_t *t, const trace_rec_t *r, size_t n, carry_t *c,
+                 sum_t *s, uint64_t from, uint64_t to, int add)
+{
+    for (size_t i = 0; i < n; i++, r++) {
+        if (r->kind == TR_K_META) {                 /* untimed: the clock comes after the name */
+            if (r->track == TR_TRACK_CTRL) {        /* new session: its spans start over */
+                uint64_t last = c->last_us;
+                int64_t off = c->off_us;
+                memset(c, 0, sizeof(*c));
+                c->last_us = last;
+                c->off_us = off;
+            } else if (r->track == TR_TRACK_CLOCK) {
+                uint64_t real;
+                memcpy(&real, r->name, sizeof(real));
+                c->off_us = (int64_t)(real - r->t_us);
+            } else if (add && r->track < TR_HEADS && !t->hdr.heads[r->track][0]) {
+                memcpy(t->hdr.heads[r->track], r->name, 12);
+            }
+            continue;
+        }
+        uint64_t ts = (uint64_t)((int64_t)r->t_us + c->off_us);
+        if (ts < c->last_us) ts = c->last_us;
+        c->last_us = ts;
+        int in = (ts >= from && ts < to);
+
+        switch (r->kind) {
+        case TR_K_PHASE: {
+            if (r->track >= TR_HEADS) break;
+            open_t *h = &c->head[r->track];
+            if (h->start_us && in) stat_add(&s->span[SP_ASPECT(r->track, h->name)], ts - h->start_us);
+            h->start_us = ts;
+            h->name = name_id(t, r->name, add);
+
+            uint16_t key = (uint16_t)(((r->mode == 'T') << 5) | (r->state & 31u));
+            if (!c->state.start_us || c->state.name != key) {
+                if (c->state.start_us && in) stat_add(&s->span[SP_STATE(c->state.name)], ts - c->state.start_us);
+                c->state.start_us = ts;
+                c->state.name = key;
+            }
+            if (r->mode == 'T' && !c->train.start_us) {
+                c->train.start_us = ts;
+            } else if (r->mode != 'T' && c->train.start_us) {
+                if (in) stat_add(&s->span[SP_TRAIN], ts - c->train.start_us);
+                c->train.start_us = 0;
+            }
+            break;
+        }
+
+        case TR_K_EVENT: {
+            uint16_t id = name_id(t, r->name, add);
+            if (in) s->ev[id]++;
+            if (r->flag != TR_FLOW_START) break;
+            int k = 0;                              /* free slot, else the oldest */
+            for (int j = 0; j < OPEN_FLOWS; j++) {
+                if (!c->flow[j].start_us) { k = j; break; }
+                if (c->flow[j].start_us < c->flow[k].start_us) k = j;
+            }
+            c->flow[k].start_us = ts;
+            c->flow[k].flow = r->flow;
+            c->flow[k].name = id;
+            break;
+        }
+
+        case TR_K_DECISION: {
+            uint16_t id = name_id(t, r->name, add);
+            if (in) s->dec[id]++;
+            if (r->flag != TR_FLOW_END) break;
+            for (int j = 0; j < OPEN_FLOWS; j++) {
+                open_t *f = &c->flow[j];
+                if (!f->start_us || f->flow != r->flow) continue;
+                if (in) stat_add(&s->span[SP_FLOW(f->name)], ts - f->start_us);
+                f->start_us = 0;
+                break;
+            }
+            break;
+        }
+        }
+    }
+}
+
+/* ================= INDEX ================= */
+static int idx_load(trace_t *t, const char *ipath)
+{
+    FILE *f = fopen(ipath, "rb");
+    if (!f) return -1;
+    int ok = fread(&t->hdr, sizeof(t->hdr), 1, f) == 1 &&
+             t->hdr.magic == IDX_MAGIC && t->hdr.version == IDX_VERSION && t->hdr.blk_recs == BLK_RECS;
+    if (ok) {
+        t->blk = malloc(((size_t)t->hdr.n_blocks + 1) * sizeof(blk_t));
+        t->sum = malloc(((size_t)t->hdr.n_blocks + 1) * sizeof(sum_t));
+        ok = t->blk && t->sum &&
+             fread(t->blk, sizeof(blk_t), t->hdr.n_blocks, f) == t->hdr.n_blocks &&
+             fread(t->sum, sizeof(sum_t), t->hdr.n_blocks, f) == t->hdr.n_blocks;
+    }
+    fclose(f);
+    if (!ok) {
+        free(t->blk); free(t->sum);
+        t->blk = NULL; t->sum = NULL;
+        memset(&t->hdr, 0, sizeof(t->hdr));
+        return -1;
+    }
+    return 0;
+}
+
+static int idx_save(const trace_t *t, const char *ipath)
+{
+    char tmp[520];
+    snprintf(tmp, sizeof(tmp), "%s.tmp", ipath);
+    FILE *f = fopen(tmp, "wb");
+    if (!f) return -1;
+    int ok = fwrite(&t->hdr, sizeof(t->hdr), 1, f) == 1 &&
+             fwrite(t->blk, sizeof(blk_t), t->hdr.n_blocks, f) == t->hdr.n_blocks &&
+             fwrite(t->sum, sizeof(sum_t), t->hdr.n_blocks, f) == t->hdr.n_blocks;
+    if (fclose(f) != 0) ok = 0;
+    if (!ok || rename(tmp, ipath) != 0) { unlink(tmp); return -1; }
+    return 0;
+}
+
+/* bring the index up to the end of the trace: rescan from the last, partial block */
+static int idx_sync(trace_t *t, int rebuild)
+{
+    char ipath[512];
+    snprintf(ipath, sizeof(ipath), "%s.idx", t->path);
+
+    uint64_t first = t->n_rec ? t->rec[0].t_us : 0;
+    if (rebuild || idx_load(t, ipath) != 0 ||
+        t->hdr.covered > t->n_rec * sizeof(trace_rec_t) || t->hdr.first_t_us != first) {
+        free(t->blk); free(t->sum);
+        memset(&t->hdr, 0, sizeof(t->hdr));
+        t->hdr.magic = IDX_MAGIC;
+        t->hdr.version = IDX_VERSION;
+        t->hdr.blk_recs = BLK_RECS;
+        t->hdr.first_t_us = first;
+        t->blk = NULL;
+        t->sum = NULL;
+    }
+    name_rehash(t);
+    if (t->hdr.covered == t->n_rec * sizeof(trace_rec_t)) return 0;
+
+    carry_t c;
+    memset(&c, 0, sizeof(c));
+    size_t b = t->hdr.n_blocks;
+    if (b && t->blk[b - 1].n_rec < BLK_RECS) {        /* partial: redo it from its carry */
+        b--;
+        c = t->blk[b].carry;
+    } else if (b) {                                   /* carry at the end of the last block */
+        static sum_t scratch;
+        c = t->blk[b - 1].carry;
+        scan(t, t->rec + t->blk[b - 1].rec, t->blk[b - 1].n_rec, &c, &scratch, 1, 0, 0);
+    }
+
+    size_t nb = (t->n_rec + BLK_RECS - 1) / BLK_RECS;
+    blk_t *nbk = realloc(t->blk, nb * sizeof(blk_t));
+    sum_t *nsm = nbk ? realloc(t->sum, nb * sizeof(sum_t)) : NULL;
+    if (nbk) t->blk = nbk;
+    if (nsm) t->sum = nsm;
+    if (!nbk || !nsm) { fprintf(stderr, "%s: out of memory\n", t->path); return -1; }
+
+    for (; b < nb; b++) {
+        blk_t *k = &t->blk[b];
+        memset(k, 0, sizeof(*k));
+        memset(&t->sum[b], 0, sizeof(sum_t));
+        k->rec = (uint64_t)b * BLK_RECS;
+        k->n_rec = (uint32_t)((t->n_rec - k->rec < BLK_RECS) ? t->n_rec - k->rec : BLK_RECS);
+        k->carry = c;
+        uint32_t j = 0;                               /* up to the first timed record */
+        while (j < k->n_rec && t->rec[k->rec + j].kind == TR_K_META) j++;
+        if (j < k->n_rec) j++;
+        scan(t, t->rec + k->rec, j, &c, &t->sum[b], 0, UINT64_MAX, 1);
+        k->first_us = c.last_us;
+        scan(t, t->rec + k->rec + j, k->n_rec - j, &c, &t->sum[b], 0, UINT64_MAX, 1);
+        k->last_us = c.last_us;
+    }
+    t->hdr.n_blocks = (uint32_t)nb;
+    t->hdr.covered = t->n_rec * sizeof(trace_rec_t);
+    if (idx_save(t, ipath) != 0)
+        fprintf(stderr, "%s: cannot write index (%s), using it in memory\n", ipath, strerror(errno));
+    return 0;
+}
+
+static int trace_open(trace_t *t, const char *path, int rebuild)
+{
+    memset(t, 0, sizeof(*t));
+    t->path = path;
+    int fd = open(path, O_RDONLY);
+    if (fd < 0) { perror(path); return -1; }
+    struct stat st;
+    if (fstat(fd, &st) != 0) { perror(path); close(fd); return -1; }
+    t->n_rec = (size_t)st.st_size / sizeof(trace_rec_t);   /* a torn tail is skipped */
+    if (t->n_rec) {
+        void *m = mmap(NULL, t->n_rec * sizeof(trace_rec_t), PROT_READ, MAP_SHARED, fd, 0);
+        if (m == MAP_FAILED) { perror(path); close(fd); return -1; }
+        t->rec = m;
+    }
+    close(fd);
+    if (t->n_rec && !(t->rec[0].kind == TR_K_META && t->rec[0].track == TR_TRACK_CTRL)) {
+        fprintf(stderr, "%s: not a controller trace\n", path);
+        return -1;
+    }
+    return idx_sync(t, rebuild);
+}
+
+/* ================= QUERY ================= */
+typedef struct { trace_t *t; size_t b; } job_t;
+
+typedef struct {
+    job_t          *job;
+    size_t          n_job;
+    atomic_size_t   next;
+    uint64_t        from, to;
+} pool_t;
+
+typedef struct { trace_t *t; sum_t sum; } file_sum_t;
+
+static pthread_mutex_t merge_mx = PTHREAD_MUTEX_INITIALIZER;
+static file_sum_t *g_fs;
+static size_t      g_nfs;
+
+/* each job: one block scanned from its carry, merged into that file's sum */
+static void *worker(void *arg)
+{
+    pool_t *p = arg;
+    sum_t *s = malloc(sizeof(*s));
+    if (!s) return NULL;
+    for (;;) {
+        size_t j = atomic_fetch_add(&p->next, 1);
+        if (j >= p->n_job) break;
+        trace_t *t = p->job[j].t;
+        const blk_t *k = &t->blk[p->job[j].b];
+        carry_t c = k->carry;
+        memset(s, 0, sizeof(*s));
+        scan(t, t->rec + k->rec, k->n_rec, &c, s, p->from, p->to, 0);
+        pthread_mutex_lock(&merge_mx);
+        for (size_t i = 0; i < g_nfs; i++)
+            if (g_fs[i].t == t) sum_merge(&g_fs[i].sum, s);
+        pthread_mutex_unlock(&merge_mx);
+    }
+    free(s);
+    return NULL;
+}
+
+/* ================= OUTPUT ================= */
+static void nm(char *o, size_t n, const char *s)
+{
+    snprintf(o, n, "%.12s", s);
+}
+
+static void print_stat(const char *label, const stat_t *s)
+{
+    if (!s->n) return;
+    printf("  %-26s %8llu %10.3f %10.3f %10.3f\n", label, (unsigned long long)s->n,
+           s->min_us / 1e6, (double)s->sum_us / (double)s->n / 1e6, s->max_us / 1e6);
+}
+
+/* the same name across files, by text: ids are per file */
+static void report(file_sum_t *fs, size_t n)
+{
+    char names[MAX_NAMES * 4][13];
+    size_t nn = 0;
+    for (size_t f = 0; f < n; f++)
+        for (uint32_t i = 0; i < fs[f].t->hdr.n_names && nn < MAX_NAMES * 4; i++) {
+            char x[13];
+            nm(x, sizeof(x), fs[f].t->hdr.names[i]);
+            size_t k;
+            for (k = 0; k < nn && strcmp(names[k], x); k++) { }
+            if (k == nn) memcpy(names[nn++], x, sizeof(x));
+        }
+
+    for (int pass = 0; pass < 2; pass++) {
+        printf("%s\n", pass ? "decisions" : "events");
+        for (size_t k = 0; k < nn; k++) {
+            uint64_t cnt = 0;
+            for (size_t f = 0; f < n; f++)
+                for (uint32_t i = 0; i < fs[f].t->hdr.n_names; i++) {
+                    char x[13];
+                    nm(x, sizeof(x), fs[f].t->hdr.names[i]);
+                    if (!strcmp(x, names[k])) cnt += pass ? fs[f].sum.dec[i] : fs[f].sum.ev[i];
+                }
+            if (cnt) printf("  %-26s %8llu\n", names[k], (unsigned long long)cnt);
+        }
+    }
+
+    printf("durations                         count      min s      avg s      max s\n");
+    stat_t s;
+    memset(&s, 0, sizeof(s));
+    for (size_t f = 0; f < n; f++) stat_merge(&s, &fs[f].sum.span[SP_TRAIN]);
+    print_stat("TRAIN preemption", &s);
+
+    for (size_t k = 0; k < nn; k++) {
+        memset(&s, 0, sizeof(s));
+        for (size_t f = 0; f < n; f++)
+            for (uint32_t i = 0; i < fs[f].t->hdr.n_names; i++) {
+                char x[13];
+                nm(x, sizeof(x), fs[f].t->hdr.names[i]);
+                if (!strcmp(x, names[k])) stat_merge(&s, &fs[f].sum.span[SP_FLOW(i)]);
+            }
+        char label[40];
+        snprintf(label, sizeof(label), "%.12s -> done", names[k]);
+        print_stat(label, &s);
+    }
+
+    for (int key = 0; key < N_STATES; key++) {
+        memset(&s, 0, sizeof(s));
+        for (size_t f = 0; f < n; f++) stat_merge(&s, &fs[f].sum.span[SP_STATE(key)]);
+        char label[40];
+        snprintf(label, sizeof(label), "%s S%02d", (key >> 5) ? "TRAIN" : "NORMAL", key & 31);
+        print_stat(label, &s);
+    }
+
+    for (int h = 0; h < TR_HEADS; h++) {
+        char head[13];
+        nm(head, sizeof(head), fs[0].t->hdr.heads[h]);
+        for (size_t f = 1; f < n; f++) {                   /* R1(W->E) / R2(W->E) ... */
+            char x[13];
+            nm(x, sizeof(x), fs[f].t->hdr.heads[h]);
+            if (strcmp(x, head)) snprintf(head, sizeof(head), "head%d", h);
+        }
+        for (size_t k = 0; k < nn; k++) {
+            memset(&s, 0, sizeof(s));
+            for (size_t f = 0; f < n; f++)
+                for (uint32_t i = 0; i < fs[f].t->hdr.n_names; i++) {
+                    char x[13];
+                    nm(x, sizeof(x), fs[f].t->hdr.names[i]);
+                    if (!strcmp(x, names[k])) stat_merge(&s, &fs[f].sum.span[SP_ASPECT(h, i)]);
+                }
+            char label[40];
+            snprintf(label, sizeof(label), "%.12s %.12s", head, names[k]);
+            print_stat(label, &s);
+        }
+    }
+}
+
+/* ================= MAIN ================= */
+static int parse_time(const char *s, uint64_t *us)
+{
+    if (s[0] == '@') { *us = strtoull(s + 1, NULL, 10) * 1000000ULL; return 0; }
+    static const char *const FMT[] = {
+        "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%dT%H:%M", "%Y-%m-%d", "%Y-%m"
+    };
+    for (size_t i = 0; i < sizeof(FMT) / sizeof(FMT[0]); i++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        tm.tm_mday = 1;
+        const char *e = strptime(s, FMT[i], &tm);
+        if (!e || *e) continue;
+        tm.tm_isdst = -1;
+        time_t t = mktime(&tm);
+        if (t == (time_t)-1) return -1;
+        *us = (uint64_t)t * 1000000ULL;
+        return 0;
+    }
+    return -1;
+}
+
+static uint64_t mono_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+int main(int argc, char **argv)
+{
+    int c, full = 0, rebuild = 0, threads = 4;
+    uint64_t from = 0, to = UINT64_MAX;
+    while ((c = getopt(argc, argv, "f:t:Sj:I")) != -1) {
+        switch (c) {
+        case 'f':
+        case 't':
+            if (parse_time(optarg, c == 'f' ? &from : &to) != 0) {
+                fprintf(stderr, "bad time '%s' (YYYY-MM[-DD[ HH:MM[:SS]]] or @epoch_s)\n", optarg);
+                return 2;
+            }
+            break;
+        case 'S': full = 1; break;
+        case 'j': threads = atoi(optarg); break;
+        case 'I': rebuild = 1; break;
+        default:
+            fprintf(stderr, "usage: %s [-f from] [-t to] [-S] [-j threads] [-I] trace [trace ...]\n", argv[0]);
+            return 2;
+        }
+    }
+    int n = argc - optind;
+    if (n < 1) {
+        fprintf(stderr, "usage: %s [-f from] [-t to] [-S] [-j threads] [-I] trace [trace ...]\n", argv[0]);
+        return 2;
+    }
+    if (threads < 1) threads = 1;
+    if (threads > 64) threads = 64;
+
+    uint64_t t0 = mono_us();
+    trace_t *tr = calloc((size_t)n, sizeof(trace_t));
+    g_fs = calloc((size_t)n, sizeof(file_sum_t));
+    if (!tr || !g_fs) return 1;
+    for (int i = 0; i < n; i++) {
+        if (trace_open(&tr[i], argv[optind + i], rebuild) != 0) return 1;
+        g_fs[g_nfs++].t = &tr[i];
+    }
+    uint64_t t1 = mono_us();
+
+    /* blocks inside the range come from the summaries; edge blocks (or all, -S) are scanned */
+    size_t n_job = 0, n_sum = 0, cap = 0;
+    job_t *job = NULL;
+    uint64_t scan_bytes = 0;
+    for (int i = 0; i < n; i++) {
+        trace_t *t = &tr[i];
+        size_t lo = 0, hi = t->hdr.n_blocks;                  /* first block ending at/after from */
+        while (lo < hi) {
+            size_t mid = (lo + hi) / 2;
+            if (t->blk[mid].last_us < from) lo = mid + 1; else hi = mid;
+        }
+        for (size_t b = lo; b < t->hdr.n_blocks && t->blk[b].first_us < to; b++) {
+            if (!full && t->blk[b].first_us >= from && t->blk[b].last_us < to) {
+                sum_merge(&g_fs[i].sum, &t->sum[b]);
+                n_sum++;
+                continue;
+            }
+            if (n_job == cap) {
+                cap = cap ? cap * 2 : 64;
+                job_t *nj = realloc(job, cap * sizeof(job_t));
+                if (!nj) return 1;
+                job = nj;
+            }
+            job[n_job].t = t;
+            job[n_job].b = b;
+            n_job++;
+            scan_bytes += (uint64_t)t->blk[b].n_rec * sizeof(trace_rec_t);
+        }
+    }
+
+    pool_t pool = { .job = job, .n_job = n_job, .from = from, .to = to };
+    atomic_init(&pool.next, 0);
+    int nt = (size_t)threads > n_job ? (int)n_job : threads;
+    pthread_t th[64];
+    for (int i = 0; i < nt; i++) pthread_create(&th[i], NULL, worker, &pool);
+    for (int i = 0; i < nt; i++) pthread_join(th[i], NULL);
+    uint64_t t2 = mono_us();
+
+    report(g_fs, g_nfs);
+    double scan_s = (t2 - t1) / 1e6;
+    printf("\n%d trace(s): %zu blocks from summaries, %zu scanned (%.1f MB, %d threads)\n",
+           n, n_sum, n_job, scan_bytes / 1e6, nt);
+    printf("index sync %.3f ms, query %.3f ms", (t1 - t0) / 1e3, (t2 - t1) / 1e3);
+    if (n_job && scan_s > 0) printf(", scan %.0f MB/s", scan_bytes / 1e6 / scan_s);
+    printf("\n");
+    return 0;
+}
@@ -0,0 +1,598 @@
+/*
+ * tracez - compressed archive of the controllers' traces
+ *
+ * Packs the binary traces demo1 / demo3 write with -R <file> (the same
+ * phase lines the controllers print, with timestamps) into an append
+ * only archive, and unpacks them bit for bit:
+ *
+ *   dictionary  a record without its time and flow id is a symbol; the
+ *               dozen NORMAL phase changes of a cycle are a dozen symbols
+ *   time        stored as the difference to the symbol's previous delta
+ *               (its expected phase duration): a steady cycle costs a
+ *               byte or two of jitter per record, zigzag varint
+ *   blocks      BLK_RECS records per block, LZ77 compressed, each block
+ *               self contained: its own dictionary, plus the META records
+ *               of the session it is in, so any block unpacks on its own
+ *               to a valid trace (trace2json / traceq read it as is)
+ *
+ * Block headers carry the realtime range, so -f / -t unpack only the
+ * blocks of a time range and -b picks blocks by number without touching
+ * the rest. Packing appends (-c archive trace, or "-" for stdin to pack
+ * a live trace through tail -f); a torn last block from an interrupted
+ * writer is cut off before appending.
+ *
+ * Usage: tracez -c archive trace|-               pack (append)
+ *        tracez -d [-f from] [-t to] [-b n[:m]] archive [> trace]
+ *        tracez -l archive                       list blocks
+ *        from / to: @epoch_s or YYYY-MM-DD[ HH:MM[:SS]] local time
+ */
+
+#define _XOPEN_SOURCE 700   /* strptime, ftruncate */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
+#include <string.h>
+#include <errno.h>
+#include <time.h>
+#include <unistd.h>
+#include <sys/stat.h>
+
+#define TR_TRACK_CTRL  0xFF
+#define TR_TRACK_CLOCK 0xFE
+
+enum { TR_K_META = 0, TR_K_PHASE, TR_K_EVENT, TR_K_DECISION };
+
+/* MUST match demo1 / demo3 (TRACE RECORDER), trace2json and traceq */
+typedef struct {
+    uint64_t t_us;
+    uint8_t  kind;
+    uint8_t  track;
+    uint8_t  mode;
+    uint8_t  flag;
+    uint16_t state;
+    uint16_t arg;
+    uint32_t flow;
+    char     name[12];
+} trace_rec_t;
+
+/* ================= ARCHIVE FORMAT ================= */
+#define TZ_MAGIC     0x315a5254u        /* "TRZ1" file header */
+#define TZ_BLK_MAGIC 0x31425a54u        /* "TZB1" block header */
+#define TZ_VERSION   1
+#define BLK_RECS     16384
+#define MAX_SYMS     4096               /* per block; past it symbols are sent inline */
+#define MAX_PRE      8                  /* session META records repeated per block */
+#define SYM_BYTES    20                 /* trace_rec_t minus t_us and flow */
+#define RAW_MAX      (BLK_RECS * 48 + MAX_PRE * 48 + 16)
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t pad;
+} tz_hdr_t;
+
+typedef struct {
+    uint32_t magic;
+    uint32_t n_rec;                     /* records, without the session prefix */
+    uint32_t raw_len;
+    uint32_t comp_len;                  /* == raw_len: stored */
+    uint64_t first_real_us, last_real_us;
+    uint32_t sum;                       /* FNV-1a of the raw stream */
+    uint32_t pad;
+} tz_blk_t;
+
+/*
+ * Raw stream of a block:
+ *   varint n_pre, then n_pre + n_rec records, each:
+ *     varint (sym << 1 | has_flow)   sym == n_syms: a new symbol, its
+ *                                    SYM_BYTES follow and it is added
+ *     varint zigzag(delta - expect[sym])   delta from the previous record
+ *                                          (the first: from t0 below)
+ *     [varint zigzag(flow - last_flow)]
+ *   t0 is a leading 8-byte time right after n_pre.
+ */
+
+/* ================= BYTES ================= */
+static uint32_t fnv1a(const uint8_t *p, size_t n)
+{
+    uint32_t h = 2166136261u;
+    for (size_t i = 0; i < n; i++) h = (h ^ p[i]) * 16777619u;
+    return h;
+}
+
+static uint8_t *put_var(uint8_t *p, uint64_t v)
+{
+    while (v >= 0x80) { *p++ = (uint8_t)(v | 0x80); v >>= 7; }
+    *p++ = (uint8_t)v;
+    return p;
+}
+
+static const uint8_t *get_var(const uint8_t *p, const uint8_t *end, uint64_t *v)
+{
+    uint64_t x = 0;
+    for (int s = 0; p < end && s < 64; s += 7) {
+        uint8_t b = *p++;
+        x |= (uint64_t)(b & 0x7f) << s;
+        if (!(b & 0x80)) { *v = x; return p; }
+    }
+    return NULL;
+}
+
+static uint64_t zz(int64_t v)  { return ((uint64_t)v << 1) ^ (uint64_t)(v >> 63); }
+static int64_t  unzz(uint64_t v) { return (int64_t)(v >> 1) ^ -(int64_t)(v & 1); }
+
+/* ================= LZ77 =================
+ * Sequences of: token (literals << 4 | match - 4), 255-extended lengths,
+ * literals, 16-bit offset. The last sequence has literals only.
+ */
+#define LZ_HASH_BITS 14
+#define LZ_MIN       4
+
+static uint32_t lz_h(const uint8_t *p)
+{
+    uint32_t v;
+    memcpy(&v, p, 4);
+    return (v * 2654435761u) >> (32 - LZ_HASH_BITS);
+}
+
+static uint8_t *lz_len(uint8_t *o, size_t n)
+{
+    for (; n >= 255; n -= 255) *o++ = 255;
+    *o++ = (uint8_t)n;
+    return o;
+}
+
+/* returns the compressed size, or 0 when it would not be smaller */
+static size_t lz_pack(const uint8_t *in, size_t n, uint8_t *out, size_t cap)
+{
+    static uint32_t tab[1u << LZ_HASH_BITS];
+    memset(tab, 0, sizeof(tab));
+    const uint8_t *ip = in, *lit = in, *end = in + n;
+    uint8_t *o = out, *oend = out + cap;
+
+    while (n >= LZ_MIN + 8 && ip + LZ_MIN + 8 <= end) {
+        uint32_t h = lz_h(ip);
+        const uint8_t *ref = in + tab[h];
+        tab[h] = (uint32_t)(ip - in);
+        if (ref >= ip || ip - ref > 0xffff || memcmp(ref, ip, LZ_MIN) != 0) { ip++; continue; }
+
+        size_t m = LZ_MIN;
+        while (ip + m < end && ref[m] == ip[m]) m++;
+        size_t l = (size_t)(ip - lit);
+        if (o + 1 + l / 255 + 1 + l + 2 + m / 255 + 1 > oend) return 0;
+        uint8_t *tok = o++;
+        *tok = (uint8_t)(((l < 15 ? l : 15) << 4) | (m - LZ_MIN < 15 ? m - LZ_MIN : 15));
+        if (l >= 15) o = lz_len(o, l - 15);
+        memcpy(o, lit, l);
+        o += l;
+        *o++ = (uint8_t)(ip - ref);
+        *o++ = (uint8_t)((ip - ref) >> 8);
+        if (m - LZ_MIN >= 15) o = lz_len(o, m - LZ_MIN - 15);
+        ip += m;
+        lit = ip;
+    }
+    size_t l = (size_t)(end - lit);
+    if (o + 1 + l / 255 + 1 + l > oend) return 0;
+    *o++ = (uint8_t)((l < 15 ? l : 15) << 4);
+    if (l >= 15) o = lz_len(o, l - 15);
+    memcpy(o, lit, l);
+    o += l;
+    return (size_t)(o - out) < n ? (size_t)(o - out) : 0;
+}
+
+static int lz_unpack(const uint8_t *in, size_t n, uint8_t *out, size_t want)
+{
+    const uint8_t *ip = in, *iend = in + n;
+    uint8_t *o = out, *oend = out + want;
+    while (ip < iend) {
+        uint8_t tok = *ip++;
+        size_t l = tok >> 4, m = tok & 15;
+        if (l == 15) { uint8_t b; do { if (ip >= iend) return -1; b = *ip++; l += b; } while (b == 255); }
+        if ((size_t)(iend - ip) < l || (size_t)(oend - o) < l) return -1;
+        memcpy(o, ip, l);
+        o += l;
+        ip += l;
+        if (ip == iend) break;                          /* last sequence */
+        if (iend - ip < 2) return -1;
+        size_t off = (size_t)ip[0] | ((size_t)ip[1] << 8);
+        ip += 2;
+        if (m == 15) { uint8_t b; do { if (ip >= iend) return -1; b = *ip++; m += b; } while (b == 255); }
+        m += LZ_MIN;
+        if (off == 0 || off > (size_t)(o - out) || (size_t)(oend - o) < m) return -1;
+        const uint8_t *r = o - off;
+        while (m--) *o++ = *r++;                         /* may overlap */
+    }
+    return o == oend ? 0 : -1;
+}
+
+/* ================= PACK ================= */
+typedef struct {
+    FILE        *out;
+    trace_rec_t  rec[BLK_RECS];
+    uint32_t     n;
+    trace_rec_t  pre[MAX_PRE];          /* META records of the current session */
+    uint32_t     n_pre, blk_pre;        /* blk_pre: prefix of the block being filled */
+    trace_rec_t  blk_pre_rec[MAX_PRE];
+    int64_t      off_us;                /* realtime - monotonic, for the block headers */
+    uint64_t     first_real;
+    uint8_t      raw[RAW_MAX], comp[RAW_MAX];
+    uint64_t     n_in, bytes_out;
+    uint32_t     blocks;
+} packer_t;
+
+typedef struct {
+    uint8_t  body[MAX_SYMS][SYM_BYTES];
+    uint64_t expect[MAX_SYMS];
+    uint32_t n;
+    uint16_t hash[1u << 13];            /* sym + 1, open addressing */
+} dict_t;
+
+static void sym_body(const trace_rec_t *r, uint8_t *b)
+{
+    memcpy(b, &r->kind, 8);                             /* kind track mode flag state arg */
+    memcpy(b + 8, r->name, 12);
+}
+
+static uint32_t dict_find(dict_t *d, const uint8_t *b, uint32_t *slot)
+{
+    uint32_t h = fnv1a(b, SYM_BYTES) & ((1u << 13) - 1);
+    for (; d->hash[h]; h = (h + 1) & ((1u << 13) - 1))
+        if (memcmp(d->body[d->hash[h] - 1], b, SYM_BYTES) == 0) return d->hash[h] - 1u;
+    *slot = h;
+    return UINT32_MAX;
+}
+
+static uint8_t *enc_rec(uint8_t *p, dict_t *d, const trace_rec_t *r, uint64_t *prev_t, uint32_t *last_flow)
+{
+    uint8_t b[SYM_BYTES];
+    uint32_t slot = 0;
+    sym_body(r, b);
+    uint32_t s = dict_find(d, b, &slot);
+    int has_flow = r->flow != 0;
+    int64_t delta = (int64_t)(r->t_us - *prev_t);
+    if (s == UINT32_MAX) {
+        s = d->n;
+        p = put_var(p, (uint64_t)s << 1 | (uint64_t)has_flow);
+        memcpy(p, b, SYM_BYTES);
+        p += SYM_BYTES;
+        if (d->n < MAX_SYMS) {
+            d->hash[slot] = (uint16_t)(d->n + 1);
+            memcpy(d->body[d->n], b, SYM_BYTES);
+            d->expect[d->n++] = (uint64_t)delta;
+        }
+        p = put_var(p, zz(delta));
+    } else {
+        p = put_var(p, (uint64_t)s << 1 | (uint64_t)has_flow);
+        p = put_var(p, zz(delta - (int64_t)d->expect[s]));
+        d->expect[s] = (uint64_t)delta;
+    }
+    if (has_flow) {
+        p = put_var(p, zz((int64_t)r->flow - (int64_t)*last_flow));
+        *last_flow = r->flow;
+    }
+    *prev_t = r->t_us;
+    return p;
+}
+
+static int flush_block(packer_t *pk)
+{
+    if (!pk->n) return 0;
+    static dict_t d;
+    memset(&d, 0, sizeof(d));
+    uint8_t *p = put_var(pk->raw, pk->blk_pre);
+    uint64_t t0 = pk->blk_pre ? pk->blk_pre_rec[0].t_us : pk->rec[0].t_us;
+    memcpy(p, &t0, 8);
+    p += 8;
+    uint64_t prev_t = t0;
+    uint32_t last_flow = 0;
+    for (uint32_t i = 0; i < pk->blk_pre; i++) p = enc_rec(p, &d, &pk->blk_pre_rec[i], &prev_t, &last_flow);
+    for (uint32_t i = 0; i < pk->n; i++)       p = enc_rec(p, &d, &pk->rec[i], &prev_t, &last_flow);
+
+    tz_blk_t h;
+    memset(&h, 0, sizeof(h));
+    h.magic = TZ_BLK_MAGIC;
+    h.n_rec = pk->n;
+    h.raw_len = (uint32_t)(p - pk->raw);
+    h.sum = fnv1a(pk->raw, h.raw_len);
+    h.last_real_us = (uint64_t)((int64_t)pk->rec[pk->n - 1].t_us + pk->off_us);
+    h.first_real_us = pk->first_real ? pk->first_real : h.last_real_us;
+    size_t c = lz_pack(pk->raw, h.raw_len, pk->comp, sizeof(pk->comp));
+    h.comp_len = c ? (uint32_t)c : h.raw_len;
+    if (fwrite(&h, sizeof(h), 1, pk->out) != 1 ||
+        fwrite(c ? pk->comp : pk->raw, 1, h.comp_len, pk->out) != h.comp_len) return -1;
+    fflush(pk->out);
+    pk->bytes_out += sizeof(h) + h.comp_len;
+    pk->blocks++;
+    pk->n = 0;
+    return 0;
+}
+
+static int pack_rec(packer_t *pk, const trace_rec_t *r)
+{
+    int kept = 0;
+    if (r->kind == TR_K_META) {
+        if (r->track == TR_TRACK_CTRL) pk->n_pre = 0;  /* a new session */
+        if (r->track == TR_TRACK_CLOCK) {
+            uint64_t real;
+            memcpy(&real, r->name, sizeof(real));
+            pk->off_us = (int64_t)(real - r->t_us);
+        }
+        if (pk->n_pre < MAX_PRE) { pk->pre[pk->n_pre++] = *r; kept = 1; }
+    }
+    if (pk->n == 0) {                                  /* block starts in this session */
+        pk->blk_pre = pk->n_pre - (uint32_t)kept;      /* r itself goes in the block */
+        memcpy(pk->blk_pre_rec, pk->pre, pk->blk_pre * sizeof(trace_rec_t));
+        pk->first_real = 0;
+    }
+    if (!pk->first_real && r->kind != TR_K_META)       /* META is untimed: clock follows the name */
+        pk->first_real = (uint64_t)((int64_t)r->t_us + pk->off_us);
+    pk->rec[pk->n++] = *r;
+    pk->n_in++;
+    return pk->n == BLK_RECS ? flush_block(pk) : 0;
+}
+
+/* cut a torn last block; returns the offset to append at, or -1 */
+static long archive_end(FILE *f, const char *path)
+{
+    tz_hdr_t fh;
+    if (fseek(f, 0, SEEK_END) != 0) return -1;
+    long size = ftell(f);
+    if (size == 0) return 0;
+    rewind(f);
+    if (fread(&fh, sizeof(fh), 1, f) != 1 || fh.magic != TZ_MAGIC || fh.version != TZ_VERSION) {
+        fprintf(stderr, "%s: not a tracez archive\n", path);
+        return -1;
+    }
+    long pos = (long)sizeof(fh);
+    tz_blk_t h;
+    while (fread(&h, sizeof(h), 1, f) == 1 && h.magic == TZ_BLK_MAGIC &&
+           pos + (long)sizeof(h) + (long)h.comp_len <= size) {
+        pos += (long)sizeof(h) + (long)h.comp_len;
+        if (fseek(f, pos, SEEK_SET) != 0) break;
+    }
+    if (pos != size) fprintf(stderr, "%s: dropping %ld bytes of a torn block\n", path, size - pos);
+    return pos;
+}
+
+static int do_pack(const char *arch, const char *src)
+{
+    FILE *in = strcmp(src, "-") ? fopen(src, "rb") : stdin;
+    if (!in) { perror(src); return 1; }
+    FILE *out = fopen(arch, "r+b");
+    if (!out) out = fopen(arch, "w+b");
+    if (!out) { perror(arch); return 1; }
+    long end = archive_end(out, arch);
+    if (end < 0) return 1;
+    if (ftruncate(fileno(out), end) != 0 || fseek(out, end, SEEK_SET) != 0) { perror(arch); return 1; }
+    if (end == 0) {
+        tz_hdr_t fh = { TZ_MAGIC, TZ_VERSION, 0 };
+        if (fwrite(&fh, sizeof(fh), 1, out) != 1) { perror(arch); return 1; }
+    }
+
+    packer_t *pk = calloc(1, sizeof(*pk));
+    if (!pk) return 1;
+    pk->out = out;
+    trace_rec_t r;
+    size_t got;
+    while ((got = fread(&r, 1, sizeof(r), in)) == sizeof(r))
+        if (pack_rec(pk, &r) != 0) { perror(arch); return 1; }
+    if (got) fprintf(stderr, "%s: %zu trailing bytes (torn record) ignored\n", src, got);
+    if (flush_block(pk) != 0 || fclose(out) != 0) { perror(arch); return 1; }
+    if (in != stdin) fclose(in);
+
+    fprintf(stderr, "%llu records (%.2f MB) -> %u blocks, %.3f MB (%.1f:1, %.2f bytes/record)\n",
+            (unsigned long long)pk->n_in, pk->n_in * sizeof(trace_rec_t) / 1e6, pk->blocks,
+            pk->bytes_out / 1e6, pk->bytes_out ? (double)(pk->n_in * sizeof(trace_rec_t)) / (double)pk->bytes_out : 0.0,
+            pk->n_in ? (double)pk->bytes_out / (double)pk->n_in : 0.0);
+    free(pk);
+    return 0;
+}
+
+/* ================= UNPACK ================= */
+/* decode one block into out[]; with_pre also emits the session prefix */
+static int unpack_block(const tz_blk_t *h, const uint8_t *data, uint8_t *raw,
+                        trace_rec_t *out, uint32_t *n_out, int with_pre)
+{
+    if (h->raw_len > RAW_MAX || h->comp_len > h->raw_len || h->n_rec > BLK_RECS) return -1;
+    if (h->comp_len == h->raw_len) memcpy(raw, data, h->raw_len);
+    else if (lz_unpack(data, h->comp_len, raw, h->raw_len) != 0) return -1;
+    if (fnv1a(raw, h->raw_len) != h->sum) return -1;
+
+    static uint8_t  body[MAX_SYMS][SYM_BYTES];
+    static uint64_t expect[MAX_SYMS];
+    uint32_t n_sym = 0, last_flow = 0, n = 0;
+    const uint8_t *p = raw, *end = raw + h->raw_len;
+    uint64_t n_pre, t;
+    if (!(p = get_var(p, end, &n_pre)) || n_pre > MAX_PRE || end - p < 8) return -1;
+    memcpy(&t, p, 8);
+    p += 8;
+
+    for (uint64_t i = 0; i < n_pre + h->n_rec; i++) {
+        uint64_t v, e;
+        const uint8_t *b;
+        if (!(p = get_var(p, end, &v))) return -1;
+        uint64_t s = v >> 1;
+        int64_t delta;
+        if (s == n_sym) {                               /* a new symbol, inline */
+            if (end - p < SYM_BYTES) return -1;
+            b = p;
+            p += SYM_BYTES;
+            if (!(p = get_var(p, end, &e))) return -1;
+            delta = unzz(e);
+            if (n_sym < MAX_SYMS) {
+                memcpy(body[n_sym], b, SYM_BYTES);
+                expect[n_sym++] = (uint64_t)delta;
+            }
+        } else if (s < n_sym) {
+            b = body[s];
+            if (!(p = get_var(p, end, &e))) return -1;
+            delta = (int64_t)expect[s] + unzz(e);
+            expect[s] = (uint64_t)delta;
+        } else {
+            return -1;
+        }
+        t += (uint64_t)delta;
+
+        trace_rec_t *r = &out[n];
+        r->t_us = t;
+        memcpy(&r->kind, b, 8);
+        memcpy(r->name, b + 8, 12);
+        r->flow = 0;
+        if (v & 1) {
+            if (!(p = get_var(p, end, &e))) return -1;
+            last_flow = (uint32_t)((int64_t)last_flow + unzz(e));
+            r->flow = last_flow;
+        }
+        if (i >= n_pre || with_pre) n++;
+    }
+    *n_out = n;
+    return p == end ? 0 : -1;
+}
+
+static int parse_time(const char *s, uint64_t *us)
+{
+    if (s[0] == '@') { *us = strtoull(s + 1, NULL, 10) * 1000000ULL; return 0; }
+    static const char *const FMT[] = {
+        "%Y-%m-%d %H:%M:%S", "%Y-%m-%dT%H:%M:%S", "%Y-%m-%d %H:%M", "%Y-%m-%dT%H:%M", "%Y-%m-%d"
+    };
+    for (size_t i = 0; i < sizeof(FMT) / sizeof(FMT[0]); i++) {
+        struct tm tm;
+        memset(&tm, 0, sizeof(tm));
+        const char *e = strptime(s, FMT[i], &tm);
+        if (!e || *e) continue;
+        tm.tm_isdst = -1;
+        time_t t = mktime(&tm);
+        if (t == (time_t)-1) return -1;
+        *us = (uint64_t)t * 1000000ULL;
+        return 0;
+    }
+    return -1;
+}
+
+static uint64_t mono_us(void)
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return (uint64_t)ts.tv_sec * 1000000ULL + (uint64_t)ts.tv_nsec / 1000ULL;
+}
+
+/* list = 1: print block headers only; blocks outside [b_lo, b_hi] and [from, to) are skipped unread */
+static int do_unpack(const char *arch, int list, uint32_t b_lo, uint32_t b_hi, uint64_t from, uint64_t to)
+{
+    FILE *f = fopen(arch, "rb");
+    if (!f) { perror(arch); return 1; }
+    tz_hdr_t fh;
+    if (fread(&fh, sizeof(fh), 1, f) != 1 || fh.magic != TZ_MAGIC || fh.version != TZ_VERSION) {
+        fprintf(stderr, "%s: not a tracez archive\n", arch);
+        return 1;
+    }
+
+    uint8_t *comp = malloc(RAW_MAX), *raw = malloc(RAW_MAX);
+    trace_rec_t *rec = malloc((BLK_RECS + MAX_PRE) * sizeof(trace_rec_t));
+    if (!comp || !raw || !rec) return 1;
+    if (list) printf("block     records    packed      first (realtime)        last\n");
+
+    struct stat st;
+    if (fstat(fileno(f), &st) != 0) { perror(arch); return 1; }
+    uint64_t n_rec = 0, n_comp = 0, t_dec = 0;
+    uint32_t b = 0, n_dec = 0;
+    long pos = (long)sizeof(fh);
+    int first = 1, rc = 0;
+    tz_blk_t h;
+    for (; fread(&h, sizeof(h), 1, f) == 1; b++) {
+        if (h.magic != TZ_BLK_MAGIC || h.comp_len > RAW_MAX) {
+            fprintf(stderr, "%s: bad block header at block %u\n", arch, b);
+            rc = 1;
+            break;
+        }
+        pos += (long)sizeof(h) + (long)h.comp_len;
+        if (pos > (long)st.st_size) {                   /* a writer is mid-block, or died there */
+            fprintf(stderr, "%s: block %u is torn\n", arch, b);
+            break;
+        }
+        if (b < b_lo || b > b_hi || h.last_real_us < from || h.first_real_us >= to) {
+            if (fseek(f, (long)h.comp_len, SEEK_CUR) != 0) break;
+            continue;
+        }
+        if (list) {
+            time_t a = (time_t)(h.first_real_us / 1000000ULL), z = (time_t)(h.last_real_us / 1000000ULL);
+            char sa[32], sz[32];
+            strftime(sa, sizeof(sa), "%Y-%m-%d %H:%M:%S", localtime(&a));
+            strftime(sz, sizeof(sz), "%Y-%m-%d %H:%M:%S", localtime(&z));
+            printf("%5u  %10u  %8u  %s  %s\n", b, h.n_rec, h.comp_len, sa, sz);
+            n_rec += h.n_rec;
+            n_comp += sizeof(h) + h.comp_len;
+            if (fseek(f, (long)h.comp_len, SEEK_CUR) != 0) break;
+            continue;
+        }
+        if (fread(comp, 1, h.comp_len, f) != h.comp_len) { perror(arch); rc = 1; break; }
+        uint64_t t0 = mono_us();
+        uint32_t n;
+        /* the first block out carries its session's META so the output is a trace on its own */
+        if (unpack_block(&h, comp, raw, rec, &n, first) != 0) {
+            fprintf(stderr, "%s: block %u is corrupt\n", arch, b);
+            rc = 1;
+            break;
+        }
+        t_dec += mono_us() - t0;
+        if (fwrite(rec, sizeof(trace_rec_t), n, stdout) != n) { perror("stdout"); rc = 1; break; }
+        first = 0;
+        n_rec += n;
+        n_comp += sizeof(h) + h.comp_len;
+        n_dec++;
+    }
+    fclose(f);
+    fflush(stdout);
+    if (list)
+        printf("%llu records, %.3f MB packed, %.2f MB raw\n", (unsigned long long)n_rec, n_comp / 1e6,
+               n_rec * sizeof(trace_rec_t) / 1e6);
+    else if (n_dec)
+        fprintf(stderr, "%u blocks, %llu records, %.3f MB -> %.2f MB, decode %.0f MB/s\n", n_dec,
+                (unsigned long long)n_rec, n_comp / 1e6, n_rec * sizeof(trace_rec_t) / 1e6,
+                t_dec ? n_rec * sizeof(trace_rec_t) / (double)t_dec : 0.0);
+    free(comp); free(raw); free(rec);
+    return rc;
+}
+
+/* ================= MAIN ================= */
+static void usage(const char *me)
+{
+    fprintf(stderr, "usage: %s -c archive trace|-\n"
+                    "       %s -d [-f from] [-t to] [-b n[:m]] archive > trace\n"
+                    "       %s -l [-f from] [-t to] archive\n", me, me, me);
+}
+
+int main(int argc, char **argv)
+{
+    int c, mode = 0;
+    uint32_t b_lo = 0, b_hi = UINT32_MAX;
+    uint64_t from = 0, to = UINT64_MAX;
+    while ((c = getopt(argc, argv, "cdlf:t:b:")) != -1) {
+        switch (c) {
+        case 'c': case 'd': case 'l': mode = c; break;
+        case 'f':
+        case 't':
+            if (parse_time(optarg, c == 'f' ? &from : &to) != 0) {
+                fprintf(stderr, "bad time '%s' (@epoch_s or YYYY-MM-DD[ HH:MM[:SS]])\n", optarg);
+                return 2;
+            }
+            break;
+        case 'b': {
+            char *e;
+            b_lo = b_hi = (uint32_t)strtoul(optarg, &e, 10);
+            if (*e == ':') b_hi = (uint32_t)strtoul(e + 1, NULL, 10);
+            break;
+        }
+        default: usage(argv[0]); return 2;
+        }
+    }
+    int n = argc - optind;
+    if (mode == 'c' && n == 2) return do_pack(argv[optind], argv[optind + 1]);
+    if ((mode == 'd' || mode == 'l') && n == 1) {
+        if (mode == 'd' && isatty(STDOUT_FILENO)) { fprintf(stderr, "refusing to write a trace to a terminal\n"); return 2; }
+        return do_unpack(argv[optind], mode == 'l', b_lo, b_hi, from, to);
+    }
+    usage(argv[0]);
+    return 2;
+}
@@ -7,6 +7,11 @@
  * Key update:
  * - R3 is a major road (high traffic) -> keep longer greens
  * - R2 is moderate traffic -> shorter greens than R3
+ * - Greens follow the time of day, weekday and holiday calendar
+ *   (see TIMING PLANS + SCHEDULE; the #defines are the base plan)
+ * - "-s <rate-file>" simulates a day of queues on a virtual clock to
+ *   compare plans offline (see SIMULATOR); "-S" sweeps timing ranges
+ *   over it for a Pareto front (see PARAMETER SWEEP)
  *
  * UPDATE APPLIED:
  * - TRAIN state 0 REMOVED (no entry all-red state)
@@ -14,6 +19,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <mqueue.h>
 #include <fcntl.h>
@@ -21,6 +28,8 @@
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
 
 /* ================= MQ CONFIG ================= */
 #define QUEUE_NAME "/traffic_mq"
@@ -30,6 +39,19 @@
 #define EVT_TRAIN_CLEAR   'c'
 #define EVT_PED_PRESS     'p'
 
+/* Priority classes (mq_receive returns highest priority first).
+ * MUST match the senders (keyboard_events.c / demo2.c).
+ */
+#define PRIO_TRAIN        3
+#define PRIO_CLEAR        2
+#define PRIO_PED          1
+
+/* Queue depth; senders refuse ped presses once fewer than
+ * MQ_RESERVED_SLOTS are free, so 't'/'c' always find room.
+ */
+#define MQ_MAXMSG         20
+#define MQ_RESERVED_SLOTS  4
+
 /* ================= TIMINGS (seconds) =================
  * R3: high traffic (major road) -> longer greens
  * R2: moderate traffic          -> shorter greens
@@ -68,9 +90,6 @@ static int in_ped_mode   = 0;
 /* notify-once flag for forced yellow */
 static int train_preempt_notified = 0;
 
-/* after forced yellow, go directly to ALL-RED (skip left phases) */
-static int train_preempt_to_allred = 0;
-
 /* ================= STATE ENUM =================
  * NORMAL: 0..9
  * TRAIN : 10..18  (starts at TRAIN state 1)
@@ -112,11 +131,17 @@ static state_t ped_return_state = N_R3_RS_G;
 /* ================= MQ ================= */
 static mqd_t mq = (mqd_t)-1;
 
+/* event statistics (printed at TRAIN BEGIN) */
+static unsigned long rx_count[PRIO_TRAIN + 1];
+static unsigned long ped_coalesced = 0;   /* 'p' while ped_request already latched */
+static unsigned long prio_mismatch = 0;   /* event arrived with wrong priority class */
+static long mq_depth_hwm = 0;             /* deepest queue seen at poll time */
+
 static void mq_setup_server(void)
 {
     struct mq_attr attr;
     memset(&attr, 0, sizeof(attr));
-    attr.mq_maxmsg  = 20;
+    attr.mq_maxmsg  = MQ_MAXMSG;
     attr.mq_msgsize = MSG_SIZE;
 
     mq_unlink(QUEUE_NAME);
@@ -130,14 +155,35 @@ static void mq_setup_server(void)
     }
 }
 
+static unsigned evt_prio(char ev)
+{
+    if (ev == EVT_TRAIN_DETECT) return PRIO_TRAIN;
+    if (ev == EVT_TRAIN_CLEAR)  return PRIO_CLEAR;
+    return PRIO_PED;
+}
+
+static void print_evt_stats(void)
+{
+    printf("[mq] rx t=%lu c=%lu p=%lu | ped coalesced=%lu | prio mismatch=%lu | depth hwm=%ld/%d\n",
+           rx_count[PRIO_TRAIN], rx_count[PRIO_CLEAR], rx_count[PRIO_PED],
+           ped_coalesced, prio_mismatch, mq_depth_hwm, MQ_MAXMSG);
+    fflush(stdout);
+}
+
 static void poll_events_from_mq(void)
 {
     if (mq == (mqd_t)-1) return;
 
     char buf[MSG_SIZE];
+    unsigned prio;
+
+    struct mq_attr attr;
+    if (mq_getattr(mq, &attr) == 0 && attr.mq_curmsgs > mq_depth_hwm) {
+        mq_depth_hwm = attr.mq_curmsgs;
+    }
 
     while (1) {
-        ssize_t n = mq_receive(mq, buf, MSG_SIZE, NULL);
+        ssize_t n = mq_receive(mq, buf, MSG_SIZE, &prio);
         if (n == -1) {
             if (errno == EAGAIN) break;
             perror("mq_receive");
@@ -145,26 +191,29 @@ static void poll_events_from_mq(void)
         }
 
         char ev = buf[0];
+        if (prio != evt_prio(ev)) prio_mismatch++;
+        if (prio <= PRIO_TRAIN) rx_count[prio]++;
+
         if (ev == EVT_TRAIN_DETECT) {
             train_request = 1;
             train_active  = 1;
             train_clear_pending = 0;
 
             train_preempt_notified = 0;
-            train_preempt_to_allred = 0;
         } else if (ev == EVT_TRAIN_CLEAR) {
             train_clear_pending = 1;
             train_request = 0;
         } else if (ev == EVT_PED_PRESS) {
+            if (ped_request) ped_coalesced++;
             ped_request = 1;
         }
     }
 }
 
 /* ================= NOTIFY HELPERS ================= */
-static void notify_train_begin(void)   { printf("\n*** TRAIN BEGIN ***\n\n"); fflush(stdout); }
+static void notify_train_begin(void)   { printf("\n*** TRAIN BEGIN ***\n\n"); print_evt_stats(); }
 static void notify_train_over(void)    { printf("\n*** TRAIN OVER  ***\n\n"); fflush(stdout); }
-static void notify_train_preempt(void) { printf("\n>>> TRAIN PREEMPT: forcing YELLOW immediately <<<\n\n"); fflush(stdout); }
+static void notify_train_preempt(void) { printf("\n>>> TRAIN PREEMPT: shortest safe path to ALL-RED <<<\n\n"); fflush(stdout); }
 static void notify_train_clear(void)   { printf("\n>>> TRAIN CLEAR: will exit at next SAFE ALL-RED <<<\n\n"); fflush(stdout); }
 static void notify_ped_begin(void)     { printf("\n*** PED BEGIN   ***\n\n"); fflush(stdout); }
 static void notify_ped_over(void)      { printf("\n*** PED OVER    ***\n\n"); fflush(stdout); }
@@ -184,43 +233,104 @@ static int mode_index_of(state_t s)
     return (int)s - 20;                               /* 0..2 */
 }
 
-static unsigned duration_of(state_t s)
+/* ================= TIMING PLAN =================
+ * Durations are read from the active plan; the #defines above are the
+ * built-in plan. Everything derived from the timings (per-state durations,
+ * preempt table, output headers) is built with the plan, so switching plans
+ * is a single pointer swap.
+ */
+#define N_STATES    ((int)P_CLEAR_ALL_RED + 1)
+#define HDR_TXT_MAX 32
+
+typedef enum {
+    TP_R3_RS_GREEN = 0, TP_R3_L_GREEN, TP_R2_RS_GREEN, TP_R2_L_GREEN,
+    TP_YELLOW, TP_ALL_RED, TP_TR_1_G, TP_TR_2_G,
+    TP_TR_3_G, TP_TR_Y, TP_TR_R, TP_PED_WALK,
+    TP_PED_FLASH, TP_PED_CLR,
+    N_TP
+} tp_key_t;
+
+/* plan file keys; a key missing from the file keeps its built-in value.
+ * Clearances (yellow, all-red, ped flash and clear) never go below the built-in ones. */
+static const struct { const char *name; unsigned def, min, max; } TP_KEYS[N_TP] = {
+    { "r3_rs_green",  T_R3_RS_GREEN,    5, 120 },
+    { "r3_l_green",   T_R3_L_GREEN,     3,  60 },
+    { "r2_rs_green",  T_R2_RS_GREEN,    5, 120 },
+    { "r2_l_green",   T_R2_L_GREEN,     3,  60 },
+    { "yellow",       T_YELLOW,         4,   6 },
+    { "all_red",      T_ALL_RED,        2,   6 },
+    { "tr_1_g",       T_TR_1_G,         3,  60 },
+    { "tr_2_g",       T_TR_2_G,         3,  60 },
+    { "tr_3_g",       T_TR_3_G,         3,  60 },
+    { "tr_y",         T_TR_Y,           4,   6 },
+    { "tr_r",         T_TR_R,           2,   6 },
+    { "ped_walk",     T_PED_WALK,       4,  60 },
+    { "ped_flash",    T_PED_FLASH,      4,  30 },
+    { "ped_clr",      T_PED_CLR,        2,   6 },
+};
+
+typedef struct {
+    state_t  next;     /* next hop (== state for a target all-red) */
+    unsigned worst_s;  /* 0 = no path (TRAIN states) */
+} preempt_entry_t;
+
+typedef struct {
+    unsigned t[N_TP];
+
+    /* derived by plan_build() */
+    char            name[16];
+    unsigned        dur[N_STATES];
+    preempt_entry_t preempt[N_STATES];
+    uint8_t         hdr_len[N_STATES];
+    char            hdr[N_STATES][HDR_TXT_MAX];   /* "[NORMAL S0] (20s)" */
+} timing_plan_t;
+
+/* read by the FSM thread only; replaced only at a safe all-red
+ * (points into plan_set_cur, see TIMING PLANS + SCHEDULE) */
+static timing_plan_t *plan_cur = NULL;
+
+static unsigned plan_state_duration(const timing_plan_t *p, state_t s)
 {
     switch (s) {
         /* NORMAL (R3 high traffic) */
-        case N_R3_RS_G:   return T_R3_RS_GREEN;
-        case N_R3_RS_Y:   return T_YELLOW;
-        case N_R3_L_G:    return T_R3_L_GREEN;
-        case N_R3_L_Y:    return T_YELLOW;
-        case N_ALL_RED_1: return T_ALL_RED;
+        case N_R3_RS_G:   return p->t[TP_R3_RS_GREEN];
+        case N_R3_RS_Y:   return p->t[TP_YELLOW];
+        case N_R3_L_G:    return p->t[TP_R3_L_GREEN];
+        case N_R3_L_Y:    return p->t[TP_YELLOW];
+        case N_ALL_RED_1: return p->t[TP_ALL_RED];
 
         /* NORMAL (R2 moderate traffic) */
-        case N_R2_RS_G:   return T_R2_RS_GREEN;
-        case N_R2_RS_Y:   return T_YELLOW;
-        case N_R2_L_G:    return T_R2_L_GREEN;
-        case N_R2_L_Y:    return T_YELLOW;
-        case N_ALL_RED_2: return T_ALL_RED;
+        case N_R2_RS_G:   return p->t[TP_R2_RS_GREEN];
+        case N_R2_RS_Y:   return p->t[TP_YELLOW];
+        case N_R2_L_G:    return p->t[TP_R2_L_GREEN];
+        case N_R2_L_Y:    return p->t[TP_YELLOW];
+        case N_ALL_RED_2: return p->t[TP_ALL_RED];
 
         /* TRAIN */
-        case T_R3_NS_SRL_G_1:       return T_TR_1_G;
-        case T_R3_NS_SRL_Y_1:       return T_TR_Y;
-        case T_ALL_RED_A:           return T_TR_R;
-        case T_R3_SN_LR_G_2:        return T_TR_2_G;
-        case T_R3_SN_LR_Y_2:        return T_TR_Y;
-        case T_ALL_RED_B:           return T_TR_R;
-        case T_R2_RESTRICT_G_3:     return T_TR_3_G;
-        case T_R2_RESTRICT_Y_3:     return T_TR_Y;
-        case T_DECISION_ALL_RED_4:  return T_TR_R;
+        case T_R3_NS_SRL_G_1:       return p->t[TP_TR_1_G];
+        case T_R3_NS_SRL_Y_1:       return p->t[TP_TR_Y];
+        case T_ALL_RED_A:           return p->t[TP_TR_R];
+        case T_R3_SN_LR_G_2:        return p->t[TP_TR_2_G];
+        case T_R3_SN_LR_Y_2:        return p->t[TP_TR_Y];
+        case T_ALL_RED_B:           return p->t[TP_TR_R];
+        case T_R2_RESTRICT_G_3:     return p->t[TP_TR_3_G];
+        case T_R2_RESTRICT_Y_3:     return p->t[TP_TR_Y];
+        case T_DECISION_ALL_RED_4:  return p->t[TP_TR_R];
 
         /* PED */
-        case P_WALK:          return T_PED_WALK;
-        case P_FLASH:         return T_PED_FLASH;
-        case P_CLEAR_ALL_RED: return T_PED_CLR;
+        case P_WALK:          return p->t[TP_PED_WALK];
+        case P_FLASH:         return p->t[TP_PED_FLASH];
+        case P_CLEAR_ALL_RED: return p->t[TP_PED_CLR];
 
         default: return 0;
     }
 }
 
+static unsigned duration_of(state_t s)
+{
+    return plan_cur->dur[s];
+}
+
 static int is_train_state(state_t s)
 {
     return (s >= T_R3_NS_SRL_G_1 && s <= T_DECISION_ALL_RED_4);
@@ -232,15 +342,133 @@ static int is_normal_green(state_t s)
             s == N_R2_RS_G || s == N_R2_L_G);
 }
 
-static state_t normal_green_to_yellow(state_t s)
+/* ================= CYCLE =================
+ * Successor of every state when nothing is pending. SingleStep_SM takes
+ * every plain advance from here and the preempt table is derived from it,
+ * so the graph is written down once. All-reds list their default exit;
+ * train, ped and exit decisions are taken in SingleStep_SM, and
+ * P_CLEAR_ALL_RED returns to ped_return_state.
+ */
+static const state_t CYCLE_NEXT[N_STATES] = {
+    [N_R3_RS_G] = N_R3_RS_Y,   [N_R3_RS_Y] = N_R3_L_G,   [N_R3_L_G] = N_R3_L_Y,
+    [N_R3_L_Y]  = N_ALL_RED_1, [N_ALL_RED_1] = N_R2_RS_G,
+    [N_R2_RS_G] = N_R2_RS_Y,   [N_R2_RS_Y] = N_R2_L_G,   [N_R2_L_G] = N_R2_L_Y,
+    [N_R2_L_Y]  = N_ALL_RED_2, [N_ALL_RED_2] = N_R3_RS_G,
+
+    [T_R3_NS_SRL_G_1] = T_R3_NS_SRL_Y_1, [T_R3_NS_SRL_Y_1] = T_ALL_RED_A,
+    [T_ALL_RED_A]     = T_R3_SN_LR_G_2,  [T_R3_SN_LR_G_2]  = T_R3_SN_LR_Y_2,
+    [T_R3_SN_LR_Y_2]  = T_ALL_RED_B,     [T_ALL_RED_B]     = T_R2_RESTRICT_G_3,
+    [T_R2_RESTRICT_G_3] = T_R2_RESTRICT_Y_3, [T_R2_RESTRICT_Y_3] = T_DECISION_ALL_RED_4,
+    [T_DECISION_ALL_RED_4] = T_R3_SN_LR_G_2,
+
+    [P_WALK] = P_FLASH, [P_FLASH] = P_CLEAR_ALL_RED, [P_CLEAR_ALL_RED] = P_CLEAR_ALL_RED,
+};
+
+static int is_left_green(state_t s)
 {
-    switch (s) {
-        case N_R3_RS_G: return N_R3_RS_Y;
-        case N_R3_L_G:  return N_R3_L_Y;
-        case N_R2_RS_G: return N_R2_RS_Y;
-        case N_R2_L_G:  return N_R2_L_Y;
-        default:        return s;
+    return (s == N_R3_L_G || s == N_R2_L_G);
+}
+
+/* ================= PREEMPT TABLE =================
+ * Shortest safe path from every NORMAL/PED state to an all-red that can
+ * start TRAIN. Built with each timing plan; the edges come from
+ * CYCLE_NEXT (preempt_edges):
+ *  - NORMAL greens and PED WALK may be cut immediately (min 0s)
+ *  - yellows, PED FLASH and all-reds always run their full time
+ * worst_s = detection at the start of the state -> TRAIN S0.
+ */
+static int is_preempt_target(state_t s)
+{
+    return (s == N_ALL_RED_1 || s == N_ALL_RED_2 || s == P_CLEAR_ALL_RED);
+}
+
+/* time that must still be served once a train is pending */
+static unsigned preempt_min_s(const timing_plan_t *p, state_t s)
+{
+    if (is_normal_green(s) || s == P_WALK) return 0;
+    return p->dur[s];
+}
+
+/* moves a pending train may take out of s: the cycle successor and, from a
+ * road yellow, the all-red after its left phases (skip left phases) */
+static int preempt_edges(state_t s, state_t to[2])
+{
+    if (is_preempt_target(s)) return 0;
+    if (s > N_ALL_RED_2 && s != P_WALK && s != P_FLASH) return 0;
+
+    int n = 0;
+    to[n++] = CYCLE_NEXT[s];
+    if (is_left_green(CYCLE_NEXT[s])) to[n++] = CYCLE_NEXT[CYCLE_NEXT[CYCLE_NEXT[s]]];
+    return n;
+}
+
+static void build_preempt_table(timing_plan_t *p)
+{
+    for (int i = 0; i < N_STATES; i++) {
+        p->preempt[i].next = (state_t)i;
+        p->preempt[i].worst_s = is_preempt_target((state_t)i) ? p->dur[i] : 0;
+    }
+
+    /* Bellman-Ford relaxation; the graph is tiny */
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < N_STATES; i++) {
+            state_t a = (state_t)i, to[2];
+            int n = preempt_edges(a, to);
+            for (int e = 0; e < n; e++) {
+                state_t b = to[e];
+                if (p->preempt[b].worst_s == 0) continue;
+
+                unsigned via = preempt_min_s(p, a) + p->preempt[b].worst_s;
+                if (p->preempt[a].worst_s == 0 || via < p->preempt[a].worst_s) {
+                    p->preempt[a].next = b;
+                    p->preempt[a].worst_s = via;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+static void print_preempt_table(void)
+{
+    printf("Train preempt table (worst case detection -> TRAIN start):\n");
+    for (int i = 0; i < N_STATES; i++) {
+        state_t s = (state_t)i;
+        if (plan_cur->preempt[i].worst_s == 0) continue;
+        printf("  [%s S%d] -> [%s S%d]  %2us\n",
+               mode_of(s), mode_index_of(s),
+               mode_of(plan_cur->preempt[i].next), mode_index_of(plan_cur->preempt[i].next),
+               plan_cur->preempt[i].worst_s);
     }
+    printf("\n");
+    fflush(stdout);
+}
+
+/* train pending outside TRAIN: follow the preempt table instead of the cycle */
+static int preempt_next(state_t *cur)
+{
+    if (!train_request || in_train_mode) return 0;
+    if (is_preempt_target(*cur)) return 0;
+    if (plan_cur->preempt[*cur].worst_s == 0) return 0;
+
+    *cur = plan_cur->preempt[*cur].next;
+    return 1;
+}
+
+/* consume train_request at a safe all-red */
+static void enter_train(state_t *cur)
+{
+    train_request = 0;
+    train_active  = 1;
+    train_clear_pending = 0;
+    train_preempt_notified = 0;
+
+    /* TRAIN starts at S1 */
+    *cur = T_R3_NS_SRL_G_1;
+
+    if (!in_train_mode) { in_train_mode = 1; notify_train_begin(); }
 }
 
 /* ================= PED SAFE CHECK ================= */
@@ -275,48 +503,884 @@ static int try_start_ped_if_safe(state_t *cur)
     return 1;
 }
 
-/* ================= OUTPUT ================= */
-static void print_state_outputs(state_t s)
+/* ================= SIGNAL HEADS + INTERLOCK =================
+ * Each head lights a set of movements (L/S/R per approach, plus PED).
+ * A movement has right of way while its head shows G or Y; PRE-Y and RED
+ * light nothing. CONFLICT_OF[mask] is the union of the conflict rows of
+ * every movement in mask, so a frame is legal iff
+ *     (mask & CONFLICT_OF[mask]) == 0
+ * Frames are validated at startup; before every output the heads as they
+ * will be driven (changed heads plus the ones held from earlier writes)
+ * are checked again.
+ */
+enum { H_R3_SN = 0, H_R3_NS, H_R2_WE, H_R2_EW, H_PED, N_HEADS };
+
+enum {
+    MV_R3_SN_L = 0, MV_R3_SN_S, MV_R3_SN_R,
+    MV_R3_NS_L,     MV_R3_NS_S, MV_R3_NS_R,
+    MV_R2_WE_L,     MV_R2_WE_S, MV_R2_WE_R,
+    MV_R2_EW_L,     MV_R2_EW_S, MV_R2_EW_R,
+    MV_PED,
+    MV_COUNT
+};
+
+typedef uint16_t mvmask_t;
+
+#define MV(b)      ((mvmask_t)(1u << (b)))
+#define MV_R3_ALL  ((mvmask_t)(0x3Fu << MV_R3_SN_L))
+#define MV_R2_ALL  ((mvmask_t)(0x3Fu << MV_R2_WE_L))
+#define MV_VEH_ALL ((mvmask_t)(MV_R3_ALL | MV_R2_ALL))
+
+/* first movement bit of each vehicle head (L, S, R follow) */
+static const int HEAD_MV_BASE[N_HEADS] = { MV_R3_SN_L, MV_R3_NS_L, MV_R2_WE_L, MV_R2_EW_L, MV_PED };
+
+/* Conflict matrix (row = movement). Crossing roads conflict, PED conflicts
+ * with every vehicle movement; opposing approaches of the same road run
+ * together (permissive turns), as in the phase tables below.
+ */
+static const mvmask_t CONFLICT_ROW[MV_COUNT] = {
+    MV_R2_ALL | MV(MV_PED), MV_R2_ALL | MV(MV_PED), MV_R2_ALL | MV(MV_PED),
+    MV_R2_ALL | MV(MV_PED), MV_R2_ALL | MV(MV_PED), MV_R2_ALL | MV(MV_PED),
+    MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED),
+    MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED),
+    MV_VEH_ALL
+};
+
+static mvmask_t CONFLICT_OF[1u << MV_COUNT];
+static mvmask_t FRAME_MASK[N_STATES];
+static unsigned long interlock_trips = 0;
+
+/* heads in print order: R3(S->N), R3(N->S), R2(W->E), R2(E->W), PED */
+static void state_heads(state_t s, const char *h[N_HEADS])
 {
-    const char *r3_sn = "RED";  /* R3 (S->N) */
-    const char *r3_ns = "RED";  /* R3 (N->S) */
-    const char *r2_we = "RED";  /* R2 (W->E) */
-    const char *r2_ew = "RED";  /* R2 (E->W) */
-    const char *ped   = "RED";
+    for (int i = 0; i < N_HEADS; i++) h[i] = "RED";
 
     switch (s) {
         /* NORMAL */
-        case N_R3_RS_G: r3_sn = "RS-G"; r3_ns = "RS-G"; break;
-        case N_R3_RS_Y: r3_sn = "RS-Y"; r3_ns = "RS-Y"; break;
-        case N_R3_L_G:  r3_sn = "L-G";  r3_ns = "L-G";  break;
-        case N_R3_L_Y:  r3_sn = "L-Y";  r3_ns = "L-Y";  break;
+        case N_R3_RS_G: h[H_R3_SN] = "RS-G"; h[H_R3_NS] = "RS-G"; break;
+        case N_R3_RS_Y: h[H_R3_SN] = "RS-Y"; h[H_R3_NS] = "RS-Y"; break;
+        case N_R3_L_G:  h[H_R3_SN] = "L-G";  h[H_R3_NS] = "L-G";  break;
+        case N_R3_L_Y:  h[H_R3_SN] = "L-Y";  h[H_R3_NS] = "L-Y";  break;
 
-        case N_R2_RS_G: r2_we = "RS-G"; r2_ew = "RS-G"; break;
-        case N_R2_RS_Y: r2_we = "RS-Y"; r2_ew = "RS-Y"; break;
-        case N_R2_L_G:  r2_we = "L-G";  r2_ew = "L-G";  break;
-        case N_R2_L_Y:  r2_we = "L-Y";  r2_ew = "L-Y";  break;
+        case N_R2_RS_G: h[H_R2_WE] = "RS-G"; h[H_R2_EW] = "RS-G"; break;
+        case N_R2_RS_Y: h[H_R2_WE] = "RS-Y"; h[H_R2_EW] = "RS-Y"; break;
+        case N_R2_L_G:  h[H_R2_WE] = "L-G";  h[H_R2_EW] = "L-G";  break;
+        case N_R2_L_Y:  h[H_R2_WE] = "L-Y";  h[H_R2_EW] = "L-Y";  break;
 
         /* TRAIN (Intersection 2 rule: clear cars applies to R3 S->N only) */
-        case T_R3_NS_SRL_G_1: r3_sn = "SRL-G"; break;
-        case T_R3_NS_SRL_Y_1: r3_sn = "SRL-Y"; break;
+        case T_R3_NS_SRL_G_1: h[H_R3_SN] = "SRL-G"; break;
+        case T_R3_NS_SRL_Y_1: h[H_R3_SN] = "SRL-Y"; break;
 
-        case T_R3_SN_LR_G_2:  r3_sn = "LR-G";  break;
-        case T_R3_SN_LR_Y_2:  r3_sn = "LR-Y";  break;
+        case T_R3_SN_LR_G_2:  h[H_R3_SN] = "LR-G";  break;
+        case T_R3_SN_LR_Y_2:  h[H_R3_SN] = "LR-Y";  break;
 
         /* TRAIN R2 restrictions */
-        case T_R2_RESTRICT_G_3: r2_we = "SL-G"; r2_ew = "SR-G"; break;
-        case T_R2_RESTRICT_Y_3: r2_we = "SL-Y"; r2_ew = "SR-Y"; break;
+        case T_R2_RESTRICT_G_3: h[H_R2_WE] = "SL-G"; h[H_R2_EW] = "SR-G"; break;
+        case T_R2_RESTRICT_Y_3: h[H_R2_WE] = "SL-Y"; h[H_R2_EW] = "SR-Y"; break;
 
         /* PED */
-        case P_WALK:  ped = "WALK";  break;
-        case P_FLASH: ped = "FLASH"; break;
+        case P_WALK:  h[H_PED] = "WALK";  break;
+        case P_FLASH: h[H_PED] = "FLASH"; break;
 
         default: break;
     }
+}
+
+static mvmask_t aspect_moves(const char *aspect, int head)
+{
+    if (head == H_PED) {
+        return (strcmp(aspect, "WALK") == 0 || strcmp(aspect, "FLASH") == 0) ? MV(MV_PED) : 0;
+    }
+    if (strcmp(aspect, "RED") == 0 || strcmp(aspect, "PRE-Y") == 0) return 0;
+
+    mvmask_t m = 0;
+    for (const char *p = aspect; *p && *p != '-'; p++) {
+        if (*p == 'L') m |= MV(HEAD_MV_BASE[head] + 0);
+        if (*p == 'S') m |= MV(HEAD_MV_BASE[head] + 1);
+        if (*p == 'R') m |= MV(HEAD_MV_BASE[head] + 2);
+    }
+    return m;
+}
+
+static int interlock_ok(mvmask_t frame)
+{
+    return (frame & CONFLICT_OF[frame]) == 0;
+}
+
+/* refuses to start if any state's frame lights conflicting movements */
+static void build_interlock(void)
+{
+    for (unsigned m = 0; m < (1u << MV_COUNT); m++) {
+        mvmask_t c = 0;
+        for (int b = 0; b < MV_COUNT; b++) {
+            if (m & (1u << b)) c |= CONFLICT_ROW[b];
+        }
+        CONFLICT_OF[m] = c;
+    }
+
+    int bad = 0;
+    for (int i = 0; i < N_STATES; i++) {
+        const char *h[N_HEADS];
+        state_heads((state_t)i, h);
+
+        mvmask_t m = 0;
+        for (int k = 0; k < N_HEADS; k++) m |= aspect_moves(h[k], k);
+        FRAME_MASK[i] = m;
+
+        if (!interlock_ok(m)) {
+            printf("INTERLOCK: state %d lights conflicting movements (mask 0x%04x)\n", i, (unsigned)m);
+            bad = 1;
+        }
+    }
+    if (bad) {
+        fflush(stdout);
+        exit(1);
+    }
+}
+
+/* ================= OUTPUT DRIVER =================
+ * Each state's frame (interned aspect per head, rendered head text) is
+ * built once at startup; the header text comes with the timing plan. A step compares aspect
+ * ids against the frame last sent and writes only the heads that changed,
+ * header included, as one line in a single write(). A step where no head
+ * changes writes nothing.
+ */
+#define FRAME_FAILSAFE  N_STATES            /* extra frame slot: ALL RED */
+#define HEAD_TXT_MAX    24
+#define OUT_LINE_MAX    (HDR_TXT_MAX + N_HEADS * (HEAD_TXT_MAX + 3) + 1)
+#define MAX_ASPECTS     32
+
+static const char *HEAD_LABEL[N_HEADS] = { "R3(S->N)", "R3(N->S)", "R2(W->E)", "R2(E->W)", "PED" };
+static const int   HEAD_WIDTH[N_HEADS] = { 6, 6, 6, 6, 5 };
+
+typedef struct {
+    uint8_t aspect_id[N_HEADS];              /* index into out_aspects[] */
+    mvmask_t head_mv[N_HEADS];               /* movements each head lights */
+    uint8_t head_len[N_HEADS];
+    char    head_txt[N_HEADS][HEAD_TXT_MAX]; /* "R3(S->N)=RS-G  " */
+} frame_t;
+
+static frame_t     FRAME[N_STATES + 1];
+static const char *out_aspects[MAX_ASPECTS];
+static int         n_out_aspects = 0;
+static int         out_last = -1;            /* frame last sent, -1 = none yet */
+static mvmask_t    out_mv[N_HEADS];          /* movements on each head as driven */
+
+static uint8_t intern_aspect(const char *a)
+{
+    for (int i = 0; i < n_out_aspects; i++) {
+        if (strcmp(out_aspects[i], a) == 0) return (uint8_t)i;
+    }
+    if (n_out_aspects == MAX_ASPECTS) {
+        printf("OUTPUT: too many distinct aspects\n");
+        exit(1);
+    }
+    out_aspects[n_out_aspects] = a;
+    return (uint8_t)n_out_aspects++;
+}
+
+/* must run after build_interlock() */
+static void build_frames(void)
+{
+    for (int i = 0; i <= N_STATES; i++) {
+        frame_t *f = &FRAME[i];
+        const char *h[N_HEADS];
+
+        if (i == FRAME_FAILSAFE) {
+            for (int k = 0; k < N_HEADS; k++) h[k] = "RED";
+        } else {
+            state_heads((state_t)i, h);
+        }
+
+        for (int k = 0; k < N_HEADS; k++) {
+            f->aspect_id[k] = intern_aspect(h[k]);
+            f->head_mv[k] = aspect_moves(h[k], k);
+            f->head_len[k] = (uint8_t)snprintf(f->head_txt[k], HEAD_TXT_MAX, "%s=%-*s",
+                                               HEAD_LABEL[k], HEAD_WIDTH[k], h[k]);
+        }
+    }
+}
+
+static void print_state_outputs(state_t s)
+{
+    const timing_plan_t *p = plan_cur;
+    int fi = (int)s;
+    const frame_t *of = (out_last >= 0) ? &FRAME[out_last] : NULL;
+
+    /* fail safe: what the heads show after this write, held heads as they
+     * were driven; a conflicting result never goes out, ALL RED instead */
+    mvmask_t driven = 0;
+    for (int k = 0; k < N_HEADS; k++) {
+        int held = of && of->aspect_id[k] == FRAME[fi].aspect_id[k];
+        driven |= held ? out_mv[k] : FRAME[fi].head_mv[k];
+    }
+    if (!interlock_ok(driven)) {
+        interlock_trips++;
+        printf("\n!!! INTERLOCK: conflicting frame 0x%04x -> ALL RED (trips=%lu) !!!\n\n",
+               (unsigned)driven, interlock_trips);
+        fi = FRAME_FAILSAFE;
+    }
+
+    const frame_t *nf = &FRAME[fi];
+    char line[OUT_LINE_MAX];
+    size_t n = 0;
+
+    for (int k = 0; k < N_HEADS; k++) {
+        if (of && of->aspect_id[k] == nf->aspect_id[k]) continue;
+        if (n == 0) {
+            memcpy(line, p->hdr[s], p->hdr_len[s]);
+            n = p->hdr_len[s];
+        }
+        memcpy(line + n, " | ", 3);
+        n += 3;
+        memcpy(line + n, nf->head_txt[k], nf->head_len[k]);
+        n += nf->head_len[k];
+        out_mv[k] = nf->head_mv[k];
+    }
+    out_last = fi;
+    if (n == 0) return;
+
+    line[n++] = '\n';
+    fflush(stdout);     /* keep ordering with the printf() users */
+    ssize_t w = write(STDOUT_FILENO, line, n);
+    (void)w;
+}
+
+/* ================= TIMING PLANS + SCHEDULE =================
+ * Plan file (BUILTIN_PLANS when none is given), one item per line, '#' comments:
+ *   key = seconds            base plan (keys as in TP_KEYS)
+ *   [name]                   new plan, starts as a copy of the base plan
+ *   at <days> HH:MM <name>   from HH:MM on <days> run <name> ("base" allowed)
+ *   holiday YYYY-MM-DD       that date runs the "hol" schedule
+ * <days>: sun..sat, ranges (mon-fri), lists (sat,sun), "hol" or "all".
+ * A day type keeps the plan of its last entry until the next one (wrapping
+ * over midnight); a day type with no entries runs the base plan.
+ *
+ * The watcher thread parses, validates and builds the whole set (every
+ * plan plus the calendar index) off the FSM path and publishes it with an
+ * atomic exchange on plan_next. At each safe all-red the FSM takes a
+ * pending set and looks the active plan up in O(1): the holiday bit of the
+ * date, then SLOT_PLAN[day type][15 min slot]. The FSM is the only reader
+ * of the current set, so it frees the set it replaces right there.
+ * No locks on the FSM path.
+ */
+#define PLAN_POLL_S        1
+#define PLAN_MAX_PREEMPT_S 15   /* worst case train detection -> TRAIN start */
+#define MAX_PLANS          8
+#define MAX_SCHED          64
+#define SCHED_SLOT_MIN     15
+#define SCHED_SLOTS        (24 * 60 / SCHED_SLOT_MIN)
+#define DT_HOLIDAY         7    /* day types 0..6 = tm_wday */
+#define N_DAYTYPES         8
+#define HOL_BASE_YEAR      2000
+#define HOL_YEARS          100
+#define HOL_BITS           (HOL_YEARS * 366)
+
+typedef struct {
+    unsigned      gen;
+    unsigned      n_plans;
+    timing_plan_t plan[MAX_PLANS];                  /* [0] = base */
+    uint8_t       slot_plan[N_DAYTYPES][SCHED_SLOTS];
+    uint8_t       holiday[(HOL_BITS + 7) / 8];      /* bit (year-2000)*366 + yday */
+} plan_set_t;
+
+/* parser state while a set is being built */
+typedef struct {
+    plan_set_t *set;
+    unsigned    t[MAX_PLANS][N_TP];
+    char        name[MAX_PLANS][16];
+    int         cur;                                /* plan receiving keys */
+    int         n_at;
+    struct { uint8_t days; uint16_t minute; char plan[16]; } at[MAX_SCHED];
+} plan_src_t;
+
+/* Intersection 2 without a plan file: R3 major all day, R3 inbound peak in
+ * the morning, both roads busier in the evening, short night cycle */
+static const char *BUILTIN_PLANS[] = {
+    "[am_peak]",
+    "r3_rs_green = 30",
+    "[pm_peak]",
+    "r3_rs_green = 30",
+    "r2_rs_green = 20",
+    "[night]",
+    "r3_rs_green = 12",
+    "r3_l_green  = 6",
+    "r2_rs_green = 8",
+    "r2_l_green  = 5",
+    "at all     06:00 base",
+    "at mon-fri 07:00 am_peak",
+    "at mon-fri 09:30 base",
+    "at mon-fri 16:00 pm_peak",
+    "at mon-fri 19:00 base",
+    "at all     22:00 night",
+    NULL
+};
+
+static const char *DAY_NAME[N_DAYTYPES] = { "sun", "mon", "tue", "wed", "thu", "fri", "sat", "hol" };
+
+static const char *plan_path = NULL;
+static _Atomic(plan_set_t *) plan_next = NULL;
+static plan_set_t *plan_set_cur = NULL;   /* FSM thread */
+static unsigned plan_gen = 0;             /* watcher thread (main before it starts) */
+
+/* schedule clock: wall clock on the street, virtual in the SIMULATOR */
+static int    sim_mode = 0;
+static time_t sim_now  = 0;
+
+static time_t fsm_time(void)
+{
+    return sim_mode ? sim_now : time(NULL);
+}
+
+/* every head RED: no movement lit, nothing to re-time mid-interval */
+static int is_safe_allred(state_t s)
+{
+    return FRAME_MASK[s] == 0;
+}
+
+static int day_index(const char *d, size_t n)
+{
+    for (int i = 0; i < N_DAYTYPES; i++) {
+        if (strlen(DAY_NAME[i]) == n && strncmp(DAY_NAME[i], d, n) == 0) return i;
+    }
+    return -1;
+}
+
+/* "mon-fri", "sat,sun", "hol", "all" -> day type mask, 0 on error */
+static unsigned day_mask(const char *spec)
+{
+    if (strcmp(spec, "all") == 0) return (1u << N_DAYTYPES) - 1;
+
+    unsigned m = 0;
+    while (*spec) {
+        size_t n = strcspn(spec, ",");
+        const char *dash = memchr(spec, '-', n);
+        int lo = day_index(spec, dash ? (size_t)(dash - spec) : n);
+        int hi = dash ? day_index(dash + 1, n - (size_t)(dash - spec) - 1) : lo;
+        if (lo < 0 || hi < 0 || hi < lo || (lo != hi && hi == DT_HOLIDAY)) return 0;
+        for (int d = lo; d <= hi; d++) m |= 1u << d;
+        spec += n;
+        if (*spec == ',') spec++;
+    }
+    return m;
+}
+
+static int plan_src_line(plan_src_t *ps, char *line, int ln, char *err, size_t errlen)
+{
+    char *hash = strchr(line, '#');
+    if (hash) *hash = '\0';
+
+    char a[32], b[32], nm[16], extra;
+    unsigned v, hh, mm, y, mo, d;
+
+    if (sscanf(line, " %31s", a) != 1) return 0;    /* blank / comment */
+
+    if (sscanf(line, " [%15[a-z0-9_]] %c", nm, &extra) == 1) {
+        if (strcmp(nm, "base") == 0) {
+            snprintf(err, errlen, "line %d: plan name 'base' is reserved", ln);
+            return -1;
+        }
+        for (int i = 0; i <= ps->cur; i++) {
+            if (strcmp(ps->name[i], nm) == 0) {
+                snprintf(err, errlen, "line %d: plan '%s' defined twice", ln, nm);
+                return -1;
+            }
+        }
+        if (ps->cur + 1 == MAX_PLANS) {
+            snprintf(err, errlen, "line %d: more than %d plans", ln, MAX_PLANS);
+            return -1;
+        }
+        ps->cur++;
+        memcpy(ps->t[ps->cur], ps->t[0], sizeof ps->t[0]);
+        memcpy(ps->name[ps->cur], nm, sizeof nm);
+        return 0;
+    }
+
+    if (sscanf(line, " at %31s %u:%u %15s %c", b, &hh, &mm, nm, &extra) == 4) {
+        unsigned m = day_mask(b);
+        if (!m || hh > 23 || mm > 59 || (mm % SCHED_SLOT_MIN) != 0) {
+            snprintf(err, errlen, "line %d: bad schedule entry (days, HH:MM on a %d min boundary)",
+                     ln, SCHED_SLOT_MIN);
+            return -1;
+        }
+        if (ps->n_at == MAX_SCHED) {
+            snprintf(err, errlen, "line %d: more than %d schedule entries", ln, MAX_SCHED);
+            return -1;
+        }
+        ps->at[ps->n_at].days = (uint8_t)m;
+        ps->at[ps->n_at].minute = (uint16_t)(hh * 60 + mm);
+        memcpy(ps->at[ps->n_at].plan, nm, sizeof nm);
+        ps->n_at++;
+        return 0;
+    }
+
+    if (sscanf(line, " holiday %u-%u-%u %c", &y, &mo, &d, &extra) == 3) {
+        struct tm tm;
+        memset(&tm, 0, sizeof tm);
+        tm.tm_year = (int)y - 1900;
+        tm.tm_mon = (int)mo - 1;
+        tm.tm_mday = (int)d;
+        tm.tm_hour = 12;
+        tm.tm_isdst = -1;
+        if (y < HOL_BASE_YEAR || y >= HOL_BASE_YEAR + HOL_YEARS || mktime(&tm) == (time_t)-1 ||
+            tm.tm_mon != (int)mo - 1 || tm.tm_mday != (int)d) {
+            snprintf(err, errlen, "line %d: bad holiday date", ln);
+            return -1;
+        }
+        unsigned bit = (y - HOL_BASE_YEAR) * 366u + (unsigned)tm.tm_yday;
+        ps->set->holiday[bit >> 3] |= (uint8_t)(1u << (bit & 7));
+        return 0;
+    }
+
+    int n = sscanf(line, " %31[a-z0-9_] = %u %c", a, &v, &extra);
+    if (n != 2) {
+        snprintf(err, errlen, "line %d: expected 'key = seconds', '[plan]', 'at ...' or 'holiday ...'", ln);
+        return -1;
+    }
+
+    int k = 0;
+    while (k < N_TP && strcmp(TP_KEYS[k].name, a) != 0) k++;
+    if (k == N_TP) {
+        snprintf(err, errlen, "line %d: unknown key '%s'", ln, a);
+        return -1;
+    }
+    if (v < TP_KEYS[k].min || v > TP_KEYS[k].max) {
+        snprintf(err, errlen, "line %d: %s=%u out of range [%u..%u]",
+                 ln, a, v, TP_KEYS[k].min, TP_KEYS[k].max);
+        return -1;
+    }
+    ps->t[ps->cur][k] = v;
+    return 0;
+}
+
+static int plan_build(timing_plan_t *p, const unsigned t[N_TP], const char *name, char *err, size_t errlen)
+{
+    memcpy(p->t, t, sizeof p->t);
+    snprintf(p->name, sizeof p->name, "%s", name);
+    for (int i = 0; i < N_STATES; i++) p->dur[i] = plan_state_duration(p, (state_t)i);
+
+    build_preempt_table(p);
+    for (int i = 0; i < N_STATES; i++) {
+        if (p->preempt[i].worst_s > PLAN_MAX_PREEMPT_S) {
+            snprintf(err, errlen, "plan %s: [%s S%d] train preempt takes %us (max %us)",
+                     name, mode_of((state_t)i), mode_index_of((state_t)i),
+                     p->preempt[i].worst_s, PLAN_MAX_PREEMPT_S);
+            return -1;
+        }
+    }
+
+    for (int i = 0; i < N_STATES; i++) {
+        state_t s = (state_t)i;
+        p->hdr_len[i] = (uint8_t)snprintf(p->hdr[i], HDR_TXT_MAX, "[%s S%d] (%us)",
+                                          mode_of(s), mode_index_of(s), p->dur[i]);
+    }
+    return 0;
+}
+
+/* plans + calendar index; frees the set on error */
+static plan_set_t *plan_set_finish(plan_src_t *ps, char *err, size_t errlen)
+{
+    plan_set_t *set = ps->set;
+    set->n_plans = (unsigned)ps->cur + 1;
+    for (unsigned i = 0; i < set->n_plans; i++) {
+        if (plan_build(&set->plan[i], ps->t[i], ps->name[i], err, errlen) != 0) {
+            free(set);
+            return NULL;
+        }
+    }
+
+    uint8_t at_plan[MAX_SCHED];
+    for (int e = 0; e < ps->n_at; e++) {
+        unsigned i = 0;
+        while (i < set->n_plans && strcmp(ps->name[i], ps->at[e].plan) != 0) i++;
+        if (i == set->n_plans) {
+            snprintf(err, errlen, "schedule: unknown plan '%s'", ps->at[e].plan);
+            free(set);
+            return NULL;
+        }
+        at_plan[e] = (uint8_t)i;
+    }
+
+    for (int dt = 0; dt < N_DAYTYPES; dt++) {
+        for (int sl = 0; sl < SCHED_SLOTS; sl++) {
+            int minute = sl * SCHED_SLOT_MIN;
+            int best = -1, last = -1;
+            for (int e = 0; e < ps->n_at; e++) {
+                if (!(ps->at[e].days & (1u << dt))) continue;
+                int em = ps->at[e].minute;
+                if (em <= minute && (best < 0 || em >= ps->at[best].minute)) best = e;
+                if (last < 0 || em >= ps->at[last].minute) last = e;
+            }
+            if (best < 0) best = last;     /* before the first entry: wrap from the day's last */
+            set->slot_plan[dt][sl] = (best < 0) ? 0 : at_plan[best];
+        }
+    }
+
+    set->gen = ++plan_gen;
+    return set;
+}
+
+static int plan_src_init(plan_src_t *ps, char *err, size_t errlen)
+{
+    memset(ps, 0, sizeof *ps);
+    ps->set = calloc(1, sizeof *ps->set);
+    if (!ps->set) {
+        snprintf(err, errlen, "out of memory");
+        return -1;
+    }
+    for (int k = 0; k < N_TP; k++) ps->t[0][k] = TP_KEYS[k].def;
+    snprintf(ps->name[0], sizeof ps->name[0], "base");
+    return 0;
+}
+
+static plan_set_t *plan_set_load(const char *path, char *err, size_t errlen)
+{
+    static plan_src_t ps;   /* watcher thread, or main before it starts */
+    if (plan_src_init(&ps, err, errlen) != 0) return NULL;
+
+    if (!path) {
+        char line[128];
+        for (int i = 0; BUILTIN_PLANS[i]; i++) {
+            snprintf(line, sizeof line, "%s", BUILTIN_PLANS[i]);
+            if (plan_src_line(&ps, line, i + 1, err, errlen) != 0) { free(ps.set); return NULL; }
+        }
+        return plan_set_finish(&ps, err, errlen);
+    }
+
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        snprintf(err, errlen, "%s: %s", path, strerror(errno));
+        free(ps.set);
+        return NULL;
+    }
+    char line[128];
+    int ln = 0;
+    while (fgets(line, sizeof line, f)) {
+        if (plan_src_line(&ps, line, ++ln, err, errlen) != 0) {
+            fclose(f);
+            free(ps.set);
+            return NULL;
+        }
+    }
+    fclose(f);
+    return plan_set_finish(&ps, err, errlen);
+}
+
+/* O(1): holiday bit, then the slot table */
+static unsigned sched_lookup(const plan_set_t *set, time_t now)
+{
+    struct tm tm;
+    localtime_r(&now, &tm);
+
+    unsigned dt = (unsigned)tm.tm_wday;
+    int y = tm.tm_year + 1900 - HOL_BASE_YEAR;
+    if (y >= 0 && y < HOL_YEARS) {
+        unsigned bit = (unsigned)y * 366u + (unsigned)tm.tm_yday;
+        if (set->holiday[bit >> 3] & (1u << (bit & 7))) dt = DT_HOLIDAY;
+    }
+    return set->slot_plan[dt][(tm.tm_hour * 60 + tm.tm_min) / SCHED_SLOT_MIN];
+}
+
+static void print_plan_set(const plan_set_t *set)
+{
+    printf("Timing plans (gen %u):", set->gen);
+    for (unsigned i = 0; i < set->n_plans; i++) {
+        const timing_plan_t *p = &set->plan[i];
+        printf(" %s[R3 %u/%u R2 %u/%u]", p->name,
+               p->t[TP_R3_RS_GREEN], p->t[TP_R3_L_GREEN], p->t[TP_R2_RS_GREEN], p->t[TP_R2_L_GREEN]);
+    }
+    printf("\n");
+    for (int dt = 0; dt < N_DAYTYPES; dt++) {
+        printf("  %s:", DAY_NAME[dt]);
+        for (int sl = 0; sl < SCHED_SLOTS; sl++) {
+            if (sl == 0 || set->slot_plan[dt][sl] != set->slot_plan[dt][sl - 1]) {
+                printf(" %02d:%02d %s", sl * SCHED_SLOT_MIN / 60, sl * SCHED_SLOT_MIN % 60,
+                       set->plan[set->slot_plan[dt][sl]].name);
+            }
+        }
+        printf("\n");
+    }
+    fflush(stdout);
+}
+
+/* FNV-1a of the plan file. Compared by content: mtime has 1s resolution, so
+ * a same-size edit within the second of the last one would be missed. */
+static int plan_file_hash(const char *path, uint32_t *h)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+
+    uint32_t v = 2166136261u;
+    int c;
+    while ((c = getc(f)) != EOF) v = (v ^ (uint8_t)c) * 16777619u;
+    fclose(f);
+    *h = v;
+    return 0;
+}
+
+static void *plan_watch_thread(void *arg)
+{
+    (void)arg;
+    uint32_t last = 0;
+    plan_file_hash(plan_path, &last);
+
+    while (1) {
+        sleep(PLAN_POLL_S);
+
+        uint32_t h;
+        if (plan_file_hash(plan_path, &h) != 0 || h == last) continue;
+        last = h;
+
+        char err[128];
+        plan_set_t *set = plan_set_load(plan_path, err, sizeof err);
+        if (!set) {
+            printf("[plan] %s rejected: %s (keeping current plans)\n", plan_path, err);
+            fflush(stdout);
+            continue;
+        }
+
+        /* a set the FSM never picked up is simply replaced */
+        free(atomic_exchange(&plan_next, set));
+        printf("[plan] gen %u validated (%u plans), switching at next safe all-red\n",
+               set->gen, set->n_plans);
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+/* FSM thread, safe all-red only: take a pending set, then the scheduled plan */
+static void plan_tick(void)
+{
+    plan_set_t *old = NULL;
+
+    if (atomic_load_explicit(&plan_next, memory_order_relaxed) != NULL) {
+        plan_set_t *set = atomic_exchange(&plan_next, NULL);
+        if (set) {
+            old = plan_set_cur;
+            plan_set_cur = set;
+        }
+    }
+
+    timing_plan_t *p = &plan_set_cur->plan[sched_lookup(plan_set_cur, fsm_time())];
+    if (p != plan_cur) {
+        plan_cur = p;
+        if (!sim_mode) {
+            printf("\n>>> TIMING PLAN %s (gen %u) ACTIVE <<<\n\n", p->name, plan_set_cur->gen);
+            fflush(stdout);
+        }
+    }
+    free(old);
+}
+
+static void plan_init(void)
+{
+    char err[128];
+
+    plan_set_cur = plan_set_load(plan_path, err, sizeof err);
+    if (!plan_set_cur) {
+        printf("PLAN: %s\n", err);
+        fflush(stdout);
+        exit(1);
+    }
+    plan_cur = &plan_set_cur->plan[sched_lookup(plan_set_cur, fsm_time())];
+    printf("Plan source: %s\n", plan_path ? plan_path : "built-in");
+    print_plan_set(plan_set_cur);
+    printf("Active plan: %s\n", plan_cur->name);
+
+    if (plan_path && !sim_mode) {
+        pthread_t th;
+        if (pthread_create(&th, NULL, plan_watch_thread, NULL) != 0) {
+            perror("pthread_create(plan watcher)");
+            exit(1);
+        }
+        pthread_detach(th);
+    }
+}
+
+/* ================= SIMULATOR =================
+ * traffic2 -s <rate-file> [-d YYYY-MM-DD] [plan-file]
+ * Runs SingleStep_SM unchanged on a virtual clock for one day: the mq is
+ * never opened, waits advance sim_now instead of sleeping, state output is
+ * muted, and plan_tick() schedules against sim_now, so plans, calendar
+ * and holidays behave as on the street.
+ *
+ * Queue model per vehicle movement (MV_* bits), 1s steps:
+ *   arrivals   rate(hour) / 3600 veh per second (fluid, deterministic)
+ *   discharge  SIM_SAT_FLOW veh/h while FRAME_MASK lights the movement
+ *              (G or Y), after SIM_LOST_S start-up lost time per interval
+ *   delay      integral of the queue (veh*s)
+ *
+ * Rate file, one item per line, '#' comments:
+ *   r3_sn_s = 700            veh/h, every hour
+ *   r3_sn_s@07-09 = 1100     veh/h, hours 07 and 08 only
+ * Movements: r3_sn, r3_ns, r2_we, r2_ew followed by _l, _s or _r.
+ */
+#define SIM_SAT_FLOW   1800.0   /* veh/h per movement while served */
+#define SIM_LOST_S     2
+#define SIM_DAY_S      (24 * 3600)
+
+typedef struct {
+    double   queue, max_queue;
+    double   arrived, departed;
+    double   delay_vs;            /* veh*s */
+    unsigned lit_s;               /* seconds into the current service, 0 = red */
+} sim_mv_t;
+
+/* one simulated day; the -s run has one, each sweep worker its own */
+typedef struct {
+    unsigned t;                   /* seconds since midnight */
+    sim_mv_t mv[MV_PED];
+} sim_ctx_t;
+
+static const char *SIM_APPROACH[4] = { "r3_sn", "r3_ns", "r2_we", "r2_ew" };
+static const char  SIM_TURN[3]     = { 'l', 's', 'r' };
+
+static time_t   sim_day0 = 0;     /* local midnight of the simulated day */
+static double   sim_rate[24][MV_PED];   /* read-only once loaded */
+static sim_ctx_t sim_day;
+static unsigned long sim_cycles = 0;
+static unsigned sim_plan_s[MAX_PLANS];
+static state_t  sim_seq[N_STATES];      /* states seen while sim_seq_n >= 0 */
+static int      sim_seq_n = -1;
+
+static int sim_movement(const char *name, size_t n)
+{
+    for (int a = 0; a < 4; a++) {
+        for (int k = 0; k < 3; k++) {
+            if (n == 7 && strncmp(name, SIM_APPROACH[a], 5) == 0 &&
+                name[5] == '_' && name[6] == SIM_TURN[k]) {
+                return HEAD_MV_BASE[a] + k;
+            }
+        }
+    }
+    return -1;
+}
+
+static int sim_load_rates(const char *path)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+
+    char line[128];
+    int ln = 0;
+    while (fgets(line, sizeof line, f)) {
+        ln++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char key[32];
+        double vph;
+        if (sscanf(line, " %31[^= \t] = %lf", key, &vph) != 2) {
+            if (strspn(line, " \t\r\n") == strlen(line)) continue;
+            printf("SIM: %s:%d: expected <movement>[@HH-HH] = veh/h\n", path, ln);
+            fclose(f);
+            return -1;
+        }
+
+        unsigned h0 = 0, h1 = 24;
+        char *at = strchr(key, '@');
+        if (at && (sscanf(at + 1, "%u-%u", &h0, &h1) != 2 || h0 >= h1 || h1 > 24)) {
+            printf("SIM: %s:%d: bad hour range '%s'\n", path, ln, at + 1);
+            fclose(f);
+            return -1;
+        }
+
+        int mv = sim_movement(key, at ? (size_t)(at - key) : strlen(key));
+        if (mv < 0 || vph < 0.0 || vph > 3600.0) {
+            printf("SIM: %s:%d: bad movement or rate '%s'\n", path, ln, key);
+            fclose(f);
+            return -1;
+        }
+        for (unsigned h = h0; h < h1; h++) sim_rate[h][mv] = vph;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* queues under one frame for secs (clipped at the end of the day) */
+static void sim_queues(sim_ctx_t *c, unsigned secs, mvmask_t lit)
+{
+    for (unsigned i = 0; i < secs && c->t < SIM_DAY_S; i++, c->t++) {
+        const double *rate = sim_rate[c->t / 3600];
+
+        for (int b = 0; b < MV_PED; b++) {
+            sim_mv_t *m = &c->mv[b];
+            double a = rate[b] / 3600.0;
+            m->queue += a;
+            m->arrived += a;
+
+            if (lit & MV(b)) {
+                if (m->lit_s++ >= SIM_LOST_S) {
+                    double d = SIM_SAT_FLOW / 3600.0;
+                    if (d > m->queue) d = m->queue;
+                    m->queue -= d;
+                    m->departed += d;
+                }
+            } else {
+                m->lit_s = 0;
+            }
+
+            m->delay_vs += m->queue;
+            if (m->queue > m->max_queue) m->max_queue = m->queue;
+        }
+    }
+}
+
+/* stands in for the sleep of one state: queues evolve under its frame */
+static void sim_advance(unsigned secs, state_t s)
+{
+    unsigned t0 = sim_day.t;
+
+    if (s == N_R3_RS_G) sim_cycles++;
+    if (sim_seq_n >= 0 && sim_seq_n < N_STATES) sim_seq[sim_seq_n++] = s;
 
-    printf("[%s S%d] (%us) | R3(S->N)=%-6s | R3(N->S)=%-6s | R2(W->E)=%-6s | R2(E->W)=%-6s | PED=%-5s\n",
-           mode_of(s), mode_index_of(s), duration_of(s),
-           r3_sn, r3_ns, r2_we, r2_ew, ped);
+    sim_queues(&sim_day, secs, FRAME_MASK[s]);
+    sim_plan_s[plan_cur - plan_set_cur->plan] += sim_day.t - t0;
+    sim_now = sim_day0 + sim_day.t;
+}
+
+static void sim_report(double wall_s)
+{
+    struct tm tm;
+    localtime_r(&sim_day0, &tm);
+    printf("\nSimulated %04d-%02d-%02d (%s): 24h in %.3fs wall, %lu cycles\n",
+           tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, DAY_NAME[tm.tm_wday], wall_s, sim_cycles);
+
+    printf("  plan time:");
+    for (unsigned i = 0; i < plan_set_cur->n_plans; i++) {
+        if (sim_plan_s[i]) printf(" %s %.1fh", plan_set_cur->plan[i].name, sim_plan_s[i] / 3600.0);
+    }
+    printf("\n\n");
+
+    printf("  %-9s %9s %9s %8s  %-20s %9s %9s\n",
+           "approach", "arrived", "served", "veh/h", "avg delay s (L/S/R)", "max queue", "end queue");
+
+    sim_mv_t tot = { 0 };
+    for (int a = 0; a < 4; a++) {
+        sim_mv_t ap = { 0 };
+        double dl[3];
+        for (int k = 0; k < 3; k++) {
+            const sim_mv_t *m = &sim_day.mv[HEAD_MV_BASE[a] + k];
+            ap.arrived += m->arrived;
+            ap.departed += m->departed;
+            ap.delay_vs += m->delay_vs;
+            ap.queue += m->queue;
+            ap.max_queue += m->max_queue;   /* upper bound: peaks may not coincide */
+            dl[k] = (m->arrived > 0.0) ? m->delay_vs / m->arrived : 0.0;
+        }
+        char d3[32];
+        snprintf(d3, sizeof d3, "%.1f/%.1f/%.1f", dl[0], dl[1], dl[2]);
+        printf("  %-9s %9.0f %9.0f %8.0f  %-20s %9.1f %9.1f\n", HEAD_LABEL[a],
+               ap.arrived, ap.departed, ap.departed / 24.0, d3, ap.max_queue, ap.queue);
+
+        tot.arrived += ap.arrived;
+        tot.departed += ap.departed;
+        tot.delay_vs += ap.delay_vs;
+        tot.queue += ap.queue;
+    }
+    printf("  %-9s %9.0f %9.0f %8.0f  %-20.1f %9s %9.1f\n", "total",
+           tot.arrived, tot.departed, tot.departed / 24.0,
+           (tot.arrived > 0.0) ? tot.delay_vs / tot.arrived : 0.0, "", tot.queue);
     fflush(stdout);
 }
 
@@ -324,6 +1388,10 @@ static void print_state_outputs(state_t s)
 static void wait_seconds_interruptible(unsigned total_sec, state_t *cur)
 {
     if (total_sec == 0) return;
+    if (sim_mode) {
+        if (cur) sim_advance(total_sec, *cur);
+        return;
+    }
 
     const long step_ns = 100L * 1000L * 1000L; /* 100ms */
     unsigned steps  = (unsigned)((total_sec * 1000U) / 100U);
@@ -337,13 +1405,12 @@ static void wait_seconds_interruptible(unsigned total_sec, state_t *cur)
         nanosleep(&ts, NULL);
         poll_events_from_mq();
 
-        if (cur && train_request && !in_train_mode && is_normal_green(*cur)) {
+        if (cur && train_request && !in_train_mode && preempt_min_s(plan_cur, *cur) == 0) {
             if (!train_preempt_notified) {
                 notify_train_preempt();
                 train_preempt_notified = 1;
             }
-            train_preempt_to_allred = 1;
-            *cur = normal_green_to_yellow(*cur);
+            preempt_next(cur);
             return;
         }
     }
@@ -355,13 +1422,12 @@ static void wait_seconds_interruptible(unsigned total_sec, state_t *cur)
         nanosleep(&ts2, NULL);
         poll_events_from_mq();
 
-        if (cur && train_request && !in_train_mode && is_normal_green(*cur)) {
+        if (cur && train_request && !in_train_mode && preempt_min_s(plan_cur, *cur) == 0) {
             if (!train_preempt_notified) {
                 notify_train_preempt();
                 train_preempt_notified = 1;
             }
-            train_preempt_to_allred = 1;
-            *cur = normal_green_to_yellow(*cur);
+            preempt_next(cur);
             return;
         }
     }
@@ -376,19 +1442,24 @@ static int should_exit_train_now(state_t s)
 
 static void do_exit_train_to_normal(state_t *cur)
 {
+    state_t allred = *cur;
+
     train_active = 0;
     train_clear_pending = 0;
     train_request = 0;
 
     train_preempt_notified = 0;
-    train_preempt_to_allred = 0;
-
-    *cur = N_R3_RS_G;
 
     if (in_train_mode) {
         in_train_mode = 0;
         notify_train_over();
     }
+
+    /* a waiting ped goes first from this all-red, so t/c bursts can't starve it */
+    if (try_start_ped_if_safe(&allred)) { *cur = allred; return; }
+
+    /* exit to normal start */
+    *cur = N_R3_RS_G;
 }
 
 /* ================= FSM STEP ================= */
@@ -396,7 +1467,9 @@ static void SingleStep_SM(state_t *cur)
 {
     if (!cur) return;
 
-    print_state_outputs(*cur);
+    if (is_safe_allred(*cur)) plan_tick();
+
+    if (!sim_mode) print_state_outputs(*cur);
     poll_events_from_mq();
 
     static int clear_notified_once = 0;
@@ -409,148 +1482,124 @@ static void SingleStep_SM(state_t *cur)
     switch (*cur) {
         /* NORMAL */
         case N_R3_RS_G:
-            wait_seconds_interruptible(T_R3_RS_GREEN, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R3_RS_G) break;
-            *cur = N_R3_RS_Y;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R3_RS_Y:
-            wait_seconds_interruptible(T_YELLOW, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R3_RS_Y) break;
-            if (train_request && train_preempt_to_allred) *cur = N_ALL_RED_1;
-            else *cur = N_R3_L_G;
+            if (preempt_next(cur)) break; /* skip left phases */
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R3_L_G:
-            wait_seconds_interruptible(T_R3_L_GREEN, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R3_L_G) break;
-            *cur = N_R3_L_Y;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R3_L_Y:
-            wait_seconds_interruptible(T_YELLOW, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R3_L_Y) break;
-            *cur = N_ALL_RED_1;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_ALL_RED_1:
-            train_preempt_to_allred = 0;
-            wait_seconds_interruptible(T_ALL_RED, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
 
-            if (train_request) {
-                train_request = 0;
-                train_active  = 1;
-                train_clear_pending = 0;
-
-                train_preempt_notified = 0;
-                train_preempt_to_allred = 0;
-
-                *cur = T_R3_NS_SRL_G_1;
-                if (!in_train_mode) { in_train_mode = 1; notify_train_begin(); }
-                break;
-            }
+            if (train_request) { enter_train(cur); break; }
 
             if (try_start_ped_if_safe(cur)) break;
-            *cur = N_R2_RS_G;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R2_RS_G:
-            wait_seconds_interruptible(T_R2_RS_GREEN, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R2_RS_G) break;
-            *cur = N_R2_RS_Y;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R2_RS_Y:
-            wait_seconds_interruptible(T_YELLOW, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R2_RS_Y) break;
-            if (train_request && train_preempt_to_allred) *cur = N_ALL_RED_2;
-            else *cur = N_R2_L_G;
+            if (preempt_next(cur)) break; /* skip left phases */
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R2_L_G:
-            wait_seconds_interruptible(T_R2_L_GREEN, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R2_L_G) break;
-            *cur = N_R2_L_Y;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R2_L_Y:
-            wait_seconds_interruptible(T_YELLOW, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R2_L_Y) break;
-            *cur = N_ALL_RED_2;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_ALL_RED_2:
-            train_preempt_to_allred = 0;
-            wait_seconds_interruptible(T_ALL_RED, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
 
-            if (train_request) {
-                train_request = 0;
-                train_active  = 1;
-                train_clear_pending = 0;
-
-                train_preempt_notified = 0;
-                train_preempt_to_allred = 0;
-
-                *cur = T_R3_NS_SRL_G_1;
-                if (!in_train_mode) { in_train_mode = 1; notify_train_begin(); }
-                break;
-            }
+            if (train_request) { enter_train(cur); break; }
 
             if (try_start_ped_if_safe(cur)) break;
-            *cur = N_R3_RS_G;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         /* TRAIN */
         case T_R3_NS_SRL_G_1:
-            wait_seconds_interruptible(T_TR_1_G, cur);
-            *cur = T_R3_NS_SRL_Y_1;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R3_NS_SRL_Y_1:
-            wait_seconds_interruptible(T_TR_Y, cur);
-            *cur = T_ALL_RED_A;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_ALL_RED_A:
-            wait_seconds_interruptible(T_TR_R, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
             if (should_exit_train_now(*cur)) { do_exit_train_to_normal(cur); break; }
             if (try_start_ped_if_safe(cur)) break;
-            *cur = T_R3_SN_LR_G_2;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R3_SN_LR_G_2:
-            wait_seconds_interruptible(T_TR_2_G, cur);
-            *cur = T_R3_SN_LR_Y_2;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R3_SN_LR_Y_2:
-            wait_seconds_interruptible(T_TR_Y, cur);
-            *cur = T_ALL_RED_B;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_ALL_RED_B:
-            wait_seconds_interruptible(T_TR_R, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
             if (should_exit_train_now(*cur)) { do_exit_train_to_normal(cur); break; }
             if (try_start_ped_if_safe(cur)) break;
-            *cur = T_R2_RESTRICT_G_3;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R2_RESTRICT_G_3:
-            wait_seconds_interruptible(T_TR_3_G, cur);
-            *cur = T_R2_RESTRICT_Y_3;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R2_RESTRICT_Y_3:
-            wait_seconds_interruptible(T_TR_Y, cur);
-            *cur = T_DECISION_ALL_RED_4;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_DECISION_ALL_RED_4:
-            wait_seconds_interruptible(T_TR_R, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
             if (should_exit_train_now(*cur)) { do_exit_train_to_normal(cur); break; }
             if (try_start_ped_if_safe(cur)) break;
@@ -560,18 +1609,22 @@ static void SingleStep_SM(state_t *cur)
 
         /* PEDESTRIAN */
         case P_WALK:
-            wait_seconds_interruptible(T_PED_WALK, cur);
-            *cur = P_FLASH;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case P_FLASH:
-            wait_seconds_interruptible(T_PED_FLASH, cur);
-            *cur = P_CLEAR_ALL_RED;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case P_CLEAR_ALL_RED:
-            wait_seconds_interruptible(T_PED_CLR, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            poll_events_from_mq();
             if (in_ped_mode) { in_ped_mode = 0; notify_ped_over(); }
+
+            /* ped clearance is a safe all-red: start TRAIN here */
+            if (train_request && !in_train_mode) { enter_train(cur); break; }
             *cur = ped_return_state;
             break;
 
@@ -586,8 +1639,424 @@ static void SingleStep_SM(state_t *cur)
     }
 }
 
-int main(void)
+/* ================= SIMULATOR RUN ================= */
+static int sim_set_day(const char *ymd)
+{
+    struct tm tm;
+    memset(&tm, 0, sizeof tm);
+    if (ymd) {
+        if (sscanf(ymd, "%d-%d-%d", &tm.tm_year, &tm.tm_mon, &tm.tm_mday) != 3) return -1;
+        tm.tm_year -= 1900;
+        tm.tm_mon  -= 1;
+    } else {
+        time_t now = time(NULL);
+        localtime_r(&now, &tm);
+        tm.tm_hour = tm.tm_min = tm.tm_sec = 0;
+    }
+    tm.tm_isdst = -1;
+    sim_day0 = mktime(&tm);
+    if (sim_day0 == (time_t)-1) return -1;
+    sim_now = sim_day0;
+    return 0;
+}
+
+static void sim_run(void)
+{
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    state_t s = N_R3_RS_G;
+    while (sim_day.t < SIM_DAY_S) {
+        SingleStep_SM(&s);
+    }
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    sim_report((double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9);
+}
+
+/* ================= PARAMETER SWEEP =================
+ * traffic2 -s <rate-file> -S <sweep-file> [-L samples] [-j threads] [plan-file]
+ * Sweep file, one key per line, '#' comments, keys as in TP_KEYS:
+ *   r3_rs_green = 15..40/5   lo..hi in steps of 5 (step defaults to 1)
+ *   yellow      = 4          fixed
+ * Keys not listed keep the base plan's value. Candidates are the full grid,
+ * or a Latin-hypercube sample of the grid with -L. The safety minimums are
+ * the plan file's: every range must lie inside TP_KEYS min/max, and the
+ * clearances (yellow, all_red, tr_y, tr_r, ped_flash, ped_clr) never
+ * start below the built-in T_* interval (sweep_floor). Every candidate
+ * must pass plan_build() (train preempt bound) or is infeasible.
+ *
+ * Each candidate runs the whole day of the rate file on the NORMAL cycle
+ * recorded from SingleStep_SM (no events, so the cycle order is fixed):
+ *   delay  mean vehicle delay from the simulator queues
+ *   ped    mean wait from a press to WALK; WALK can only start at the end
+ *          of a ped_safe_checkpoint() state
+ *   train  mean detection -> TRAIN start over the cycle, from the plan's
+ *          preempt table (the max is bounded by PLAN_MAX_PREEMPT_S)
+ * Limitation, also printed with the results: no ped or train events are
+ * simulated. The delay never sees WALK or TRAIN phases, and ped / train
+ * are computed from the cycle, not measured. Re-check a chosen plan with
+ * a full -s run.
+ * Workers take candidates in chunks from one atomic counter and write only
+ * their own result slots: no locks, so throughput scales with cores.
+ * The output is the Pareto front of (delay, ped, train).
+ */
+#define SWEEP_MAX_CAND  (1ul << 22)
+#define SWEEP_CHUNK     8
+#define SWEEP_MAX_JOBS  64
+
+typedef struct { unsigned lo, step, levels; } sweep_axis_t;
+
+typedef struct {
+    float   delay_s, ped_s, train_s;
+    uint8_t ped_max_s, train_max_s;
+    uint8_t ok;
+} sweep_res_t;
+
+static sweep_axis_t  sweep_ax[N_TP];
+static unsigned long sweep_n = 0;
+static uint16_t     *sweep_lhs = NULL;     /* [sweep_n][N_TP] level per key, -L only */
+static sweep_res_t  *sweep_res = NULL;
+static state_t       sweep_cyc[N_STATES];  /* recorded NORMAL cycle */
+static int           sweep_cyc_n = 0;
+static _Atomic unsigned long sweep_next = 0;
+
+/* clearances never go below the built-in interval, whatever TP_KEYS allows */
+static unsigned sweep_floor(int k)
+{
+    int clr = (k == TP_YELLOW || k == TP_ALL_RED || k == TP_TR_Y || k == TP_TR_R ||
+               k == TP_PED_FLASH || k == TP_PED_CLR);
+    return (clr && TP_KEYS[k].def > TP_KEYS[k].min) ? TP_KEYS[k].def : TP_KEYS[k].min;
+}
+
+static int sweep_load(const char *path, const unsigned base[N_TP])
+{
+    for (int k = 0; k < N_TP; k++) {
+        sweep_ax[k].lo = base[k];
+        sweep_ax[k].step = 1;
+        sweep_ax[k].levels = 1;
+    }
+
+    FILE *f = fopen(path, "r");
+    if (!f) { perror(path); return -1; }
+
+    char line[128], a[32];
+    int ln = 0;
+    while (fgets(line, sizeof line, f)) {
+        ln++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+        if (strspn(line, " \t\r\n") == strlen(line)) continue;
+
+        unsigned lo, hi, step = 1;
+        int n = sscanf(line, " %31[a-z0-9_] = %u..%u/%u", a, &lo, &hi, &step);
+        if (n == 2) hi = lo;
+        if (n < 2 || step == 0 || hi < lo) {
+            printf("SWEEP: %s:%d: expected 'key = lo..hi[/step]' or 'key = seconds'\n", path, ln);
+            fclose(f);
+            return -1;
+        }
+
+        int k = 0;
+        while (k < N_TP && strcmp(TP_KEYS[k].name, a) != 0) k++;
+        if (k == N_TP) {
+            printf("SWEEP: %s:%d: unknown key '%s'\n", path, ln, a);
+            fclose(f);
+            return -1;
+        }
+        if (lo < sweep_floor(k) || hi > TP_KEYS[k].max) {
+            printf("SWEEP: %s:%d: %s %u..%u outside the safety range [%u..%u]\n",
+                   path, ln, a, lo, hi, sweep_floor(k), TP_KEYS[k].max);
+            fclose(f);
+            return -1;
+        }
+        sweep_ax[k].lo = lo;
+        sweep_ax[k].step = step;
+        sweep_ax[k].levels = (hi - lo) / step + 1;
+    }
+    fclose(f);
+    return 0;
+}
+
+/* Latin hypercube: each key's levels are cut into n strata, one sample each */
+static void sweep_make_lhs(unsigned long n, uint32_t seed)
+{
+    uint32_t *perm = malloc(n * sizeof *perm);
+    sweep_lhs = malloc(n * N_TP * sizeof *sweep_lhs);
+    if (!perm || !sweep_lhs) { perror("malloc"); exit(1); }
+
+    uint32_t r = seed ? seed : 1;
+    for (int k = 0; k < N_TP; k++) {
+        for (unsigned long i = 0; i < n; i++) perm[i] = (uint32_t)i;
+        for (unsigned long i = n - 1; i > 0; i--) {
+            r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+            unsigned long j = r % (i + 1);
+            uint32_t tmp = perm[i]; perm[i] = perm[j]; perm[j] = tmp;
+        }
+        for (unsigned long i = 0; i < n; i++) {
+            r ^= r << 13; r ^= r >> 17; r ^= r << 5;
+            double u = (perm[i] + (r >> 8) / 16777216.0) / (double)n;
+            sweep_lhs[i * N_TP + k] = (uint16_t)(u * sweep_ax[k].levels);
+        }
+    }
+    free(perm);
+}
+
+static void sweep_values(unsigned long i, unsigned t[N_TP])
+{
+    for (int k = 0; k < N_TP; k++) {
+        unsigned lv;
+        if (sweep_lhs) {
+            lv = sweep_lhs[i * N_TP + k];
+        } else {
+            lv = (unsigned)(i % sweep_ax[k].levels);
+            i /= sweep_ax[k].levels;
+        }
+        t[k] = sweep_ax[k].lo + lv * sweep_ax[k].step;
+    }
+}
+
+static void sweep_eval(const unsigned t[N_TP], sweep_res_t *r)
+{
+    timing_plan_t p;
+    char err[96];
+
+    memset(r, 0, sizeof *r);
+    if (plan_build(&p, t, "sweep", err, sizeof err) != 0) return;
+
+    /* delay: the day's queues on this plan */
+    sim_ctx_t c;
+    memset(&c, 0, sizeof c);
+    while (c.t < SIM_DAY_S) {
+        for (int i = 0; i < sweep_cyc_n; i++) {
+            sim_queues(&c, p.dur[sweep_cyc[i]], FRAME_MASK[sweep_cyc[i]]);
+        }
+    }
+    double arrived = 0.0, delay = 0.0;
+    for (int b = 0; b < MV_PED; b++) {
+        arrived += c.mv[b].arrived;
+        delay += c.mv[b].delay_vs;
+    }
+
+    /* ped: gaps between WALK opportunities, train: latency over the cycle */
+    unsigned cyc = 0, first_end = 0, last_end = 0, gap_max = 0, w_max = 0;
+    double gap_sq = 0.0, train_area = 0.0;
+    int have = 0;
+    for (int i = 0; i < sweep_cyc_n; i++) {
+        state_t s = sweep_cyc[i];
+        double d = p.dur[s], w = p.preempt[s].worst_s;
+
+        train_area += is_normal_green(s) ? d * w : d * w - d * d / 2.0;
+        if (p.preempt[s].worst_s > w_max) w_max = p.preempt[s].worst_s;
+
+        cyc += p.dur[s];
+        if (ped_safe_checkpoint(s)) {
+            if (have) {
+                unsigned g = cyc - last_end;
+                gap_sq += (double)g * g;
+                if (g > gap_max) gap_max = g;
+            } else {
+                first_end = cyc;
+            }
+            last_end = cyc;
+            have = 1;
+        }
+    }
+    if (!have || cyc == 0) return;
+    unsigned wrap = first_end + cyc - last_end;
+    gap_sq += (double)wrap * wrap;
+    if (wrap > gap_max) gap_max = wrap;
+
+    r->delay_s = (float)(arrived > 0.0 ? delay / arrived : 0.0);
+    r->ped_s = (float)(gap_sq / (2.0 * cyc));
+    r->ped_max_s = (uint8_t)(gap_max > 255 ? 255 : gap_max);
+    r->train_s = (float)(train_area / cyc);
+    r->train_max_s = (uint8_t)w_max;
+    r->ok = 1;
+}
+
+static void *sweep_worker(void *arg)
+{
+    (void)arg;
+    unsigned t[N_TP];
+
+    while (1) {
+        unsigned long i0 = atomic_fetch_add_explicit(&sweep_next, SWEEP_CHUNK, memory_order_relaxed);
+        if (i0 >= sweep_n) break;
+        unsigned long i1 = (i0 + SWEEP_CHUNK < sweep_n) ? i0 + SWEEP_CHUNK : sweep_n;
+        for (unsigned long i = i0; i < i1; i++) {
+            sweep_values(i, t);
+            sweep_eval(t, &sweep_res[i]);
+        }
+    }
+    return NULL;
+}
+
+/* NORMAL cycle as the FSM runs it: one lap from N_R3_RS_G */
+static int sweep_record_cycle(void)
+{
+    state_t s = N_R3_RS_G;
+    sim_seq_n = 0;
+    for (int guard = 0; guard < N_STATES; guard++) {
+        SingleStep_SM(&s);
+        if (s == N_R3_RS_G) break;
+    }
+    sweep_cyc_n = sim_seq_n;
+    memcpy(sweep_cyc, sim_seq, sizeof sweep_cyc);
+    sim_seq_n = -1;
+    return (s == N_R3_RS_G) ? 0 : -1;
+}
+
+static int sweep_cmp(const void *a, const void *b)
+{
+    const sweep_res_t *x = &sweep_res[*(const unsigned long *)a];
+    const sweep_res_t *y = &sweep_res[*(const unsigned long *)b];
+    if (x->delay_s != y->delay_s) return (x->delay_s < y->delay_s) ? -1 : 1;
+    if (x->ped_s != y->ped_s)     return (x->ped_s < y->ped_s) ? -1 : 1;
+    if (x->train_s != y->train_s) return (x->train_s < y->train_s) ? -1 : 1;
+    return 0;
+}
+
+static int sweep_run(const char *path, unsigned long lhs_n, unsigned jobs)
+{
+    if (sweep_load(path, plan_set_cur->plan[0].t) != 0) return 1;
+    if (sweep_record_cycle() != 0) {
+        printf("SWEEP: NORMAL cycle did not close\n");
+        return 1;
+    }
+
+    unsigned long grid = 1;
+    for (int k = 0; k < N_TP; k++) {
+        grid *= sweep_ax[k].levels;
+        if (grid > SWEEP_MAX_CAND) break;
+    }
+    if (lhs_n) {
+        sweep_n = lhs_n;
+    } else if (grid > SWEEP_MAX_CAND) {
+        printf("SWEEP: grid has more than %lu candidates, use -L <samples>\n", SWEEP_MAX_CAND);
+        return 1;
+    } else {
+        sweep_n = grid;
+    }
+    if (lhs_n) sweep_make_lhs(sweep_n, (uint32_t)sim_day0);
+
+    sweep_res = calloc(sweep_n, sizeof *sweep_res);
+    unsigned long *idx = malloc(sweep_n * sizeof *idx);
+    if (!sweep_res || !idx) { perror("calloc"); return 1; }
+
+    if (jobs < 1) jobs = 1;
+    if (jobs > SWEEP_MAX_JOBS) jobs = SWEEP_MAX_JOBS;
+
+    struct timespec t0, t1;
+    clock_gettime(CLOCK_MONOTONIC, &t0);
+
+    pthread_t th[SWEEP_MAX_JOBS];
+    for (unsigned j = 0; j < jobs; j++) {
+        if (pthread_create(&th[j], NULL, sweep_worker, NULL) != 0) {
+            perror("pthread_create(sweep)");
+            return 1;
+        }
+    }
+    for (unsigned j = 0; j < jobs; j++) pthread_join(th[j], NULL);
+
+    clock_gettime(CLOCK_MONOTONIC, &t1);
+    double wall = (double)(t1.tv_sec - t0.tv_sec) + (double)(t1.tv_nsec - t0.tv_nsec) / 1e9;
+
+    unsigned long n_ok = 0;
+    for (unsigned long i = 0; i < sweep_n; i++) {
+        if (sweep_res[i].ok) idx[n_ok++] = i;
+    }
+    qsort(idx, n_ok, sizeof *idx, sweep_cmp);
+
+    /* sorted by delay, so only plans already on the front can dominate */
+    unsigned long n_front = 0;
+    for (unsigned long i = 0; i < n_ok; i++) {
+        const sweep_res_t *c = &sweep_res[idx[i]];
+        int dominated = 0;
+        for (unsigned long f = 0; f < n_front && !dominated; f++) {
+            const sweep_res_t *o = &sweep_res[idx[f]];
+            dominated = (o->delay_s <= c->delay_s && o->ped_s <= c->ped_s && o->train_s <= c->train_s);
+        }
+        if (!dominated) idx[n_front++] = idx[i];
+    }
+
+    printf("\nSweep %s: %lu candidates (%s), %u threads, %.2fs = %.0f plans/s\n",
+           path, sweep_n, lhs_n ? "latin hypercube" : "full grid", jobs, wall, sweep_n / wall);
+    printf("  %lu feasible, %lu rejected by the train preempt bound (%us)\n",
+           n_ok, sweep_n - n_ok, PLAN_MAX_PREEMPT_S);
+    printf("  Pareto front: %lu plans (delay vs ped wait vs train preempt)\n", n_front);
+    printf("  note: one recorded NORMAL cycle per candidate, no ped / train events;\n"
+           "        ped and train are computed from the cycle, not simulated\n\n");
+
+    printf(" ");
+    for (int k = 0; k < N_TP; k++) {
+        if (sweep_ax[k].levels > 1) printf(" %*s", (int)strlen(TP_KEYS[k].name), TP_KEYS[k].name);
+    }
+    printf("  | delay s/veh | ped wait s avg/max | train s avg/max\n");
+
+    unsigned t[N_TP];
+    for (unsigned long f = 0; f < n_front; f++) {
+        const sweep_res_t *r = &sweep_res[idx[f]];
+        sweep_values(idx[f], t);
+        printf(" ");
+        for (int k = 0; k < N_TP; k++) {
+            if (sweep_ax[k].levels > 1) printf(" %*u", (int)strlen(TP_KEYS[k].name), t[k]);
+        }
+        printf("  | %11.1f | %11.1f / %4u | %8.1f / %3u\n",
+               r->delay_s, r->ped_s, r->ped_max_s, r->train_s, r->train_max_s);
+    }
+    fflush(stdout);
+
+    free(idx);
+    free(sweep_res);
+    free(sweep_lhs);
+    return 0;
+}
+
+int main(int argc, char **argv)
 {
+    const char *rate_path = NULL, *sim_day = NULL, *sweep_path = NULL;
+    unsigned long lhs_n = 0;
+    long jobs = sysconf(_SC_NPROCESSORS_ONLN);
+    int c;
+    while ((c = getopt(argc, argv, "s:d:S:L:j:")) != -1) {
+        switch (c) {
+        case 's': rate_path = optarg; break;
+        case 'd': sim_day = optarg; break;
+        case 'S': sweep_path = optarg; break;
+        case 'L': lhs_n = strtoul(optarg, NULL, 10); break;
+        case 'j': jobs = strtol(optarg, NULL, 10); break;
+        default:
+            fprintf(stderr, "usage: %s [plan-file]\n"
+                            "       %s -s <rate-file> [-d YYYY-MM-DD] [plan-file]\n"
+                            "       %s -s <rate-file> -S <sweep-file> [-L samples] [-j threads] [plan-file]\n",
+                    argv[0], argv[0], argv[0]);
+            return 2;
+        }
+    }
+    if (optind < argc) plan_path = argv[optind];
+    if (sweep_path && !rate_path) {
+        fprintf(stderr, "%s: -S needs a rate file (-s)\n", argv[0]);
+        return 2;
+    }
+    if (lhs_n > SWEEP_MAX_CAND) lhs_n = SWEEP_MAX_CAND;
+
+    if (rate_path) {
+        sim_mode = 1;
+        if (sim_set_day(sim_day) != 0) {
+            fprintf(stderr, "SIM: bad date '%s'\n", sim_day);
+            return 2;
+        }
+        if (sim_load_rates(rate_path) != 0) return 1;
+
+        build_interlock();
+        build_frames();
+        plan_init();
+        if (sweep_path) return sweep_run(sweep_path, lhs_n, jobs > 0 ? (unsigned)jobs : 1);
+        sim_run();
+        return 0;
+    }
+
     printf("Local Control 2 (Intersection 2)\n");
     printf("Queue: %s\n", QUEUE_NAME);
     printf("Keyboard events: t=train detect, c=train clear, p=ped press\n\n");
@@ -595,6 +2064,11 @@ int main(void)
 
     mq_setup_server();
 
+    build_interlock();
+    build_frames();
+    plan_init();
+    print_preempt_table();
+
     state_t s = N_R3_RS_G;
     while (1) {
         SingleStep_SM(&s);
@@ -7,18 +7,23 @@
  *   c = Train cleared   (request exit train mode at next SAFE all-red)
  *   p = Ped button      (ped_request=1)
  *
+ * Events carry a priority class (t > c > p); the queue always keeps
+ * MQ_RESERVED_SLOTS free for t/c, so a burst of 'p' never delays a train.
+ *
  * Notify messages:
  *   *** TRAIN BEGIN ***
  *   *** TRAIN OVER  ***
- *   >>> TRAIN PREEMPT: forcing YELLOW immediately <<<
+ *   >>> TRAIN PREEMPT: shortest safe path to ALL-RED <<<
  *   >>> TRAIN CLEAR: will exit at next SAFE ALL-RED <<<
  *   *** PED BEGIN   ***
  *   *** PED OVER    ***
  *
  * Behaviour:
- * 1) Press 't' during NORMAL GREEN:
- *    - Force matching YELLOW immediately (within ~100ms)
- *    - After forced YELLOW finishes, jump DIRECTLY to ALL-RED (skip left phases)
+ * 1) Press 't' outside TRAIN:
+ *    - A NORMAL green or PED WALK is cut immediately (within ~100ms);
+ *      yellows, PED FLASH and all-reds always run their full time
+ *    - The preempt table then takes the shortest safe path to an ALL-RED
+ *      (a road yellow skips the left phases)
  *    - Then enter TRAIN mode
  *
  * 2) Press 'c' during TRAIN (Option A):
@@ -35,6 +40,8 @@
  */
 
 #include <stdio.h>
+#include <stdlib.h>
+#include <stdint.h>
 #include <unistd.h>
 #include <mqueue.h>
 #include <fcntl.h>
@@ -42,6 +49,9 @@
 #include <errno.h>
 #include <string.h>
 #include <time.h>
+#include <pthread.h>
+#include <stdatomic.h>
+#include <sys/mman.h>
 
 /* ================= MQ CONFIG ================= */
 #define QUEUE_NAME "/traffic_mq"
@@ -51,7 +61,22 @@
 #define EVT_TRAIN_CLEAR   'c'
 #define EVT_PED_PRESS     'p'
 
-/* ================= TIMINGS (seconds) ================= */
+/* Priority classes (mq_receive returns highest priority first).
+ * MUST match the senders (keyboard_events.c / demo2.c).
+ */
+#define PRIO_TRAIN        3
+#define PRIO_CLEAR        2
+#define PRIO_PED          1
+
+/* Queue depth; senders refuse ped presses once fewer than
+ * MQ_RESERVED_SLOTS are free, so 't'/'c' always find room.
+ */
+#define MQ_MAXMSG         20
+#define MQ_RESERVED_SLOTS  4
+
+/* ================= TIMINGS (seconds) =================
+ * Built-in plan; override with a plan file: traffic <plan-file>
+ */
 #define T_RS_GREEN   20
 #define T_L_GREEN    12
 #define T_YELLOW      4
@@ -80,9 +105,6 @@ static int in_ped_mode   = 0;
 /* notify-once flag for forced yellow */
 static int train_preempt_notified = 0;
 
-/* after forced yellow, go directly to ALL-RED (skip left phases) */
-static int train_preempt_to_allred = 0;
-
 /* ================= STATE ENUM =================
  * Explicit numbering keeps mode_index logic stable:
  *  NORMAL: 0..9
@@ -125,11 +147,17 @@ static state_t ped_return_state = N_R3_RS_G;
 /* ================= MQ ================= */
 static mqd_t mq = (mqd_t)-1;
 
+/* event statistics (printed at TRAIN BEGIN) */
+static unsigned long rx_count[PRIO_TRAIN + 1];
+static unsigned long ped_coalesced = 0;   /* 'p' while ped_request already latched */
+static unsigned long prio_mismatch = 0;   /* event arrived with wrong priority class */
+static long mq_depth_hwm = 0;             /* deepest queue seen at poll time */
+
 static void mq_setup_server(void)
 {
     struct mq_attr attr;
     memset(&attr, 0, sizeof(attr));
-    attr.mq_maxmsg  = 20;
+    attr.mq_maxmsg  = MQ_MAXMSG;
     attr.mq_msgsize = MSG_SIZE;
 
     mq_unlink(QUEUE_NAME);
@@ -143,14 +171,35 @@ static void mq_setup_server(void)
     }
 }
 
+static unsigned evt_prio(char ev)
+{
+    if (ev == EVT_TRAIN_DETECT) return PRIO_TRAIN;
+    if (ev == EVT_TRAIN_CLEAR)  return PRIO_CLEAR;
+    return PRIO_PED;
+}
+
+static void print_evt_stats(void)
+{
+    printf("[mq] rx t=%lu c=%lu p=%lu | ped coalesced=%lu | prio mismatch=%lu | depth hwm=%ld/%d\n",
+           rx_count[PRIO_TRAIN], rx_count[PRIO_CLEAR], rx_count[PRIO_PED],
+           ped_coalesced, prio_mismatch, mq_depth_hwm, MQ_MAXMSG);
+    fflush(stdout);
+}
+
 static void poll_events_from_mq(void)
 {
     if (mq == (mqd_t)-1) return;
 
     char buf[MSG_SIZE];
+    unsigned prio;
+
+    struct mq_attr attr;
+    if (mq_getattr(mq, &attr) == 0 && attr.mq_curmsgs > mq_depth_hwm) {
+        mq_depth_hwm = attr.mq_curmsgs;
+    }
 
     while (1) {
-        ssize_t n = mq_receive(mq, buf, MSG_SIZE, NULL);
+        ssize_t n = mq_receive(mq, buf, MSG_SIZE, &prio);
         if (n == -1) {
             if (errno == EAGAIN) break;
             perror("mq_receive");
@@ -158,6 +207,9 @@ static void poll_events_from_mq(void)
         }
 
         char ev = buf[0];
+        if (prio != evt_prio(ev)) prio_mismatch++;
+        if (prio <= PRIO_TRAIN) rx_count[prio]++;
+
         if (ev == EVT_TRAIN_DETECT) {
             train_request = 1;
             train_active  = 1;
@@ -169,15 +221,16 @@ static void poll_events_from_mq(void)
             train_clear_pending = 1;
             train_request = 0; /* cancel any pending enter */
         } else if (ev == EVT_PED_PRESS) {
+            if (ped_request) ped_coalesced++;
             ped_request = 1;
         }
     }
 }
 
 /* ================= NOTIFY HELPERS ================= */
-static void notify_train_begin(void)   { printf("\n*** TRAIN BEGIN ***\n\n"); fflush(stdout); }
+static void notify_train_begin(void)   { printf("\n*** TRAIN BEGIN ***\n\n"); print_evt_stats(); }
 static void notify_train_over(void)    { printf("\n*** TRAIN OVER  ***\n\n"); fflush(stdout); }
-static void notify_train_preempt(void) { printf("\n>>> TRAIN PREEMPT: forcing YELLOW immediately <<<\n\n"); fflush(stdout); }
+static void notify_train_preempt(void) { printf("\n>>> TRAIN PREEMPT: shortest safe path to ALL-RED <<<\n\n"); fflush(stdout); }
 static void notify_train_clear(void)   { printf("\n>>> TRAIN CLEAR: will exit at next SAFE ALL-RED <<<\n\n"); fflush(stdout); }
 static void notify_ped_begin(void)     { printf("\n*** PED BEGIN   ***\n\n"); fflush(stdout); }
 static void notify_ped_over(void)      { printf("\n*** PED OVER    ***\n\n"); fflush(stdout); }
@@ -203,42 +256,99 @@ static int mode_index_of(state_t s)
  * You did NOT ask for print renumbering, only to start at TRAIN state 1.
  */
 
-static unsigned duration_of(state_t s)
+/* ================= TIMING PLAN =================
+ * Durations are read from the active plan; the #defines above are the
+ * built-in plan. Everything derived from the timings (per-state durations,
+ * preempt table, output headers) is built with the plan, so switching plans
+ * is a single pointer swap.
+ */
+#define N_STATES    ((int)P_CLEAR_ALL_RED + 1)
+#define HDR_TXT_MAX 32
+
+typedef enum {
+    TP_RS_GREEN = 0, TP_L_GREEN, TP_YELLOW, TP_ALL_RED,
+    TP_TR_1_G, TP_TR_2_G, TP_TR_3_G, TP_TR_Y,
+    TP_TR_R, TP_PED_WALK, TP_PED_FLASH, TP_PED_CLR,
+    N_TP
+} tp_key_t;
+
+/* plan file keys; a key missing from the file keeps its built-in value.
+ * Clearances (yellow, all-red, ped flash and clear) never go below the built-in ones. */
+static const struct { const char *name; unsigned def, min, max; } TP_KEYS[N_TP] = {
+    { "rs_green",   T_RS_GREEN,     5, 120 },
+    { "l_green",    T_L_GREEN,      3,  60 },
+    { "yellow",     T_YELLOW,       4,   6 },
+    { "all_red",    T_ALL_RED,      2,   6 },
+    { "tr_1_g",     T_TR_1_G,       3,  60 },
+    { "tr_2_g",     T_TR_2_G,       3,  60 },
+    { "tr_3_g",     T_TR_3_G,       3,  60 },
+    { "tr_y",       T_TR_Y,         4,   6 },
+    { "tr_r",       T_TR_R,         2,   6 },
+    { "ped_walk",   T_PED_WALK,     4,  60 },
+    { "ped_flash",  T_PED_FLASH,    4,  30 },
+    { "ped_clr",    T_PED_CLR,      2,   6 },
+};
+
+typedef struct {
+    state_t  next;     /* next hop (== state for a target all-red) */
+    unsigned worst_s;  /* 0 = no path (TRAIN states) */
+} preempt_entry_t;
+
+typedef struct {
+    unsigned t[N_TP];
+
+    /* derived by plan_build() */
+    unsigned        gen;
+    unsigned        dur[N_STATES];
+    preempt_entry_t preempt[N_STATES];
+    uint8_t         hdr_len[N_STATES];
+    char            hdr[N_STATES][HDR_TXT_MAX];   /* "[NORMAL S0] (20s)" */
+} timing_plan_t;
+
+/* read by the FSM thread only; replaced only at a safe all-red */
+static timing_plan_t *plan_cur = NULL;
+
+static unsigned plan_state_duration(const timing_plan_t *p, state_t s)
 {
     switch (s) {
         /* NORMAL */
-        case N_R3_RS_G:  return T_RS_GREEN;
-        case N_R3_RS_Y:  return T_YELLOW;
-        case N_R3_L_G:   return T_L_GREEN;
-        case N_R3_L_Y:   return T_YELLOW;
-        case N_ALL_RED_1:return T_ALL_RED;
-
-        case N_R1_RS_G:  return T_RS_GREEN;
-        case N_R1_RS_Y:  return T_YELLOW;
-        case N_R1_L_G:   return T_L_GREEN;
-        case N_R1_L_Y:   return T_YELLOW;
-        case N_ALL_RED_2:return T_ALL_RED;
+        case N_R3_RS_G:  return p->t[TP_RS_GREEN];
+        case N_R3_RS_Y:  return p->t[TP_YELLOW];
+        case N_R3_L_G:   return p->t[TP_L_GREEN];
+        case N_R3_L_Y:   return p->t[TP_YELLOW];
+        case N_ALL_RED_1:return p->t[TP_ALL_RED];
+
+        case N_R1_RS_G:  return p->t[TP_RS_GREEN];
+        case N_R1_RS_Y:  return p->t[TP_YELLOW];
+        case N_R1_L_G:   return p->t[TP_L_GREEN];
+        case N_R1_L_Y:   return p->t[TP_YELLOW];
+        case N_ALL_RED_2:return p->t[TP_ALL_RED];
 
         /* TRAIN (starts at S1) */
-        case T_R3_NS_SRL_G_1:      return T_TR_1_G;
-        case T_R3_NS_SRL_Y_1:      return T_TR_Y;
-        case T_ALL_RED_A:          return T_TR_R;
-        case T_R3_SN_LR_G_2:       return T_TR_2_G;
-        case T_R3_SN_LR_Y_2:       return T_TR_Y;
-        case T_ALL_RED_B:          return T_TR_R;
-        case T_R1_RESTRICT_G_3:    return T_TR_3_G;
-        case T_R1_RESTRICT_Y_3:    return T_TR_Y;
-        case T_DECISION_ALL_RED_4: return T_TR_R;
+        case T_R3_NS_SRL_G_1:      return p->t[TP_TR_1_G];
+        case T_R3_NS_SRL_Y_1:      return p->t[TP_TR_Y];
+        case T_ALL_RED_A:          return p->t[TP_TR_R];
+        case T_R3_SN_LR_G_2:       return p->t[TP_TR_2_G];
+        case T_R3_SN_LR_Y_2:       return p->t[TP_TR_Y];
+        case T_ALL_RED_B:          return p->t[TP_TR_R];
+        case T_R1_RESTRICT_G_3:    return p->t[TP_TR_3_G];
+        case T_R1_RESTRICT_Y_3:    return p->t[TP_TR_Y];
+        case T_DECISION_ALL_RED_4: return p->t[TP_TR_R];
 
         /* PED */
-        case P_WALK:          return T_PED_WALK;
-        case P_FLASH:         return T_PED_FLASH;
-        case P_CLEAR_ALL_RED: return T_PED_CLR;
+        case P_WALK:          return p->t[TP_PED_WALK];
+        case P_FLASH:         return p->t[TP_PED_FLASH];
+        case P_CLEAR_ALL_RED: return p->t[TP_PED_CLR];
 
         default: return 0;
     }
 }
 
+static unsigned duration_of(state_t s)
+{
+    return plan_cur->dur[s];
+}
+
 static int is_train_state(state_t s)
 {
     return (s >= T_R3_NS_SRL_G_1 && s <= T_DECISION_ALL_RED_4);
@@ -255,15 +365,133 @@ static int is_normal_green(state_t s)
             s == N_R1_RS_G || s == N_R1_L_G);
 }
 
-static state_t normal_green_to_yellow(state_t s)
+/* ================= CYCLE =================
+ * Successor of every state when nothing is pending. SingleStep_SM takes
+ * every plain advance from here and the preempt table is derived from it,
+ * so the graph is written down once. All-reds list their default exit;
+ * train, ped and exit decisions are taken in SingleStep_SM, and
+ * P_CLEAR_ALL_RED returns to ped_return_state.
+ */
+static const state_t CYCLE_NEXT[N_STATES] = {
+    [N_R3_RS_G] = N_R3_RS_Y,   [N_R3_RS_Y] = N_R3_L_G,   [N_R3_L_G] = N_R3_L_Y,
+    [N_R3_L_Y]  = N_ALL_RED_1, [N_ALL_RED_1] = N_R1_RS_G,
+    [N_R1_RS_G] = N_R1_RS_Y,   [N_R1_RS_Y] = N_R1_L_G,   [N_R1_L_G] = N_R1_L_Y,
+    [N_R1_L_Y]  = N_ALL_RED_2, [N_ALL_RED_2] = N_R3_RS_G,
+
+    [T_R3_NS_SRL_G_1] = T_R3_NS_SRL_Y_1, [T_R3_NS_SRL_Y_1] = T_ALL_RED_A,
+    [T_ALL_RED_A]     = T_R3_SN_LR_G_2,  [T_R3_SN_LR_G_2]  = T_R3_SN_LR_Y_2,
+    [T_R3_SN_LR_Y_2]  = T_ALL_RED_B,     [T_ALL_RED_B]     = T_R1_RESTRICT_G_3,
+    [T_R1_RESTRICT_G_3] = T_R1_RESTRICT_Y_3, [T_R1_RESTRICT_Y_3] = T_DECISION_ALL_RED_4,
+    [T_DECISION_ALL_RED_4] = T_R3_SN_LR_G_2,
+
+    [P_WALK] = P_FLASH, [P_FLASH] = P_CLEAR_ALL_RED, [P_CLEAR_ALL_RED] = P_CLEAR_ALL_RED,
+};
+
+static int is_left_green(state_t s)
 {
-    switch (s) {
-        case N_R3_RS_G: return N_R3_RS_Y;
-        case N_R3_L_G:  return N_R3_L_Y;
-        case N_R1_RS_G: return N_R1_RS_Y;
-        case N_R1_L_G:  return N_R1_L_Y;
-        default:        return s;
+    return (s == N_R3_L_G || s == N_R1_L_G);
+}
+
+/* ================= PREEMPT TABLE =================
+ * Shortest safe path from every NORMAL/PED state to an all-red that can
+ * start TRAIN. Built with each timing plan; the edges come from
+ * CYCLE_NEXT (preempt_edges):
+ *  - NORMAL greens and PED WALK may be cut immediately (min 0s)
+ *  - yellows, PED FLASH and all-reds always run their full time
+ * worst_s = detection at the start of the state -> TRAIN S0.
+ */
+static int is_preempt_target(state_t s)
+{
+    return (s == N_ALL_RED_1 || s == N_ALL_RED_2 || s == P_CLEAR_ALL_RED);
+}
+
+/* time that must still be served once a train is pending */
+static unsigned preempt_min_s(const timing_plan_t *p, state_t s)
+{
+    if (is_normal_green(s) || s == P_WALK) return 0;
+    return p->dur[s];
+}
+
+/* moves a pending train may take out of s: the cycle successor and, from a
+ * road yellow, the all-red after its left phases (skip left phases) */
+static int preempt_edges(state_t s, state_t to[2])
+{
+    if (is_preempt_target(s)) return 0;
+    if (!is_normal_state(s) && s != P_WALK && s != P_FLASH) return 0;
+
+    int n = 0;
+    to[n++] = CYCLE_NEXT[s];
+    if (is_left_green(CYCLE_NEXT[s])) to[n++] = CYCLE_NEXT[CYCLE_NEXT[CYCLE_NEXT[s]]];
+    return n;
+}
+
+static void build_preempt_table(timing_plan_t *p)
+{
+    for (int i = 0; i < N_STATES; i++) {
+        p->preempt[i].next = (state_t)i;
+        p->preempt[i].worst_s = is_preempt_target((state_t)i) ? p->dur[i] : 0;
     }
+
+    /* Bellman-Ford relaxation; the graph is tiny */
+    int changed = 1;
+    while (changed) {
+        changed = 0;
+        for (int i = 0; i < N_STATES; i++) {
+            state_t a = (state_t)i, to[2];
+            int n = preempt_edges(a, to);
+            for (int e = 0; e < n; e++) {
+                state_t b = to[e];
+                if (p->preempt[b].worst_s == 0) continue;
+
+                unsigned via = preempt_min_s(p, a) + p->preempt[b].worst_s;
+                if (p->preempt[a].worst_s == 0 || via < p->preempt[a].worst_s) {
+                    p->preempt[a].next = b;
+                    p->preempt[a].worst_s = via;
+                    changed = 1;
+                }
+            }
+        }
+    }
+}
+
+static void print_preempt_table(void)
+{
+    printf("Train preempt table (worst case detection -> TRAIN start):\n");
+    for (int i = 0; i < N_STATES; i++) {
+        state_t s = (state_t)i;
+        if (plan_cur->preempt[i].worst_s == 0) continue;
+        printf("  [%s S%d] -> [%s S%d]  %2us\n",
+               mode_of(s), mode_index_of(s),
+               mode_of(plan_cur->preempt[i].next), mode_index_of(plan_cur->preempt[i].next),
+               plan_cur->preempt[i].worst_s);
+    }
+    printf("\n");
+    fflush(stdout);
+}
+
+/* train pending outside TRAIN: follow the preempt table instead of the cycle */
+static int preempt_next(state_t *cur)
+{
+    if (!train_request || in_train_mode) return 0;
+    if (is_preempt_target(*cur)) return 0;
+    if (plan_cur->preempt[*cur].worst_s == 0) return 0;
+
+    *cur = plan_cur->preempt[*cur].next;
+    return 1;
+}
+
+/* consume train_request at a safe all-red */
+static void enter_train(state_t *cur)
+{
+    train_request = 0;
+    train_active  = 1;
+    train_clear_pending = 0;
+    train_preempt_notified = 0;
+
+    /* TRAIN starts at S1 */
+    *cur = T_R3_NS_SRL_G_1;
+
+    if (!in_train_mode) { in_train_mode = 1; notify_train_begin(); }
 }
 
 /* ================= PED SAFE CHECK ================= */
@@ -300,67 +528,605 @@ static int try_start_ped_if_safe(state_t *cur)
     return 1;
 }
 
-/* ================= OUTPUT ================= */
-static void print_state_outputs(state_t s)
+/* ================= SIGNAL HEADS + INTERLOCK =================
+ * Each head lights a set of movements (L/S/R per approach, plus PED).
+ * A movement has right of way while its head shows G or Y; PRE-Y and RED
+ * light nothing. CONFLICT_OF[mask] is the union of the conflict rows of
+ * every movement in mask, so a frame is legal iff
+ *     (mask & CONFLICT_OF[mask]) == 0
+ * Frames are validated at startup; before every output the heads as they
+ * will be driven (changed heads plus the ones held from earlier writes)
+ * are checked again.
+ */
+enum { H_R3_SN = 0, H_R3_NS, H_R1_WE, H_R1_EW, H_PED, N_HEADS };
+
+enum {
+    MV_R3_SN_L = 0, MV_R3_SN_S, MV_R3_SN_R,
+    MV_R3_NS_L,     MV_R3_NS_S, MV_R3_NS_R,
+    MV_R1_WE_L,     MV_R1_WE_S, MV_R1_WE_R,
+    MV_R1_EW_L,     MV_R1_EW_S, MV_R1_EW_R,
+    MV_PED,
+    MV_COUNT
+};
+
+typedef uint16_t mvmask_t;
+
+#define MV(b)      ((mvmask_t)(1u << (b)))
+#define MV_R3_ALL  ((mvmask_t)(0x3Fu << MV_R3_SN_L))
+#define MV_R1_ALL  ((mvmask_t)(0x3Fu << MV_R1_WE_L))
+#define MV_VEH_ALL ((mvmask_t)(MV_R3_ALL | MV_R1_ALL))
+
+/* first movement bit of each vehicle head (L, S, R follow) */
+static const int HEAD_MV_BASE[N_HEADS] = { MV_R3_SN_L, MV_R3_NS_L, MV_R1_WE_L, MV_R1_EW_L, MV_PED };
+
+/* Conflict matrix (row = movement). Crossing roads conflict, PED conflicts
+ * with every vehicle movement; opposing approaches of the same road run
+ * together (permissive turns), as in the phase tables below.
+ */
+static const mvmask_t CONFLICT_ROW[MV_COUNT] = {
+    MV_R1_ALL | MV(MV_PED), MV_R1_ALL | MV(MV_PED), MV_R1_ALL | MV(MV_PED),
+    MV_R1_ALL | MV(MV_PED), MV_R1_ALL | MV(MV_PED), MV_R1_ALL | MV(MV_PED),
+    MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED),
+    MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED), MV_R3_ALL | MV(MV_PED),
+    MV_VEH_ALL
+};
+
+static mvmask_t CONFLICT_OF[1u << MV_COUNT];
+static mvmask_t FRAME_MASK[N_STATES];
+static unsigned long interlock_trips = 0;
+
+/* heads in print order: R3(S->N), R3(N->S), R1(W->E), R1(E->W), PED */
+static void state_heads(state_t s, const char *h[N_HEADS])
 {
-    const char *r3_sn = "RED";
-    const char *r3_ns = "RED";
-    const char *r1_we = "RED";
-    const char *r1_ew = "RED";
-    const char *ped   = "RED";
+    for (int i = 0; i < N_HEADS; i++) h[i] = "RED";
 
     switch (s) {
         /* NORMAL */
-        case N_R3_RS_G: r3_sn = "RS-G"; r3_ns = "RS-G"; break;
-        case N_R3_RS_Y: r3_sn = "RS-Y"; r3_ns = "RS-Y"; break;
-        case N_R3_L_G:  r3_sn = "L-G";  r3_ns = "L-G";  break;
-        case N_R3_L_Y:  r3_sn = "L-Y";  r3_ns = "L-Y";  break;
+        case N_R3_RS_G: h[H_R3_SN] = "RS-G"; h[H_R3_NS] = "RS-G"; break;
+        case N_R3_RS_Y: h[H_R3_SN] = "RS-Y"; h[H_R3_NS] = "RS-Y"; break;
+        case N_R3_L_G:  h[H_R3_SN] = "L-G";  h[H_R3_NS] = "L-G";  break;
+        case N_R3_L_Y:  h[H_R3_SN] = "L-Y";  h[H_R3_NS] = "L-Y";  break;
 
-        case N_R1_RS_G: r1_we = "RS-G"; r1_ew = "RS-G"; break;
-        case N_R1_RS_Y: r1_we = "RS-Y"; r1_ew = "RS-Y"; break;
-        case N_R1_L_G:  r1_we = "L-G";  r1_ew = "L-G";  break;
-        case N_R1_L_Y:  r1_we = "L-Y";  r1_ew = "L-Y";  break;
+        case N_R1_RS_G: h[H_R1_WE] = "RS-G"; h[H_R1_EW] = "RS-G"; break;
+        case N_R1_RS_Y: h[H_R1_WE] = "RS-Y"; h[H_R1_EW] = "RS-Y"; break;
+        case N_R1_L_G:  h[H_R1_WE] = "L-G";  h[H_R1_EW] = "L-G";  break;
+        case N_R1_L_Y:  h[H_R1_WE] = "L-Y";  h[H_R1_EW] = "L-Y";  break;
 
         /* TRAIN */
-        case T_R3_NS_SRL_G_1: r3_ns = "SRL-G"; break;
-        case T_R3_NS_SRL_Y_1: r3_ns = "SRL-Y"; break;
-        case T_R3_SN_LR_G_2:  r3_sn = "LR-G";  break;
-        case T_R3_SN_LR_Y_2:  r3_sn = "LR-Y";  break;
+        case T_R3_NS_SRL_G_1: h[H_R3_NS] = "SRL-G"; break;
+        case T_R3_NS_SRL_Y_1: h[H_R3_NS] = "SRL-Y"; break;
+        case T_R3_SN_LR_G_2:  h[H_R3_SN] = "LR-G";  break;
+        case T_R3_SN_LR_Y_2:  h[H_R3_SN] = "LR-Y";  break;
 
         case T_R1_RESTRICT_G_3:
-            r1_we = "SR-G";
-            r1_ew = "SL-G";
+            h[H_R1_WE] = "SR-G";
+            h[H_R1_EW] = "SL-G";
             break;
         case T_R1_RESTRICT_Y_3:
-            r1_we = "SR-Y";
-            r1_ew = "SL-Y";
+            h[H_R1_WE] = "SR-Y";
+            h[H_R1_EW] = "SL-Y";
             break;
 
         /* PED */
-        case P_WALK:  ped = "WALK";  break;
-        case P_FLASH: ped = "FLASH"; break;
+        case P_WALK:  h[H_PED] = "WALK";  break;
+        case P_FLASH: h[H_PED] = "FLASH"; break;
 
         default:
             break;
     }
+}
+
+static mvmask_t aspect_moves(const char *aspect, int head)
+{
+    if (head == H_PED) {
+        return (strcmp(aspect, "WALK") == 0 || strcmp(aspect, "FLASH") == 0) ? MV(MV_PED) : 0;
+    }
+    if (strcmp(aspect, "RED") == 0 || strcmp(aspect, "PRE-Y") == 0) return 0;
+
+    mvmask_t m = 0;
+    for (const char *p = aspect; *p && *p != '-'; p++) {
+        if (*p == 'L') m |= MV(HEAD_MV_BASE[head] + 0);
+        if (*p == 'S') m |= MV(HEAD_MV_BASE[head] + 1);
+        if (*p == 'R') m |= MV(HEAD_MV_BASE[head] + 2);
+    }
+    return m;
+}
+
+static int interlock_ok(mvmask_t frame)
+{
+    return (frame & CONFLICT_OF[frame]) == 0;
+}
+
+/* refuses to start if any state's frame lights conflicting movements */
+static void build_interlock(void)
+{
+    for (unsigned m = 0; m < (1u << MV_COUNT); m++) {
+        mvmask_t c = 0;
+        for (int b = 0; b < MV_COUNT; b++) {
+            if (m & (1u << b)) c |= CONFLICT_ROW[b];
+        }
+        CONFLICT_OF[m] = c;
+    }
+
+    int bad = 0;
+    for (int i = 0; i < N_STATES; i++) {
+        const char *h[N_HEADS];
+        state_heads((state_t)i, h);
+
+        mvmask_t m = 0;
+        for (int k = 0; k < N_HEADS; k++) m |= aspect_moves(h[k], k);
+        FRAME_MASK[i] = m;
+
+        if (!interlock_ok(m)) {
+            printf("INTERLOCK: state %d lights conflicting movements (mask 0x%04x)\n", i, (unsigned)m);
+            bad = 1;
+        }
+    }
+    if (bad) {
+        fflush(stdout);
+        exit(1);
+    }
+}
+
+/* ================= OUTPUT DRIVER =================
+ * Each state's frame (interned aspect per head, rendered head text) is
+ * built once at startup; the header text comes with the timing plan. A step compares aspect
+ * ids against the frame last sent and writes only the heads that changed,
+ * header included, as one line in a single write(). A step where no head
+ * changes writes nothing.
+ */
+#define FRAME_FAILSAFE  N_STATES            /* extra frame slot: ALL RED */
+#define HEAD_TXT_MAX    24
+#define OUT_LINE_MAX    (HDR_TXT_MAX + N_HEADS * (HEAD_TXT_MAX + 3) + 1)
+#define MAX_ASPECTS     32
+
+static const char *HEAD_LABEL[N_HEADS] = { "R3(S->N)", "R3(N->S)", "R1(W->E)", "R1(E->W)", "PED" };
+static const int   HEAD_WIDTH[N_HEADS] = { 6, 6, 6, 6, 5 };
+
+typedef struct {
+    uint8_t aspect_id[N_HEADS];              /* index into out_aspects[] */
+    mvmask_t head_mv[N_HEADS];               /* movements each head lights */
+    uint8_t head_len[N_HEADS];
+    char    head_txt[N_HEADS][HEAD_TXT_MAX]; /* "R3(S->N)=RS-G  " */
+} frame_t;
+
+static frame_t     FRAME[N_STATES + 1];
+static const char *out_aspects[MAX_ASPECTS];
+static int         n_out_aspects = 0;
+static int         out_last = -1;            /* frame last sent, -1 = none yet */
+static mvmask_t    out_mv[N_HEADS];          /* movements on each head as driven */
+
+static uint8_t intern_aspect(const char *a)
+{
+    for (int i = 0; i < n_out_aspects; i++) {
+        if (strcmp(out_aspects[i], a) == 0) return (uint8_t)i;
+    }
+    if (n_out_aspects == MAX_ASPECTS) {
+        printf("OUTPUT: too many distinct aspects\n");
+        exit(1);
+    }
+    out_aspects[n_out_aspects] = a;
+    return (uint8_t)n_out_aspects++;
+}
+
+/* must run after build_interlock() */
+static void build_frames(void)
+{
+    for (int i = 0; i <= N_STATES; i++) {
+        frame_t *f = &FRAME[i];
+        const char *h[N_HEADS];
+
+        if (i == FRAME_FAILSAFE) {
+            for (int k = 0; k < N_HEADS; k++) h[k] = "RED";
+        } else {
+            state_heads((state_t)i, h);
+        }
+
+        for (int k = 0; k < N_HEADS; k++) {
+            f->aspect_id[k] = intern_aspect(h[k]);
+            f->head_mv[k] = aspect_moves(h[k], k);
+            f->head_len[k] = (uint8_t)snprintf(f->head_txt[k], HEAD_TXT_MAX, "%s=%-*s",
+                                               HEAD_LABEL[k], HEAD_WIDTH[k], h[k]);
+        }
+    }
+}
+
+static void print_state_outputs(state_t s)
+{
+    const timing_plan_t *p = plan_cur;
+    int fi = (int)s;
+    const frame_t *of = (out_last >= 0) ? &FRAME[out_last] : NULL;
+
+    /* fail safe: what the heads show after this write, held heads as they
+     * were driven; a conflicting result never goes out, ALL RED instead */
+    mvmask_t driven = 0;
+    for (int k = 0; k < N_HEADS; k++) {
+        int held = of && of->aspect_id[k] == FRAME[fi].aspect_id[k];
+        driven |= held ? out_mv[k] : FRAME[fi].head_mv[k];
+    }
+    if (!interlock_ok(driven)) {
+        interlock_trips++;
+        printf("\n!!! INTERLOCK: conflicting frame 0x%04x -> ALL RED (trips=%lu) !!!\n\n",
+               (unsigned)driven, interlock_trips);
+        fi = FRAME_FAILSAFE;
+    }
+
+    const frame_t *nf = &FRAME[fi];
+    char line[OUT_LINE_MAX];
+    size_t n = 0;
+
+    for (int k = 0; k < N_HEADS; k++) {
+        if (of && of->aspect_id[k] == nf->aspect_id[k]) continue;
+        if (n == 0) {
+            memcpy(line, p->hdr[s], p->hdr_len[s]);
+            n = p->hdr_len[s];
+        }
+        memcpy(line + n, " | ", 3);
+        n += 3;
+        memcpy(line + n, nf->head_txt[k], nf->head_len[k]);
+        n += nf->head_len[k];
+        out_mv[k] = nf->head_mv[k];
+    }
+    out_last = fi;
+    if (n == 0) return;
+
+    line[n++] = '\n';
+    fflush(stdout);     /* keep ordering with the printf() users */
+    ssize_t w = write(STDOUT_FILENO, line, n);
+    (void)w;
+}
+
+/* ================= TIMING PLAN RELOAD =================
+ * Plan file: one "key = seconds" per line, '#' starts a comment, keys as
+ * in TP_KEYS. A watcher thread polls the file, and parses, validates and
+ * builds a complete plan off the FSM path. It publishes the plan with an
+ * atomic exchange on plan_next. The FSM takes it with a second exchange
+ * at the next safe all-red and frees the old plan right there: the FSM
+ * is the only reader of plan_cur, so that is its grace period.
+ * No locks on the FSM path.
+ */
+#define PLAN_POLL_S        1
+#define PLAN_MAX_PREEMPT_S 15   /* worst case train detection -> TRAIN start */
+
+static const char *plan_path = NULL;
+static _Atomic(timing_plan_t *) plan_next = NULL;
+static unsigned plan_gen = 0;   /* watcher thread (main before it starts) */
+
+/* every head RED: no movement lit, nothing to re-time mid-interval */
+static int is_safe_allred(state_t s)
+{
+    return FRAME_MASK[s] == 0;
+}
+
+static int plan_parse(const char *path, unsigned t[N_TP], char *err, size_t errlen)
+{
+    FILE *f = fopen(path, "r");
+    if (!f) {
+        snprintf(err, errlen, "%s: %s", path, strerror(errno));
+        return -1;
+    }
+
+    for (int k = 0; k < N_TP; k++) t[k] = TP_KEYS[k].def;
+
+    char line[128];
+    int ln = 0;
+    while (fgets(line, sizeof line, f)) {
+        ln++;
+        char *hash = strchr(line, '#');
+        if (hash) *hash = '\0';
+
+        char key[32], extra;
+        unsigned v;
+        int n = sscanf(line, " %31[a-z0-9_] = %u %c", key, &v, &extra);
+        if (n <= 0) continue;   /* blank / comment */
+        if (n != 2) {
+            snprintf(err, errlen, "line %d: expected 'key = seconds'", ln);
+            fclose(f);
+            return -1;
+        }
+
+        int k = 0;
+        while (k < N_TP && strcmp(TP_KEYS[k].name, key) != 0) k++;
+        if (k == N_TP) {
+            snprintf(err, errlen, "line %d: unknown key '%s'", ln, key);
+            fclose(f);
+            return -1;
+        }
+        if (v < TP_KEYS[k].min || v > TP_KEYS[k].max) {
+            snprintf(err, errlen, "line %d: %s=%u out of range [%u..%u]",
+                     ln, key, v, TP_KEYS[k].min, TP_KEYS[k].max);
+            fclose(f);
+            return -1;
+        }
+        t[k] = v;
+    }
+    fclose(f);
+    return 0;
+}
+
+static timing_plan_t *plan_build(const unsigned t[N_TP], char *err, size_t errlen)
+{
+    timing_plan_t *p = calloc(1, sizeof *p);
+    if (!p) {
+        snprintf(err, errlen, "out of memory");
+        return NULL;
+    }
+
+    memcpy(p->t, t, sizeof p->t);
+    for (int i = 0; i < N_STATES; i++) p->dur[i] = plan_state_duration(p, (state_t)i);
+
+    build_preempt_table(p);
+    for (int i = 0; i < N_STATES; i++) {
+        if (p->preempt[i].worst_s > PLAN_MAX_PREEMPT_S) {
+            snprintf(err, errlen, "[%s S%d] train preempt takes %us (max %us)",
+                     mode_of((state_t)i), mode_index_of((state_t)i),
+                     p->preempt[i].worst_s, PLAN_MAX_PREEMPT_S);
+            free(p);
+            return NULL;
+        }
+    }
+
+    for (int i = 0; i < N_STATES; i++) {
+        state_t s = (state_t)i;
+        p->hdr_len[i] = (uint8_t)snprintf(p->hdr[i], HDR_TXT_MAX, "[%s S%d] (%us)",
+                                          mode_of(s), mode_index_of(s), p->dur[i]);
+    }
+
+    p->gen = ++plan_gen;
+    return p;
+}
+
+static timing_plan_t *plan_load(const char *path, char *err, size_t errlen)
+{
+    unsigned t[N_TP];
+    if (plan_parse(path, t, err, errlen) != 0) return NULL;
+    return plan_build(t, err, errlen);
+}
+
+/* FNV-1a of the plan file. Compared by content: mtime has 1s resolution, so
+ * a same-size edit within the second of the last one would be missed. */
+static int plan_file_hash(const char *path, uint32_t *h)
+{
+    FILE *f = fopen(path, "rb");
+    if (!f) return -1;
+
+    uint32_t v = 2166136261u;
+    int c;
+    while ((c = getc(f)) != EOF) v = (v ^ (uint8_t)c) * 16777619u;
+    fclose(f);
+    *h = v;
+    return 0;
+}
+
+static void *plan_watch_thread(void *arg)
+{
+    (void)arg;
+    uint32_t last = 0;
+    plan_file_hash(plan_path, &last);
+
+    while (1) {
+        sleep(PLAN_POLL_S);
+
+        uint32_t h;
+        if (plan_file_hash(plan_path, &h) != 0 || h == last) continue;
+        last = h;
+
+        char err[128];
+        timing_plan_t *p = plan_load(plan_path, err, sizeof err);
+        if (!p) {
+            printf("[plan] %s rejected: %s (keeping current plan)\n", plan_path, err);
+            fflush(stdout);
+            continue;
+        }
+
+        /* a plan the FSM never picked up is simply replaced */
+        free(atomic_exchange(&plan_next, p));
+        printf("[plan] gen %u validated, switching at next safe all-red\n", p->gen);
+        fflush(stdout);
+    }
+    return NULL;
+}
+
+/* FSM thread, safe all-red only */
+static void plan_apply_pending(void)
+{
+    if (atomic_load_explicit(&plan_next, memory_order_relaxed) == NULL) return;
+
+    timing_plan_t *p = atomic_exchange(&plan_next, NULL);
+    if (!p) return;
+
+    timing_plan_t *old = plan_cur;
+    plan_cur = p;
+    free(old);
+
+    printf("\n>>> TIMING PLAN gen %u ACTIVE <<<\n\n", p->gen);
+    fflush(stdout);
+}
+
+static void plan_init(void)
+{
+    char err[128];
+    unsigned t[N_TP];
+    for (int k = 0; k < N_TP; k++) t[k] = TP_KEYS[k].def;
+
+    plan_cur = plan_path ? plan_load(plan_path, err, sizeof err) : plan_build(t, err, sizeof err);
+    if (!plan_cur) {
+        printf("PLAN: %s\n", err);
+        fflush(stdout);
+        exit(1);
+    }
+    printf("Timing plan: %s (gen %u)\n", plan_path ? plan_path : "built-in", plan_cur->gen);
+
+    if (plan_path) {
+        pthread_t th;
+        if (pthread_create(&th, NULL, plan_watch_thread, NULL) != 0) {
+            perror("pthread_create(plan watcher)");
+            exit(1);
+        }
+        pthread_detach(th);
+    }
+}
+
+/* ================= WARM RESTART SNAPSHOT =================
+ * State, flags and the end of the current state live in a one-page file
+ * mapping (SNAP_PATH). Stores land in the page cache and outlive the
+ * process, so a crash or an upgrade resumes mid-phase instead of
+ * restarting the cycle. Written at every state entry and on every 100ms
+ * poll. The page is a seqlock as in demo1: seq is odd while a write is in
+ * progress, with release fences around the stores.
+ *
+ * Safe-entry rule on startup: the snapshot must be whole (magic, version,
+ * size, seq even), in range, and written at most SNAP_MAX_GAP_MS ago (the
+ * heads still show the saved state). The state then resumes with the time
+ * it had left, clamped to [100ms, full length]: no green restarts from
+ * zero and no yellow or all-red is cut. Only the gap is measured on
+ * CLOCK_REALTIME (alive_ms); the end of the state is a CLOCK_MONOTONIC
+ * deadline, so a wall-clock step never stretches or cuts the resumed
+ * state. A valid but stale snapshot keeps pending train / ped requests
+ * and starts at ALL-RED 1; otherwise cold start as before.
+ */
+#define SNAP_PATH        "/tmp/traffic_fsm.snap"
+#define SNAP_MAGIC       0x534E4150u   /* "SNAP" */
+#define SNAP_VERSION     2
+#define SNAP_MAX_GAP_MS  3000U
+
+typedef struct {
+    uint32_t magic;
+    uint16_t version;
+    uint16_t size;
+    uint32_t seq;             /* odd while writing */
+    int32_t  state;
+    int32_t  ped_return;
+    uint8_t  train_request, train_active, train_clear_pending, ped_request;
+    uint8_t  in_train_mode, in_ped_mode, train_preempt_notified, pad;
+    uint64_t deadline_ms;     /* CLOCK_MONOTONIC end of the current state */
+    uint64_t alive_ms;        /* CLOCK_REALTIME of the last write */
+} snap_t;
+
+static volatile snap_t *snap = NULL;
+static state_t  snap_state = N_R3_RS_G;
+static uint64_t snap_deadline = 0;
+static unsigned snap_resume_ms = 0;   /* first wait after a warm restart */
+
+static uint64_t clock_ms(clockid_t clk)
+{
+    struct timespec ts;
+    clock_gettime(clk, &ts);
+    return (uint64_t)ts.tv_sec * 1000ULL + (uint64_t)ts.tv_nsec / 1000000ULL;
+}
+
+static void snap_save(void)
+{
+    if (!snap) return;
+
+    snap->seq++;
+    atomic_thread_fence(memory_order_release);
+    snap->state = (int32_t)snap_state;
+    snap->ped_return = (int32_t)ped_return_state;
+    snap->train_request = (uint8_t)train_request;
+    snap->train_active = (uint8_t)train_active;
+    snap->train_clear_pending = (uint8_t)train_clear_pending;
+    snap->ped_request = (uint8_t)ped_request;
+    snap->in_train_mode = (uint8_t)in_train_mode;
+    snap->in_ped_mode = (uint8_t)in_ped_mode;
+    snap->train_preempt_notified = (uint8_t)train_preempt_notified;
+    snap->deadline_ms = snap_deadline;
+    snap->alive_ms = clock_ms(CLOCK_REALTIME);
+    atomic_thread_fence(memory_order_release);
+    snap->seq++;
+}
+
+static void snap_enter(state_t s)
+{
+    unsigned ms = snap_resume_ms ? snap_resume_ms : duration_of(s) * 1000U;
+    snap_state = s;
+    snap_deadline = clock_ms(CLOCK_MONOTONIC) + ms;
+    snap_save();
+}
+
+static int snap_state_ok(int32_t s)
+{
+    return is_normal_state((state_t)s) || is_train_state((state_t)s) ||
+           (s >= P_WALK && s <= P_CLEAR_ALL_RED);
+}
+
+/* returns 1 on a warm restart (*s resumes mid-phase) */
+static int snap_restore(state_t *s)
+{
+    int fd = open(SNAP_PATH, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) { perror("open(" SNAP_PATH ")"); return 0; }
+    if (ftruncate(fd, sizeof(snap_t)) == -1) { perror("ftruncate(snap)"); close(fd); return 0; }
+    void *p = mmap(NULL, sizeof(snap_t), PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    close(fd);
+    if (p == MAP_FAILED) { perror("mmap(snap)"); return 0; }
+
+    snap_t c;
+    memcpy(&c, p, sizeof(c));
+    snap = (volatile snap_t *)p;
+
+    int ok = c.magic == SNAP_MAGIC && c.version == SNAP_VERSION && c.size == sizeof(snap_t) &&
+             !(c.seq & 1U) && snap_state_ok(c.state) && snap_state_ok(c.ped_return) &&
+             c.train_request <= 1 && c.train_active <= 1 && c.train_clear_pending <= 1 &&
+             c.ped_request <= 1 && c.in_train_mode <= 1 && c.in_ped_mode <= 1 &&
+             c.train_preempt_notified <= 1;
+
+    uint32_t seq = c.seq;
+    memset((void *)snap, 0, sizeof(snap_t));
+    snap->magic = SNAP_MAGIC;
+    snap->version = SNAP_VERSION;
+    snap->size = sizeof(snap_t);
+    snap->seq = seq & ~1U;
+    if (!ok) return 0;
+
+    ped_request = c.ped_request;
+
+    uint64_t now = clock_ms(CLOCK_REALTIME);
+    if (now < c.alive_ms || now - c.alive_ms > SNAP_MAX_GAP_MS) {
+        train_active  = c.train_active && !c.train_clear_pending;
+        train_request = train_active;
+        *s = N_ALL_RED_1;
+        printf("SNAP: stale snapshot, start at ALL-RED 1%s%s\n",
+               train_request ? " (train pending)" : "", ped_request ? " (ped pending)" : "");
+        fflush(stdout);
+        return 0;
+    }
 
-    printf("[%s S%d] (%us) | R3(S->N)=%-6s | R3(N->S)=%-6s | R1(W->E)=%-6s | R1(E->W)=%-6s | PED=%-5s\n",
-           mode_of(s), mode_index_of(s), duration_of(s),
-           r3_sn, r3_ns, r1_we, r1_ew, ped);
+    train_request = c.train_request;
+    train_active = c.train_active;
+    train_clear_pending = c.train_clear_pending;
+    in_train_mode = c.in_train_mode;
+    in_ped_mode = c.in_ped_mode;
+    train_preempt_notified = c.train_preempt_notified;
+    ped_return_state = (state_t)c.ped_return;
+    *s = (state_t)c.state;
+
+    uint64_t full = duration_of(*s) * 1000ULL;
+    uint64_t mono = clock_ms(CLOCK_MONOTONIC);
+    uint64_t left = c.deadline_ms > mono ? c.deadline_ms - mono : 0;
+    if (left > full) left = full;
+    if (left < 100U) left = 100U;
+    snap_resume_ms = (unsigned)left;
+
+    printf("SNAP: warm restart in %s S%d, %u.%us left\n", mode_of(*s), mode_index_of(*s),
+           snap_resume_ms / 1000U, (snap_resume_ms % 1000U) / 100U);
     fflush(stdout);
+    return 1;
 }
 
 /* ================= INTERRUPTIBLE WAIT =================
- * - If 't' during NORMAL GREEN: force YELLOW now, set train_preempt_to_allred (skip left)
+ * - If 't' during NORMAL GREEN or PED WALK: cut to the next hop of the preempt table now
  * - If 'c' during TRAIN: do NOT change lights; just sets train_clear_pending (handled at safe checkpoints)
  */
 static void wait_seconds_interruptible(unsigned total_sec, state_t *cur)
 {
-    if (total_sec == 0) return;
+    /* after a warm restart the first state only runs what it had left */
+    unsigned total_ms = snap_resume_ms ? snap_resume_ms : total_sec * 1000U;
+    snap_resume_ms = 0;
+    if (total_ms == 0) return;
 
     const long step_ns = 100L * 1000L * 1000L; /* 100ms */
-    unsigned steps  = (unsigned)((total_sec * 1000U) / 100U);
-    unsigned rem_ms = (total_sec * 1000U) % 100U;
+    unsigned steps  = total_ms / 100U;
+    unsigned rem_ms = total_ms % 100U;
 
     struct timespec ts;
     ts.tv_sec = 0;
@@ -369,15 +1135,15 @@ static void wait_seconds_interruptible(unsigned total_sec, state_t *cur)
     for (unsigned i = 0; i < steps; i++) {
         nanosleep(&ts, NULL);
         poll_events_from_mq();
+        snap_save();
 
-        /* PREEMPT: normal green -> yellow immediately */
-        if (cur && train_request && !in_train_mode && is_normal_green(*cur)) {
+        /* PREEMPT: green/WALK -> next hop of the preempt table immediately */
+        if (cur && train_request && !in_train_mode && preempt_min_s(plan_cur, *cur) == 0) {
             if (!train_preempt_notified) {
                 notify_train_preempt();
                 train_preempt_notified = 1;
             }
-            train_preempt_to_allred = 1;
-            *cur = normal_green_to_yellow(*cur);
+            preempt_next(cur);
             return;
         }
     }
@@ -388,14 +1154,14 @@ static void wait_seconds_interruptible(unsigned total_sec, state_t *cur)
         ts2.tv_nsec = (long)rem_ms * 1000L * 1000L;
         nanosleep(&ts2, NULL);
         poll_events_from_mq();
+        snap_save();
 
-        if (cur && train_request && !in_train_mode && is_normal_green(*cur)) {
+        if (cur && train_request && !in_train_mode && preempt_min_s(plan_cur, *cur) == 0) {
             if (!train_preempt_notified) {
                 notify_train_preempt();
                 train_preempt_notified = 1;
             }
-            train_preempt_to_allred = 1;
-            *cur = normal_green_to_yellow(*cur);
+            preempt_next(cur);
             return;
         }
     }
@@ -410,17 +1176,22 @@ static int should_exit_train_now(state_t s)
 
 static void do_exit_train_to_normal(state_t *cur)
 {
+    state_t allred = *cur;
+
     train_active = 0;
     train_clear_pending = 0;
     train_request = 0;
 
-    /* exit to normal start */
-    *cur = N_R3_RS_G;
-
     if (in_train_mode) {
         in_train_mode = 0;
         notify_train_over();
     }
+
+    /* a waiting ped goes first from this all-red, so t/c bursts can't starve it */
+    if (try_start_ped_if_safe(&allred)) { *cur = allred; return; }
+
+    /* exit to normal start */
+    *cur = N_R3_RS_G;
 }
 
 /* ================= FSM STEP ================= */
@@ -428,8 +1199,11 @@ static void SingleStep_SM(state_t *cur)
 {
     if (!cur) return;
 
+    if (is_safe_allred(*cur)) plan_apply_pending();
+
     print_state_outputs(*cur);
     poll_events_from_mq();
+    snap_enter(*cur);
 
     /* notify once when clear is requested */
     static int clear_notified_once = 0;
@@ -443,158 +1217,130 @@ static void SingleStep_SM(state_t *cur)
 
         /* ===================== NORMAL ===================== */
         case N_R3_RS_G:
-            wait_seconds_interruptible(T_RS_GREEN, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R3_RS_G) break;
-            *cur = N_R3_RS_Y;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R3_RS_Y:
-            wait_seconds_interruptible(T_YELLOW, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R3_RS_Y) break;
 
-            if (train_request && train_preempt_to_allred) {
-                *cur = N_ALL_RED_1; /* skip left phases */
-            } else {
-                *cur = N_R3_L_G;
-            }
+            if (preempt_next(cur)) break; /* skip left phases */
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R3_L_G:
-            wait_seconds_interruptible(T_L_GREEN, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R3_L_G) break;
-            *cur = N_R3_L_Y;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R3_L_Y:
-            wait_seconds_interruptible(T_YELLOW, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R3_L_Y) break;
-            *cur = N_ALL_RED_1;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_ALL_RED_1:
-            train_preempt_to_allred = 0;
-            wait_seconds_interruptible(T_ALL_RED, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
 
-            if (train_request) {
-                train_request = 0;
-                train_active  = 1;
-                train_clear_pending = 0;
-
-                /* TRAIN now starts at S1 */
-                *cur = T_R3_NS_SRL_G_1;
-
-                if (!in_train_mode) { in_train_mode = 1; notify_train_begin(); }
-                break;
-            }
+            if (train_request) { enter_train(cur); break; }
 
             if (try_start_ped_if_safe(cur)) break;
-            *cur = N_R1_RS_G;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R1_RS_G:
-            wait_seconds_interruptible(T_RS_GREEN, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R1_RS_G) break;
-            *cur = N_R1_RS_Y;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R1_RS_Y:
-            wait_seconds_interruptible(T_YELLOW, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R1_RS_Y) break;
 
-            if (train_request && train_preempt_to_allred) {
-                *cur = N_ALL_RED_2; /* skip left phases */
-            } else {
-                *cur = N_R1_L_G;
-            }
+            if (preempt_next(cur)) break; /* skip left phases */
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R1_L_G:
-            wait_seconds_interruptible(T_L_GREEN, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R1_L_G) break;
-            *cur = N_R1_L_Y;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_R1_L_Y:
-            wait_seconds_interruptible(T_YELLOW, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             if (*cur != N_R1_L_Y) break;
-            *cur = N_ALL_RED_2;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case N_ALL_RED_2:
-            train_preempt_to_allred = 0;
-            wait_seconds_interruptible(T_ALL_RED, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
 
-            if (train_request) {
-                train_request = 0;
-                train_active  = 1;
-                train_clear_pending = 0;
-
-                /* TRAIN now starts at S1 */
-                *cur = T_R3_NS_SRL_G_1;
-
-                if (!in_train_mode) { in_train_mode = 1; notify_train_begin(); }
-                break;
-            }
+            if (train_request) { enter_train(cur); break; }
 
             if (try_start_ped_if_safe(cur)) break;
-            *cur = N_R3_RS_G;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         /* ===================== TRAIN ===================== */
         case T_R3_NS_SRL_G_1:
-            wait_seconds_interruptible(T_TR_1_G, cur);
-            *cur = T_R3_NS_SRL_Y_1;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R3_NS_SRL_Y_1:
-            wait_seconds_interruptible(T_TR_Y, cur);
-            *cur = T_ALL_RED_A;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_ALL_RED_A:
-            wait_seconds_interruptible(T_TR_R, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
 
             if (should_exit_train_now(*cur)) { do_exit_train_to_normal(cur); break; }
             if (try_start_ped_if_safe(cur)) break;
 
-            *cur = T_R3_SN_LR_G_2;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R3_SN_LR_G_2:
-            wait_seconds_interruptible(T_TR_2_G, cur);
-            *cur = T_R3_SN_LR_Y_2;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R3_SN_LR_Y_2:
-            wait_seconds_interruptible(T_TR_Y, cur);
-            *cur = T_ALL_RED_B;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_ALL_RED_B:
-            wait_seconds_interruptible(T_TR_R, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
 
             if (should_exit_train_now(*cur)) { do_exit_train_to_normal(cur); break; }
             if (try_start_ped_if_safe(cur)) break;
 
-            *cur = T_R1_RESTRICT_G_3;
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R1_RESTRICT_G_3:
-            wait_seconds_interruptible(T_TR_3_G, cur);
-            *cur = T_R1_RESTRICT_Y_3;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_R1_RESTRICT_Y_3:
-            wait_seconds_interruptible(T_TR_Y, cur);
-            *cur = T_DECISION_ALL_RED_4;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case T_DECISION_ALL_RED_4:
-            wait_seconds_interruptible(T_TR_R, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
             poll_events_from_mq();
 
             if (should_exit_train_now(*cur)) { do_exit_train_to_normal(cur); break; }
@@ -602,7 +1348,7 @@ static void SingleStep_SM(state_t *cur)
 
             /* keep train looping if not clearing */
             if (train_active && !train_clear_pending) {
-                *cur = T_R3_SN_LR_G_2;
+                *cur = CYCLE_NEXT[*cur];
             } else {
                 /* default safe exit */
                 do_exit_train_to_normal(cur);
@@ -611,18 +1357,22 @@ static void SingleStep_SM(state_t *cur)
 
         /* ===================== PEDESTRIAN ===================== */
         case P_WALK:
-            wait_seconds_interruptible(T_PED_WALK, cur);
-            *cur = P_FLASH;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case P_FLASH:
-            wait_seconds_interruptible(T_PED_FLASH, cur);
-            *cur = P_CLEAR_ALL_RED;
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            *cur = CYCLE_NEXT[*cur];
             break;
 
         case P_CLEAR_ALL_RED:
-            wait_seconds_interruptible(T_PED_CLR, cur);
+            wait_seconds_interruptible(duration_of(*cur), cur);
+            poll_events_from_mq();
             if (in_ped_mode) { in_ped_mode = 0; notify_ped_over(); }
+
+            /* ped clearance is a safe all-red: start TRAIN here */
+            if (train_request && !in_train_mode) { enter_train(cur); break; }
             *cur = ped_return_state;
             break;
 
@@ -644,8 +1394,10 @@ static void SingleStep_SM(state_t *cur)
     }
 }
 
-int main(void)
+int main(int argc, char **argv)
 {
+    if (argc > 1) plan_path = argv[1];
+
     printf("local control 1\n");
     printf("Queue: %s\n", QUEUE_NAME);
     printf("Keyboard events: t=train detect, c=train clear, p=ped press\n\n");
@@ -653,7 +1405,13 @@ int main(void)
 
     mq_setup_server();
 
+    build_interlock();
+    build_frames();
+    plan_init();
+    print_preempt_table();
+
     state_t s = N_R3_RS_G;
+    snap_restore(&s);
     while (1) {
         SingleStep_SM(&s);
     }